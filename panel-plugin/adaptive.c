@@ -0,0 +1,455 @@
+/*
+ *  Copyright (C) 2010 Erik Edelmann <erik.edelmann@iki.fi>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include <float.h>
+#include <math.h>
+#include <glib.h>
+#include "flattree.h"
+#include "functions.h"
+#include "specfun.h"
+#include "stats.h"
+#include "adaptive.h"
+
+// The unit roundoff of double
+#define U (DBL_EPSILON/2)
+
+// Trees up to this size are evaluated without allocating
+#define SMALL_TREE 64
+
+static double tolerance = 0.0;
+
+
+/* Double-double numbers: hi + lo, where |lo| <= ulp(hi)/2.  The operations
+   are the usual ones from Dekker, Knuth and the QD library. */
+
+typedef struct {
+    double hi, lo;
+} dd_t;
+
+
+static dd_t dd(double hi, double lo)
+{
+    dd_t r;
+
+    r.hi = hi;
+    r.lo = isfinite(hi) ? lo : 0.0;
+    return r;
+}
+
+
+// a + b exactly, for |a| >= |b|
+static dd_t quick_two_sum(double a, double b)
+{
+    double s = a + b;
+
+    return dd(s, b - (s - a));
+}
+
+
+static dd_t two_sum(double a, double b)
+{
+    double s = a + b, bb = s - a;
+
+    return dd(s, (a - (s - bb)) + (b - bb));
+}
+
+
+static dd_t dd_add(dd_t a, dd_t b)
+{
+    dd_t s, t;
+
+    s = two_sum(a.hi, b.hi);
+    t = two_sum(a.lo, b.lo);
+    s = quick_two_sum(s.hi, s.lo + t.hi);
+    return quick_two_sum(s.hi, s.lo + t.lo);
+}
+
+
+static dd_t dd_neg(dd_t a)
+{
+    return dd(-a.hi, -a.lo);
+}
+
+
+static dd_t dd_mul(dd_t a, dd_t b)
+{
+    double p = a.hi*b.hi;
+
+    return quick_two_sum(p, fma(a.hi, b.hi, -p) + (a.hi*b.lo + a.lo*b.hi));
+}
+
+
+static dd_t dd_div(dd_t a, dd_t b)
+{
+    double q1, q2, q3;
+    dd_t r;
+
+    q1 = a.hi/b.hi;
+    if (!isfinite(q1))
+        return dd(q1, 0.0);
+    r = dd_add(a, dd_neg(dd_mul(b, dd(q1, 0.0))));
+    q2 = r.hi/b.hi;
+    r = dd_add(r, dd_neg(dd_mul(b, dd(q2, 0.0))));
+    q3 = r.hi/b.hi;
+    return dd_add(quick_two_sum(q1, q2), dd(q3, 0.0));
+}
+
+
+static dd_t dd_sqrt(dd_t a)
+{
+    double s = sqrt(a.hi);
+    dd_t r;
+
+    if (s == 0.0 || !isfinite(s))
+        return dd(s, 0.0);
+    // One Newton step: s + (a - s^2)/(2 s)
+    r = dd_add(a, dd_neg(dd_mul(dd(s, 0.0), dd(s, 0.0))));
+    return quick_two_sum(s, r.hi/(2*s));
+}
+
+
+/* a^b.  Whole number powers are computed by repeated squaring, others from
+   the double result and its first order correction for the low parts. */
+
+static dd_t dd_pow(dd_t a, dd_t b)
+{
+    double n, hi;
+    dd_t r;
+
+    if (b.lo == 0.0 && b.hi == floor(b.hi) && fabs(b.hi) <= 1024) {
+        r = dd(1.0, 0.0);
+        for (n = fabs(b.hi); n > 0; n = floor(n/2)) {
+            if (fmod(n, 2) == 1)
+                r = dd_mul(r, a);
+            if (n > 1)
+                a = dd_mul(a, a);
+        }
+        return (b.hi < 0) ? dd_div(dd(1.0, 0.0), r) : r;
+    }
+
+    hi = pow(a.hi, b.hi);
+    if (a.hi <= 0 || !isfinite(hi))
+        return dd(hi, 0.0);
+    return two_sum(hi, hi*(b.hi*a.lo/a.hi + b.lo*log(a.hi)));
+}
+
+
+static dd_t dd_function(gint fun, dd_t x)
+{
+    const function_t *f = &functions[fun];
+    double hi, d;
+
+    if (f->fun == sqrt)
+        return dd_sqrt(x);
+    if (f->fun == fabs)
+        return (x.hi < 0) ? dd_neg(x) : x;
+
+    hi = f->fun(x.hi);
+    d = f->deriv(x.hi)*x.lo;
+    if (x.lo == 0.0 || !isfinite(hi) || !isfinite(d))
+        return dd(hi, 0.0);
+    return two_sum(hi, d);
+}
+
+
+static gboolean supported(const flattree_t *tree, node_id_t id)
+{
+    const function_t *f;
+
+    switch (tree->type[id]) {
+    case NODE_NUMBER:
+    case NODE_VARIABLE:
+    case NODE_POLY:
+        return TRUE;
+    case NODE_FUNCTION:
+        /* The bounds take functions to be within an ulp or two, and need
+           their derivatives.  gamma and lgamma can be further off. */
+        f = &functions[tree->arg[id]];
+        return f->fun && f->deriv && f->fun != tgamma &&
+            f->fun != spec_lgamma;
+    case NODE_OPERATOR:
+        switch (tree->arg[id]) {
+        case OP_PLUS:
+        case OP_MINUS:
+        case OP_UMINUS:
+        case OP_TIMES:
+        case OP_DIV:
+        case OP_POW:
+            return TRUE;
+        default:
+            return FALSE;
+        }
+    default:
+        return FALSE;
+    }
+}
+
+
+/* The error bound of a result r, given the bound 'err' computed for it.
+   Non-finite results have no error unless their operands had some. */
+
+static double bound(double r, double err, gboolean inexact)
+{
+    if (!isfinite(r))
+        return inexact ? INFINITY : 0.0;
+    return isnan(err) ? INFINITY : err;
+}
+
+
+/* The NODE_POLY 'id' at x, computed exactly like eval.c does, with the
+   running error bound of Horner's rule (Higham, Accuracy and Stability of
+   Numerical Algorithms, 5.1) in '*err'.  'ex' is the error of x. */
+
+static double poly_bounded(const flattree_t *tree, node_id_t id, double x,
+                           double ex, double *err)
+{
+    const double *c = tree->nums + tree->arg[id];
+    double p = c[1], dp = 0.0, mu = fabs(c[1])/2;
+    gint i, n = c[0];
+
+    for (i = 2; i <= n + 1; i++) {
+        dp = dp*x + p;
+        if (c[i] == 0.0)
+            p *= x;
+        else if (tree->fma)
+            p = fma(p, x, c[i]);
+        else
+            p = p*x + c[i];
+        mu = mu*fabs(x) + fabs(p);
+    }
+    *err = bound(p, U*(2*mu - fabs(p)) + fabs(dp)*ex, ex > 0);
+
+    return p;
+}
+
+
+/* Evaluate the nodes first ... id in double, with the values in v[] and their
+   error bounds in e[]. */
+
+static void eval_bounded(const flattree_t *tree, node_id_t first, node_id_t id,
+                         const double *vars, double *v, double *e)
+{
+    const function_t *f;
+    double a, b, ea, eb, r, err;
+    node_id_t i, k;
+
+#define V(node) v[(node) - first]
+#define E(node) e[(node) - first]
+
+    for (i = first; i <= id; i++) {
+        k = i - first;
+        switch (tree->type[i]) {
+        case NODE_NUMBER:
+            v[k] = tree->nums[tree->arg[i]];
+            e[k] = 0.0;
+            break;
+        case NODE_VARIABLE:
+            v[k] = vars[tree->arg[i]];
+            e[k] = 0.0;
+            break;
+        case NODE_FUNCTION:
+            f = &functions[tree->arg[i]];
+            a = V(tree->right[i]);
+            ea = E(tree->right[i]);
+            r = f->fun(a);
+            err = 2*U*fabs(r);
+            if (ea > 0)
+                err += fabs(f->deriv(a))*ea;
+            v[k] = r;
+            e[k] = bound(r, err, ea > 0);
+            break;
+        case NODE_POLY:
+            v[k] = poly_bounded(tree, i, V(tree->right[i]),
+                                E(tree->right[i]), &e[k]);
+            break;
+        case NODE_OPERATOR:
+            a = (tree->left[i] != NO_NODE) ? V(tree->left[i]) : 0.0;
+            ea = (tree->left[i] != NO_NODE) ? E(tree->left[i]) : 0.0;
+            b = V(tree->right[i]);
+            eb = E(tree->right[i]);
+            switch (tree->arg[i]) {
+            case OP_PLUS:
+                r = a + b;
+                err = ea + eb + U*fabs(r);
+                break;
+            case OP_MINUS:
+                r = a - b;
+                err = ea + eb + U*fabs(r);
+                break;
+            case OP_UMINUS:
+                r = -b;
+                err = eb;
+                break;
+            case OP_TIMES:
+                r = a*b;
+                err = fabs(a)*eb + fabs(b)*ea + ea*eb + U*fabs(r);
+                break;
+            case OP_DIV:
+                r = a/b;
+                err = (eb >= fabs(b)) ? INFINITY :
+                      (ea + fabs(r)*eb)/(fabs(b) - eb) + U*fabs(r);
+                break;
+            case OP_POW:
+                r = pow(a, b);
+                err = 2*U*fabs(r);
+                if (ea > 0)
+                    err += (a == 0) ? INFINITY : fabs(b*r/a)*ea;
+                if (eb > 0)
+                    err += (a <= 0) ? INFINITY : fabs(r*log(a))*eb;
+                break;
+            default:
+                g_assert_not_reached();
+            }
+            v[k] = r;
+            e[k] = bound(r, err, ea > 0 || eb > 0);
+            break;
+        default:
+            g_assert_not_reached();
+        }
+    }
+
+#undef V
+#undef E
+}
+
+
+/* The same in double-double, without error bounds. */
+
+static dd_t eval_dd(const flattree_t *tree, node_id_t first, node_id_t id,
+                    const double *vars, dd_t *v)
+{
+    const double *c;
+    dd_t a, b, p;
+    node_id_t i;
+    gint j;
+
+#define V(node) v[(node) - first]
+
+    for (i = first; i <= id; i++) {
+        switch (tree->type[i]) {
+        case NODE_NUMBER:
+            V(i) = dd(tree->nums[tree->arg[i]], 0.0);
+            break;
+        case NODE_VARIABLE:
+            V(i) = dd(vars[tree->arg[i]], 0.0);
+            break;
+        case NODE_FUNCTION:
+            V(i) = dd_function(tree->arg[i], V(tree->right[i]));
+            break;
+        case NODE_POLY:
+            c = tree->nums + tree->arg[i];
+            a = V(tree->right[i]);
+            p = dd(c[1], 0.0);
+            for (j = 2; j <= (gint)c[0] + 1; j++)
+                p = dd_add(dd_mul(p, a), dd(c[j], 0.0));
+            V(i) = p;
+            break;
+        case NODE_OPERATOR:
+            a = (tree->left[i] != NO_NODE) ? V(tree->left[i]) : dd(0.0, 0.0);
+            b = V(tree->right[i]);
+            switch (tree->arg[i]) {
+            case OP_PLUS:
+                V(i) = dd_add(a, b);
+                break;
+            case OP_MINUS:
+                V(i) = dd_add(a, dd_neg(b));
+                break;
+            case OP_UMINUS:
+                V(i) = dd_neg(b);
+                break;
+            case OP_TIMES:
+                V(i) = dd_mul(a, b);
+                break;
+            case OP_DIV:
+                V(i) = dd_div(a, b);
+                break;
+            case OP_POW:
+                V(i) = dd_pow(a, b);
+                break;
+            default:
+                g_assert_not_reached();
+            }
+            break;
+        default:
+            g_assert_not_reached();
+        }
+    }
+
+#undef V
+
+    return v[id - first];
+}
+
+
+/* Evaluate the subtree 'id' of 'tree' with the variable values vars[], and
+   put the result in '*r'.  Return FALSE, without evaluating anything, if the
+   tree can't be evaluated adaptively. */
+
+gboolean adaptive_eval(const flattree_t *tree, node_id_t id, const double *vars,
+                       double *r)
+{
+    double small_v[SMALL_TREE], small_e[SMALL_TREE], *v, *e, err;
+    dd_t small_dd[SMALL_TREE], *w, result;
+    node_id_t first, i;
+    gsize n;
+
+    if (tolerance <= 0.0)
+        return FALSE;
+
+    first = flattree_first(tree, id);
+    for (i = first; i <= id; i++)
+        if (!supported(tree, i))
+            return FALSE;
+
+    n = id - first + 1;
+    v = (n <= SMALL_TREE) ? small_v : g_new(double, n);
+    e = (n <= SMALL_TREE) ? small_e : g_new(double, n);
+
+    stats_count(STAT_ADAPTIVE, 1);
+    eval_bounded(tree, first, id, vars, v, e);
+    *r = v[n - 1];
+    err = e[n - 1];
+
+    if (isfinite(*r) ? err > tolerance*fabs(*r) : err > 0) {
+        stats_count(STAT_ESCALATIONS, 1);
+        w = (n <= SMALL_TREE) ? small_dd : g_new(dd_t, n);
+        result = eval_dd(tree, first, id, vars, w);
+        *r = result.hi + result.lo;
+        if (w != small_dd)
+            g_free(w);
+    }
+
+    if (v != small_v) {
+        g_free(v);
+        g_free(e);
+    }
+
+    return TRUE;
+}
+
+
+void adaptive_set_tolerance(double tol)
+{
+    tolerance = tol;
+}
+
+
+double adaptive_tolerance(void)
+{
+    return tolerance;
+}
@@ -0,0 +1,52 @@
+/*
+ *  Copyright (C) 2010 Erik Edelmann <erik.edelmann@iki.fi>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __ADAPTIVE_H__
+#define __ADAPTIVE_H__
+
+#include <glib.h>
+#include "flattree.h"
+
+/*
+ * Adaptive precision.  An expression is evaluated in double, with a bound on
+ * the rounding error kept alongside every value.  If the bound is larger than
+ * 'tol' times the result, e.g. because nearly equal numbers were subtracted,
+ * the expression is evaluated again in double-double arithmetic (about 106
+ * bits).  So '(1e16 + 1) - 1e16' gives 1, while most expressions only pay for
+ * the bookkeeping.
+ *
+ * Numbers in the expression and variable values are taken as exact.  +, -, *,
+ * /, sqrt() and whole number powers are exact to about 106 bits in the second
+ * evaluation; other functions only to about 53 bits, but their arguments
+ * still get the extra bits.  Cancellations of more than about 30 digits are
+ * wrong in double-double too.
+ *
+ * Only trees built of numbers, variables, arithmetic operators and functions
+ * are handled; adaptive_eval() returns FALSE for the rest, and for all trees
+ * when the tolerance is 0.  The stats counters STAT_ADAPTIVE and
+ * STAT_ESCALATIONS count the evaluations and the second evaluations.
+ */
+
+gboolean adaptive_eval(const flattree_t *tree, node_id_t id, const double *vars,
+                       double *r);
+
+/* The tolerance adaptive_eval() uses, 0 (off) unless changed. */
+void adaptive_set_tolerance(double tol);
+double adaptive_tolerance(void);
+
+#endif
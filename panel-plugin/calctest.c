@@ -4,36 +4,428 @@
 #include <string.h>
 #include <math.h>
 #include <glib.h>
+#include "constants.h"
 #include "parser.h"
 #include "eval.h"
+#include "stats.h"
+#include "server.h"
+#include "columns.h"
+#include "flatfile.h"
+#include "optimize.h"
+#include "adaptive.h"
+#include "session.h"
 
 #define LINE_LENGTH 1024
+#define PROFILE_RUNS 1000
+
+static gboolean exact = FALSE;  // Show fractions, see rational.h
+static gint number_type = -1;   // Set by --type, see eval-typed.h
 
 void calc(const char *input, char *result, size_t result_len);
+void calc_tree(const flattree_t *tree, char *result, size_t result_len);
+
+/* Evaluate the lines of stdin.  They may also define names for the lines
+   after them, see session.h.  --exact and --type only apply to the lines
+   that don't use names. */
 
 void interactive()
 {
     char line[LINE_LENGTH], result[LINE_LENGTH];
+    session_t *session = session_new(FALSE);
+    flattree_t *tree;
+    GError *err = NULL;
+    gchar *s;
 
     while (fgets(line, LINE_LENGTH, stdin)) {
-        calc(line, result, LINE_LENGTH);
+        tree = (exact || number_type >= 0) ? build_flattree(line, NULL) : NULL;
+        if (tree) {
+            calc_tree(tree, result, LINE_LENGTH);
+            free_flattree(tree);
+        } else if ((s = session_enter(session, line, "%g", &err))) {
+            snprintf(result, LINE_LENGTH, "%s\n", s);
+            g_free(s);
+        } else if (err) {
+            snprintf(result, LINE_LENGTH, "%s\n", err->message);
+            g_clear_error(&err);
+        } else
+            snprintf(result, LINE_LENGTH, "böö\n");
         printf("%s\n", result);
     }
+
+    session_free(session);
+}
+
+
+/* Evaluate 'expr' for each value of 'var' read from stdin, one per line. */
+
+gboolean batch(const char *expr, const char *var)
+{
+    flattree_t *tree;
+    GError *err = NULL;
+    GArray *x;
+    double *y, val;
+    char line[LINE_LENGTH], *end;
+    guint i;
+
+    tree = build_flattree_vars(expr, &var, 1, &err);
+    if (!tree) {
+        fprintf(stderr, "%s\n", err ? err->message : "böö");
+        if (err) g_error_free(err);
+        return FALSE;
+    }
+
+    x = g_array_new(FALSE, FALSE, sizeof(double));
+    while (fgets(line, LINE_LENGTH, stdin)) {
+        val = g_ascii_strtod(line, &end);
+        if (end == line)
+            val = NAN;
+        g_array_append_val(x, val);
+    }
+
+    y = g_new(double, x->len);
+    if (number_type >= 0)
+        eval_flattree_batch_typed(tree, number_type, 0, (double *)x->data, y,
+                                  x->len, FALSE);
+    else
+        eval_flattree_batch(tree, 0, (double *)x->data, y, x->len, FALSE);
+    for (i = 0; i < x->len; i++)
+        printf("%g\n", y[i]);
+
+    g_free(y);
+    g_array_free(x, TRUE);
+    free_flattree(tree);
+    return TRUE;
+}
+
+
+/* Check that 'line' parses, without evaluating it.  Print the error, if any,
+   as LINE:COLUMN: message, and return FALSE. */
+
+gboolean validate(const char *line, guint lineno)
+{
+    parse_error_t err = PARSE_ERROR_INIT;
+    flattree_t *tree;
+    char msg[128];
+
+    tree = parse_flattree(line, NULL, 0, &err);
+    free_flattree(tree);
+    if (!err.set)
+        return TRUE;
+
+    parse_error_message(&err, msg, sizeof(msg));
+    if (err.position >= 0)
+        printf("%u:%i: %s\n", lineno, err.position+1, msg);
+    else
+        printf("%u:end: %s\n", lineno, msg);
+    return FALSE;
+}
+
+
+/* Compile the expressions read from stdin, one per line, into 'path'. */
+
+gboolean compile(const char *path)
+{
+    GPtrArray *trees, *sources;
+    flattree_t *tree;
+    GError *err = NULL;
+    char line[LINE_LENGTH];
+    gboolean ok = TRUE;
+    guint lineno, i;
+
+    trees = g_ptr_array_new();
+    sources = g_ptr_array_new();
+    for (lineno = 1; fgets(line, LINE_LENGTH, stdin); lineno++) {
+        g_strstrip(line);
+        tree = build_flattree(line, &err);
+        if (err) {
+            fprintf(stderr, "%u: %s\n", lineno, err->message);
+            g_clear_error(&err);
+            ok = FALSE;
+        } else if (tree) {
+            g_ptr_array_add(trees, tree);
+            g_ptr_array_add(sources, g_strdup(line));
+        }
+    }
+
+    if (ok)
+        ok = flatfile_write(path, (const flattree_t * const *)trees->pdata,
+                            (const char * const *)sources->pdata, trees->len,
+                            &err);
+    if (err) {
+        fprintf(stderr, "%s\n", err->message);
+        g_error_free(err);
+    }
+
+    for (i = 0; i < trees->len; i++) {
+        free_flattree(g_ptr_array_index(trees, i));
+        g_free(g_ptr_array_index(sources, i));
+    }
+    g_ptr_array_free(trees, TRUE);
+    g_ptr_array_free(sources, TRUE);
+    return ok;
+}
+
+
+/* Evaluate all the expressions compiled into 'path'. */
+
+gboolean load(const char *path)
+{
+    flatfile_t *file;
+    flattree_t tree;
+    GError *err = NULL;
+    char result[LINE_LENGTH];
+    guint i;
+
+    file = flatfile_open(path, &err);
+    if (!file) {
+        fprintf(stderr, "%s\n", err->message);
+        g_error_free(err);
+        return FALSE;
+    }
+
+    for (i = 0; i < flatfile_count(file); i++) {
+        flatfile_get(file, i, &tree);
+        calc_tree(&tree, result, LINE_LENGTH);
+        fputs(result, stdout);
+    }
+
+    flatfile_close(file);
+    return TRUE;
+}
+
+
+/* Evaluate 'expr' PROFILE_RUNS times, and print the result and the time
+   spent in each node.  The folded stacks go to 'folded_path', if given. */
+
+gboolean profile(const char *expr, const char *folded_path)
+{
+    flattree_t *tree;
+    profile_t *prof;
+    GError *err = NULL;
+    gchar *report;
+    gboolean ok = TRUE;
+    double r = NAN;
+    gint i;
+
+    tree = build_flattree(expr, &err);
+    if (!tree) {
+        fprintf(stderr, "%s\n", err ? err->message : "böö");
+        if (err) g_error_free(err);
+        return FALSE;
+    }
+    if (!flattree_is_scalar(tree)) {
+        fprintf(stderr, "Can't profile matrices or units\n");
+        free_flattree(tree);
+        return FALSE;
+    }
+
+    prof = profile_new(tree);
+    for (i = 0; i < PROFILE_RUNS; i++)
+        r = eval_flattree_profile(tree, NULL, prof, FALSE);
+    printf("%g\n\n", r);
+
+    report = profile_report(prof);
+    fputs(report, stdout);
+    g_free(report);
+
+    if (folded_path) {
+        report = profile_folded(prof);
+        if (!g_file_set_contents(folded_path, report, -1, &err)) {
+            fprintf(stderr, "%s\n", err->message);
+            g_error_free(err);
+            ok = FALSE;
+        }
+        g_free(report);
+    }
+
+    profile_free(prof);
+    free_flattree(tree);
+    return ok;
+}
+
+
+void usage(const char *prog)
+{
+    fprintf(stderr,"Usage: %s [--stats] [--optimize MODE] [--adaptive TOL] "
+                   "[--exact | --type TYPE] [--batch VAR] [expr]\n"
+                   "       %s [--stats] --csv FILE [--output FILE] "
+                   "[--binary-output] expr\n"
+                   "       %s [--stats] --column VAR=FILE... "
+                   "[--output FILE] [--binary-output] expr\n"
+                   "       %s [--optimize MODE] --profile [--folded FILE] "
+                   "expr\n"
+                   "       %s --validate [expr]\n"
+                   "       %s --compile FILE\n"
+                   "       %s [--stats] --load FILE\n"
+                   "       %s --serve SOCKET\n"
+                   "       %s --connect SOCKET\n"
+                   "MODE is 'strict' or 'contract'; it and TOL apply to "
+                   "the other forms too\n"
+                   "TYPE is 'float', 'double', 'long-double', 'float128', "
+                   "'decimal64' or 'decimal128'\n",
+            prog, prog, prog, prog, prog, prog, prog, prog, prog);
 }
 
 
 int main(int argc, char **argv)
 {
     char result[LINE_LENGTH];
+    const char *expr = NULL;
+    const char *batch_var = NULL;
+    const char *serve_path = NULL, *connect_path = NULL;
+    const char *csv_path = NULL, *out_path = NULL;
+    const char *compile_path = NULL, *load_path = NULL, *folded_path = NULL;
+    column_file_t files[MAX_VARS];
+    gint n_files = 0;
+    gboolean binary_out = FALSE, check_only = FALSE, profiling = FALSE, ok;
+    char line[LINE_LENGTH], *eq;
+    guint lineno;
+    GError *err = NULL;
+    gboolean print_stats = FALSE;
+    gchar *report;
+    int i;
+
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--stats") == 0) {
+            print_stats = TRUE;
+            stats_set_timing(TRUE);
+        }
+        else if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc)
+            batch_var = argv[++i];
+        else if (strcmp(argv[i], "--serve") == 0 && i + 1 < argc)
+            serve_path = argv[++i];
+        else if (strcmp(argv[i], "--connect") == 0 && i + 1 < argc)
+            connect_path = argv[++i];
+        else if (strcmp(argv[i], "--csv") == 0 && i + 1 < argc)
+            csv_path = argv[++i];
+        else if (strcmp(argv[i], "--column") == 0 && i + 1 < argc &&
+                 (eq = strchr(argv[i + 1], '=')) && n_files < MAX_VARS) {
+            *eq = '\0';
+            files[n_files].name = argv[++i];
+            files[n_files].path = eq + 1;
+            n_files++;
+        } else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc)
+            out_path = argv[++i];
+        else if (strcmp(argv[i], "--binary-output") == 0)
+            binary_out = TRUE;
+        else if (strcmp(argv[i], "--validate") == 0)
+            check_only = TRUE;
+        else if (strcmp(argv[i], "--compile") == 0 && i + 1 < argc)
+            compile_path = argv[++i];
+        else if (strcmp(argv[i], "--load") == 0 && i + 1 < argc)
+            load_path = argv[++i];
+        else if (strcmp(argv[i], "--optimize") == 0 && i + 1 < argc &&
+                 strcmp(argv[i + 1], "strict") == 0) {
+            optimize_set_mode(POLY_STRICT);
+            i++;
+        } else if (strcmp(argv[i], "--optimize") == 0 && i + 1 < argc &&
+                   strcmp(argv[i + 1], "contract") == 0) {
+            optimize_set_mode(POLY_CONTRACT);
+            i++;
+        } else if (strcmp(argv[i], "--exact") == 0)
+            exact = TRUE;
+        else if (strcmp(argv[i], "--type") == 0 && i + 1 < argc &&
+                 find_number_type(argv[i + 1]) >= 0)
+            number_type = find_number_type(argv[++i]);
+        else if (strcmp(argv[i], "--profile") == 0)
+            profiling = TRUE;
+        else if (strcmp(argv[i], "--folded") == 0 && i + 1 < argc)
+            folded_path = argv[++i];
+        else if (strcmp(argv[i], "--adaptive") == 0 && i + 1 < argc)
+            adaptive_set_tolerance(g_ascii_strtod(argv[++i], NULL));
+        else if (!expr)
+            expr = argv[i];
+        else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
 
-    if (argc == 1) {
+    // Horner's rule would take the coefficients as doubles, and lose digits
+    // of the literals that decimals keep
+    if (number_type == NUMBER_DECIMAL64 || number_type == NUMBER_DECIMAL128)
+        optimize_set_mode(POLY_OFF);
+
+    if (folded_path && !profiling) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if (profiling) {
+        if (!expr || compile_path || load_path || check_only || csv_path ||
+            n_files > 0 || serve_path || connect_path || batch_var || exact) {
+            usage(argv[0]);
+            return 1;
+        }
+        if (!profile(expr, folded_path))
+            return 1;
+    } else if (compile_path || load_path) {
+        if (expr || batch_var || serve_path || connect_path || csv_path ||
+            n_files > 0 || check_only || (compile_path && load_path)) {
+            usage(argv[0]);
+            return 1;
+        }
+        if (compile_path ? !compile(compile_path) : !load(load_path))
+            return 1;
+    } else if (check_only) {
+        if (batch_var || serve_path || connect_path || csv_path ||
+            n_files > 0) {
+            usage(argv[0]);
+            return 1;
+        }
+        if (expr)
+            ok = validate(expr, 1);
+        else {
+            ok = TRUE;
+            for (lineno = 1; fgets(line, LINE_LENGTH, stdin); lineno++)
+                ok = validate(line, lineno) && ok;
+        }
+        if (!ok)
+            return 1;
+    } else if (csv_path || n_files > 0) {
+        if (!expr || batch_var || serve_path || connect_path ||
+            (csv_path && n_files > 0)) {
+            usage(argv[0]);
+            return 1;
+        }
+        if (!calc_columns(expr, csv_path, files, n_files, out_path,
+                          binary_out, &err)) {
+            fprintf(stderr, "%s\n", err ? err->message : "böö");
+            if (err) g_error_free(err);
+            return 1;
+        }
+    } else if (serve_path || connect_path) {
+        if (expr || batch_var || (serve_path && connect_path)) {
+            usage(argv[0]);
+            return 1;
+        }
+        if (serve_path)
+            calc_server_run(serve_path, &err);
+        else
+            calc_client_run(connect_path, fileno(stdin), fileno(stdout), &err);
+        if (err) {
+            fprintf(stderr, "%s\n", err->message);
+            g_error_free(err);
+            return 1;
+        }
+    } else if (batch_var) {
+        if (!expr) {
+            usage(argv[0]);
+            return 1;
+        }
+        if (!batch(expr, batch_var))
+            return 1;
+    } else if (!expr) {
         interactive();
-    } else if (argc == 2) {
-        calc(argv[1], result, LINE_LENGTH);
-        printf("%s\n", result);
     } else {
-        fprintf(stderr,"Usage: %s [expr]\n", argv[0]);
-        return 1;
+        calc(expr, result, LINE_LENGTH);
+        printf("%s\n", result);
+    }
+
+    if (print_stats) {
+        report = stats_report();
+        fputs(report, stderr);
+        g_free(report);
     }
     return 0;
 }
@@ -41,18 +433,52 @@ int main(int argc, char **argv)
 
 void calc(const char *input, char *result, size_t result_len)
 {
-    node_t *parsetree;
-    double r;
+    flattree_t *tree;
     GError *err = NULL;
 
-    parsetree = build_parse_tree(input, &err);
+    tree = build_flattree(input, &err);
     if (err) {
         snprintf(result, result_len, "%s\n", err->message);
         g_error_free(err);
-    } else if (parsetree) {
-        r = eval_parse_tree(parsetree, FALSE);
-        snprintf(result, result_len, "%g\n", r);
-    } else
+    } else if (tree)
+        calc_tree(tree, result, result_len);
+    else
         snprintf(result, result_len, "böö\n");
-    free_parsetree(parsetree);
+    free_flattree(tree);
+}
+
+
+void calc_tree(const flattree_t *tree, char *result, size_t result_len)
+{
+    matrix_t *r;
+    rational_t q;
+    gchar *s;
+    GError *err = NULL;
+
+    if (exact && flattree_is_scalar(tree)) {
+        q = eval_flattree_rational(tree, FALSE);
+        s = rational_to_string(&q, "%g");
+        snprintf(result, result_len, "%s\n", s);
+        g_free(s);
+        rational_clear(&q);
+        return;
+    }
+
+    if (number_type >= 0 && flattree_is_scalar(tree)) {
+        s = eval_flattree_typed(tree, number_type, NULL, FALSE);
+        snprintf(result, result_len, "%s\n", s);
+        g_free(s);
+        return;
+    }
+
+    r = eval_flattree_matrix(tree, FALSE, &err);
+    if (err) {
+        snprintf(result, result_len, "%s\n", err->message);
+        g_error_free(err);
+    } else {
+        s = matrix_to_string(r, "%g");
+        snprintf(result, result_len, "%s\n", s);
+        g_free(s);
+        free_matrix(r);
+    }
 }
@@ -23,8 +23,10 @@
 #endif
 
 #include <string.h>
-#include <locale.h>
 #include <gtk/gtk.h>
+#ifdef CALC_INTERNAL
+#   include <gmodule.h>
+#endif
 #include <libxfce4util/libxfce4util.h>
 #include <libxfcegui4/libxfcegui4.h>
 #include <libxfce4panel/xfce-panel-plugin.h>
@@ -32,12 +34,18 @@
 #include "parsetree.h"
 #include "parser.h"
 #include "eval.h"
+#include "stats.h"
+#include "adaptive.h"
+#include "session.h"
 
 
 // Default settings
 #define DEFAULT_DEGREES FALSE
+#define DEFAULT_EXACT FALSE
+#define DEFAULT_DECIMAL FALSE
 #define DEFAULT_SIZE 20
 #define DEFAULT_HIST_SIZE 25
+#define DEFAULT_TOLERANCE 1e-12   // see adaptive.h
 
 
 typedef struct {
@@ -47,12 +55,16 @@ typedef struct {
     GtkWidget *hvbox;
     GtkWidget *combo;
     GtkWidget *degrees_button;
-    GtkWidget *radians_button;
+    GtkWidget *radians_button;  // NULL until our menu items have been added
 
     GList *expr_hist;   // Expression history
+    session_t *session; // The definitions entered so far
     
     // Settings
     gboolean degrees; // Degrees or radians for trigonometric functions?
+    gboolean exact;   // Show results as fractions when possible?
+    gboolean decimal; // Compute in decimal128 instead of double?
+    gboolean stats;   // Timing evaluations, for the statistics in the log?
     gint size;		  // Size of comboboxentry 
     gint hist_size;
 } CalcPlugin;
@@ -60,7 +72,20 @@ typedef struct {
 
 static void calc_construct(XfcePanelPlugin *plugin);
 
+#ifdef CALC_INTERNAL
+/* All instances share the panel's process, and the backend's statistics.
+   Threads that have evaluated something call back into the module when they
+   exit, so it must stay loaded. */
+G_MODULE_EXPORT const gchar *g_module_check_init(GModule *module)
+{
+    g_module_make_resident(module);
+    return NULL;
+}
+
+XFCE_PANEL_PLUGIN_REGISTER_INTERNAL(calc_construct);
+#else
 XFCE_PANEL_PLUGIN_REGISTER_EXTERNAL(calc_construct);
+#endif
 
 
 void calc_save_config(XfcePanelPlugin *plugin, CalcPlugin *calc)
@@ -76,6 +101,8 @@ void calc_save_config(XfcePanelPlugin *plugin, CalcPlugin *calc)
 
     if (rc != NULL) {
         xfce_rc_write_bool_entry(rc, "degrees", calc->degrees);
+        xfce_rc_write_bool_entry(rc, "exact", calc->exact);
+        xfce_rc_write_bool_entry(rc, "decimal", calc->decimal);
         xfce_rc_write_int_entry(rc, "size", calc->size);
         xfce_rc_write_int_entry(rc, "hist_size", calc->hist_size);
         xfce_rc_close(rc);
@@ -98,12 +125,16 @@ static void calc_read_config(CalcPlugin *calc)
 
     if (rc) {
         calc->degrees = xfce_rc_read_bool_entry(rc, "degrees", DEFAULT_DEGREES);
+        calc->exact = xfce_rc_read_bool_entry(rc, "exact", DEFAULT_EXACT);
+        calc->decimal = xfce_rc_read_bool_entry(rc, "decimal", DEFAULT_DECIMAL);
         calc->size = xfce_rc_read_int_entry(rc, "size", DEFAULT_SIZE);
         calc->hist_size = xfce_rc_read_int_entry(rc, "hist_size", DEFAULT_HIST_SIZE);
         xfce_rc_close(rc);
     } else {
         /* Something went wrong, apply default values. */
         calc->degrees = DEFAULT_DEGREES;
+        calc->exact = DEFAULT_EXACT;
+        calc->decimal = DEFAULT_DECIMAL;
         calc->size = DEFAULT_SIZE;
         calc->hist_size = DEFAULT_HIST_SIZE;
     }
@@ -138,35 +169,48 @@ static GList *add_to_expr_hist(GList *ehist, gint hist_size, const gchar *str)
 
 static void entry_enter_cb(GtkEntry *entry, CalcPlugin *calc)
 {
-    node_t *parsetree;
+    flattree_t *tree = NULL;
     const gchar *input;
+    gchar *output;
     GError *err = NULL;
 
     input = gtk_entry_get_text(entry);
-    parsetree = build_parse_tree(input, &err);
+
+    // Fractions and decimals are only for plain numbers, without definitions
+    if (calc->exact || calc->decimal)
+        tree = build_flattree(input, NULL);
+    if (tree && !flattree_is_scalar(tree)) {
+        free_flattree(tree);
+        tree = NULL;
+    }
+
+    if (tree && calc->exact) {
+        rational_t q;
+
+        q = eval_flattree_rational(tree, calc->degrees);
+        output = rational_to_string(&q, "%.16g");
+        rational_clear(&q);
+    } else if (tree)
+        output = eval_flattree_typed(tree, NUMBER_DECIMAL128, NULL,
+                                     calc->degrees);
+    else
+        output = session_enter(calc->session, input, "%.16g", &err);
+    free_flattree(tree);
+
     if (err) {
         xfce_err("Calculator error: %s", err->message);
         g_error_free(err);
-        free_parsetree(parsetree);
         return;
     }
+    if (!output)
+        return;
 
     calc->expr_hist = add_to_expr_hist(calc->expr_hist, calc->hist_size, input);
     gtk_combo_set_popdown_strings(GTK_COMBO(calc->combo), calc->expr_hist);
 
-    if (parsetree) {
-        gdouble r;
-        gchar *output;
-
-        r = eval_parse_tree(parsetree, calc->degrees);
-
-        output = g_strdup_printf("%.16g", r);
-        gtk_entry_set_text(entry, output);
-        gtk_editable_set_position(GTK_EDITABLE(entry), -1);
-        g_free(output);
-        free_parsetree(parsetree);
-    }
-    
+    gtk_entry_set_text(entry, output);
+    gtk_editable_set_position(GTK_EDITABLE(entry), -1);
+    g_free(output);
 }
 
 
@@ -194,6 +238,7 @@ static CalcPlugin *calc_new(XfcePanelPlugin *plugin)
     calc = panel_slice_new0(CalcPlugin);
     calc->plugin = plugin;
     calc_read_config(calc);
+    calc->session = session_new(calc->degrees);
 
     orientation = xfce_panel_plugin_get_orientation(plugin);
 
@@ -243,12 +288,16 @@ static void calc_free(XfcePanelPlugin *plugin, CalcPlugin *calc)
     if (dialog != NULL)
         gtk_widget_destroy(dialog);
 
+    if (calc->stats)
+        stats_set_timing(FALSE);
+
     gtk_widget_destroy(calc->ebox);
     gtk_widget_destroy(calc->hvbox);
     gtk_widget_destroy(calc->combo);
 
     g_list_foreach(calc->expr_hist, (GFunc)free_stuff, NULL);
     g_list_free(calc->expr_hist);
+    session_free(calc->session);
 
     /* 
      * FIXME: Do we need to free the strings in the combo list, or is the
@@ -327,6 +376,19 @@ static void angle_unit_chosen(GtkCheckMenuItem *button, CalcPlugin *calc)
         g_assert(button == (GtkCheckMenuItem *)calc->radians_button);
         calc->degrees = FALSE;
     }
+    session_set_degrees(calc->session, calc->degrees);
+}
+
+
+static void exact_toggled(GtkCheckMenuItem *item, CalcPlugin *calc)
+{
+    calc->exact = gtk_check_menu_item_get_active(item);
+}
+
+
+static void decimal_toggled(GtkCheckMenuItem *item, CalcPlugin *calc)
+{
+    calc->decimal = gtk_check_menu_item_get_active(item);
 }
 
 
@@ -423,36 +485,33 @@ static void calc_configure(XfcePanelPlugin *plugin, CalcPlugin *calc)
 }
 
 
-static void calc_construct(XfcePanelPlugin *plugin)
-{
-    CalcPlugin *calc;
-    GtkWidget *degrees, *radians;
+/* Called when the "Write statistics to log" menu item is toggled.  While it
+   is on, evaluations are timed too; when it is turned off, the statistics
+   are written to the log. */
 
-    /* Make sure the comma sign (",") isn't treated as a decimal separator. */
-    setlocale(LC_NUMERIC, "C");
+static void stats_toggled(GtkCheckMenuItem *item, CalcPlugin *calc)
+{
+    gchar *report;
 
-    xfce_textdomain(GETTEXT_PACKAGE, PACKAGE_LOCALE_DIR, "UTF-8");
+    calc->stats = gtk_check_menu_item_get_active(item);
+    stats_set_timing(calc->stats);
+    if (calc->stats)
+        return;
 
-    calc = calc_new(plugin);
-    gtk_container_add(GTK_CONTAINER(plugin), calc->ebox);
+    report = stats_report();
+    g_message("Calculator statistics:\n%s", report);
+    g_free(report);
+}
 
-    /* Show the panel's right-click menu on this ebox */
-    xfce_panel_plugin_add_action_widget(plugin, calc->ebox);
-    
-    g_signal_connect(G_OBJECT(plugin), "free-data",
-                     G_CALLBACK(calc_free), calc);
-    g_signal_connect(G_OBJECT(plugin), "save",
-                     G_CALLBACK(calc_save_config), calc);
-    g_signal_connect(G_OBJECT(plugin), "size-changed",
-                     G_CALLBACK(calc_size_changed), calc);
-    g_signal_connect(G_OBJECT(plugin), "orientation-changed",
-                     G_CALLBACK(calc_orientation_changed), calc);
 
-    /* Show the configure menu item and connect signal */
-    xfce_panel_plugin_menu_show_configure(plugin);
-    g_signal_connect(G_OBJECT(plugin), "configure-plugin",
-                     G_CALLBACK(calc_configure), calc);
+/* Add our items to the panel's right-click menu.  This is done the first
+   time the menu is about to be shown, so that a calculator no one
+   right-clicks never builds them. */
 
+static void calc_add_menu_items(CalcPlugin *calc)
+{
+    XfcePanelPlugin *plugin = calc->plugin;
+    GtkWidget *degrees, *radians, *exact, *decimal, *stats_item;
 
     // Add controls for choosing angle unit to the menu.
     degrees = gtk_radio_menu_item_new_with_label(
@@ -481,4 +540,76 @@ static void calc_construct(XfcePanelPlugin *plugin)
 
     calc->degrees_button = degrees;
     calc->radians_button = radians;
+
+    // Add a toggle for showing results as fractions.
+    exact = gtk_check_menu_item_new_with_label("Exact fractions");
+    gtk_check_menu_item_set_active(GTK_CHECK_MENU_ITEM(exact), calc->exact);
+    g_signal_connect(G_OBJECT(exact), "toggled",
+                     G_CALLBACK(exact_toggled), calc);
+    gtk_widget_show(exact);
+    xfce_panel_plugin_menu_insert_item(plugin, GTK_MENU_ITEM(exact));
+
+    // And one for computing in decimal, so that 0.1 + 0.2 is 0.3.
+    decimal = gtk_check_menu_item_new_with_label("Decimal arithmetic");
+    gtk_check_menu_item_set_active(GTK_CHECK_MENU_ITEM(decimal),
+                                   calc->decimal);
+    g_signal_connect(G_OBJECT(decimal), "toggled",
+                     G_CALLBACK(decimal_toggled), calc);
+    gtk_widget_show(decimal);
+    xfce_panel_plugin_menu_insert_item(plugin, GTK_MENU_ITEM(decimal));
+
+    // Add a toggle for timing evaluations, which dumps the runtime
+    // statistics to the debug log when it is turned off.
+    stats_item = gtk_check_menu_item_new_with_label("Write statistics to log");
+    g_signal_connect(G_OBJECT(stats_item), "toggled",
+                     G_CALLBACK(stats_toggled), calc);
+    gtk_widget_show(stats_item);
+    xfce_panel_plugin_menu_insert_item(plugin, GTK_MENU_ITEM(stats_item));
+}
+
+
+/* Connected before xfce_panel_plugin_add_action_widget(), so that it runs
+   before the handler that pops up the menu. */
+
+static gboolean calc_buttonpress_cb(GtkWidget *widget, GdkEventButton *event,
+                                    CalcPlugin *calc)
+{
+    if (event->button == 3 && !calc->degrees_button)
+        calc_add_menu_items(calc);
+
+    return FALSE;
+}
+
+
+static void calc_construct(XfcePanelPlugin *plugin)
+{
+    CalcPlugin *calc;
+
+    xfce_textdomain(GETTEXT_PACKAGE, PACKAGE_LOCALE_DIR, "UTF-8");
+
+    adaptive_set_tolerance(DEFAULT_TOLERANCE);
+    calc = calc_new(plugin);
+    gtk_container_add(GTK_CONTAINER(plugin), calc->ebox);
+
+    /* Show the panel's right-click menu on this ebox, with our items in
+       it */
+    g_signal_connect(G_OBJECT(calc->ebox), "button-press-event",
+                     G_CALLBACK(calc_buttonpress_cb), calc);
+    g_signal_connect(G_OBJECT(plugin), "button-press-event",
+                     G_CALLBACK(calc_buttonpress_cb), calc);
+    xfce_panel_plugin_add_action_widget(plugin, calc->ebox);
+    
+    g_signal_connect(G_OBJECT(plugin), "free-data",
+                     G_CALLBACK(calc_free), calc);
+    g_signal_connect(G_OBJECT(plugin), "save",
+                     G_CALLBACK(calc_save_config), calc);
+    g_signal_connect(G_OBJECT(plugin), "size-changed",
+                     G_CALLBACK(calc_size_changed), calc);
+    g_signal_connect(G_OBJECT(plugin), "orientation-changed",
+                     G_CALLBACK(calc_orientation_changed), calc);
+
+    /* Show the configure menu item and connect signal */
+    xfce_panel_plugin_menu_show_configure(plugin);
+    g_signal_connect(G_OBJECT(plugin), "configure-plugin",
+                     G_CALLBACK(calc_configure), calc);
 }
@@ -0,0 +1,338 @@
+/*
+ *  Copyright (C) 2010 Erik Edelmann <erik.edelmann@iki.fi>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <math.h>
+#include <glib.h>
+#include "constants.h"
+#include "flattree.h"
+#include "parser.h"
+#include "eval.h"
+#include "columns.h"
+
+// Rows evaluated at a time
+#define BLOCK_ROWS 65536
+
+
+static gboolean valid_name(const char *name)
+{
+    const char *p;
+
+    if (!isalpha(name[0]) || strlen(name) > MAX_ID_LEN)
+        return FALSE;
+    for (p = name; *p; p++)
+        if (!isalnum(*p) && *p != '_')
+            return FALSE;
+
+    return TRUE;
+}
+
+
+static flattree_t *compile(const char *expr, const char * const *names,
+                           gint n_names, GError **err)
+{
+    flattree_t *tree;
+    gint i;
+
+    if (n_names > MAX_VARS) {
+        g_set_error(err, 0, -1, "Too many columns (at most %d)", MAX_VARS);
+        return NULL;
+    }
+
+    for (i = 0; i < n_names; i++) {
+        if (!valid_name(names[i])) {
+            g_set_error(err, 0, -1, "Bad column name '%s'", names[i]);
+            return NULL;
+        }
+    }
+
+    tree = build_flattree_vars(expr, names, n_names, err);
+    if (!tree && err && !*err)
+        g_set_error(err, 0, -1, "Empty expression");
+
+    return tree;
+}
+
+
+static gboolean write_block(FILE *out, gboolean binary, const double *y,
+                            gsize n, GError **err)
+{
+    guint64 *le;
+    gsize i;
+    gboolean ok = TRUE;
+
+    if (binary && G_BYTE_ORDER == G_LITTLE_ENDIAN) {
+        ok = fwrite(y, sizeof(double), n, out) == n;
+    } else if (binary) {
+        le = g_new(guint64, n);
+        memcpy(le, y, n*sizeof(double));
+        for (i = 0; i < n; i++)
+            le[i] = GUINT64_TO_LE(le[i]);
+        ok = fwrite(le, sizeof(guint64), n, out) == n;
+        g_free(le);
+    } else {
+        for (i = 0; i < n && ok; i++)
+            ok = fprintf(out, "%.17g\n", y[i]) > 0;
+    }
+
+    if (!ok)
+        g_set_error(err, 0, errno, "Can't write output: %s", g_strerror(errno));
+    return ok;
+}
+
+
+/* Split the header line of a CSV file into the column names. */
+
+static gchar **read_header(FILE *in, GError **err)
+{
+    char *line = NULL;
+    size_t size = 0;
+    gchar **names;
+    gint i;
+    gsize len;
+
+    if (getline(&line, &size, in) < 0) {
+        g_set_error(err, 0, -1, "No header line in CSV input");
+        free(line);
+        return NULL;
+    }
+
+    names = g_strsplit(line, ",", -1);
+    free(line);
+
+    for (i = 0; names[i]; i++) {
+        g_strstrip(names[i]);
+        len = strlen(names[i]);
+        if (len >= 2 && names[i][0] == '"' && names[i][len - 1] == '"') {
+            memmove(names[i], names[i] + 1, len - 2);
+            names[i][len - 2] = '\0';
+        }
+    }
+
+    return names;
+}
+
+
+/* Read up to 'max_rows' rows into the columns.  Fields that are missing or
+   aren't numbers become NaN.  Returns the number of rows read. */
+
+static gsize read_rows(FILE *in, double **cols, gint n_cols, gsize max_rows,
+                       char **line, size_t *size)
+{
+    gsize rows = 0;
+    char *p, *end;
+    gint j;
+
+    while (rows < max_rows && getline(line, size, in) >= 0) {
+        p = *line;
+        while (isspace(*p))
+            p++;
+        if (*p == '\0')
+            continue;
+
+        for (j = 0; j < n_cols; j++) {
+            cols[j][rows] = g_ascii_strtod(p, &end);
+            if (end == p)
+                cols[j][rows] = NAN;
+            p = strchr(end, ',');
+            if (p)
+                p++;
+            else
+                p = end + strlen(end);
+        }
+        rows++;
+    }
+
+    return rows;
+}
+
+
+static gboolean eval_csv(const char *expr, const char *path, FILE *out,
+                         gboolean binary_out, GError **err)
+{
+    FILE *in;
+    gchar **names;
+    flattree_t *tree = NULL;
+    double **cols = NULL, *y = NULL;
+    char *line = NULL;
+    size_t size = 0;
+    gsize rows;
+    gint j, n_cols = 0;
+    gboolean ok = FALSE;
+
+    in = strcmp(path, "-") == 0 ? stdin : fopen(path, "r");
+    if (!in) {
+        g_set_error(err, 0, errno, "Can't open %s: %s", path, g_strerror(errno));
+        return FALSE;
+    }
+
+    names = read_header(in, err);
+    if (names) {
+        n_cols = g_strv_length(names);
+        tree = compile(expr, (const char * const *)names, n_cols, err);
+    }
+    if (!tree)
+        goto out;
+
+    cols = g_new(double *, n_cols);
+    for (j = 0; j < n_cols; j++)
+        cols[j] = g_new(double, BLOCK_ROWS);
+    y = g_new(double, BLOCK_ROWS);
+
+    ok = TRUE;
+    while (ok && (rows = read_rows(in, cols, n_cols, BLOCK_ROWS,
+                                   &line, &size)) > 0) {
+        eval_flattree_columns(tree, (const double * const *)cols, n_cols,
+                              y, rows, FALSE);
+        ok = write_block(out, binary_out, y, rows, err);
+    }
+
+out:
+    if (cols)
+        for (j = 0; j < n_cols; j++)
+            g_free(cols[j]);
+    g_free(cols);
+    g_free(y);
+    free(line);
+    g_strfreev(names);
+    free_flattree(tree);
+    if (in != stdin)
+        fclose(in);
+
+    return ok;
+}
+
+
+static gboolean eval_files(const char *expr, const column_file_t *files,
+                           gint n_files, FILE *out, gboolean binary_out,
+                           GError **err)
+{
+    GMappedFile **maps;
+    const char **names;
+    const double **cols;
+    double **swapped = NULL, *y = NULL;
+    flattree_t *tree = NULL;
+    guint64 *le;
+    gsize rows = 0, start, n, len, i;
+    gint j;
+    gboolean ok = FALSE;
+
+    maps = g_new0(GMappedFile *, n_files);
+    names = g_new(const char *, n_files);
+    cols = g_new(const double *, n_files);
+
+    for (j = 0; j < n_files; j++) {
+        names[j] = files[j].name;
+        maps[j] = g_mapped_file_new(files[j].path, FALSE, err);
+        if (!maps[j])
+            goto out;
+        len = g_mapped_file_get_length(maps[j]);
+        if (len % sizeof(double) != 0) {
+            g_set_error(err, 0, -1, "%s: length is not a multiple of 8 bytes",
+                        files[j].path);
+            goto out;
+        }
+        if (j > 0 && len/sizeof(double) != rows) {
+            g_set_error(err, 0, -1, "%s: not as long as %s", files[j].path,
+                        files[0].path);
+            goto out;
+        }
+        rows = len/sizeof(double);
+    }
+
+    tree = compile(expr, names, n_files, err);
+    if (!tree)
+        goto out;
+
+    // The mapped data can be used as it is, unless the byte order differs
+    if (G_BYTE_ORDER != G_LITTLE_ENDIAN) {
+        swapped = g_new(double *, n_files);
+        for (j = 0; j < n_files; j++)
+            swapped[j] = g_new(double, BLOCK_ROWS);
+    }
+    y = g_new(double, BLOCK_ROWS);
+
+    ok = TRUE;
+    for (start = 0; ok && start < rows; start += n) {
+        n = MIN(BLOCK_ROWS, rows - start);
+        for (j = 0; j < n_files; j++) {
+            cols[j] = (const double *)g_mapped_file_get_contents(maps[j]) +
+                      start;
+            if (swapped) {
+                le = (guint64 *)swapped[j];
+                memcpy(le, cols[j], n*sizeof(double));
+                for (i = 0; i < n; i++)
+                    le[i] = GUINT64_FROM_LE(le[i]);
+                cols[j] = swapped[j];
+            }
+        }
+        eval_flattree_columns(tree, cols, n_files, y, n, FALSE);
+        ok = write_block(out, binary_out, y, n, err);
+    }
+
+out:
+    for (j = 0; j < n_files; j++) {
+        if (maps[j])
+            g_mapped_file_unref(maps[j]);
+        if (swapped)
+            g_free(swapped[j]);
+    }
+    g_free(swapped);
+    g_free(maps);
+    g_free(names);
+    g_free(cols);
+    g_free(y);
+    free_flattree(tree);
+
+    return ok;
+}
+
+
+gboolean calc_columns(const char *expr, const char *csv_path,
+                      const column_file_t *files, gint n_files,
+                      const char *out_path, gboolean binary_out, GError **err)
+{
+    FILE *out;
+    gboolean ok;
+
+    out = out_path ? fopen(out_path, binary_out ? "wb" : "w") : stdout;
+    if (!out) {
+        g_set_error(err, 0, errno, "Can't open %s: %s", out_path,
+                    g_strerror(errno));
+        return FALSE;
+    }
+
+    if (csv_path)
+        ok = eval_csv(expr, csv_path, out, binary_out, err);
+    else
+        ok = eval_files(expr, files, n_files, out, binary_out, err);
+
+    if (out != stdout) {
+        if (fclose(out) != 0 && ok) {
+            g_set_error(err, 0, errno, "Can't write %s: %s", out_path,
+                        g_strerror(errno));
+            ok = FALSE;
+        }
+    } else
+        fflush(stdout);
+
+    return ok;
+}
@@ -0,0 +1,42 @@
+/*
+ *  Copyright (C) 2010 Erik Edelmann <erik.edelmann@iki.fi>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+#ifndef __COLUMNS_H__
+#define __COLUMNS_H__
+
+#include <glib.h>
+
+/* A file of raw little-endian doubles, with the values of variable 'name'. */
+typedef struct {
+    const char *name;
+    const char *path;
+} column_file_t;
+
+/* Evaluate 'expr' for every row of a table, and write one result per row to
+   'out_path' (NULL for stdout): as text, or as raw little-endian doubles if
+   'binary_out' is set.
+
+   The table is either a CSV file, whose first line names the variables of
+   the columns ('csv_path', "-" for stdin), or 'n_files' binary files, one
+   per variable, all of the same length.  The binary files are mapped into
+   memory rather than read.  Either way the rows are evaluated a block at a
+   time, so tables of any length fit. */
+gboolean calc_columns(const char *expr, const char *csv_path,
+                      const column_file_t *files, gint n_files,
+                      const char *out_path, gboolean binary_out, GError **err);
+
+#endif
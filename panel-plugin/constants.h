@@ -17,6 +17,7 @@
  */
 
 #define MAX_ID_LEN 16
+#define MAX_VARS 64
 #ifndef NAN
 #   define NAN (0.0/0.0)
 #endif
@@ -0,0 +1,825 @@
+/*
+ *  Copyright (C) 2010 Erik Edelmann <erik.edelmann@iki.fi>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+#include <math.h>
+#include <glib.h>
+#include "decimal.h"
+#include "numparse.h"
+
+/*
+ * The arithmetic is done on unpacked values, with the coefficient in a 128
+ * bit integer, and rounded and packed again at the end.  Sums and quotients
+ * of decimal128s are computed with at most 38 digits, which still fits:
+ *
+ *  - In a + b, where a is the larger one, the digits of b that are more than
+ *    two below the last digit the result can have are only remembered as a
+ *    last digit of 1 if any of them is non-zero.  That is enough to round
+ *    correctly.
+ *
+ *  - a/b is computed a few digits at a time, like long division.
+ *
+ * Only the product of two decimal128s needs more, and is computed with 256
+ * bits.
+ */
+
+typedef unsigned __int128 u128;
+
+#define MAX_POW10 38            // 10^38 < 2^128 < 10^39
+#define E19 G_GUINT64_CONSTANT(10000000000000000000)
+
+static const u128 powers_of_ten[MAX_POW10 + 1] = {
+    1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000,
+    1000000000, 10000000000ULL, 100000000000ULL, 1000000000000ULL,
+    10000000000000ULL, 100000000000000ULL, 1000000000000000ULL,
+    10000000000000000ULL, 100000000000000000ULL, 1000000000000000000ULL,
+    E19, (u128)E19*10, (u128)E19*100, (u128)E19*1000, (u128)E19*10000,
+    (u128)E19*100000, (u128)E19*1000000, (u128)E19*10000000,
+    (u128)E19*100000000, (u128)E19*1000000000, (u128)E19*10000000000ULL,
+    (u128)E19*100000000000ULL, (u128)E19*1000000000000ULL,
+    (u128)E19*10000000000000ULL, (u128)E19*100000000000000ULL,
+    (u128)E19*1000000000000000ULL, (u128)E19*10000000000000000ULL,
+    (u128)E19*100000000000000000ULL, (u128)E19*1000000000000000000ULL,
+    (u128)E19*E19
+};
+
+static const double exact_pow10[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+typedef struct {
+    gint digits;                // of the coefficient
+    gint emin, emax;            // the range of the exponent e
+} format_t;
+
+static const format_t formats[] = {
+    { 16, -398, 369 },          // DECIMAL64
+    { 34, -6176, 6111 }         // DECIMAL128
+};
+
+// The top bits of infinities and NaNs
+#define INF_BITS G_GUINT64_CONSTANT(0x7800000000000000)
+#define NAN_BITS G_GUINT64_CONSTANT(0x7c00000000000000)
+
+#define BIT(n) (G_GUINT64_CONSTANT(1) << (n))
+
+typedef enum { KIND_FINITE, KIND_INF, KIND_NAN } kind_t;
+
+typedef struct {
+    kind_t kind;
+    gboolean neg;
+    u128 c;
+    gint e;
+} unpacked_t;
+
+
+static gint n_digits(u128 c)
+{
+    guint64 hi = c >> 64;
+    gint bits, d;
+
+    if (c == 0)
+        return 1;
+
+    bits = hi ? 128 - __builtin_clzll(hi) : 64 - __builtin_clzll((guint64)c);
+    d = bits*1233 >> 12;        // 1233/4096 is just below log10(2)
+    return d + (c >= powers_of_ten[d]);
+}
+
+
+static decimal_t special(decimal_format_t f, gboolean neg, kind_t kind)
+{
+    decimal_t r = { 0, 0 };
+    guint64 top = ((guint64)neg << 63) | (kind == KIND_NAN ? NAN_BITS
+                                                           : INF_BITS);
+
+    if (f == DECIMAL64)
+        r.lo = top;
+    else
+        r.hi = top;
+    return r;
+}
+
+
+/* c must fit in the format, and e be in its range. */
+
+static decimal_t pack(decimal_format_t f, gboolean neg, u128 c, gint e)
+{
+    guint64 sign = (guint64)neg << 63, be = e - formats[f].emin;
+    decimal_t r;
+
+    if (f == DECIMAL64) {
+        if (c < BIT(53))
+            r.lo = sign | be << 53 | (guint64)c;
+        else
+            r.lo = sign | G_GUINT64_CONSTANT(3) << 61 | be << 51 |
+                   ((guint64)c & (BIT(51) - 1));
+        r.hi = 0;
+    } else {
+        r.hi = sign | be << 49 | (guint64)(c >> 64);
+        r.lo = (guint64)c;
+    }
+
+    return r;
+}
+
+
+static unpacked_t unpack(decimal_format_t f, decimal_t a)
+{
+    guint64 top = (f == DECIMAL64) ? a.lo : a.hi;
+    unpacked_t u;
+
+    u.neg = top >> 63;
+    u.c = 0;
+    u.e = 0;
+    if ((top & NAN_BITS) == NAN_BITS) {
+        u.kind = KIND_NAN;
+        return u;
+    }
+    if ((top & INF_BITS) == INF_BITS) {
+        u.kind = KIND_INF;
+        return u;
+    }
+
+    u.kind = KIND_FINITE;
+    if (f == DECIMAL64) {
+        if ((top >> 61 & 3) == 3) {
+            u.e = (gint)(top >> 51 & 0x3ff);
+            u.c = BIT(53) | (top & (BIT(51) - 1));
+        } else {
+            u.e = (gint)(top >> 53 & 0x3ff);
+            u.c = top & (BIT(53) - 1);
+        }
+    } else {
+        // The other form only has coefficients > 10^34, which read as 0
+        if ((top >> 61 & 3) == 3)
+            u.e = (gint)(top >> 47 & 0x3fff);
+        else {
+            u.e = (gint)(top >> 49 & 0x3fff);
+            u.c = (u128)(top & (BIT(49) - 1)) << 64 | a.lo;
+        }
+    }
+    u.e += formats[f].emin;
+
+    // So do other too large coefficients
+    if (u.c >= powers_of_ten[formats[f].digits])
+        u.c = 0;
+
+    return u;
+}
+
+
+/* Round c*10^e to the format, half to even, and pack it.  'sticky' says that
+   the exact value is a bit larger than c*10^e; then c must have more digits
+   than the format. */
+
+static decimal_t round_pack(decimal_format_t f, gboolean neg, u128 c, gint e,
+                            gboolean sticky)
+{
+    const format_t *fmt = &formats[f];
+    gint d = n_digits(c), k;
+    u128 q, r, half;
+
+    // Drop k digits, for the precision or to make the number subnormal
+    k = MAX(d - fmt->digits, fmt->emin - e);
+    if (k > 0) {
+        if (k > d || k > MAX_POW10)
+            q = 0;              // Less than half of the last digit
+        else {
+            q = c/powers_of_ten[k];
+            r = c - q*powers_of_ten[k];
+            half = powers_of_ten[k]/2;
+            if (r > half || (r == half && (sticky || (q & 1))))
+                q++;
+        }
+        c = q;
+        e += k;
+        if (c == powers_of_ten[fmt->digits]) {
+            c /= 10;
+            e++;
+        }
+    }
+
+    // Too large exponents can be fixed with trailing zeros, if there's room
+    if (e > fmt->emax) {
+        if (c == 0)
+            e = fmt->emax;
+        else if (n_digits(c) + e - fmt->emax <= fmt->digits) {
+            c *= powers_of_ten[e - fmt->emax];
+            e = fmt->emax;
+        } else
+            return special(f, neg, KIND_INF);
+    }
+
+    return pack(f, neg, c, e);
+}
+
+
+decimal_t decimal_nan(decimal_format_t f)
+{
+    return special(f, FALSE, KIND_NAN);
+}
+
+
+decimal_t decimal_from_int(decimal_format_t f, gint64 n)
+{
+    u128 c = (n < 0) ? (u128)(-(n + 1)) + 1 : (u128)n;
+
+    return round_pack(f, n < 0, c, 0, FALSE);
+}
+
+
+decimal_t decimal_from_double(decimal_format_t f, double x)
+{
+    guint64 m;
+    gint e;
+
+    if (isnan(x))
+        return special(f, FALSE, KIND_NAN);
+    if (isinf(x))
+        return special(f, x < 0, KIND_INF);
+
+    shortest_decimal(fabs(x), &m, &e);
+    return round_pack(f, signbit(x) != 0, m, e, FALSE);
+}
+
+
+decimal_t decimal_convert(decimal_format_t to, decimal_format_t from,
+                          decimal_t a)
+{
+    unpacked_t u = unpack(from, a);
+
+    if (u.kind != KIND_FINITE)
+        return special(to, u.neg, u.kind);
+    return round_pack(to, u.neg, u.c, u.e, FALSE);
+}
+
+
+/* The digits of c, without leading zeros.  'buf' must have room for 40. */
+
+static gint format_digits(u128 c, char *buf)
+{
+    char tmp[40];
+    gint n = 0, i;
+
+    do {
+        tmp[n++] = '0' + (gint)(c % 10);
+        c /= 10;
+    } while (c != 0);
+
+    for (i = 0; i < n; i++)
+        buf[i] = tmp[n - 1 - i];
+    buf[n] = '\0';
+
+    return n;
+}
+
+
+double decimal_to_double(decimal_format_t f, decimal_t a)
+{
+    unpacked_t u = unpack(f, a);
+    const char *end;
+    char buf[64];
+    double x;
+    gint n;
+
+    if (u.kind == KIND_NAN)
+        return NAN;
+    if (u.kind == KIND_INF)
+        return u.neg ? -INFINITY : INFINITY;
+
+#if FLT_EVAL_METHOD == 0
+    // Both c and 10^e are exact doubles, like in parse_number()
+    if (u.c <= BIT(53) && u.e >= -22 && u.e <= 22) {
+        x = (u.e < 0) ? (double)u.c/exact_pow10[-u.e]
+                      : (double)u.c*exact_pow10[u.e];
+        return u.neg ? -x : x;
+    }
+#endif
+
+    n = format_digits(u.c, buf);
+    g_snprintf(buf + n, sizeof(buf) - n, "e%d", u.e);
+    x = parse_number(buf, &end);
+    return u.neg ? -x : x;
+}
+
+
+static inline gboolean is_digit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+
+// As in numparse.c
+static inline const char *skip_separator(const char *p, const char *s)
+{
+    if (*p == '_' && p > s && is_digit(p[-1]) && is_digit(p[1]))
+        return p + 1;
+    return p;
+}
+
+
+decimal_t decimal_from_string(decimal_format_t f, const char *s,
+                              const char **end)
+{
+    const char *p, *q;
+    u128 c = 0;
+    gint digits = 0, n = 0, e = 0, exp10 = 0, exp_sign = 1;
+    gboolean sticky = FALSE, fraction = FALSE;
+
+    // Digits beyond MAX_POW10 - 1 are only remembered as 'sticky'
+    for (p = s; ; p++) {
+        p = skip_separator(p, s);
+        if (*p == '.' && !fraction) {
+            fraction = TRUE;
+            continue;
+        }
+        if (!is_digit(*p))
+            break;
+        if (digits < MAX_POW10 - 1) {
+            c = 10*c + (*p - '0');
+            if (c != 0)
+                digits++;
+            e -= fraction;
+        } else {
+            sticky |= (*p != '0');
+            e += !fraction;
+        }
+        n++;
+    }
+    if (n == 0) {
+        if (end)
+            *end = s;
+        return pack(f, FALSE, 0, 0);
+    }
+
+    // The exponent is only part of the number if it has digits
+    if (*p == 'e' || *p == 'E') {
+        q = p + 1;
+        if (*q == '+' || *q == '-')
+            exp_sign = (*q++ == '-') ? -1 : 1;
+        if (is_digit(*q)) {
+            for (;;) {
+                q = skip_separator(q, s);
+                if (!is_digit(*q))
+                    break;
+                if (exp10 < 100000)
+                    exp10 = exp10*10 + (*q - '0');
+                q++;
+            }
+            e += exp_sign*exp10;
+            p = q;
+        }
+    }
+    if (end)
+        *end = p;
+
+    return round_pack(f, FALSE, c, e, sticky);
+}
+
+
+gchar *decimal_to_string(decimal_format_t f, decimal_t a)
+{
+    unpacked_t u = unpack(f, a);
+    char digits[40];
+    GString *s;
+    gint n, adjusted, point;
+
+    if (u.kind == KIND_NAN)
+        return g_strdup("nan");
+    if (u.kind == KIND_INF)
+        return g_strdup(u.neg ? "-inf" : "inf");
+
+    n = format_digits(u.c, digits);
+    adjusted = u.e + n - 1;
+
+    s = g_string_new(u.neg ? "-" : "");
+    if (u.e <= 0 && adjusted >= -6) {
+        // Without exponent
+        point = n + u.e;
+        if (point <= 0) {
+            g_string_append(s, "0.");
+            for (; point < 0; point++)
+                g_string_append_c(s, '0');
+            g_string_append(s, digits);
+        } else {
+            g_string_append_len(s, digits, point);
+            if (point < n) {
+                g_string_append_c(s, '.');
+                g_string_append(s, digits + point);
+            }
+        }
+    } else {
+        g_string_append_c(s, digits[0]);
+        if (n > 1) {
+            g_string_append_c(s, '.');
+            g_string_append(s, digits + 1);
+        }
+        g_string_append_printf(s, "e%+d", adjusted);
+    }
+
+    return g_string_free(s, FALSE);
+}
+
+
+gboolean decimal_is_nan(decimal_format_t f, decimal_t a)
+{
+    return unpack(f, a).kind == KIND_NAN;
+}
+
+
+gboolean decimal_is_zero(decimal_format_t f, decimal_t a)
+{
+    unpacked_t u = unpack(f, a);
+
+    return u.kind == KIND_FINITE && u.c == 0;
+}
+
+
+static gint sign(const unpacked_t *u)
+{
+    if (u->kind == KIND_FINITE && u->c == 0)
+        return 0;
+    return u->neg ? -1 : 1;
+}
+
+
+gint decimal_compare(decimal_format_t f, decimal_t a, decimal_t b)
+{
+    unpacked_t ua = unpack(f, a), ub = unpack(f, b);
+    gint sa, sb, adj_a, adj_b, c;
+    u128 ca, cb;
+
+    if (ua.kind == KIND_NAN || ub.kind == KIND_NAN)
+        return DECIMAL_UNORDERED;
+
+    sa = sign(&ua);
+    sb = sign(&ub);
+    if (sa != sb || sa == 0)
+        return (sa > sb) - (sa < sb);
+
+    // The same sign, compare the magnitudes
+    if (ua.kind == KIND_INF || ub.kind == KIND_INF)
+        c = (ua.kind == KIND_INF) - (ub.kind == KIND_INF);
+    else {
+        adj_a = ua.e + n_digits(ua.c);
+        adj_b = ub.e + n_digits(ub.c);
+        if (adj_a != adj_b)
+            c = (adj_a > adj_b) - (adj_a < adj_b);
+        else {
+            // With the same number of digits, e differs by less than that
+            ca = (ua.e > ub.e) ? ua.c*powers_of_ten[ua.e - ub.e] : ua.c;
+            cb = (ub.e > ua.e) ? ub.c*powers_of_ten[ub.e - ua.e] : ub.c;
+            c = (ca > cb) - (ca < cb);
+        }
+    }
+
+    return ua.neg ? -c : c;
+}
+
+
+decimal_t decimal_neg(decimal_format_t f, decimal_t a)
+{
+    if (f == DECIMAL64)
+        a.lo ^= BIT(63);
+    else
+        a.hi ^= BIT(63);
+    return a;
+}
+
+
+/* c*10^ec as a multiple of 10^(e - 1), where ec < e: the digits above 10^e,
+   and a last digit of 1 if any of the ones below were non-zero. */
+
+static u128 cut(u128 c, gint ec, gint e)
+{
+    gint k = e - ec;
+    u128 q;
+
+    if (k > MAX_POW10)
+        return c != 0;
+    q = c/powers_of_ten[k];
+    return 10*q + (q*powers_of_ten[k] != c);
+}
+
+
+static decimal_t add(decimal_format_t f, unpacked_t a, unpacked_t b)
+{
+    const format_t *fmt = &formats[f];
+    unpacked_t t;
+    gint adj_a, adj_b, floor, e, s;
+    u128 ca, cb, c;
+    gboolean neg;
+
+    if (a.kind == KIND_NAN || b.kind == KIND_NAN)
+        return special(f, FALSE, KIND_NAN);
+    if (a.kind == KIND_INF || b.kind == KIND_INF) {
+        if (a.kind == b.kind && a.neg != b.neg)
+            return special(f, FALSE, KIND_NAN);
+        return special(f, (a.kind == KIND_INF) ? a.neg : b.neg, KIND_INF);
+    }
+
+    // With zeros, the exponent still goes as close to the smaller one as
+    // the digits allow
+    if (a.c == 0 && b.c == 0)
+        return pack(f, a.neg && b.neg, 0, MIN(a.e, b.e));
+    if (a.c == 0) {
+        t = a;
+        a = b;
+        b = t;
+    }
+    if (b.c == 0) {
+        s = MIN(a.e - b.e, fmt->digits - n_digits(a.c));
+        if (s > 0) {
+            a.c *= powers_of_ten[s];
+            a.e -= s;
+        }
+        return pack(f, a.neg, a.c, a.e);
+    }
+
+    adj_a = a.e + n_digits(a.c) - 1;
+    adj_b = b.e + n_digits(b.c) - 1;
+    floor = MAX(adj_a, adj_b) - fmt->digits - 2;
+    e = MIN(a.e, b.e);
+    if (e >= floor) {
+        ca = a.c*powers_of_ten[a.e - e];
+        cb = b.c*powers_of_ten[b.e - e];
+    } else {
+        // Only the smaller one can be below 'floor'
+        e = floor - 1;
+        ca = (a.e < floor) ? cut(a.c, a.e, floor)
+                           : a.c*powers_of_ten[a.e - e];
+        cb = (b.e < floor) ? cut(b.c, b.e, floor)
+                           : b.c*powers_of_ten[b.e - e];
+    }
+
+    if (a.neg == b.neg) {
+        c = ca + cb;
+        neg = a.neg;
+    } else if (ca >= cb) {
+        c = ca - cb;
+        neg = a.neg;
+    } else {
+        c = cb - ca;
+        neg = b.neg;
+    }
+    if (c == 0)
+        neg = FALSE;
+
+    return round_pack(f, neg, c, e, FALSE);
+}
+
+
+/* The usual decimal64 sum, of two finite numbers with coefficients below
+   2^53 whose exact sum is below 2^53 too, so that nothing is rounded.
+   Returns FALSE for everything else. */
+
+static inline gboolean add64_exact(guint64 a, guint64 b, decimal_t *r)
+{
+    guint64 ca, cb, c, sign;
+    gint ea, eb, d;
+
+    // Infinities and NaNs have these bits set too
+    if ((a >> 61 & 3) == 3 || (b >> 61 & 3) == 3)
+        return FALSE;
+
+    ea = a >> 53 & 0x3ff;
+    eb = b >> 53 & 0x3ff;
+    ca = a & (BIT(53) - 1);
+    cb = b & (BIT(53) - 1);
+    d = ea - eb;
+    if (d < 0) {
+        if (d < -16 || (u128)cb*(guint64)powers_of_ten[-d] >= BIT(53))
+            return FALSE;
+        cb *= (guint64)powers_of_ten[-d];
+        eb = ea;
+    } else if (d > 0) {
+        if (d > 16 || (u128)ca*(guint64)powers_of_ten[d] >= BIT(53))
+            return FALSE;
+        ca *= (guint64)powers_of_ten[d];
+    }
+
+    if ((a ^ b) >> 63 == 0) {
+        c = ca + cb;
+        sign = a & BIT(63);
+    } else if (ca >= cb) {
+        c = ca - cb;
+        sign = (c != 0) ? a & BIT(63) : 0;
+    } else {
+        c = cb - ca;
+        sign = b & BIT(63);
+    }
+    if (c >= BIT(53))
+        return FALSE;
+
+    r->lo = sign | (guint64)eb << 53 | c;
+    r->hi = 0;
+    return TRUE;
+}
+
+
+decimal_t decimal_add(decimal_format_t f, decimal_t a, decimal_t b)
+{
+    decimal_t r;
+
+    if (f == DECIMAL64 && add64_exact(a.lo, b.lo, &r))
+        return r;
+    return add(f, unpack(f, a), unpack(f, b));
+}
+
+
+decimal_t decimal_sub(decimal_format_t f, decimal_t a, decimal_t b)
+{
+    unpacked_t ub;
+    decimal_t r;
+
+    if (f == DECIMAL64 && add64_exact(a.lo, b.lo ^ BIT(63), &r))
+        return r;
+    ub = unpack(f, b);
+    ub.neg = !ub.neg;
+    return add(f, unpack(f, a), ub);
+}
+
+
+/* w = a*b, least significant limb first. */
+
+static void mul_wide(u128 a, u128 b, guint64 w[4])
+{
+    guint64 a0 = a, a1 = a >> 64, b0 = b, b1 = b >> 64;
+    u128 p00 = (u128)a0*b0, p01 = (u128)a0*b1, p10 = (u128)a1*b0;
+    u128 p11 = (u128)a1*b1, mid, high;
+
+    mid = (p00 >> 64) + (guint64)p01 + (guint64)p10;
+    high = p11 + (p01 >> 64) + (p10 >> 64) + (mid >> 64);
+    w[0] = p00;
+    w[1] = mid;
+    w[2] = high;
+    w[3] = high >> 64;
+}
+
+
+/* w /= d, and return the remainder. */
+
+static guint64 div_wide(guint64 w[4], guint64 d)
+{
+    u128 r = 0;
+    gint i;
+
+    for (i = 3; i >= 0; i--) {
+        r = r << 64 | w[i];
+        w[i] = r/d;
+        r %= d;
+    }
+
+    return r;
+}
+
+
+decimal_t decimal_mul(decimal_format_t f, decimal_t a, decimal_t b)
+{
+    unpacked_t ua = unpack(f, a), ub = unpack(f, b);
+    gboolean neg = ua.neg != ub.neg, sticky = FALSE;
+    guint64 w[4];
+    gint bits, k;
+
+    if (ua.kind == KIND_NAN || ub.kind == KIND_NAN)
+        return special(f, FALSE, KIND_NAN);
+    if (ua.kind == KIND_INF || ub.kind == KIND_INF) {
+        if ((ua.kind == KIND_FINITE && ua.c == 0) ||
+            (ub.kind == KIND_FINITE && ub.c == 0))
+            return special(f, FALSE, KIND_NAN);
+        return special(f, neg, KIND_INF);
+    }
+
+    // Two decimal64 coefficients have at most 32 digits
+    if (f == DECIMAL64)
+        return round_pack(f, neg, ua.c*ub.c, ua.e + ub.e, FALSE);
+
+    mul_wide(ua.c, ub.c, w);
+    if (w[2] == 0 && w[3] == 0)
+        return round_pack(f, neg, (u128)w[1] << 64 | w[0], ua.e + ub.e,
+                          FALSE);
+
+    /* Keep between 36 and 37 digits: the product has at least the number
+       of digits of 2^(bits - 1). */
+    bits = w[3] ? 256 - __builtin_clzll(w[3]) : 192 - __builtin_clzll(w[2]);
+    k = ((bits - 1)*1233 >> 12) + 1 - (formats[f].digits + 2);
+    if (k > 19) {
+        sticky = div_wide(w, E19) != 0;
+        sticky |= div_wide(w, (guint64)powers_of_ten[k - 19]) != 0;
+    } else
+        sticky = div_wide(w, (guint64)powers_of_ten[k]) != 0;
+
+    return round_pack(f, neg, (u128)w[1] << 64 | w[0], ua.e + ub.e + k,
+                      sticky);
+}
+
+
+decimal_t decimal_div(decimal_format_t f, decimal_t a, decimal_t b)
+{
+    const format_t *fmt = &formats[f];
+    unpacked_t ua = unpack(f, a), ub = unpack(f, b);
+    gboolean neg = ua.neg != ub.neg;
+    gint db, s, j, e;
+    u128 q, r;
+
+    if (ua.kind == KIND_NAN || ub.kind == KIND_NAN)
+        return special(f, FALSE, KIND_NAN);
+    if (ua.kind == KIND_INF)
+        return special(f, neg, (ub.kind == KIND_INF) ? KIND_NAN : KIND_INF);
+    if (ub.kind == KIND_INF)
+        return pack(f, neg, 0, fmt->emin);
+    if (ub.c == 0)
+        return (ua.c == 0) ? special(f, FALSE, KIND_NAN)
+                           : special(f, neg, KIND_INF);
+    if (ua.c == 0)
+        return round_pack(f, neg, 0, ua.e - ub.e, FALSE);
+
+    /* q = a.c*10^s/b.c, with s such that q has more digits than the format,
+       a few digits at a time.  r*10^j must fit, where r < b.c. */
+    db = n_digits(ub.c);
+    s = fmt->digits + 1 + db - n_digits(ua.c);
+    e = ua.e - ub.e - s;
+    q = ua.c/ub.c;
+    r = ua.c%ub.c;
+    for (; s > 0; s -= j) {
+        j = MIN(s, MAX_POW10 - db);
+        r *= powers_of_ten[j];
+        q = q*powers_of_ten[j] + r/ub.c;
+        r %= ub.c;
+    }
+
+    // An exact quotient gets as close to the exponent a.e - b.e as it can
+    if (r == 0)
+        while (e < ua.e - ub.e && q%10 == 0) {
+            q /= 10;
+            e++;
+        }
+
+    return round_pack(f, neg, q, e, r != 0);
+}
+
+
+/* Is u an integer with |u| <= 10^9?  Then put it in *n. */
+
+static gboolean small_integer(const unpacked_t *u, gint64 *n)
+{
+    u128 c = u->c;
+
+    if (u->kind != KIND_FINITE)
+        return FALSE;
+    if (c != 0 && u->e > 0) {
+        if (n_digits(c) + u->e > 9)
+            return FALSE;
+        c *= powers_of_ten[u->e];
+    } else if (c != 0 && u->e < 0) {
+        if (-u->e > MAX_POW10 || c%powers_of_ten[-u->e] != 0)
+            return FALSE;
+        c /= powers_of_ten[-u->e];
+    }
+    if (c > 1000000000)
+        return FALSE;
+
+    *n = u->neg ? -(gint64)c : (gint64)c;
+    return TRUE;
+}
+
+
+decimal_t decimal_pow(decimal_format_t f, decimal_t a, decimal_t b)
+{
+    unpacked_t ub = unpack(f, b);
+    decimal_t r, one = decimal_from_int(f, 1);
+    gint64 n, m;
+
+    if (!small_integer(&ub, &n))
+        return decimal_from_double(f, pow(decimal_to_double(f, a),
+                                          decimal_to_double(f, b)));
+
+    r = one;
+    for (m = ABS(n); m > 0; m >>= 1) {
+        if (m & 1)
+            r = decimal_mul(f, r, a);
+        if (m > 1)
+            a = decimal_mul(f, a, a);
+    }
+
+    return (n < 0) ? decimal_div(f, one, r) : r;
+}
@@ -0,0 +1,77 @@
+/*
+ *  Copyright (C) 2010 Erik Edelmann <erik.edelmann@iki.fi>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __DECIMAL_H__
+#define __DECIMAL_H__
+
+#include <glib.h>
+
+/*
+ * IEEE 754-2008 decimal floating point, decimal64 (16 digits) and decimal128
+ * (34 digits), in the binary integer decimal (BID) encoding.  A value is a
+ * coefficient c < 10^16 or 10^34 times 10^e.  Different (c, e) can have the
+ * same value, like 1.5 and 1.50; the arithmetic keeps track of the exponent
+ * as IEEE says, so 1.10 + 2.20 is 3.30, and decimal_to_string() shows it that
+ * way.
+ *
+ * Addition, subtraction, multiplication, division and comparisons are exact
+ * when the result fits, and correctly rounded, half to even, otherwise.  Other
+ * operations go through double.  Every function takes the format of its
+ * arguments, which must all have that format.
+ */
+
+typedef enum { DECIMAL64, DECIMAL128 } decimal_format_t;
+
+// A decimal64 is in 'lo', with 'hi' zero
+typedef struct {
+    guint64 lo, hi;
+} decimal_t;
+
+// decimal_compare() of a NaN
+#define DECIMAL_UNORDERED 2
+
+decimal_t decimal_nan(decimal_format_t f);
+decimal_t decimal_from_int(decimal_format_t f, gint64 n);
+decimal_t decimal_from_double(decimal_format_t f, double x);
+decimal_t decimal_convert(decimal_format_t to, decimal_format_t from,
+                          decimal_t a);
+double decimal_to_double(decimal_format_t f, decimal_t a);
+
+/* Like parse_number() (see numparse.h), but rounded to f. */
+decimal_t decimal_from_string(decimal_format_t f, const char *s,
+                              const char **end);
+
+/* The digits of a, like "0.30", "-12" or "1.5e+40" (the scientific string of
+   the IEEE standard), or "inf" or "nan".  Free with g_free(). */
+gchar *decimal_to_string(decimal_format_t f, decimal_t a);
+
+gboolean decimal_is_nan(decimal_format_t f, decimal_t a);
+gboolean decimal_is_zero(decimal_format_t f, decimal_t a);
+gint decimal_compare(decimal_format_t f, decimal_t a, decimal_t b);
+
+decimal_t decimal_neg(decimal_format_t f, decimal_t a);
+decimal_t decimal_add(decimal_format_t f, decimal_t a, decimal_t b);
+decimal_t decimal_sub(decimal_format_t f, decimal_t a, decimal_t b);
+decimal_t decimal_mul(decimal_format_t f, decimal_t a, decimal_t b);
+decimal_t decimal_div(decimal_format_t f, decimal_t a, decimal_t b);
+
+/* For integer b up to 10^9 in magnitude, a is multiplied by itself, which is
+   exact as long as the result fits.  Through double otherwise. */
+decimal_t decimal_pow(decimal_format_t f, decimal_t a, decimal_t b);
+
+#endif
@@ -0,0 +1,409 @@
+/*
+ *  Copyright (C) 2010 Erik Edelmann <erik.edelmann@iki.fi>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/* Evaluation of scalar flattrees with another number type than double.  This
+   file is included by eval.c once for every type, with
+
+     T          the number type,
+     NAME(x)    the name 'x' gets for this type,
+     F(x)       the libm function 'x' for T, like sinf for float, and
+     LIT(x)     the literal 'x' as a T.
+
+   Numbers in the tree are doubles.  They are turned into T by way of the
+   shortest decimal that gives the same double, so 0.1 is the T closest to
+   0.1 (see shortest_decimal()), and pi is pi to the precision of T.  Values
+   of variables are taken as they are.  Sums and products are added up in order,
+   without compensation.  Integrals, solve and things with matrices or units
+   are computed in double. */
+
+#define PI LIT(3.14159265358979323846264338327950288)
+
+// NULL for the functions that are computed in double
+static T (*const NAME(functions)[])(T) = {
+#define FUNCTION(name, fun, deriv, vfun, angle, base) F(base),
+#define DOUBLE_FUNCTION(name, fun, deriv, vfun) NULL,
+#define FUNCTION2(name, fun2, deriv2) NULL,
+#include "function-list.h"
+#undef FUNCTION
+#undef DOUBLE_FUNCTION
+#undef FUNCTION2
+};
+
+
+static T NAME(from_double)(double x)
+{
+    guint64 m;
+    gint e;
+    T r;
+
+    if (sizeof(T) <= sizeof(double) || !shortest_decimal(fabs(x), &m, &e))
+        return x;
+
+    r = (e >= 0) ? (T)m*F(pow)(10, e) : (T)m/F(pow)(10, -e);
+    return (x < 0) ? -r : r;
+}
+
+
+static T *NAME(convert_nums)(const flattree_t *tree)
+{
+    T *nums;
+    guint32 i;
+
+    // pi is the only constant, see parser.c
+    nums = g_new(T, MAX(tree->n_nums, 1));
+    for (i = 0; i < tree->n_nums; i++)
+        nums[i] = (tree->nums[i] == G_PI) ? PI
+                                          : NAME(from_double)(tree->nums[i]);
+
+    return nums;
+}
+
+
+static T NAME(truth)(T x)
+{
+    return (x != x) ? NAN : (x != 0);
+}
+
+
+static T NAME(apply_operator)(operator_type_t op, T left, T right)
+{
+    switch (op) {
+    case OP_PLUS:
+        return left + right;
+    case OP_MINUS:
+        return left - right;
+    case OP_UMINUS:
+        return -right;
+    case OP_TIMES:
+    case OP_EMUL:
+        return left * right;
+    case OP_DIV:
+    case OP_EDIV:
+        return left / right;
+    case OP_POW:
+    case OP_EPOW:
+        return F(pow)(left, right);
+    case OP_LT:
+        return left < right;
+    case OP_LE:
+        return left <= right;
+    case OP_GT:
+        return left > right;
+    case OP_GE:
+        return left >= right;
+    case OP_EQ:
+        return left == right;
+    case OP_NE:
+        return left != right;
+    case OP_NOT:
+        return (right != right) ? NAN : (right == 0);
+    default:
+        g_assert_not_reached();
+    }
+
+    return NAN;
+}
+
+
+/* 'a' is the first argument of functions of two arguments. */
+
+static T NAME(apply_function)(gint fun, T a, T x)
+{
+    T y;
+
+    if (functions[fun].fun2)
+        return functions[fun].fun2(a, x);
+    if (!NAME(functions)[fun])
+        return functions[fun].fun(x);
+
+    if (trigonometrics_use_degrees && functions[fun].angle == ANGLE_ARGUMENT)
+        x = x/360*2*PI;
+    y = NAME(functions)[fun](x);
+    if (trigonometrics_use_degrees && functions[fun].angle == ANGLE_RESULT)
+        y = y/(2*PI)*360;
+
+    return y;
+}
+
+
+static T NAME(eval_poly)(const flattree_t *tree, const T *nums, node_id_t id,
+                         T x)
+{
+    const T *c = nums + tree->arg[id];
+    T p = c[1];
+    gint i, n = tree->nums[tree->arg[id]];
+
+    for (i = 2; i <= n + 1; i++) {
+        if (c[i] == 0)
+            p *= x;
+        else if (tree->fma)
+            p = F(fma)(p, x, c[i]);
+        else
+            p = p*x + c[i];
+    }
+
+    return p;
+}
+
+
+static T NAME(eval)(const flattree_t *tree, const T *nums, node_id_t id,
+                    T *vars)
+{
+    double dvars[MAX_VARS];
+    T left, right, r, k, n;
+    node_id_t branches, range;
+    gint s, slot;
+
+    switch (tree->type[id]) {
+
+    case NODE_NUMBER:
+        return nums[tree->arg[id]];
+
+    case NODE_VARIABLE:
+        return vars[tree->arg[id]];
+
+    case NODE_OPERATOR:
+
+        switch (tree->arg[id]) {
+        case OP_AND:
+            left = NAME(eval)(tree, nums, tree->left[id], vars);
+            if (left == 0 || left != left)
+                return NAME(truth)(left);
+            return NAME(truth)(NAME(eval)(tree, nums, tree->right[id], vars));
+        case OP_OR:
+            left = NAME(eval)(tree, nums, tree->left[id], vars);
+            if (left != 0)
+                return NAME(truth)(left);
+            return NAME(truth)(NAME(eval)(tree, nums, tree->right[id], vars));
+        case OP_COND:
+            branches = tree->right[id];
+            left = NAME(eval)(tree, nums, tree->left[id], vars);
+            if (left != left)
+                return NAN;
+            else if (left != 0)
+                return NAME(eval)(tree, nums, tree->left[branches], vars);
+            else
+                return NAME(eval)(tree, nums, tree->right[branches], vars);
+        case OP_UMINUS:
+        case OP_NOT:
+            right = NAME(eval)(tree, nums, tree->right[id], vars);
+            return NAME(apply_operator)(tree->arg[id], NAN, right);
+        default:
+            left = NAME(eval)(tree, nums, tree->left[id], vars);
+            right = NAME(eval)(tree, nums, tree->right[id], vars);
+            return NAME(apply_operator)(tree->arg[id], left, right);
+        }
+
+    case NODE_FUNCTION:
+        right = NAME(eval)(tree, nums, tree->right[id], vars);
+        left = (tree->left[id] != NO_NODE)
+            ? NAME(eval)(tree, nums, tree->left[id], vars) : 0;
+        return NAME(apply_function)(tree->arg[id], left, right);
+
+    case NODE_POLY:
+        right = NAME(eval)(tree, nums, tree->right[id], vars);
+        return NAME(eval_poly)(tree, nums, id, right);
+
+    case NODE_SUM:
+    case NODE_PROD:
+        range = tree->left[id];
+        left = NAME(eval)(tree, nums, tree->left[range], vars);
+        right = NAME(eval)(tree, nums, tree->right[range], vars);
+        if (left != left || right != right)
+            return NAN;
+        n = (right >= left) ? F(floor)(right - left) + 1 : 0;
+        if (n > MAX_TYPED_TERMS)
+            return NAN;
+
+        slot = tree->arg[id];
+        r = (tree->type[id] == NODE_SUM) ? 0 : 1;
+        for (k = 0; k < n; k++) {
+            vars[slot] = left + k;
+            if (tree->type[id] == NODE_SUM)
+                r += NAME(eval)(tree, nums, tree->right[id], vars);
+            else
+                r *= NAME(eval)(tree, nums, tree->right[id], vars);
+        }
+        return r;
+
+    default:
+        for (s = 0; s < tree->n_vars; s++)
+            dvars[s] = vars[s];
+        return eval_flat_number(tree, id, dvars);
+    }
+}
+
+
+/* Evaluate the subtree 'id' for n values x[] of vars[slot], like
+   eval_flat_columns(). */
+
+static void NAME(eval_batch)(const flattree_t *tree, const T *nums,
+                             node_id_t id, T *vars, gint slot, const T *x,
+                             T *y, int n)
+{
+    node_id_t first, i;
+    T *vals, *v, *l, *r;
+    gint fun;
+    int k;
+
+    if (!flattree_is_straight(tree, id)) {
+        for (k = 0; k < n; k++) {
+            vars[slot] = x[k];
+            y[k] = NAME(eval)(tree, nums, id, vars);
+        }
+        return;
+    }
+
+    first = flattree_first(tree, id);
+    vals = g_new(T, (gsize)(id - first + 1)*n);
+
+#define VALS(node) (vals + (gsize)((node) - first)*n)
+
+    for (i = first; i <= id; i++) {
+        v = VALS(i);
+        switch (tree->type[i]) {
+        case NODE_NUMBER:
+            for (k = 0; k < n; k++) v[k] = nums[tree->arg[i]];
+            break;
+        case NODE_VARIABLE:
+            if (tree->arg[i] == slot)
+                memcpy(v, x, n*sizeof(T));
+            else
+                for (k = 0; k < n; k++) v[k] = vars[tree->arg[i]];
+            break;
+        case NODE_OPERATOR:
+            l = (tree->left[i] != NO_NODE) ? VALS(tree->left[i]) : NULL;
+            r = VALS(tree->right[i]);
+            switch (tree->arg[i]) {
+            case OP_PLUS:
+                for (k = 0; k < n; k++) v[k] = l[k] + r[k];
+                break;
+            case OP_MINUS:
+                for (k = 0; k < n; k++) v[k] = l[k] - r[k];
+                break;
+            case OP_UMINUS:
+                for (k = 0; k < n; k++) v[k] = -r[k];
+                break;
+            case OP_TIMES:
+                for (k = 0; k < n; k++) v[k] = l[k] * r[k];
+                break;
+            case OP_DIV:
+                for (k = 0; k < n; k++) v[k] = l[k] / r[k];
+                break;
+            default:
+                for (k = 0; k < n; k++)
+                    v[k] = NAME(apply_operator)(tree->arg[i], l ? l[k] : NAN,
+                                                r[k]);
+            }
+            break;
+        case NODE_FUNCTION:
+            fun = tree->arg[i];
+            l = (tree->left[i] != NO_NODE) ? VALS(tree->left[i]) : NULL;
+            r = VALS(tree->right[i]);
+            if (functions[fun].angle == ANGLE_NONE && NAME(functions)[fun])
+                for (k = 0; k < n; k++) v[k] = NAME(functions)[fun](r[k]);
+            else
+                for (k = 0; k < n; k++)
+                    v[k] = NAME(apply_function)(fun, l ? l[k] : 0, r[k]);
+            break;
+        case NODE_POLY:
+            r = VALS(tree->right[i]);
+            for (k = 0; k < n; k++)
+                v[k] = NAME(eval_poly)(tree, nums, i, r[k]);
+            break;
+        default:
+            g_assert_not_reached();
+        }
+    }
+
+    memcpy(y, VALS(id), n*sizeof(T));
+
+#undef VALS
+
+    g_free(vals);
+}
+
+
+typedef struct {
+    const flattree_t *tree;
+    const T *nums;
+    const T *vars;
+    gint slot;
+    const double *x;
+    double *y;
+    gsize n;
+} NAME(batch_task_t);
+
+
+static void NAME(eval_batch_block)(guint i, gpointer data)
+{
+    NAME(batch_task_t) *task = data;
+    T vars[MAX_VARS], x[BATCH_BLOCK], y[BATCH_BLOCK];
+    gsize start = (gsize)i*BATCH_BLOCK;
+    int k, n = MIN(BATCH_BLOCK, task->n - start);
+
+    memcpy(vars, task->vars, sizeof(vars));
+    for (k = 0; k < n; k++)
+        x[k] = task->x[start + k];
+
+    NAME(eval_batch)(task->tree, task->nums, task->tree->root, vars,
+                     task->slot, x, y, n);
+
+    for (k = 0; k < n; k++)
+        task->y[start + k] = y[k];
+}
+
+
+static void NAME(eval_flattree_batch)(const flattree_t *tree, gint slot,
+                                      const double *x, double *y, gsize n)
+{
+    NAME(batch_task_t) task;
+    T vars[MAX_VARS] = { 0 }, *nums;
+
+    nums = NAME(convert_nums)(tree);
+
+    task.tree = tree;
+    task.nums = nums;
+    task.vars = vars;
+    task.slot = slot;
+    task.x = x;
+    task.y = y;
+    task.n = n;
+    parallel_for((n + BATCH_BLOCK - 1)/BATCH_BLOCK, NAME(eval_batch_block),
+                 &task);
+
+    g_free(nums);
+}
+
+
+static T NAME(eval_flattree)(const flattree_t *tree, const double *values)
+{
+    T vars[MAX_VARS], *nums, r;
+    gint s;
+
+    for (s = 0; s < tree->n_vars; s++)
+        vars[s] = values ? values[s] : 0;
+
+    nums = NAME(convert_nums)(tree);
+    r = NAME(eval)(tree, nums, tree->root, vars);
+    g_free(nums);
+
+    return r;
+}
+
+#undef PI
@@ -15,13 +15,40 @@
  *  along with this program; if not, write to the Free Software
  *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
  */
+#ifdef HAVE_CONFIG_H
+#   include <config.h>
+#endif
+
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
 #include <glib.h>
+#ifdef HAVE_QUADMATH
+#include <quadmath.h>
+#endif
 #include "parsetree.h"
+#include "flattree.h"
+#include "functions.h"
 #include "constants.h"
 #include "eval.h"
+#include "stats.h"
+#include "reduce.h"
+#include "quad.h"
+#include "solve.h"
+#include "parallel.h"
+#include "matrix.h"
+#include "vmath.h"
+#include "adaptive.h"
+#include "parser.h"
+#include "profile.h"
+#include "numparse.h"
+#include "decimal.h"
+
+#define BATCH_BLOCK 256
+
+// Expressions with more nodes than this are split, see eval_flat_split()
+#define SPLIT_MIN_NODES 16384
+#define SPLIT_GRAIN 4096
 
 static gboolean trigonometrics_use_degrees;
 
@@ -45,6 +72,34 @@ double my_tan(double x)
     return tan(x);
 }
 
+/* The same for arrays of arguments. */
+
+static const double *radians(const double *x, double *y, gsize n)
+{
+    gsize i;
+
+    if (!trigonometrics_use_degrees)
+        return x;
+
+    for (i = 0; i < n; i++) y[i] = x[i]/360*2*G_PI;
+    return y;
+}
+
+void my_vsin(const double *x, double *y, gsize n)
+{
+    vmath_sin(radians(x, y, n), y, n);
+}
+
+void my_vcos(const double *x, double *y, gsize n)
+{
+    vmath_cos(radians(x, y, n), y, n);
+}
+
+void my_vtan(const double *x, double *y, gsize n)
+{
+    vmath_tan(radians(x, y, n), y, n);
+}
+
 double my_asin(double x)
 {
     double y = asin(x);
@@ -67,9 +122,134 @@ double my_atan(double x)
 }
 
 
-static double eval(node_t *parsetree)
+/* Derivatives of the above. */
+
+static double angle_unit(void)
+{
+    return trigonometrics_use_degrees ? 2*G_PI/360 : 1.0;
+}
+
+double my_dsin(double x)
+{
+    return angle_unit()*my_cos(x);
+}
+
+double my_dcos(double x)
+{
+    return -angle_unit()*my_sin(x);
+}
+
+double my_dtan(double x)
+{
+    double c = my_cos(x);
+    return angle_unit()/(c*c);
+}
+
+double my_dasin(double x)
+{
+    return 1.0/(angle_unit()*sqrt(1 - x*x));
+}
+
+double my_dacos(double x)
+{
+    return -1.0/(angle_unit()*sqrt(1 - x*x));
+}
+
+double my_datan(double x)
+{
+    return 1.0/(angle_unit()*(1 + x*x));
+}
+
+
+/* Return 1.0 if 'x' is true (non-zero), 0.0 if false, and NaN if 'x' is NaN. */
+
+static double truth(double x)
+{
+    return isnan(x) ? NAN : (x != 0.0);
+}
+
+
+/* Apply an operator that needs the values of both operands.  Unary operators
+   ignore 'left'.  OP_AND, OP_OR and OP_COND must not evaluate all their
+   operands, so they are handled by the evaluators. */
+
+static double apply_operator(operator_type_t op, double left, double right)
+{
+    switch (op) {
+    case OP_PLUS:
+        return left + right;
+    case OP_MINUS:
+        return left - right;
+    case OP_UMINUS:
+        return -right;
+    case OP_TIMES:
+    case OP_EMUL:
+        return left * right;
+    case OP_DIV:
+    case OP_EDIV:
+        return left / right;
+    case OP_POW:
+    case OP_EPOW:
+        return pow(left, right);
+    case OP_LT:
+        return left < right;
+    case OP_LE:
+        return left <= right;
+    case OP_GT:
+        return left > right;
+    case OP_GE:
+        return left >= right;
+    case OP_EQ:
+        return left == right;
+    case OP_NE:
+        return left != right;
+    case OP_NOT:
+        return isnan(right) ? NAN : (right == 0.0);
+    default:
+        g_assert_not_reached();
+    }
+
+    return NAN;
+}
+
+
+typedef struct {
+    const flattree_t *tree;
+    node_id_t id;
+} flat_body_t;
+
+
+static double eval(node_t *parsetree, double *vars);
+static double eval_flat_dual_body(gconstpointer body, double *vars, gint slot,
+                                  double x, double *dy);
+static double eval_flat_number(const flattree_t *tree, node_id_t id,
+                               double *vars);
+
+
+static double eval_body(gconstpointer body, double *vars)
+{
+    return eval((node_t *)body, vars);
+}
+
+
+static void eval_batch(gconstpointer body, double *vars, gint slot,
+                       const double *x, double *y, int n)
 {
-    double left, right, r, arg;
+    int i;
+
+    for (i = 0; i < n; i++) {
+        vars[slot] = x[i];
+        y[i] = eval((node_t *)body, vars);
+    }
+}
+
+
+static double eval(node_t *parsetree, double *vars)
+{
+    double left, right, r, arg, tol, err;
+    node_t *args;
+    flattree_t *flat;
+    flat_body_t body;
 
     if (!parsetree)
         return NAN;
@@ -82,42 +262,113 @@ static double eval(node_t *parsetree)
 
     case NODE_OPERATOR:
 
-        left = eval(parsetree->left);
-        right = eval(parsetree->right);
-
         switch (parsetree->val.op) {
-        case OP_PLUS:
-            r = left + right;
+        case OP_AND:
+            left = eval(parsetree->left, vars);
+            if (left == 0.0 || isnan(left))
+                r = truth(left);
+            else
+                r = truth(eval(parsetree->right, vars));
             break;
-        case OP_MINUS:
-            r = left - right;
-            break;
-        case OP_UMINUS:
-            g_assert(isnan(left));
-            r = -right;
-            break;
-        case OP_TIMES:
-            r = left * right;
+        case OP_OR:
+            left = eval(parsetree->left, vars);
+            if (left != 0.0)
+                r = truth(left);
+            else
+                r = truth(eval(parsetree->right, vars));
             break;
-        case OP_DIV:
-            r = left / right;
+        case OP_COND:
+            g_assert(parsetree->right->val.op == OP_BRANCHES);
+            left = eval(parsetree->left, vars);
+            if (isnan(left))
+                r = NAN;
+            else if (left != 0.0)
+                r = eval(parsetree->right->left, vars);
+            else
+                r = eval(parsetree->right->right, vars);
             break;
-        case OP_POW:
-            r = pow(left, right);
+        case OP_UMINUS:
+            g_assert(parsetree->left == NULL);
+            r = -eval(parsetree->right, vars);
             break;
         default:
-            g_assert_not_reached();
+            left = eval(parsetree->left, vars);
+            right = eval(parsetree->right, vars);
+            r = apply_operator(parsetree->val.op, left, right);
         }
         break;
 
     case NODE_FUNCTION:
         g_assert(parsetree->right);
-        g_assert(parsetree->left == NULL);
 
-        arg = eval(parsetree->right);
-        r = parsetree->val.fun(arg);
+        arg = eval(parsetree->right, vars);
+        if (parsetree->left)
+            r = parsetree->val.fun2(eval(parsetree->left, vars), arg);
+        else
+            r = parsetree->val.fun(arg);
+        break;
+
+    case NODE_VARIABLE:
+        r = vars[parsetree->val.var];
+        break;
+
+    case NODE_SUM:
+    case NODE_PROD:
+        g_assert(parsetree->left->val.op == OP_RANGE);
+
+        left = eval(parsetree->left->left, vars);
+        right = eval(parsetree->left->right, vars);
+        if (parsetree->type == NODE_SUM)
+            r = reduce_sum(eval_body, parsetree->right, vars,
+                           parsetree->val.var, left, right);
+        else
+            r = reduce_prod(eval_body, parsetree->right, vars,
+                            parsetree->val.var, left, right);
+        break;
+
+    case NODE_INTEGRAL:
+    case NODE_INTEGRAL_ERR:
+        args = parsetree->right;
+        g_assert(args->val.op == OP_ARGS && args->left->val.op == OP_RANGE);
+
+        left = eval(args->left->left, vars);
+        right = eval(args->left->right, vars);
+        tol = eval(args->right, vars);
+        r = quad_integrate(eval_batch, parsetree->left, vars,
+                           parsetree->val.var, left, right, tol, &err);
+        if (parsetree->type == NODE_INTEGRAL_ERR)
+            r = err;
+        break;
+
+    case NODE_SOLVE:
+        g_assert(parsetree->right->val.op == OP_RANGE);
+
+        // The solver needs derivatives, which only the flattree evaluator has
+        left = eval(parsetree->right->left, vars);
+        right = eval(parsetree->right->right, vars);
+        flat = flatten_parsetree(parsetree->left);
+        body.tree = flat;
+        body.id = flat->root;
+        r = solve_root(eval_flat_dual_body, &body, vars, parsetree->val.var,
+                       left, right);
+        free_flattree(flat);
+        break;
+
+    case NODE_UNIT:
+        r = units[parsetree->val.unit].factor;
+        break;
+
+    case NODE_CONVERT:
+        r = eval(parsetree->left, vars)/eval(parsetree->right, vars);
         break;
-        
+
+    case NODE_MATRIX:
+    case NODE_MATFUN:
+        flat = flatten_parsetree(parsetree);
+        r = eval_flat_number(flat, flat->root, vars);
+        free_flattree(flat);
+        break;
+
     default:
         g_assert_not_reached();
     }
@@ -128,7 +379,2133 @@ static double eval(node_t *parsetree)
 
 double eval_parse_tree(node_t *parsetree, gboolean use_degrees)
 {
+    double vars[MAX_VARS];
+    gint64 start;
+    double r;
+
     trigonometrics_use_degrees = use_degrees;
 
-    return eval(parsetree);
+    start = stats_start();
+    r = eval(parsetree, vars);
+    stats_record_time(STAT_EVAL, start);
+    stats_count_result(r);
+
+    return r;
+}
+
+
+static double eval_flat(const flattree_t *tree, node_id_t id, double *vars);
+static rational_t eval_flat_rational(const flattree_t *tree, node_id_t id,
+                                     rational_t *vars);
+
+
+static double eval_flat_body(gconstpointer body, double *vars)
+{
+    const flat_body_t *b = body;
+
+    return eval_flat_number(b->tree, b->id, vars);
+}
+
+
+/* The NODE_POLY 'id' at x, by Horner's rule, and its derivative in '*d' if
+   'd' isn't NULL. */
+
+static double eval_poly(const flattree_t *tree, node_id_t id, double x,
+                        double *d)
+{
+    const double *c = tree->nums + tree->arg[id];
+    double p = c[1], dp = 0.0;
+    gint i, n = c[0];
+
+    for (i = 2; i <= n + 1; i++) {
+        if (d)
+            dp = tree->fma ? fma(dp, x, p) : dp*x + p;
+        if (c[i] == 0.0)
+            p *= x;
+        else if (tree->fma)
+            p = fma(p, x, c[i]);
+        else
+            p = p*x + c[i];
+    }
+    if (d)
+        *d = dp;
+
+    return p;
+}
+
+
+/* Like apply_operator(), but for arrays of n operands.  'left' is NULL for
+   unary operators. */
+
+static void apply_operator_batch(operator_type_t op, const double *left,
+                                 const double *right, double *y, int n)
+{
+    int i;
+
+    switch (op) {
+    case OP_PLUS:
+        for (i = 0; i < n; i++) y[i] = left[i] + right[i];
+        break;
+    case OP_MINUS:
+        for (i = 0; i < n; i++) y[i] = left[i] - right[i];
+        break;
+    case OP_UMINUS:
+        for (i = 0; i < n; i++) y[i] = -right[i];
+        break;
+    case OP_TIMES:
+        for (i = 0; i < n; i++) y[i] = left[i] * right[i];
+        break;
+    case OP_DIV:
+        for (i = 0; i < n; i++) y[i] = left[i] / right[i];
+        break;
+    default:
+        for (i = 0; i < n; i++)
+            y[i] = apply_operator(op, left ? left[i] : NAN, right[i]);
+    }
+}
+
+
+/* y[i] = fun(x[i]) for the function with index 'fun' in functions[], or
+   fun(a[i], x[i]) if it takes two arguments. */
+
+static void apply_function_batch(gint fun, const double *a, const double *x,
+                                 double *y, gsize n)
+{
+    gsize i;
+
+    if (a)
+        for (i = 0; i < n; i++) y[i] = functions[fun].fun2(a[i], x[i]);
+    else if (functions[fun].vfun)
+        functions[fun].vfun(x, y, n);
+    else
+        for (i = 0; i < n; i++) y[i] = functions[fun].fun(x[i]);
+}
+
+
+/* eval_poly() for n values x[]. */
+
+static void eval_poly_batch(const flattree_t *tree, node_id_t id,
+                            const double *x, double *y, int n)
+{
+    const double *c = tree->nums + tree->arg[id];
+    gint i, deg = c[0];
+    int k;
+
+    for (k = 0; k < n; k++) y[k] = c[1];
+    for (i = 2; i <= deg + 1; i++) {
+        if (c[i] == 0.0)
+            for (k = 0; k < n; k++) y[k] *= x[k];
+        else if (tree->fma)
+            for (k = 0; k < n; k++) y[k] = fma(y[k], x[k], c[i]);
+        else
+            for (k = 0; k < n; k++) y[k] = y[k]*x[k] + c[i];
+    }
+}
+
+
+/* Evaluate the subtree 'id' for n rows of variable values, and put the
+   results in y[].  cols[s] holds the n values of vars[s], or is NULL if
+   vars[s] is the same for all rows.  A straight subtree is evaluated in one
+   bottom-up sweep, with a whole array of values per node.  Others are
+   evaluated row by row. */
+
+static void eval_flat_columns(const flattree_t *tree, node_id_t id,
+                              double *vars, const double * const *cols,
+                              double *y, int n)
+{
+    node_id_t first, i;
+    double *vals, *v, *left;
+    gint s;
+    int k;
+
+    if (!flattree_is_straight(tree, id)) {
+        for (k = 0; k < n; k++) {
+            for (s = 0; s < tree->n_vars; s++)
+                if (cols[s]) vars[s] = cols[s][k];
+            y[k] = eval_flat_number(tree, id, vars);
+        }
+        return;
+    }
+
+    first = flattree_first(tree, id);
+    vals = g_new(double, (gsize)(id - first + 1)*n);
+
+#define VALS(node) (vals + (gsize)((node) - first)*n)
+
+    for (i = first; i <= id; i++) {
+        v = VALS(i);
+        switch (tree->type[i]) {
+        case NODE_NUMBER:
+            for (k = 0; k < n; k++) v[k] = tree->nums[tree->arg[i]];
+            break;
+        case NODE_VARIABLE:
+            if (cols[tree->arg[i]])
+                memcpy(v, cols[tree->arg[i]], n*sizeof(double));
+            else
+                for (k = 0; k < n; k++) v[k] = vars[tree->arg[i]];
+            break;
+        case NODE_OPERATOR:
+            left = (tree->left[i] != NO_NODE) ? VALS(tree->left[i]) : NULL;
+            apply_operator_batch(tree->arg[i], left, VALS(tree->right[i]), v, n);
+            break;
+        case NODE_FUNCTION:
+            left = (tree->left[i] != NO_NODE) ? VALS(tree->left[i]) : NULL;
+            apply_function_batch(tree->arg[i], left, VALS(tree->right[i]), v, n);
+            break;
+        case NODE_POLY:
+            eval_poly_batch(tree, i, VALS(tree->right[i]), v, n);
+            break;
+        default:
+            g_assert_not_reached();
+        }
+    }
+
+    memcpy(y, VALS(id), n*sizeof(double));
+
+#undef VALS
+
+    g_free(vals);
+}
+
+
+/* The same, for n values x[] of vars[slot]. */
+
+static void eval_flat_batch(const flattree_t *tree, node_id_t id, double *vars,
+                            gint slot, const double *x, double *y, int n)
+{
+    const double *cols[MAX_VARS] = { NULL };
+
+    cols[slot] = x;
+    eval_flat_columns(tree, id, vars, cols, y, n);
+}
+
+
+static void eval_flat_batch_body(gconstpointer body, double *vars, gint slot,
+                                 const double *x, double *y, int n)
+{
+    const flat_body_t *b = body;
+
+    eval_flat_batch(b->tree, b->id, vars, slot, x, y, n);
+}
+
+
+/* Evaluate the subtree 'id' like eval_flat(), and put its derivative with
+   respect to vars[slot] in '*d'.  The derivative is NaN where it isn't known,
+   e.g. for functions without a 'deriv' or inside sums and integrals. */
+
+static double eval_flat_dual(const flattree_t *tree, node_id_t id,
+                             double *vars, gint slot, double *d)
+{
+    double left, right, dl, dr, r, cond;
+    node_id_t branches;
+
+    switch (tree->type[id]) {
+
+    case NODE_NUMBER:
+        *d = 0.0;
+        return tree->nums[tree->arg[id]];
+
+    case NODE_VARIABLE:
+        *d = (tree->arg[id] == slot) ? 1.0 : 0.0;
+        return vars[tree->arg[id]];
+
+    case NODE_OPERATOR:
+
+        switch (tree->arg[id]) {
+        case OP_COND:
+            branches = tree->right[id];
+            cond = eval_flat(tree, tree->left[id], vars);
+            if (isnan(cond)) {
+                *d = NAN;
+                return NAN;
+            } else if (cond != 0.0)
+                return eval_flat_dual(tree, tree->left[branches], vars, slot, d);
+            else
+                return eval_flat_dual(tree, tree->right[branches], vars, slot, d);
+        case OP_UMINUS:
+            r = eval_flat_dual(tree, tree->right[id], vars, slot, &dr);
+            *d = -dr;
+            return -r;
+        case OP_PLUS:
+        case OP_MINUS:
+        case OP_TIMES:
+        case OP_DIV:
+        case OP_POW:
+        case OP_EMUL:
+        case OP_EDIV:
+        case OP_EPOW:
+            left = eval_flat_dual(tree, tree->left[id], vars, slot, &dl);
+            right = eval_flat_dual(tree, tree->right[id], vars, slot, &dr);
+            r = apply_operator(tree->arg[id], left, right);
+            switch (tree->arg[id]) {
+            case OP_PLUS:
+                *d = dl + dr;
+                break;
+            case OP_MINUS:
+                *d = dl - dr;
+                break;
+            case OP_TIMES:
+            case OP_EMUL:
+                *d = dl*right + left*dr;
+                break;
+            case OP_DIV:
+            case OP_EDIV:
+                *d = (dl*right - left*dr)/(right*right);
+                break;
+            default:
+                if (dr == 0.0)
+                    *d = (dl == 0.0) ? 0.0 : right*pow(left, right - 1)*dl;
+                else
+                    *d = r*(dr*log(left) + right*dl/left);
+            }
+            return r;
+        default:
+            // Comparisons and logical operators are piecewise constant
+            *d = 0.0;
+            return eval_flat(tree, id, vars);
+        }
+
+    case NODE_FUNCTION:
+        right = eval_flat_dual(tree, tree->right[id], vars, slot, &dr);
+        if (tree->left[id] != NO_NODE) {
+            // Only the derivative in the second argument is known
+            left = eval_flat_dual(tree, tree->left[id], vars, slot, &dl);
+            if (dl != 0.0)
+                *d = NAN;
+            else if (dr == 0.0)
+                *d = 0.0;
+            else if (functions[tree->arg[id]].deriv2)
+                *d = functions[tree->arg[id]].deriv2(left, right)*dr;
+            else
+                *d = NAN;
+            return functions[tree->arg[id]].fun2(left, right);
+        }
+        if (dr == 0.0)
+            *d = 0.0;
+        else if (functions[tree->arg[id]].deriv)
+            *d = functions[tree->arg[id]].deriv(right)*dr;
+        else
+            *d = NAN;
+        return functions[tree->arg[id]].fun(right);
+
+    case NODE_POLY:
+        right = eval_flat_dual(tree, tree->right[id], vars, slot, &dr);
+        r = eval_poly(tree, id, right, &dl);
+        *d = dl*dr;
+        return r;
+
+    default:
+        *d = NAN;
+        return eval_flat(tree, id, vars);
+    }
+}
+
+
+static double eval_flat_dual_body(gconstpointer body, double *vars, gint slot,
+                                  double x, double *dy)
+{
+    const flat_body_t *b = body;
+
+    vars[slot] = x;
+    if (!flattree_is_scalar(b->tree)) {
+        *dy = NAN;
+        return eval_flat_number(b->tree, b->id, vars);
+    }
+    return eval_flat_dual(b->tree, b->id, vars, slot, dy);
+}
+
+
+static double eval_flat_node(const flattree_t *tree, node_id_t id,
+                             double *vars)
+{
+    double left, right, tol, err, r;
+    node_id_t branches, range, args;
+    flat_body_t body;
+
+    switch (tree->type[id]) {
+
+    case NODE_NUMBER:
+        return tree->nums[tree->arg[id]];
+
+    case NODE_OPERATOR:
+
+        switch (tree->arg[id]) {
+        case OP_AND:
+            left = eval_flat(tree, tree->left[id], vars);
+            if (left == 0.0 || isnan(left))
+                return truth(left);
+            return truth(eval_flat(tree, tree->right[id], vars));
+        case OP_OR:
+            left = eval_flat(tree, tree->left[id], vars);
+            if (left != 0.0)
+                return truth(left);
+            return truth(eval_flat(tree, tree->right[id], vars));
+        case OP_COND:
+            branches = tree->right[id];
+            g_assert(tree->arg[branches] == OP_BRANCHES);
+            left = eval_flat(tree, tree->left[id], vars);
+            if (isnan(left))
+                return NAN;
+            else if (left != 0.0)
+                return eval_flat(tree, tree->left[branches], vars);
+            else
+                return eval_flat(tree, tree->right[branches], vars);
+        case OP_UMINUS:
+        case OP_NOT:
+            g_assert(tree->left[id] == NO_NODE);
+            right = eval_flat(tree, tree->right[id], vars);
+            return apply_operator(tree->arg[id], NAN, right);
+        default:
+            left = eval_flat(tree, tree->left[id], vars);
+            right = eval_flat(tree, tree->right[id], vars);
+            return apply_operator(tree->arg[id], left, right);
+        }
+        break;
+
+    case NODE_FUNCTION:
+        g_assert(tree->right[id] != NO_NODE);
+
+        right = eval_flat(tree, tree->right[id], vars);
+        if (tree->left[id] != NO_NODE)
+            return functions[tree->arg[id]].fun2(
+                       eval_flat(tree, tree->left[id], vars), right);
+        return functions[tree->arg[id]].fun(right);
+
+    case NODE_VARIABLE:
+        return vars[tree->arg[id]];
+
+    case NODE_POLY:
+        right = eval_flat(tree, tree->right[id], vars);
+        return eval_poly(tree, id, right, NULL);
+
+    case NODE_SUM:
+    case NODE_PROD:
+        range = tree->left[id];
+        g_assert(tree->arg[range] == OP_RANGE);
+
+        left = eval_flat(tree, tree->left[range], vars);
+        right = eval_flat(tree, tree->right[range], vars);
+        body.tree = tree;
+        body.id = tree->right[id];
+        if (tree->type[id] == NODE_SUM)
+            return reduce_sum(eval_flat_body, &body, vars, tree->arg[id],
+                              left, right);
+        else
+            return reduce_prod(eval_flat_body, &body, vars, tree->arg[id],
+                               left, right);
+
+    case NODE_INTEGRAL:
+    case NODE_INTEGRAL_ERR:
+        args = tree->right[id];
+        range = tree->left[args];
+        g_assert(tree->arg[args] == OP_ARGS && tree->arg[range] == OP_RANGE);
+
+        left = eval_flat(tree, tree->left[range], vars);
+        right = eval_flat(tree, tree->right[range], vars);
+        tol = eval_flat(tree, tree->right[args], vars);
+        body.tree = tree;
+        body.id = tree->left[id];
+        r = quad_integrate(eval_flat_batch_body, &body, vars, tree->arg[id],
+                           left, right, tol, &err);
+        return (tree->type[id] == NODE_INTEGRAL) ? r : err;
+
+    case NODE_SOLVE:
+        range = tree->right[id];
+        g_assert(tree->arg[range] == OP_RANGE);
+
+        left = eval_flat(tree, tree->left[range], vars);
+        right = eval_flat(tree, tree->right[range], vars);
+        body.tree = tree;
+        body.id = tree->left[id];
+        return solve_root(eval_flat_dual_body, &body, vars, tree->arg[id],
+                          left, right);
+
+    case NODE_MATRIX:
+    case NODE_MATFUN:
+    case NODE_UNIT:
+    case NODE_CONVERT:
+        return eval_flat_number(tree, id, vars);
+
+    default:
+        g_assert_not_reached();
+    }
+
+    return NAN;
+}
+
+
+/* Set while eval_flattree_profile() runs.  Other trees, which other threads
+   may be evaluating meanwhile, aren't profiled. */
+static profile_t *profile = NULL;
+
+static double eval_flat_profiled(const flattree_t *tree, node_id_t id,
+                                 double *vars)
+{
+    gint64 start;
+    double r;
+
+    start = stats_now();
+    r = eval_flat_node(tree, id, vars);
+    profile->total_ns[id] += stats_now() - start;
+    profile->count[id]++;
+
+    return r;
+}
+
+
+static double eval_flat(const flattree_t *tree, node_id_t id, double *vars)
+{
+    if (G_UNLIKELY(profile != NULL) && profile->tree == tree)
+        return eval_flat_profiled(tree, id, vars);
+    return eval_flat_node(tree, id, vars);
+}
+
+
+/* Exact evaluation, see rational.h.  Sums and products with more terms than
+   this are done in double. */
+#define MAX_EXACT_TERMS 100000
+
+
+/* The subtree 'id' evaluated with eval_flat(), for when it can't be exact. */
+
+static rational_t eval_flat_inexact(const flattree_t *tree, node_id_t id,
+                                    const rational_t *vars)
+{
+    double dvars[MAX_VARS];
+    gint i;
+
+    for (i = 0; i < MAX_VARS; i++)
+        dvars[i] = rational_to_double(&vars[i]);
+    return rational_inexact(eval_flat(tree, id, dvars));
+}
+
+
+/* Like truth(), but -1 for NaN. */
+
+static gint rational_truth(const rational_t *a)
+{
+    if (rational_is_exact(a))
+        return rational_sign(a) != 0;
+    return isnan(a->x) ? -1 : (a->x != 0.0);
+}
+
+
+static rational_t truth_value(gint t)
+{
+    return (t < 0) ? rational_inexact(NAN) : rational_from_int(t);
+}
+
+
+static rational_t apply_rational_operator(operator_type_t op,
+                                          const rational_t *a,
+                                          const rational_t *b)
+{
+    gint c;
+
+    switch (op) {
+    case OP_PLUS:
+        return rational_add(a, b);
+    case OP_MINUS:
+        return rational_sub(a, b);
+    case OP_UMINUS:
+        return rational_neg(b);
+    case OP_TIMES:
+    case OP_EMUL:
+        return rational_mul(a, b);
+    case OP_DIV:
+    case OP_EDIV:
+        return rational_div(a, b);
+    case OP_POW:
+    case OP_EPOW:
+        return rational_pow(a, b);
+    case OP_NOT:
+        return truth_value((rational_truth(b) < 0) ? -1 : !rational_truth(b));
+    default:
+        break;
+    }
+
+    // Comparisons
+    if (!rational_is_exact(a) || !rational_is_exact(b))
+        return rational_inexact(apply_operator(op, rational_to_double(a),
+                                               rational_to_double(b)));
+    c = rational_compare(a, b);
+    switch (op) {
+    case OP_LT:
+        return rational_from_int(c < 0);
+    case OP_LE:
+        return rational_from_int(c <= 0);
+    case OP_GT:
+        return rational_from_int(c > 0);
+    case OP_GE:
+        return rational_from_int(c >= 0);
+    case OP_EQ:
+        return rational_from_int(c == 0);
+    case OP_NE:
+        return rational_from_int(c != 0);
+    default:
+        g_assert_not_reached();
+    }
+
+    return rational_inexact(NAN);
+}
+
+
+/* A sum or product, term by term.  Falls back to eval_flat(), with its
+   compensated and parallel reduction, as soon as a term isn't exact. */
+
+static rational_t eval_flat_reduction(const flattree_t *tree, node_id_t id,
+                                      rational_t *vars)
+{
+    rational_t lower, upper, n, acc, term, t, one = rational_from_int(1);
+    node_id_t range = tree->left[id];
+    gint slot = tree->arg[id];
+    gboolean exact;
+
+    lower = eval_flat_rational(tree, tree->left[range], vars);
+    upper = eval_flat_rational(tree, tree->right[range], vars);
+    n = rational_sub(&upper, &lower);
+    exact = rational_is_exact(&n) && rational_to_double(&n) < MAX_EXACT_TERMS;
+    rational_clear(&n);
+
+    acc = rational_from_int(tree->type[id] == NODE_PROD);
+    while (exact && rational_compare(&lower, &upper) <= 0) {
+        rational_clear(&vars[slot]);
+        vars[slot] = rational_copy(&lower);
+        term = eval_flat_rational(tree, tree->right[id], vars);
+        t = (tree->type[id] == NODE_SUM) ? rational_add(&acc, &term)
+                                         : rational_mul(&acc, &term);
+        rational_clear(&acc);
+        rational_clear(&term);
+        acc = t;
+        exact = rational_is_exact(&acc);
+
+        t = rational_add(&lower, &one);
+        rational_clear(&lower);
+        lower = t;
+    }
+    rational_clear(&lower);
+    rational_clear(&upper);
+
+    if (!exact) {
+        rational_clear(&acc);
+        acc = eval_flat_inexact(tree, id, vars);
+    }
+    return acc;
+}
+
+
+/* Evaluate the subtree 'id' exactly where possible.  vars[] holds the values
+   of the variables, and is used for bound variables too. */
+
+static rational_t eval_flat_rational(const flattree_t *tree, node_id_t id,
+                                     rational_t *vars)
+{
+    rational_t a, b, r;
+    node_id_t branches;
+    guint32 lit;
+    gint t;
+
+    switch (tree->type[id]) {
+
+    case NODE_NUMBER:
+        // Literals are taken as written, not as their double
+        lit = tree->lits ? tree->lits[tree->arg[id]] : NO_LITERAL;
+        if (lit == NAMED_CONSTANT)
+            return rational_inexact(tree->nums[tree->arg[id]]);
+        else if (lit != NO_LITERAL)
+            return rational_from_string(tree->source + lit);
+        return rational_from_double(tree->nums[tree->arg[id]]);
+
+    case NODE_VARIABLE:
+        return rational_copy(&vars[tree->arg[id]]);
+
+    case NODE_OPERATOR:
+
+        switch (tree->arg[id]) {
+        case OP_AND:
+        case OP_OR:
+            a = eval_flat_rational(tree, tree->left[id], vars);
+            t = rational_truth(&a);
+            rational_clear(&a);
+            // Short circuit: false AND x, true OR x
+            if (t < 0 || (tree->arg[id] == OP_AND) != (t != 0))
+                return truth_value(t);
+            a = eval_flat_rational(tree, tree->right[id], vars);
+            t = rational_truth(&a);
+            rational_clear(&a);
+            return truth_value(t);
+        case OP_COND:
+            branches = tree->right[id];
+            a = eval_flat_rational(tree, tree->left[id], vars);
+            t = rational_truth(&a);
+            rational_clear(&a);
+            if (t < 0)
+                return rational_inexact(NAN);
+            return eval_flat_rational(tree, t ? tree->left[branches]
+                                              : tree->right[branches], vars);
+        default:
+            a = (tree->left[id] != NO_NODE) ?
+                eval_flat_rational(tree, tree->left[id], vars) :
+                rational_from_int(0);
+            b = eval_flat_rational(tree, tree->right[id], vars);
+            r = apply_rational_operator(tree->arg[id], &a, &b);
+            rational_clear(&a);
+            rational_clear(&b);
+            return r;
+        }
+
+    case NODE_FUNCTION:
+        a = eval_flat_rational(tree, tree->right[id], vars);
+        if (tree->left[id] != NO_NODE) {
+            b = eval_flat_rational(tree, tree->left[id], vars);
+            r = rational_inexact(functions[tree->arg[id]].fun2(
+                                     rational_to_double(&b),
+                                     rational_to_double(&a)));
+            rational_clear(&b);
+        } else if (functions[tree->arg[id]].fun == fabs)
+            r = rational_abs(&a);
+        else if (functions[tree->arg[id]].fun == sqrt)
+            r = rational_sqrt(&a);
+        else
+            r = rational_inexact(functions[tree->arg[id]].fun(
+                                     rational_to_double(&a)));
+        rational_clear(&a);
+        return r;
+
+    case NODE_SUM:
+    case NODE_PROD:
+        return eval_flat_reduction(tree, id, vars);
+
+    default:
+        // Polynomials have rounded coefficients; the rest can't be exact
+        return eval_flat_inexact(tree, id, vars);
+    }
+}
+
+
+/* Set an evaluation error, unless there already is an error. */
+
+static void value_error(GError **err, stat_error_t kind, const char *msg)
+{
+    if (err && !*err) {
+        stats_count_error(kind);
+        g_set_error(err, 0, -1, "%s", msg);
+    }
+}
+
+
+static matrix_t *eval_flat_matrix(const flattree_t *tree, node_id_t id,
+                                  double *vars, GError **err);
+
+
+/* Evaluate a subtree that must give a number without a unit. */
+
+static double eval_flat_scalar(const flattree_t *tree, node_id_t id,
+                               double *vars, GError **err)
+{
+    matrix_t *m;
+    double r;
+
+    m = eval_flat_matrix(tree, id, vars, err);
+    if (!m)
+        return NAN;
+    if (!matrix_is_scalar(m)) {
+        value_error(err, STAT_ERROR_MATRIX, "Expected a number, not a matrix");
+        r = NAN;
+    } else if (!dims_is_zero(m->dims)) {
+        value_error(err, STAT_ERROR_UNITS, "Expected a number without a unit");
+        r = NAN;
+    } else
+        r = m->data[0];
+    free_matrix(m);
+
+    return r;
+}
+
+
+/* Can the subtree 'id' give a matrix?  Decided from the nodes alone. */
+
+static gboolean may_give_matrix(const flattree_t *tree, node_id_t id)
+{
+    node_id_t branches;
+
+    if (id == NO_NODE)
+        return FALSE;
+
+    switch (tree->type[id]) {
+    case NODE_MATRIX:
+        // [x] is a number
+        return tree->type[tree->right[id]] == NODE_OPERATOR &&
+               tree->arg[tree->right[id]] == OP_ARGS;
+    case NODE_MATFUN:
+        return tree->arg[id] != MATFUN_DET && tree->arg[id] != MATFUN_DOT;
+    case NODE_FUNCTION:
+    case NODE_CONVERT:
+        return may_give_matrix(tree, tree->left[id]) ||
+               may_give_matrix(tree, tree->right[id]);
+    case NODE_OPERATOR:
+        switch (tree->arg[id]) {
+        case OP_AND:
+        case OP_OR:
+            return FALSE;
+        case OP_COND:
+            branches = tree->right[id];
+            return may_give_matrix(tree, tree->left[branches]) ||
+                   may_give_matrix(tree, tree->right[branches]);
+        default:
+            return may_give_matrix(tree, tree->left[id]) ||
+                   may_give_matrix(tree, tree->right[id]);
+        }
+    default:
+        return FALSE;
+    }
+}
+
+
+/* Sums, integrals and solve() are evaluated with plain numbers by
+   eval_flat(), which would turn a matrix or a unit into NaN.  Check that
+   the sum etc. 'id', and the ones inside it, have no units, and no
+   bodies or bounds that give matrices. */
+
+static void check_reduction(const flattree_t *tree, node_id_t id, GError **err)
+{
+    node_id_t i, body, range, tol;
+    gboolean matrices = FALSE;
+
+    for (i = flattree_first(tree, id); i <= id; i++) {
+        if (tree->type[i] == NODE_UNIT) {
+            value_error(err, STAT_ERROR_UNITS,
+                        "Expected a number without a unit");
+            return;
+        }
+        if (tree->type[i] == NODE_MATRIX || tree->type[i] == NODE_MATFUN)
+            matrices = TRUE;
+    }
+    if (!matrices)
+        return;
+
+    for (i = flattree_first(tree, id); i <= id; i++) {
+        tol = NO_NODE;
+        switch (tree->type[i]) {
+        case NODE_SUM:
+        case NODE_PROD:
+            body = tree->right[i];
+            range = tree->left[i];
+            break;
+        case NODE_INTEGRAL:
+        case NODE_INTEGRAL_ERR:
+            body = tree->left[i];
+            range = tree->left[tree->right[i]];
+            tol = tree->right[tree->right[i]];
+            break;
+        case NODE_SOLVE:
+            body = tree->left[i];
+            range = tree->right[i];
+            break;
+        default:
+            continue;
+        }
+        if (may_give_matrix(tree, body) ||
+            may_give_matrix(tree, tree->left[range]) ||
+            may_give_matrix(tree, tree->right[range]) ||
+            may_give_matrix(tree, tol)) {
+            value_error(err, STAT_ERROR_MATRIX,
+                        "Expected a number, not a matrix");
+            return;
+        }
+    }
+}
+
+
+/* Evaluate a subtree as a number.  Unlike eval_flat(), this works even if
+   there are matrices inside, as long as the result is a number. */
+
+static double eval_flat_number(const flattree_t *tree, node_id_t id,
+                               double *vars)
+{
+    if (flattree_is_scalar(tree))
+        return eval_flat(tree, id, vars);
+
+    return eval_flat_scalar(tree, id, vars, NULL);
+}
+
+
+static operator_type_t scalar_operator(operator_type_t op)
+{
+    switch (op) {
+    case OP_EMUL:
+        return OP_TIMES;
+    case OP_EDIV:
+        return OP_DIV;
+    case OP_EPOW:
+        return OP_POW;
+    default:
+        return op;
+    }
+}
+
+
+/* Put the unit of 'a op b' in '*dims', where 'op' applies element by element.
+   Return FALSE, and set 'err', if the units don't fit 'op'. */
+
+static gboolean operator_dims(operator_type_t op, const matrix_t *a,
+                              const matrix_t *b, dims_t *dims, GError **err)
+{
+    switch (op) {
+    case OP_PLUS:
+    case OP_MINUS:
+    case OP_LT:
+    case OP_LE:
+    case OP_GT:
+    case OP_GE:
+    case OP_EQ:
+    case OP_NE:
+        if (!dims_equal(a->dims, b->dims)) {
+            value_error(err, STAT_ERROR_UNITS, "Units don't match");
+            return FALSE;
+        }
+        if (op == OP_PLUS || op == OP_MINUS)
+            *dims = a->dims;
+        else
+            memset(dims, 0, sizeof(*dims));
+        return TRUE;
+    case OP_TIMES:
+        *dims = dims_add(a->dims, b->dims);
+        return TRUE;
+    case OP_DIV:
+        *dims = dims_sub(a->dims, b->dims);
+        return TRUE;
+    case OP_POW:
+        if (!dims_is_zero(b->dims)) {
+            value_error(err, STAT_ERROR_UNITS, "Exponents can't have units");
+            return FALSE;
+        }
+        *dims = a->dims;
+        if (dims_is_zero(a->dims))
+            return TRUE;
+        if (!matrix_is_scalar(b) || !dims_scale(a->dims, b->data[0], dims)) {
+            value_error(err, STAT_ERROR_UNITS,
+                        "Units can only be raised to whole number powers");
+            return FALSE;
+        }
+        return TRUE;
+    default:
+        g_assert_not_reached();
+    }
+
+    return FALSE;
+}
+
+
+/* Apply 'op' element by element.  Either operand may be a number, which is
+   then used with every element of the other one. */
+
+static matrix_t *elementwise(operator_type_t op, const matrix_t *a,
+                             const matrix_t *b, GError **err)
+{
+    matrix_t *r;
+    dims_t dims;
+    gsize i, n;
+
+    op = scalar_operator(op);
+    if (!operator_dims(op, a, b, &dims, err))
+        return NULL;
+
+    if (a->rows == b->rows && a->cols == b->cols) {
+        r = matrix_new(a->rows, a->cols);
+        apply_operator_batch(op, a->data, b->data, r->data, matrix_size(r));
+    } else if (matrix_is_scalar(a)) {
+        r = matrix_new(b->rows, b->cols);
+        n = matrix_size(r);
+        for (i = 0; i < n; i++)
+            r->data[i] = apply_operator(op, a->data[0], b->data[i]);
+    } else if (matrix_is_scalar(b)) {
+        r = matrix_new(a->rows, a->cols);
+        n = matrix_size(r);
+        for (i = 0; i < n; i++)
+            r->data[i] = apply_operator(op, a->data[i], b->data[0]);
+    } else {
+        value_error(err, STAT_ERROR_MATRIX, "Matrix sizes don't match");
+        return NULL;
+    }
+    r->dims = dims;
+
+    return r;
+}
+
+
+static matrix_t *apply_matrix_operator(operator_type_t op, const matrix_t *a,
+                                       const matrix_t *b, GError **err)
+{
+    matrix_t *r = NULL;
+    dims_t dims;
+    double e;
+
+    switch (op) {
+    case OP_TIMES:
+        if (matrix_is_scalar(a) || matrix_is_scalar(b))
+            r = elementwise(op, a, b, err);
+        else if (a->cols == b->rows) {
+            r = matrix_mul(a, b);
+            r->dims = dims_add(a->dims, b->dims);
+        } else
+            value_error(err, STAT_ERROR_MATRIX,
+                        "Matrix sizes don't match for '*'");
+        break;
+    case OP_DIV:
+        if (matrix_is_scalar(b))
+            r = elementwise(op, a, b, err);
+        else
+            value_error(err, STAT_ERROR_MATRIX,
+                        "Can't divide by a matrix; use inv() or solve()");
+        break;
+    case OP_POW:
+        e = b->data[0];
+        if (matrix_is_scalar(a) && matrix_is_scalar(b))
+            r = elementwise(op, a, b, err);
+        else if (a->rows == a->cols && matrix_is_scalar(b) && e == floor(e)
+                 && fabs(e) <= G_MAXINT) {
+            if (!operator_dims(op, a, b, &dims, err))
+                break;
+            r = matrix_pow(a, (long)e);
+            if (r)
+                r->dims = dims;
+            else
+                value_error(err, STAT_ERROR_MATRIX, "Matrix is singular");
+        } else
+            value_error(err, STAT_ERROR_MATRIX, "Only square matrices can be "
+                        "raised to a power, and only to an integer power");
+        break;
+    default:
+        r = elementwise(op, a, b, err);
+    }
+
+    return r;
+}
+
+
+/* Put the unit of functions[fun] of something with the unit 'a' in '*r'.  abs
+   keeps the unit, sqrt and cbrt take its root, and the others only take
+   numbers without units. */
+
+static gboolean function_dims(gint fun, dims_t a, dims_t *r)
+{
+    if (dims_is_zero(a) || functions[fun].fun == fabs) {
+        *r = a;
+        return TRUE;
+    } else if (functions[fun].fun == sqrt)
+        return dims_root(a, 2, r);
+    else if (functions[fun].fun == cbrt)
+        return dims_root(a, 3, r);
+    else
+        return FALSE;
+}
+
+
+/* functions[fun](a, b) element by element, like elementwise(). */
+
+static matrix_t *elementwise_function2(gint fun, const matrix_t *a,
+                                       const matrix_t *b, GError **err)
+{
+    double (*fun2)(double, double) = functions[fun].fun2;
+    matrix_t *r;
+    gsize i, n;
+
+    if (a->rows == b->rows && a->cols == b->cols) {
+        r = matrix_new(a->rows, a->cols);
+        apply_function_batch(fun, a->data, b->data, r->data, matrix_size(r));
+    } else if (matrix_is_scalar(a)) {
+        r = matrix_new(b->rows, b->cols);
+        n = matrix_size(r);
+        for (i = 0; i < n; i++)
+            r->data[i] = fun2(a->data[0], b->data[i]);
+    } else if (matrix_is_scalar(b)) {
+        r = matrix_new(a->rows, a->cols);
+        n = matrix_size(r);
+        for (i = 0; i < n; i++)
+            r->data[i] = fun2(a->data[i], b->data[0]);
+    } else {
+        value_error(err, STAT_ERROR_MATRIX, "Matrix sizes don't match");
+        return NULL;
+    }
+
+    return r;
+}
+
+
+static matrix_t *apply_matrix_function(matfun_t fun, const matrix_t *a,
+                                       const matrix_t *b, GError **err)
+{
+    matrix_t *r = NULL;
+    dims_t dims;
+
+    switch (fun) {
+    case MATFUN_DET:
+    case MATFUN_INV:
+        if (b->rows != b->cols)
+            value_error(err, STAT_ERROR_MATRIX, "Expected a square matrix");
+        else if (!dims_scale(b->dims, (fun == MATFUN_DET) ? b->rows : -1,
+                             &dims))
+            value_error(err, STAT_ERROR_UNITS, "Unit out of range");
+        else if (fun == MATFUN_DET)
+            r = matrix_scalar(matrix_det(b));
+        else if (!(r = matrix_inv(b)))
+            value_error(err, STAT_ERROR_MATRIX, "Matrix is singular");
+        break;
+    case MATFUN_TRANSPOSE:
+        r = matrix_transpose(b);
+        dims = b->dims;
+        break;
+    case MATFUN_DOT:
+        if (!matrix_is_vector(a) || !matrix_is_vector(b) ||
+            matrix_size(a) != matrix_size(b))
+            value_error(err, STAT_ERROR_MATRIX,
+                        "dot() needs two vectors of the same length");
+        else
+            r = matrix_scalar(matrix_dot(a, b));
+        dims = dims_add(a->dims, b->dims);
+        break;
+    case MATFUN_SOLVE:
+        if (a->rows != a->cols || b->rows != a->rows)
+            value_error(err, STAT_ERROR_MATRIX, "solve(A, b) needs a square "
+                        "A, and as many rows in b as in A");
+        else if (!(r = matrix_solve(a, b)))
+            value_error(err, STAT_ERROR_MATRIX, "Matrix is singular");
+        dims = dims_sub(b->dims, a->dims);
+        break;
+    default:
+        g_assert_not_reached();
+    }
+
+    if (r)
+        r->dims = dims;
+    return r;
+}
+
+
+/* eval_flat() as a 1 x 1 matrix.  Sums and products too long to count give
+   NaN, and this reports them. */
+
+static matrix_t *eval_flat_checked(const flattree_t *tree, node_id_t id,
+                                   double *vars, GError **err)
+{
+    double x;
+
+    reduce_set_range_error(FALSE);
+    x = eval_flat(tree, id, vars);
+    if (isnan(x) && reduce_range_error()) {
+        value_error(err, STAT_ERROR_RANGE, "Too many terms");
+        return NULL;
+    }
+    return matrix_scalar(x);
+}
+
+
+/* Evaluate the subtree 'id', which may give a matrix.  Return NULL, and set
+   'err', if the sizes of the operands don't fit. */
+
+static matrix_t *eval_flat_matrix(const flattree_t *tree, node_id_t id,
+                                  double *vars, GError **err)
+{
+    matrix_t *a = NULL, *b = NULL, *r = NULL;
+    node_id_t elem, branches;
+    GError *tmp_err = NULL;
+    gchar *from, *to, msg[128];
+    dims_t dims;
+    double x;
+    gsize i, n;
+
+    switch (tree->type[id]) {
+
+    case NODE_MATRIX:
+        n = 1;
+        for (elem = tree->right[id]; tree->type[elem] == NODE_OPERATOR &&
+                 tree->arg[elem] == OP_ARGS; elem = tree->left[elem])
+            n++;
+
+        // The elements are chained from the last one backwards, and must
+        // all have the unit of the last one
+        r = matrix_new(n/tree->arg[id], tree->arg[id]);
+        elem = tree->right[id];
+        for (i = n; i-- > 0 && !tmp_err; ) {
+            a = eval_flat_matrix(tree, (i > 0) ? tree->right[elem] : elem,
+                                 vars, &tmp_err);
+            if (tmp_err)
+                break;
+            if (!matrix_is_scalar(a))
+                value_error(&tmp_err, STAT_ERROR_MATRIX,
+                            "Matrix elements must be numbers");
+            else if (i == n-1)
+                r->dims = a->dims;
+            else if (!dims_equal(a->dims, r->dims))
+                value_error(&tmp_err, STAT_ERROR_UNITS,
+                            "Matrix elements must all have the same unit");
+            r->data[i] = a->data[0];
+            free_matrix(a);
+            a = NULL;
+            elem = tree->left[elem];
+        }
+        break;
+
+    case NODE_MATFUN:
+        if (tree->left[id] != NO_NODE)
+            a = eval_flat_matrix(tree, tree->left[id], vars, &tmp_err);
+        if (!tmp_err)
+            b = eval_flat_matrix(tree, tree->right[id], vars, &tmp_err);
+        if (!tmp_err)
+            r = apply_matrix_function(tree->arg[id], a, b, &tmp_err);
+        break;
+
+    case NODE_FUNCTION:
+        if (tree->left[id] != NO_NODE)
+            b = eval_flat_matrix(tree, tree->left[id], vars, &tmp_err);
+        if (!tmp_err)
+            a = eval_flat_matrix(tree, tree->right[id], vars, &tmp_err);
+        if (tmp_err)
+            break;
+        if (!function_dims(tree->arg[id], a->dims, &dims) ||
+            (b && !dims_is_zero(b->dims))) {
+            g_snprintf(msg, sizeof(msg), "%s() can't take a unit",
+                       functions[tree->arg[id]].name);
+            value_error(&tmp_err, STAT_ERROR_UNITS, msg);
+            break;
+        }
+        if (b)
+            r = elementwise_function2(tree->arg[id], b, a, &tmp_err);
+        else {
+            r = matrix_new(a->rows, a->cols);
+            apply_function_batch(tree->arg[id], NULL, a->data, r->data,
+                                 matrix_size(r));
+        }
+        if (r)
+            r->dims = dims;
+        break;
+
+    case NODE_UNIT:
+        r = matrix_scalar(units[tree->arg[id]].factor);
+        r->dims = units[tree->arg[id]].dims;
+        break;
+
+    case NODE_CONVERT:
+        a = eval_flat_matrix(tree, tree->left[id], vars, &tmp_err);
+        if (!tmp_err)
+            b = eval_flat_matrix(tree, tree->right[id], vars, &tmp_err);
+        if (tmp_err)
+            break;
+        if (!matrix_is_scalar(b)) {
+            value_error(&tmp_err, STAT_ERROR_MATRIX,
+                        "Can't convert to a matrix");
+            break;
+        }
+        if (!dims_equal(a->dims, b->dims)) {
+            from = dims_to_string(a->dims);
+            to = dims_to_string(b->dims);
+            g_snprintf(msg, sizeof(msg), "Can't convert %s to %s",
+                       *from ? from : "a number", *to ? to : "a number");
+            value_error(&tmp_err, STAT_ERROR_UNITS, msg);
+            g_free(from);
+            g_free(to);
+            break;
+        }
+        r = matrix_new(a->rows, a->cols);
+        n = matrix_size(r);
+        for (i = 0; i < n; i++)
+            r->data[i] = a->data[i]/b->data[0];
+        r->unit = tree->unit_text;
+        break;
+
+    case NODE_OPERATOR:
+
+        switch (tree->arg[id]) {
+        case OP_AND:
+        case OP_OR:
+        case OP_COND:
+            x = eval_flat_scalar(tree, tree->left[id], vars, &tmp_err);
+            if (tmp_err)
+                break;
+            if (tree->arg[id] == OP_COND) {
+                branches = tree->right[id];
+                if (isnan(x))
+                    r = matrix_scalar(NAN);
+                else if (x != 0.0)
+                    r = eval_flat_matrix(tree, tree->left[branches], vars,
+                                         &tmp_err);
+                else
+                    r = eval_flat_matrix(tree, tree->right[branches], vars,
+                                         &tmp_err);
+            } else if (tree->arg[id] == OP_AND ? (x == 0.0 || isnan(x))
+                                               : (x != 0.0))
+                r = matrix_scalar(truth(x));
+            else {
+                x = eval_flat_scalar(tree, tree->right[id], vars, &tmp_err);
+                r = matrix_scalar(truth(x));
+            }
+            break;
+        case OP_UMINUS:
+        case OP_NOT:
+            b = eval_flat_matrix(tree, tree->right[id], vars, &tmp_err);
+            if (tmp_err)
+                break;
+            r = matrix_new(b->rows, b->cols);
+            apply_operator_batch(tree->arg[id], NULL, b->data, r->data,
+                                 matrix_size(r));
+            break;
+        default:
+            a = eval_flat_matrix(tree, tree->left[id], vars, &tmp_err);
+            if (!tmp_err)
+                b = eval_flat_matrix(tree, tree->right[id], vars, &tmp_err);
+            if (!tmp_err)
+                r = apply_matrix_operator(tree->arg[id], a, b, &tmp_err);
+        }
+        break;
+
+    case NODE_SUM:
+    case NODE_PROD:
+    case NODE_INTEGRAL:
+    case NODE_INTEGRAL_ERR:
+    case NODE_SOLVE:
+        check_reduction(tree, id, &tmp_err);
+        if (!tmp_err)
+            r = eval_flat_checked(tree, id, vars, &tmp_err);
+        break;
+
+    default:
+        r = eval_flat_checked(tree, id, vars, &tmp_err);
+    }
+
+    free_matrix(a);
+    free_matrix(b);
+    if (tmp_err) {
+        g_propagate_error(err, tmp_err);
+        free_matrix(r);
+        r = NULL;
+    }
+
+    return r;
+}
+
+
+typedef struct {
+    const flattree_t *tree;
+    const double *vars;
+    const node_id_t *pieces;
+    const guint *chunks;
+    double *vals;               // Indexed by node id
+    gint range_error;           // See reduce.h
+} split_task_t;
+
+typedef struct {
+    node_id_t first, last;
+} span_t;
+
+
+static void eval_split_chunk(guint i, gpointer data)
+{
+    split_task_t *task = data;
+    double vars[MAX_VARS];
+    guint j;
+
+    // eval_flat() binds the variables of sums etc. in 'vars'
+    memcpy(vars, task->vars, sizeof(vars));
+    reduce_set_range_error(FALSE);
+
+    for (j = task->chunks[i]; j < task->chunks[i+1]; j++)
+        task->vals[task->pieces[j]] = eval_flat(task->tree, task->pieces[j],
+                                                vars);
+
+    if (reduce_range_error())
+        g_atomic_int_set(&task->range_error, TRUE);
+}
+
+
+static gboolean is_split_operator(const flattree_t *tree, node_id_t id)
+{
+    return tree->type[id] == NODE_OPERATOR &&
+           (tree->arg[id] == OP_PLUS || tree->arg[id] == OP_MINUS ||
+            tree->arg[id] == OP_TIMES || tree->arg[id] == OP_DIV);
+}
+
+
+/* The same as eval_flat(), for huge expressions.  The operands of +, -, *
+   and / with more than SPLIT_GRAIN nodes are split further, and the pieces
+   that are left are evaluated in parallel, in chunks of about SPLIT_GRAIN
+   nodes.  The operators above the pieces are then applied one by one, in
+   the same order as in eval_flat(), so the result is exactly the same with
+   any number of threads.  Long chains like 1 + 2 + 3 + ... don't recurse
+   once per term here either. */
+
+static double eval_flat_split(const flattree_t *tree, node_id_t root,
+                              double *vars)
+{
+    GArray *stack, *splits, *pieces, *chunks;
+    split_task_t task;
+    span_t span;
+    node_id_t id, lo;
+    guint i, size;
+    gboolean had_error;
+    double r;
+
+    lo = flattree_first(tree, root);
+    if (root - lo + 1 < SPLIT_MIN_NODES || !is_split_operator(tree, root))
+        return eval_flat(tree, root, vars);
+
+    stack = g_array_new(FALSE, FALSE, sizeof(span_t));
+    splits = g_array_new(FALSE, FALSE, sizeof(node_id_t));
+    pieces = g_array_new(FALSE, FALSE, sizeof(node_id_t));
+    chunks = g_array_new(FALSE, FALSE, sizeof(guint));
+
+    /* Walk the tree depth first, left operands first, so that the pieces come
+       out in increasing order, and every split operator before its
+       operands. */
+    span.first = lo;
+    span.last = root;
+    g_array_append_val(stack, span);
+    size = 0;
+    while (stack->len > 0) {
+        span = g_array_index(stack, span_t, stack->len - 1);
+        g_array_set_size(stack, stack->len - 1);
+        lo = span.first;
+        id = span.last;
+
+        if (id - lo + 1 > SPLIT_GRAIN && is_split_operator(tree, id)) {
+            g_array_append_val(splits, id);
+            span.first = tree->left[id] + 1;
+            span.last = tree->right[id];
+            g_array_append_val(stack, span);
+            span.first = lo;
+            span.last = tree->left[id];
+            g_array_append_val(stack, span);
+        } else {
+            if (size == 0 || size >= SPLIT_GRAIN) {
+                g_array_append_val(chunks, pieces->len);
+                size = 0;
+            }
+            g_array_append_val(pieces, id);
+            size += id - lo + 1;
+        }
+    }
+    g_array_append_val(chunks, pieces->len);
+
+    task.tree = tree;
+    task.vars = vars;
+    task.pieces = (node_id_t *)pieces->data;
+    task.chunks = (guint *)chunks->data;
+    task.vals = g_new(double, root + 1);
+    task.range_error = FALSE;
+    had_error = reduce_range_error();
+    parallel_for(chunks->len - 1, eval_split_chunk, &task);
+    reduce_set_range_error(had_error || task.range_error);
+
+    // Operands come after the operator in 'splits'
+    for (i = splits->len; i-- > 0; ) {
+        id = g_array_index(splits, node_id_t, i);
+        task.vals[id] = apply_operator(tree->arg[id],
+                                       task.vals[tree->left[id]],
+                                       task.vals[tree->right[id]]);
+    }
+    r = task.vals[root];
+
+    g_free(task.vals);
+    g_array_free(stack, TRUE);
+    g_array_free(splits, TRUE);
+    g_array_free(pieces, TRUE);
+    g_array_free(chunks, TRUE);
+
+    return r;
+}
+
+
+/* Evaluate 'tree' to a number.  A quantity with a unit gives its value in SI
+   base units, and a matrix gives NaN. */
+
+double eval_flattree(const flattree_t *tree, gboolean use_degrees)
+{
+    double vars[MAX_VARS];
+    matrix_t *m;
+    gint64 start;
+    double r;
+
+    trigonometrics_use_degrees = use_degrees;
+
+    if (!tree || tree->root == NO_NODE)
+        return NAN;
+
+    if (!flattree_is_scalar(tree)) {
+        m = eval_flattree_matrix(tree, use_degrees, NULL);
+        r = (m && matrix_is_scalar(m)) ? m->data[0] : NAN;
+        free_matrix(m);
+        return r;
+    }
+
+    start = stats_start();
+    if (!adaptive_eval(tree, tree->root, vars, &r))
+        r = eval_flat_split(tree, tree->root, vars);
+    stats_record_time(STAT_EVAL, start);
+    stats_count_result(r);
+
+    return r;
+}
+
+
+double eval_flattree_vars(const flattree_t *tree, const double *values,
+                          gboolean use_degrees)
+{
+    double vars[MAX_VARS];
+    gint64 start;
+    double r;
+
+    trigonometrics_use_degrees = use_degrees;
+
+    if (!tree || tree->root == NO_NODE)
+        return NAN;
+
+    memcpy(vars, values, tree->n_vars*sizeof(double));
+
+    start = stats_start();
+    if (!adaptive_eval(tree, tree->root, vars, &r))
+        r = eval_flat_split(tree, tree->root, vars);
+    stats_record_time(STAT_EVAL, start);
+    stats_count_result(r);
+
+    return r;
+}
+
+
+/* Evaluate 'tree' like eval_flattree_vars(), and add the evaluation to
+   'prof'.  Everything runs in the calling thread, so that the times of the
+   nodes add up. */
+
+double eval_flattree_profile(const flattree_t *tree, const double *values,
+                             profile_t *prof, gboolean use_degrees)
+{
+    double vars[MAX_VARS];
+    guint n_threads;
+    double r;
+
+    trigonometrics_use_degrees = use_degrees;
+
+    if (!tree || tree->root == NO_NODE || !flattree_is_scalar(tree))
+        return NAN;
+
+    g_assert(prof->tree == tree);
+    if (values)
+        memcpy(vars, values, tree->n_vars*sizeof(double));
+
+    n_threads = parallel_get_threads();
+    parallel_set_threads(1);
+    profile = prof;
+    r = eval_flat(tree, tree->root, vars);
+    profile = NULL;
+    parallel_set_threads(n_threads);
+    prof->n_evals++;
+
+    return r;
+}
+
+
+typedef struct {
+    const flattree_t *tree;
+    const double *cols[MAX_VARS];
+    double *y;
+    gsize n;
+} batch_task_t;
+
+
+static void eval_batch_block(guint i, gpointer data)
+{
+    batch_task_t *task = data;
+    const double *cols[MAX_VARS];
+    double vars[MAX_VARS];
+    gsize start = (gsize)i*BATCH_BLOCK;
+    int n = MIN(BATCH_BLOCK, task->n - start);
+    gint s;
+
+    for (s = 0; s < MAX_VARS; s++)
+        cols[s] = task->cols[s] ? task->cols[s] + start : NULL;
+
+    eval_flat_columns(task->tree, task->tree->root, vars, cols,
+                      task->y + start, n);
+}
+
+
+/* Evaluate 'tree' for n rows of variable values, and put the results in
+   y[].  cols[s] holds the n values of variable s, for the n_cols first
+   variables.  The rows are split into blocks, which are evaluated in
+   parallel. */
+
+void eval_flattree_columns(const flattree_t *tree, const double * const *cols,
+                           gint n_cols, double *y, gsize n,
+                           gboolean use_degrees)
+{
+    batch_task_t task;
+    gint64 start;
+    gsize i;
+
+    trigonometrics_use_degrees = use_degrees;
+
+    if (!tree || tree->root == NO_NODE) {
+        for (i = 0; i < n; i++) y[i] = NAN;
+        return;
+    }
+
+    g_assert(n_cols <= MAX_VARS);
+
+    task.tree = tree;
+    memset(task.cols, 0, sizeof(task.cols));
+    memcpy(task.cols, cols, n_cols*sizeof(*cols));
+    task.y = y;
+    task.n = n;
+
+    start = stats_start();
+    parallel_for((n + BATCH_BLOCK - 1)/BATCH_BLOCK, eval_batch_block, &task);
+    stats_record_time(STAT_EVAL, start);
+    for (i = 0; i < n; i++)
+        stats_count_result(y[i]);
+}
+
+
+/* Evaluate 'tree' for each of the n values x[] of vars[slot], and put the
+   results in y[]. */
+
+void eval_flattree_batch(const flattree_t *tree, gint slot, const double *x,
+                         double *y, gsize n, gboolean use_degrees)
+{
+    const double *cols[MAX_VARS] = { NULL };
+
+    g_assert(slot < MAX_VARS);
+
+    cols[slot] = x;
+    eval_flattree_columns(tree, cols, slot + 1, y, n, use_degrees);
+}
+
+
+/* Evaluate 'tree', which may give a matrix.  Return NULL and set 'err' if
+   the sizes of some operands don't fit.  The result should be freed with
+   free_matrix(). */
+
+matrix_t *eval_flattree_matrix(const flattree_t *tree, gboolean use_degrees,
+                               GError **err)
+{
+    return eval_flattree_matrix_vars(tree, NULL, use_degrees, err);
+}
+
+
+/* Like eval_flattree_matrix(), with the variables set to 'values', like in
+   eval_flattree_vars(). */
+
+matrix_t *eval_flattree_matrix_vars(const flattree_t *tree,
+                                    const double *values,
+                                    gboolean use_degrees, GError **err)
+{
+    double vars[MAX_VARS], x;
+    matrix_t *m;
+    gint64 start;
+
+    if (!tree || tree->root == NO_NODE)
+        return matrix_scalar(NAN);
+
+    if (values)
+        memcpy(vars, values, tree->n_vars*sizeof(double));
+
+    if (flattree_is_scalar(tree)) {
+        reduce_set_range_error(FALSE);
+        x = values ? eval_flattree_vars(tree, values, use_degrees)
+                   : eval_flattree(tree, use_degrees);
+        if (isnan(x) && reduce_range_error()) {
+            value_error(err, STAT_ERROR_RANGE, "Too many terms");
+            return NULL;
+        }
+        return matrix_scalar(x);
+    }
+
+    trigonometrics_use_degrees = use_degrees;
+
+    start = stats_start();
+    m = eval_flat_matrix(tree, tree->root, vars, err);
+    stats_record_time(STAT_EVAL, start);
+    if (m && matrix_is_scalar(m))
+        stats_count_result(m->data[0]);
+
+    return m;
+}
+
+
+/* Evaluate 'tree' exactly, with fractions, as far as that's possible (see
+   rational.h).  Trees with matrices or units are evaluated in double.  Free
+   the result with rational_clear(). */
+
+rational_t eval_flattree_rational(const flattree_t *tree, gboolean use_degrees)
+{
+    rational_t vars[MAX_VARS], r;
+    gint64 start;
+    gint i;
+
+    trigonometrics_use_degrees = use_degrees;
+
+    if (!tree || tree->root == NO_NODE)
+        return rational_inexact(NAN);
+    if (!flattree_is_scalar(tree))
+        return rational_inexact(eval_flattree(tree, use_degrees));
+
+    for (i = 0; i < MAX_VARS; i++)
+        vars[i] = rational_from_int(0);
+
+    start = stats_start();
+    r = eval_flat_rational(tree, tree->root, vars);
+    stats_record_time(STAT_EVAL, start);
+    stats_count_result(rational_to_double(&r));
+
+    for (i = 0; i < MAX_VARS; i++)
+        rational_clear(&vars[i]);
+
+    return r;
+}
+
+
+/* Other number types than double, see eval-typed.h. */
+
+#define MAX_TYPED_TERMS 9007199254740992.0      // 2^53, as in reduce.c
+
+static const char *number_type_names[] = {
+    "float", "double", "long-double", "float128", "decimal64", "decimal128"
+};
+
+
+#define T float
+#define NAME(x) x##_float
+#define F(x) x##f
+#define LIT(x) x##f
+#include "eval-typed.h"
+#undef T
+#undef NAME
+#undef F
+#undef LIT
+
+#define T long double
+#define NAME(x) x##_long_double
+#define F(x) x##l
+#define LIT(x) x##L
+#include "eval-typed.h"
+#undef T
+#undef NAME
+#undef F
+#undef LIT
+
+#ifdef HAVE_QUADMATH
+#define T __float128
+#define NAME(x) x##_float128
+#define F(x) x##q
+#define LIT(x) x##Q
+#include "eval-typed.h"
+#undef T
+#undef NAME
+#undef F
+#undef LIT
+#endif
+
+
+/* Decimal floating point, see decimal.h.  Numbers start from the decimal they
+   were written as (see flattree_add_literal()), or else from the shortest
+   decimal of their double.  Functions, integrals, solve and the like are
+   computed in double, and rounded to the shortest decimal again. */
+
+#define DECIMAL_PI "3.14159265358979323846264338327950288"
+
+static decimal_t *decimal_nums(const flattree_t *tree, decimal_format_t f)
+{
+    decimal_t *nums;
+    guint32 i, lit;
+
+    nums = g_new(decimal_t, MAX(tree->n_nums, 1));
+    for (i = 0; i < tree->n_nums; i++) {
+        lit = tree->lits ? tree->lits[i] : NO_LITERAL;
+        if (lit == NAMED_CONSTANT && tree->nums[i] == G_PI)
+            nums[i] = decimal_from_string(f, DECIMAL_PI, NULL);
+        else if (lit != NO_LITERAL && lit != NAMED_CONSTANT)
+            nums[i] = decimal_from_string(f, tree->source + lit, NULL);
+        else
+            nums[i] = decimal_from_double(f, tree->nums[i]);
+    }
+
+    return nums;
+}
+
+
+static decimal_t decimal_truth(decimal_format_t f, decimal_t x)
+{
+    if (decimal_is_nan(f, x))
+        return x;
+    return decimal_from_int(f, !decimal_is_zero(f, x));
+}
+
+
+static decimal_t apply_decimal_operator(decimal_format_t f,
+                                        operator_type_t op, decimal_t a,
+                                        decimal_t b)
+{
+    gint c;
+
+    switch (op) {
+    case OP_PLUS:
+        return decimal_add(f, a, b);
+    case OP_MINUS:
+        return decimal_sub(f, a, b);
+    case OP_UMINUS:
+        return decimal_neg(f, b);
+    case OP_TIMES:
+    case OP_EMUL:
+        return decimal_mul(f, a, b);
+    case OP_DIV:
+    case OP_EDIV:
+        return decimal_div(f, a, b);
+    case OP_POW:
+    case OP_EPOW:
+        return decimal_pow(f, a, b);
+    case OP_NOT:
+        if (decimal_is_nan(f, b))
+            return b;
+        return decimal_from_int(f, decimal_is_zero(f, b));
+    default:
+        break;
+    }
+
+    // Comparisons, where NaN is only != like in double
+    c = decimal_compare(f, a, b);
+    switch (op) {
+    case OP_LT:
+        return decimal_from_int(f, c == -1);
+    case OP_LE:
+        return decimal_from_int(f, c == -1 || c == 0);
+    case OP_GT:
+        return decimal_from_int(f, c == 1);
+    case OP_GE:
+        return decimal_from_int(f, c == 1 || c == 0);
+    case OP_EQ:
+        return decimal_from_int(f, c == 0);
+    case OP_NE:
+        return decimal_from_int(f, c != 0);
+    default:
+        g_assert_not_reached();
+    }
+
+    return decimal_nan(f);
+}
+
+
+static decimal_t apply_decimal_function(decimal_format_t f, gint fun,
+                                        decimal_t a, decimal_t x)
+{
+    double y;
+
+    if (functions[fun].fun == fabs)
+        return (decimal_compare(f, x, decimal_from_int(f, 0)) < 0)
+            ? decimal_neg(f, x) : x;
+
+    if (functions[fun].fun2)
+        y = functions[fun].fun2(decimal_to_double(f, a),
+                                decimal_to_double(f, x));
+    else
+        y = functions[fun].fun(decimal_to_double(f, x));
+
+    return decimal_from_double(f, y);
+}
+
+
+static decimal_t eval_decimal(const flattree_t *tree, decimal_format_t f,
+                              const decimal_t *nums, node_id_t id,
+                              decimal_t *vars)
+{
+    double dvars[MAX_VARS], n;
+    decimal_t left, right, r, p, one;
+    const decimal_t *c;
+    node_id_t branches, range;
+    gint s, slot, i, degree;
+    gint64 k;
+
+    switch (tree->type[id]) {
+
+    case NODE_NUMBER:
+        return nums[tree->arg[id]];
+
+    case NODE_VARIABLE:
+        return vars[tree->arg[id]];
+
+    case NODE_OPERATOR:
+
+        switch (tree->arg[id]) {
+        case OP_AND:
+            left = eval_decimal(tree, f, nums, tree->left[id], vars);
+            if (decimal_is_zero(f, left) || decimal_is_nan(f, left))
+                return decimal_truth(f, left);
+            right = eval_decimal(tree, f, nums, tree->right[id], vars);
+            return decimal_truth(f, right);
+        case OP_OR:
+            left = eval_decimal(tree, f, nums, tree->left[id], vars);
+            if (!decimal_is_zero(f, left))
+                return decimal_truth(f, left);
+            right = eval_decimal(tree, f, nums, tree->right[id], vars);
+            return decimal_truth(f, right);
+        case OP_COND:
+            branches = tree->right[id];
+            left = eval_decimal(tree, f, nums, tree->left[id], vars);
+            if (decimal_is_nan(f, left))
+                return left;
+            else if (!decimal_is_zero(f, left))
+                return eval_decimal(tree, f, nums, tree->left[branches], vars);
+            else
+                return eval_decimal(tree, f, nums, tree->right[branches],
+                                    vars);
+        case OP_UMINUS:
+        case OP_NOT:
+            right = eval_decimal(tree, f, nums, tree->right[id], vars);
+            return apply_decimal_operator(f, tree->arg[id], decimal_nan(f),
+                                          right);
+        default:
+            left = eval_decimal(tree, f, nums, tree->left[id], vars);
+            right = eval_decimal(tree, f, nums, tree->right[id], vars);
+            return apply_decimal_operator(f, tree->arg[id], left, right);
+        }
+
+    case NODE_FUNCTION:
+        right = eval_decimal(tree, f, nums, tree->right[id], vars);
+        left = (tree->left[id] != NO_NODE)
+            ? eval_decimal(tree, f, nums, tree->left[id], vars)
+            : decimal_from_int(f, 0);
+        return apply_decimal_function(f, tree->arg[id], left, right);
+
+    case NODE_POLY:
+        // Horner, without fma
+        right = eval_decimal(tree, f, nums, tree->right[id], vars);
+        c = nums + tree->arg[id];
+        degree = tree->nums[tree->arg[id]];
+        p = c[1];
+        for (i = 2; i <= degree + 1; i++)
+            p = decimal_add(f, decimal_mul(f, p, right), c[i]);
+        return p;
+
+    case NODE_SUM:
+    case NODE_PROD:
+        range = tree->left[id];
+        left = eval_decimal(tree, f, nums, tree->left[range], vars);
+        right = eval_decimal(tree, f, nums, tree->right[range], vars);
+        if (decimal_is_nan(f, left) || decimal_is_nan(f, right))
+            return decimal_nan(f);
+        n = decimal_to_double(f, right) - decimal_to_double(f, left);
+        n = (n >= 0) ? floor(n) + 1 : 0;
+        if (n > MAX_TYPED_TERMS)
+            return decimal_nan(f);
+
+        slot = tree->arg[id];
+        one = decimal_from_int(f, 1);
+        r = decimal_from_int(f, tree->type[id] == NODE_PROD);
+        for (k = 0; k < n; k++) {
+            vars[slot] = left;
+            right = eval_decimal(tree, f, nums, tree->right[id], vars);
+            r = (tree->type[id] == NODE_SUM) ? decimal_add(f, r, right)
+                                             : decimal_mul(f, r, right);
+            left = decimal_add(f, left, one);
+        }
+        return r;
+
+    default:
+        for (s = 0; s < tree->n_vars; s++)
+            dvars[s] = decimal_to_double(f, vars[s]);
+        return decimal_from_double(f, eval_flat_number(tree, id, dvars));
+    }
+}
+
+
+static decimal_t eval_flattree_decimal(const flattree_t *tree,
+                                       decimal_format_t f,
+                                       const double *values)
+{
+    decimal_t vars[MAX_VARS], *nums, r;
+    gint s;
+
+    for (s = 0; s < tree->n_vars; s++)
+        vars[s] = decimal_from_double(f, values ? values[s] : 0);
+
+    nums = decimal_nums(tree, f);
+    r = eval_decimal(tree, f, nums, tree->root, vars);
+    g_free(nums);
+
+    return r;
+}
+
+
+typedef struct {
+    const flattree_t *tree;
+    decimal_format_t f;
+    const decimal_t *nums;
+    gint slot;
+    const double *x;
+    double *y;
+    gsize n;
+} decimal_batch_task_t;
+
+
+static void eval_decimal_block(guint i, gpointer data)
+{
+    decimal_batch_task_t *task = data;
+    decimal_t vars[MAX_VARS], r;
+    gsize k, start = (gsize)i*BATCH_BLOCK;
+    gsize end = MIN(start + BATCH_BLOCK, task->n);
+    gint s;
+
+    for (s = 0; s < task->tree->n_vars; s++)
+        vars[s] = decimal_from_int(task->f, 0);
+
+    for (k = start; k < end; k++) {
+        vars[task->slot] = decimal_from_double(task->f, task->x[k]);
+        r = eval_decimal(task->tree, task->f, task->nums, task->tree->root,
+                         vars);
+        task->y[k] = decimal_to_double(task->f, r);
+    }
+}
+
+
+static void eval_flattree_batch_decimal(const flattree_t *tree,
+                                        decimal_format_t f, gint slot,
+                                        const double *x, double *y, gsize n)
+{
+    decimal_batch_task_t task;
+    decimal_t *nums;
+
+    nums = decimal_nums(tree, f);
+
+    task.tree = tree;
+    task.f = f;
+    task.nums = nums;
+    task.slot = slot;
+    task.x = x;
+    task.y = y;
+    task.n = n;
+    parallel_for((n + BATCH_BLOCK - 1)/BATCH_BLOCK, eval_decimal_block, &task);
+
+    g_free(nums);
+}
+
+
+/* Return the type called 'name', or -1 if there is no such type, or it isn't
+   available in this build. */
+
+gint find_number_type(const char *name)
+{
+    gint i;
+
+    for (i = 0; i < N_NUMBER_TYPES; i++)
+        if (strcmp(name, number_type_names[i]) == 0)
+            break;
+
+#ifndef HAVE_QUADMATH
+    if (i == NUMBER_FLOAT128)
+        return -1;
+#endif
+
+    return (i < N_NUMBER_TYPES) ? i : -1;
+}
+
+
+const char *number_type_name(number_type_t type)
+{
+    return number_type_names[type];
+}
+
+
+/* Evaluate 'tree' with numbers of type 'type', and return the result with
+   all its digits.  'values' are the values of the variables, or NULL.  Free
+   the result with g_free().  Returns NULL for trees that aren't scalar. */
+
+gchar *eval_flattree_typed(const flattree_t *tree, number_type_t type,
+                           const double *values, gboolean use_degrees)
+{
+#ifdef HAVE_QUADMATH
+    char buf[64];
+#endif
+    gint64 start;
+    gchar *s = NULL;
+
+    trigonometrics_use_degrees = use_degrees;
+
+    if (!tree || tree->root == NO_NODE || !flattree_is_scalar(tree))
+        return NULL;
+
+    start = stats_start();
+    switch (type) {
+    case NUMBER_FLOAT:
+        s = g_strdup_printf("%.9g", eval_flattree_float(tree, values));
+        break;
+    case NUMBER_DOUBLE:
+        s = g_strdup_printf("%.17g", values ?
+                                     eval_flattree_vars(tree, values,
+                                                        use_degrees) :
+                                     eval_flattree(tree, use_degrees));
+        break;
+    case NUMBER_LONG_DOUBLE:
+        s = g_strdup_printf("%.21Lg", eval_flattree_long_double(tree, values));
+        break;
+    case NUMBER_FLOAT128:
+#ifdef HAVE_QUADMATH
+        quadmath_snprintf(buf, sizeof(buf), "%.36Qg",
+                          eval_flattree_float128(tree, values));
+        s = g_strdup(buf);
+#endif
+        break;
+    case NUMBER_DECIMAL64:
+        s = decimal_to_string(DECIMAL64,
+                              eval_flattree_decimal(tree, DECIMAL64, values));
+        break;
+    case NUMBER_DECIMAL128:
+        s = decimal_to_string(DECIMAL128,
+                              eval_flattree_decimal(tree, DECIMAL128, values));
+        break;
+    default:
+        g_assert_not_reached();
+    }
+    stats_record_time(STAT_EVAL, start);
+
+    return s;
+}
+
+
+/* eval_flattree_batch() with numbers of type 'type'.  x[] is converted to
+   'type', and the results back to double. */
+
+void eval_flattree_batch_typed(const flattree_t *tree, number_type_t type,
+                               gint slot, const double *x, double *y,
+                               gsize n, gboolean use_degrees)
+{
+    gint64 start;
+
+    trigonometrics_use_degrees = use_degrees;
+
+    if (type == NUMBER_DOUBLE || !tree || tree->root == NO_NODE ||
+        !flattree_is_scalar(tree)) {
+        eval_flattree_batch(tree, slot, x, y, n, use_degrees);
+        return;
+    }
+
+    start = stats_start();
+    switch (type) {
+    case NUMBER_FLOAT:
+        eval_flattree_batch_float(tree, slot, x, y, n);
+        break;
+    case NUMBER_LONG_DOUBLE:
+        eval_flattree_batch_long_double(tree, slot, x, y, n);
+        break;
+    case NUMBER_FLOAT128:
+#ifdef HAVE_QUADMATH
+        eval_flattree_batch_float128(tree, slot, x, y, n);
+#endif
+        break;
+    case NUMBER_DECIMAL64:
+        eval_flattree_batch_decimal(tree, DECIMAL64, slot, x, y, n);
+        break;
+    case NUMBER_DECIMAL128:
+        eval_flattree_batch_decimal(tree, DECIMAL128, slot, x, y, n);
+        break;
+    default:
+        g_assert_not_reached();
+    }
+    stats_record_time(STAT_EVAL, start);
 }
@@ -20,8 +20,42 @@
 
 #include <glib.h>
 #include "parsetree.h"
+#include "flattree.h"
+#include "matrix.h"
+#include "rational.h"
+#include "profile.h"
 
 double eval_parse_tree(node_t *parsetree, gboolean use_degrees);
+double eval_flattree(const flattree_t *tree, gboolean use_degrees);
+matrix_t *eval_flattree_matrix(const flattree_t *tree, gboolean use_degrees,
+                               GError **err);
+matrix_t *eval_flattree_matrix_vars(const flattree_t *tree,
+                                    const double *values,
+                                    gboolean use_degrees, GError **err);
+double eval_flattree_vars(const flattree_t *tree, const double *values,
+                          gboolean use_degrees);
+double eval_flattree_profile(const flattree_t *tree, const double *values,
+                             profile_t *prof, gboolean use_degrees);
+/* Number types for eval_flattree_typed() and eval_flattree_batch_typed().
+   NUMBER_FLOAT128 needs libquadmath.  The decimal types are decimal floating
+   point, see decimal.h. */
+typedef enum { NUMBER_FLOAT, NUMBER_DOUBLE, NUMBER_LONG_DOUBLE,
+               NUMBER_FLOAT128, NUMBER_DECIMAL64, NUMBER_DECIMAL128,
+               N_NUMBER_TYPES } number_type_t;
+
+gint find_number_type(const char *name);
+const char *number_type_name(number_type_t type);
+gchar *eval_flattree_typed(const flattree_t *tree, number_type_t type,
+                           const double *values, gboolean use_degrees);
+void eval_flattree_batch_typed(const flattree_t *tree, number_type_t type,
+                               gint slot, const double *x, double *y,
+                               gsize n, gboolean use_degrees);
+rational_t eval_flattree_rational(const flattree_t *tree, gboolean use_degrees);
+void eval_flattree_batch(const flattree_t *tree, gint slot, const double *x,
+                         double *y, gsize n, gboolean use_degrees);
+void eval_flattree_columns(const flattree_t *tree, const double * const *cols,
+                           gint n_cols, double *y, gsize n,
+                           gboolean use_degrees);
 
 double my_sin(double x);
 double my_cos(double x);
@@ -30,4 +64,15 @@ double my_asin(double x);
 double my_acos(double x);
 double my_atan(double x);
 
+double my_dsin(double x);
+double my_dcos(double x);
+double my_dtan(double x);
+double my_dasin(double x);
+double my_dacos(double x);
+double my_datan(double x);
+
+void my_vsin(const double *x, double *y, gsize n);
+void my_vcos(const double *x, double *y, gsize n);
+void my_vtan(const double *x, double *y, gsize n);
+
 #endif // !__EVAL_H__
@@ -0,0 +1,347 @@
+/*
+ *  Copyright (C) 2010 Erik Edelmann <erik.edelmann@iki.fi>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/* Evaluation time of huge expressions with different numbers of threads, of
+   batches with different number types, and of changes to a worksheet of
+   definitions.
+
+   evalbench            time every expression with 1, 2, 4, ... threads, up
+                        to the number of processors, a batch of values
+                        with every number type, and the worksheet
+   evalbench --check    only check that the results don't depend on the number
+                        of threads, that the number types agree, and that the
+                        worksheet gets the right values */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <glib.h>
+#include "parser.h"
+#include "eval.h"
+#include "parallel.h"
+#include "session.h"
+
+#define N_TERMS 200000
+#define BENCH_TIME 500000       // microseconds per measurement
+#define N_VALUES 65536          // in a batch
+#define N_SAMPLES 1000          // for the errors of the number types
+
+// Evaluated for x = 0 ... 10 with every number type
+#define TYPED_EXPR "sin(x)*exp(-x/4) + x^3/7 - sqrt(x)*cos(3*x) + 0.1"
+#define ARITH_EXPR "(x*1.07 + 2.5)*12 - x/3 + 0.15*x*x"
+
+// The worksheet: a chain of N_DEFS definitions that all depend on 'rate', and
+// as many that don't
+#define N_DEFS 500
+
+typedef struct {
+    const char *name;
+    const char *term;           // printf format of term k
+    const char *op;             // between the terms
+} bench_t;
+
+static const bench_t benches[] = {
+    { "sum", "sin(%d)", " + " },
+    { "product", "(1 + 1/(%d^2 + 1))", " * " },
+    { "mixed", "sqrt(%d)*cos(%d/7)", " - " },
+    { NULL, NULL, NULL }
+};
+
+
+static flattree_t *build(const bench_t *b)
+{
+    flattree_t *tree;
+    GString *s;
+    GError *err = NULL;
+    gint k;
+
+    s = g_string_new(NULL);
+    for (k = 1; k <= N_TERMS; k++) {
+        if (k > 1)
+            g_string_append(s, b->op);
+        g_string_append_printf(s, b->term, k, k);
+    }
+
+    tree = build_flattree(s->str, &err);
+    if (!tree) {
+        fprintf(stderr, "%s: %s\n", b->name, err ? err->message : "no tree");
+        exit(1);
+    }
+    g_string_free(s, TRUE);
+
+    return tree;
+}
+
+
+/* Milliseconds per evaluation. */
+
+static double timing(const flattree_t *tree, double *r)
+{
+    gint64 start, elapsed;
+    guint count = 0;
+
+    start = g_get_monotonic_time();
+    do {
+        *r = eval_flattree(tree, FALSE);
+        count++;
+        elapsed = g_get_monotonic_time() - start;
+    } while (elapsed < BENCH_TIME);
+
+    return elapsed/1000.0/count;
+}
+
+
+/* Millions of values per second for a batch of type 'type'. */
+
+static double typed_throughput(const flattree_t *tree, number_type_t type)
+{
+    double *x, *y;
+    gint64 start, elapsed;
+    guint64 count = 0;
+    gsize i;
+
+    x = g_new(double, N_VALUES);
+    y = g_new(double, N_VALUES);
+    for (i = 0; i < N_VALUES; i++)
+        x[i] = 10.0*i/N_VALUES;
+
+    start = g_get_monotonic_time();
+    do {
+        eval_flattree_batch_typed(tree, type, 0, x, y, N_VALUES, FALSE);
+        count += N_VALUES;
+        elapsed = g_get_monotonic_time() - start;
+    } while (elapsed < BENCH_TIME);
+
+    g_free(x);
+    g_free(y);
+
+    return (double)count/elapsed;
+}
+
+
+/* The largest difference between the results with 'type' and with 'ref',
+   relative to the largest result.  The results are read back as long
+   doubles. */
+
+static long double typed_error(const flattree_t *tree, number_type_t type,
+                               number_type_t ref)
+{
+    long double err = 0, scale = 0, a, b;
+    gchar *sa, *sb;
+    double x;
+    gint i;
+
+    for (i = 0; i < N_SAMPLES; i++) {
+        x = 10.0*i/N_SAMPLES;
+        sa = eval_flattree_typed(tree, type, &x, FALSE);
+        sb = eval_flattree_typed(tree, ref, &x, FALSE);
+        a = strtold(sa, NULL);
+        b = strtold(sb, NULL);
+        err = MAX(err, fabsl(a - b));
+        scale = MAX(scale, fabsl(b));
+        g_free(sa);
+        g_free(sb);
+    }
+
+    return (scale > 0) ? err/scale : err;
+}
+
+
+/* Time and compare the number types, with an expression with functions and
+   one with only arithmetic.  The most precise type there is serves as the
+   reference. */
+
+static gboolean bench_types(gboolean check)
+{
+    static const long double max_error[N_NUMBER_TYPES] = {
+        1e-6, 1e-15, 1e-15, 1e-15, 1e-15, 1e-15
+    };
+    const char *var = "x";
+    flattree_t *tree, *arith;
+    GError *err = NULL;
+    gboolean ok = TRUE;
+    long double e;
+    gint type, ref;
+
+    tree = build_flattree_vars(TYPED_EXPR, &var, 1, &err);
+    arith = tree ? build_flattree_vars(ARITH_EXPR, &var, 1, &err) : NULL;
+    if (!tree || !arith) {
+        fprintf(stderr, "%s\n", err ? err->message : "no tree");
+        free_flattree(tree);
+        return FALSE;
+    }
+
+    ref = (find_number_type("float128") >= 0) ? NUMBER_FLOAT128
+                                              : NUMBER_LONG_DOUBLE;
+
+    if (!check)
+        printf("\n%-12s %10s %10s %14s\n%-12s %10s %10s\n", "",
+               "functions", "arithm.", "max rel. error", "", "Mvalues/s",
+               "Mvalues/s");
+    for (type = 0; type < N_NUMBER_TYPES; type++) {
+        if (find_number_type(number_type_name(type)) < 0)
+            continue;
+        e = MAX(typed_error(tree, type, ref), typed_error(arith, type, ref));
+        if (check && e > max_error[type]) {
+            printf("%s: relative error %Lg\n", number_type_name(type), e);
+            ok = FALSE;
+        }
+        if (!check)
+            printf("%-12s %10.1f %10.1f %14.2Lg\n", number_type_name(type),
+                   typed_throughput(tree, type),
+                   typed_throughput(arith, type), e);
+    }
+
+    free_flattree(tree);
+    free_flattree(arith);
+    return ok;
+}
+
+
+static session_t *worksheet(void)
+{
+    session_t *session = session_new(FALSE);
+    char line[64];
+    guint i;
+
+    g_free(session_enter(session, "rate = 0.05", "%g", NULL));
+    g_free(session_enter(session, "b0 = 1000", "%g", NULL));
+    for (i = 1; i < N_DEFS; i++) {
+        g_snprintf(line, sizeof(line), "b%u = b%u*(1 + rate/12) - 10", i, i-1);
+        g_free(session_enter(session, line, "%g", NULL));
+        g_snprintf(line, sizeof(line), "u%u = %u*2 + 1", i, i);
+        g_free(session_enter(session, line, "%g", NULL));
+    }
+
+    return session;
+}
+
+
+/* Microseconds per call of session_enter(session, input), and the number of
+   definitions computed by each. */
+
+static double session_timing(session_t *session, const char *input,
+                             guint64 *n_evals)
+{
+    guint64 n0 = session_get_evaluations(session);
+    gint64 start = g_get_monotonic_time(), t;
+    guint n = 0;
+
+    do {
+        g_free(session_enter(session, input, "%g", NULL));
+        n++;
+        t = g_get_monotonic_time() - start;
+    } while (t < BENCH_TIME);
+
+    *n_evals = (session_get_evaluations(session) - n0)/n;
+    return (double)t/n;
+}
+
+
+static gboolean bench_session(gboolean check)
+{
+    session_t *session;
+    gint64 start;
+    guint64 n;
+    double b, x;
+    guint i, runs;
+
+    if (check) {
+        session = worksheet();
+        g_free(session_enter(session, "rate = 0.06", "%g", NULL));
+        for (x = 1000, i = 1; i < N_DEFS; i++)
+            x = x*(1 + 0.06/12) - 10;
+        session_lookup(session, "b499", &b);
+        session_free(session);
+        if (fabs(b - x) > 1e-12*fabs(x)) {
+            printf("worksheet: %.17g, should be %.17g\n", b, x);
+            return FALSE;
+        }
+        return TRUE;
+    }
+
+    start = g_get_monotonic_time();
+    for (runs = 0; g_get_monotonic_time() - start < BENCH_TIME; runs++)
+        session_free(worksheet());
+    printf("\n%-24s %10s %12s\n", "worksheet", "us", "definitions");
+    printf("%-24s %10.1f %12u\n", "from scratch",
+           (double)(g_get_monotonic_time() - start)/runs, 2*N_DEFS - 1);
+
+    session = worksheet();
+    x = session_timing(session, "rate = 0.06", &n);
+    printf("%-24s %10.1f %12" G_GUINT64_FORMAT "\n", "rate = 0.06", x, n);
+    x = session_timing(session, "u7 = 3", &n);
+    printf("%-24s %10.1f %12" G_GUINT64_FORMAT "\n", "u7 = 3", x, n);
+    session_free(session);
+
+    return TRUE;
+}
+
+
+int main(int argc, char **argv)
+{
+    gboolean check = argc > 1 && strcmp(argv[1], "--check") == 0;
+    gboolean ok = TRUE;
+    flattree_t *tree;
+    guint i, n, n_procs;
+    double r, r1, t, t1;
+
+    n_procs = g_get_num_processors();
+
+    if (!check)
+        printf("%-8s %8s %10s %8s\n", "", "threads", "ms", "speedup");
+
+    for (i = 0; benches[i].name; i++) {
+        tree = build(&benches[i]);
+
+        if (check) {
+            // More threads than processors is fine for checking
+            parallel_set_threads(1);
+            r1 = eval_flattree(tree, FALSE);
+            for (n = 2; n <= 8; n++) {
+                parallel_set_threads(n);
+                r = eval_flattree(tree, FALSE);
+                if (memcmp(&r, &r1, sizeof(r)) != 0) {
+                    printf("%s: %.17g with %u threads, %.17g with one\n",
+                           benches[i].name, r, n, r1);
+                    ok = FALSE;
+                }
+            }
+        } else {
+            for (n = 1; ; n = MIN(2*n, n_procs)) {
+                parallel_set_threads(n);
+                t = timing(tree, &r);
+                if (n == 1)
+                    t1 = t;
+                printf("%-8s %8u %10.2f %8.2f\n", benches[i].name, n, t,
+                       t1/t);
+                if (n == n_procs)
+                    break;
+            }
+        }
+
+        free_flattree(tree);
+    }
+    parallel_set_threads(0);
+
+    ok = bench_types(check) && ok;
+    ok = bench_session(check) && ok;
+
+    return ok ? 0 : 1;
+}
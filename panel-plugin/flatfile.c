@@ -0,0 +1,492 @@
+/*
+ *  Copyright (C) 2010 Erik Edelmann <erik.edelmann@iki.fi>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+#include <string.h>
+#include <math.h>
+#include <glib.h>
+#include "constants.h"
+#include "flattree.h"
+#include "functions.h"
+#include "matrix.h"
+#include "units.h"
+#include "flatfile.h"
+
+/* 
+ * The layout: a header_t, then one entry_t per tree, then the arrays of the
+ * trees.  Everything is in the byte order of the machine, and every array
+ * is aligned for its type (the file is mapped at a page boundary).
+ */
+
+#define MAGIC "CALCTREE"
+#define BYTE_ORDER_MARK 0x01020304
+
+#define HAS_MATRICES 1
+#define HAS_UNITS    2
+#define USES_FMA     4
+
+typedef struct {
+    char magic[8];
+    guint32 version, byte_order;
+    guint32 symbols;            // symbols_hash() of the writer
+    guint32 n_trees;
+    guint64 size;               // Of the whole file
+} header_t;
+
+// Offsets from the start of the file; unit_text, lits and lit_source are 0
+// if there are none
+typedef struct {
+    guint64 nums, arg, left, right, type, var_names, unit_text, source;
+    guint64 lits, lit_source;
+    guint32 n_nodes, n_nums, n_vars, root;
+    guint32 flags, padding;
+} entry_t;
+
+struct _flatfile_t {
+    GMappedFile *map;
+    const char *data;
+    gsize size;
+    const header_t *header;
+    const entry_t *entries;
+};
+
+
+/* FNV-1a of 's' and its '\0', continuing from 'h'. */
+
+static guint32 hash_string(guint32 h, const char *s)
+{
+    do
+        h = (h ^ (guchar)*s)*16777619u;
+    while (*s++);
+
+    return h;
+}
+
+
+/* A hash of the names in the tables the trees refer to by index. */
+
+static guint32 symbols_hash(void)
+{
+    guint32 h = 2166136261u;
+    gsize i;
+
+    for (i = 0; functions[i].name; i++)
+        h = hash_string(h, functions[i].name);
+    for (i = 0; matrix_functions[i].name; i++)
+        h = hash_string(h, matrix_functions[i].name);
+    for (i = 0; i < n_units; i++)
+        h = hash_string(h, units[i].name);
+
+    return h;
+}
+
+
+/* Append 'n' bytes from 'p' to 'buf', after padding it to a multiple of
+   'align'.  Return the offset they went to. */
+
+static guint64 append(GByteArray *buf, const void *p, gsize n, gsize align)
+{
+    static const guint8 zeros[8] = {0};
+    guint64 offset;
+
+    g_byte_array_append(buf, zeros, (align - buf->len % align) % align);
+    offset = buf->len;
+    g_byte_array_append(buf, p, n);
+
+    return offset;
+}
+
+
+gboolean flatfile_write(const char *path, const flattree_t * const *trees,
+                        const char * const *sources, guint n, GError **err)
+{
+    GByteArray *buf;
+    header_t header;
+    entry_t *entries;
+    const flattree_t *t;
+    gboolean ok;
+    guint i;
+
+    buf = g_byte_array_new();
+    entries = g_new0(entry_t, n);
+
+    // The header and entries are filled in last
+    memset(&header, 0, sizeof(header));
+    append(buf, &header, sizeof(header), 8);
+    for (i = 0; i < n; i++)
+        append(buf, &entries[i], sizeof(entry_t), 8);
+
+    for (i = 0; i < n; i++) {
+        t = trees[i];
+        entries[i].n_nodes = t->n_nodes;
+        entries[i].n_nums = t->n_nums;
+        entries[i].n_vars = t->n_vars;
+        entries[i].root = t->root;
+        entries[i].flags = (t->has_matrices ? HAS_MATRICES : 0) |
+                           (t->has_units ? HAS_UNITS : 0) |
+                           (t->fma ? USES_FMA : 0);
+        entries[i].nums = append(buf, t->nums, t->n_nums*sizeof(double), 8);
+        entries[i].arg = append(buf, t->arg, t->n_nodes*sizeof(guint32), 4);
+        entries[i].left = append(buf, t->left, t->n_nodes*sizeof(node_id_t),
+                                 4);
+        entries[i].right = append(buf, t->right,
+                                  t->n_nodes*sizeof(node_id_t), 4);
+        entries[i].type = append(buf, t->type, t->n_nodes, 1);
+        entries[i].var_names = append(buf, t->var_names,
+                                      t->n_vars*(MAX_ID_LEN+1), 1);
+        if (t->unit_text)
+            entries[i].unit_text = append(buf, t->unit_text,
+                                          strlen(t->unit_text) + 1, 1);
+        entries[i].source = append(buf, sources[i], strlen(sources[i]) + 1,
+                                   1);
+        if (t->lits) {
+            entries[i].lits = append(buf, t->lits,
+                                     t->n_nums*sizeof(guint32), 4);
+            entries[i].lit_source = append(buf, t->source,
+                                           strlen(t->source) + 1, 1);
+        }
+    }
+
+    memcpy(header.magic, MAGIC, sizeof(header.magic));
+    header.version = FLATFILE_VERSION;
+    header.byte_order = BYTE_ORDER_MARK;
+    header.symbols = symbols_hash();
+    header.n_trees = n;
+    header.size = buf->len;
+    memcpy(buf->data, &header, sizeof(header));
+    memcpy(buf->data + sizeof(header), entries, n*sizeof(entry_t));
+
+    ok = g_file_set_contents(path, (const gchar *)buf->data, buf->len, err);
+
+    g_free(entries);
+    g_byte_array_free(buf, TRUE);
+    return ok;
+}
+
+
+/* Is there room for 'n' elements of size 'size' at 'offset', and is the
+   offset aligned for them? */
+
+static gboolean in_file(const flatfile_t *file, guint64 offset, guint64 n,
+                        gsize size, gsize align)
+{
+    return offset % align == 0 && offset <= file->size &&
+           n <= (file->size - offset)/size;
+}
+
+
+static gboolean is_string(const flatfile_t *file, guint64 offset)
+{
+    return offset < file->size &&
+           memchr(file->data + offset, '\0', file->size - offset) != NULL;
+}
+
+
+static gsize count_functions(void)
+{
+    gsize n = 0;
+
+    while (functions[n].name)
+        n++;
+    return n;
+}
+
+
+static gsize count_matrix_functions(void)
+{
+    gsize n = 0;
+
+    while (matrix_functions[n].name)
+        n++;
+    return n;
+}
+
+
+// What a node must be used as, if it's OP_RANGE, OP_BRANCHES or OP_ARGS
+#define USE_RANGE    1
+#define USE_BRANCHES 2
+#define USE_ARGS     4
+
+/* Is 'id', a child of 'parent', an OP_RANGE etc. node?  Mark it as used
+   that way. */
+
+static gboolean is_operator(const flattree_t *t, guint8 *use, node_id_t parent,
+                            node_id_t id, operator_type_t op, guint8 how)
+{
+    if (id >= parent || t->type[id] != NODE_OPERATOR || t->arg[id] != op)
+        return FALSE;
+    use[id] |= how;
+    return TRUE;
+}
+
+
+/* Check that the nodes of 't', which are straight from the file, are a tree
+   that the evaluators can walk: the arguments are inside their tables, and
+   every node has the children its type needs.  The parents come after their
+   children, so going backwards, the uses of a node are known when it's
+   reached. */
+
+static gboolean check_nodes(const flattree_t *t, gsize n_funs,
+                            gsize n_matfuns)
+{
+    guint8 *use;
+    guint32 arg;
+    node_id_t id, l, r, elem, parent;
+    gsize n;
+    double degree;
+    gboolean ok = TRUE;
+
+    use = g_malloc0(t->n_nodes);
+
+    for (id = t->n_nodes; ok && id-- > 0; ) {
+        l = t->left[id];
+        r = t->right[id];
+        arg = t->arg[id];
+        if ((l != NO_NODE && l >= id) || (r != NO_NODE && r >= id)) {
+            ok = FALSE;
+            break;
+        }
+
+        switch (t->type[id]) {
+        case NODE_NUMBER:
+            ok = arg < t->n_nums;
+            break;
+        case NODE_OPERATOR:
+            switch (arg) {
+            case OP_UMINUS:
+            case OP_NOT:
+                ok = l == NO_NODE && r != NO_NODE;
+                break;
+            case OP_COND:
+                ok = l != NO_NODE &&
+                     is_operator(t, use, id, r, OP_BRANCHES, USE_BRANCHES);
+                break;
+            case OP_RANGE:
+            case OP_BRANCHES:
+            case OP_ARGS:
+                // Only as the child of the nodes that expect them
+                ok = l != NO_NODE && r != NO_NODE &&
+                     use[id] == (arg == OP_RANGE ? USE_RANGE :
+                                 arg == OP_BRANCHES ? USE_BRANCHES : USE_ARGS);
+                break;
+            default:
+                ok = arg < OP_RANGE && l != NO_NODE && r != NO_NODE;
+            }
+            break;
+        case NODE_FUNCTION:
+            ok = arg < n_funs && r != NO_NODE &&
+                 (l != NO_NODE) == (functions[arg].fun2 != NULL);
+            break;
+        case NODE_VARIABLE:
+            ok = arg < t->n_vars;
+            break;
+        case NODE_SUM:
+        case NODE_PROD:
+            ok = arg < t->n_vars && r != NO_NODE &&
+                 is_operator(t, use, id, l, OP_RANGE, USE_RANGE);
+            break;
+        case NODE_INTEGRAL:
+        case NODE_INTEGRAL_ERR:
+            ok = arg < t->n_vars && l != NO_NODE &&
+                 is_operator(t, use, id, r, OP_ARGS, USE_ARGS) &&
+                 is_operator(t, use, r, t->left[r], OP_RANGE, USE_RANGE);
+            break;
+        case NODE_SOLVE:
+            ok = arg < t->n_vars && l != NO_NODE &&
+                 is_operator(t, use, id, r, OP_RANGE, USE_RANGE);
+            break;
+        case NODE_MATRIX:
+            n = 1;
+            for (parent = id, elem = r;
+                 is_operator(t, use, parent, elem, OP_ARGS, USE_ARGS);
+                 parent = elem, elem = t->left[elem])
+                n++;
+            ok = t->has_matrices && r != NO_NODE && arg > 0 && n % arg == 0;
+            break;
+        case NODE_MATFUN:
+            ok = t->has_matrices && arg < n_matfuns && r != NO_NODE &&
+                 (l != NO_NODE) == (matrix_functions[arg].n_args == 2);
+            break;
+        case NODE_UNIT:
+            ok = t->has_units && arg < n_units;
+            break;
+        case NODE_CONVERT:
+            ok = t->has_units && l != NO_NODE && r != NO_NODE;
+            break;
+        case NODE_POLY:
+            // The degree and the coefficients
+            ok = arg < t->n_nums && r != NO_NODE;
+            if (ok) {
+                degree = t->nums[arg];
+                ok = degree >= 0 && degree == floor(degree) &&
+                     degree < t->n_nums - arg - 1;
+            }
+            break;
+        default:
+            ok = FALSE;
+        }
+    }
+
+    // The root can't be a part of another node
+    if (ok && t->root != NO_NODE)
+        ok = use[t->root] == 0 && !(t->type[t->root] == NODE_OPERATOR &&
+                                   t->arg[t->root] >= OP_BRANCHES);
+
+    g_free(use);
+    return ok;
+}
+
+
+/* Check that the arrays of the entries are inside the file, and that the
+   trees in them are sound; the file may have been damaged. */
+
+static gboolean check_entries(const flatfile_t *file)
+{
+    const entry_t *e;
+    flattree_t t;
+    gsize n_funs, n_matfuns, len;
+    guint i, j;
+
+    n_funs = count_functions();
+    n_matfuns = count_matrix_functions();
+
+    for (i = 0; i < file->header->n_trees; i++) {
+        e = &file->entries[i];
+        if (!in_file(file, e->nums, e->n_nums, sizeof(double), 8) ||
+            !in_file(file, e->arg, e->n_nodes, sizeof(guint32), 4) ||
+            !in_file(file, e->left, e->n_nodes, sizeof(node_id_t), 4) ||
+            !in_file(file, e->right, e->n_nodes, sizeof(node_id_t), 4) ||
+            !in_file(file, e->type, e->n_nodes, 1, 1) ||
+            !in_file(file, e->var_names, e->n_vars, MAX_ID_LEN+1, 1) ||
+            (e->unit_text && !is_string(file, e->unit_text)) ||
+            !is_string(file, e->source) ||
+            (e->lits && !in_file(file, e->lits, e->n_nums, sizeof(guint32),
+                                 4)) ||
+            (e->lits && !is_string(file, e->lit_source)) ||
+            (e->root != NO_NODE && e->root >= e->n_nodes) ||
+            e->n_vars > MAX_VARS)
+            return FALSE;
+
+        flatfile_get(file, i, &t);
+        for (j = 0; j < t.n_vars; j++)
+            if (!memchr(t.var_names[j], '\0', MAX_ID_LEN+1))
+                return FALSE;
+        if (t.lits) {
+            len = strlen(t.source);
+            for (j = 0; j < t.n_nums; j++)
+                if (t.lits[j] != NO_LITERAL && t.lits[j] != NAMED_CONSTANT &&
+                    t.lits[j] >= len)
+                    return FALSE;
+        }
+        if (!check_nodes(&t, n_funs, n_matfuns))
+            return FALSE;
+    }
+
+    return TRUE;
+}
+
+
+flatfile_t *flatfile_open(const char *path, GError **err)
+{
+    flatfile_t *file;
+    const header_t *h;
+
+    file = g_new0(flatfile_t, 1);
+    file->map = g_mapped_file_new(path, FALSE, err);
+    if (!file->map) {
+        g_free(file);
+        return NULL;
+    }
+    file->data = g_mapped_file_get_contents(file->map);
+    file->size = g_mapped_file_get_length(file->map);
+
+    h = file->header = (const header_t *)file->data;
+    if (file->size < sizeof(header_t) ||
+        memcmp(h->magic, MAGIC, sizeof(h->magic)) != 0) {
+        g_set_error(err, 0, -1, "%s: Not a file of compiled expressions",
+                    path);
+    } else if (h->version != FLATFILE_VERSION ||
+               h->byte_order != BYTE_ORDER_MARK ||
+               h->symbols != symbols_hash()) {
+        g_set_error(err, 0, -1, "%s: Compiled by an incompatible version",
+                    path);
+    } else if (h->size != file->size ||
+               !in_file(file, sizeof(header_t), h->n_trees,
+                        sizeof(entry_t), 8)) {
+        g_set_error(err, 0, -1, "%s: File is truncated", path);
+    } else {
+        file->entries = (const entry_t *)(file->data + sizeof(header_t));
+        if (check_entries(file))
+            return file;
+        g_set_error(err, 0, -1, "%s: File is corrupt", path);
+    }
+
+    flatfile_close(file);
+    return NULL;
+}
+
+
+void flatfile_close(flatfile_t *file)
+{
+    if (!file) return;
+
+    g_mapped_file_unref(file->map);
+    g_free(file);
+}
+
+
+guint flatfile_count(const flatfile_t *file)
+{
+    return file->header->n_trees;
+}
+
+
+const char *flatfile_source(const flatfile_t *file, guint i)
+{
+    g_assert(i < file->header->n_trees);
+
+    return file->data + file->entries[i].source;
+}
+
+
+void flatfile_get(const flatfile_t *file, guint i, flattree_t *tree)
+{
+    const entry_t *e;
+
+    g_assert(i < file->header->n_trees);
+    e = &file->entries[i];
+
+    tree->n_nodes = tree->size = e->n_nodes;
+    tree->type = (guint8 *)(file->data + e->type);
+    tree->arg = (guint32 *)(file->data + e->arg);
+    tree->left = (node_id_t *)(file->data + e->left);
+    tree->right = (node_id_t *)(file->data + e->right);
+    tree->root = e->root;
+    tree->has_matrices = (e->flags & HAS_MATRICES) != 0;
+    tree->has_units = (e->flags & HAS_UNITS) != 0;
+    tree->fma = (e->flags & USES_FMA) != 0;
+    tree->unit_text = e->unit_text ? (char *)(file->data + e->unit_text)
+                                   : NULL;
+    tree->n_nums = tree->nums_size = e->n_nums;
+    tree->nums = (double *)(file->data + e->nums);
+    tree->lits = e->lits ? (guint32 *)(file->data + e->lits) : NULL;
+    tree->source = e->lits ? (char *)(file->data + e->lit_source) : NULL;
+    tree->n_vars = e->n_vars;
+    tree->n_scope = 0;
+    tree->var_names = (char (*)[MAX_ID_LEN+1])(file->data + e->var_names);
+    tree->scope = NULL;
+    tree->outer = NULL;
+}
@@ -0,0 +1,59 @@
+/*
+ *  Copyright (C) 2010 Erik Edelmann <erik.edelmann@iki.fi>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+#ifndef __FLATFILE_H__
+#define __FLATFILE_H__
+
+#include <glib.h>
+#include "flattree.h"
+
+/* 
+ * A file of compiled expressions.  The flattrees are stored as they are in
+ * memory (nodes, numbers and variable names, with functions and units as
+ * indices into their tables), together with the text they came from, so
+ * that they can be used straight from the mapped file: opening the file
+ * doesn't parse or allocate anything per expression.  It does check every
+ * node, in one pass, so that a damaged file is refused instead of crashing
+ * the evaluation.
+ *
+ * The file is only valid for the program that wrote it, or one with the
+ * same function and unit tables and byte order; this is checked when it's
+ * opened.  Bump FLATFILE_VERSION if node_type_t, operator_type_t or the
+ * layout changes.
+ */
+
+#define FLATFILE_VERSION 3
+
+typedef struct _flatfile_t flatfile_t;
+
+/* Write the 'n' trees in 'trees', and the expressions 'sources' they were
+   built from, to 'path'. */
+gboolean flatfile_write(const char *path, const flattree_t * const *trees,
+                        const char * const *sources, guint n, GError **err);
+
+flatfile_t *flatfile_open(const char *path, GError **err);
+void flatfile_close(flatfile_t *file);
+
+guint flatfile_count(const flatfile_t *file);
+const char *flatfile_source(const flatfile_t *file, guint i);
+
+/* Make 'tree' tree number 'i' of 'file'.  The arrays of 'tree' point into
+   the file, so it must not be changed or freed, and it's only valid until
+   the file is closed. */
+void flatfile_get(const flatfile_t *file, guint i, flattree_t *tree);
+
+#endif
@@ -0,0 +1,469 @@
+/*
+ *  Copyright (C) 2010 Erik Edelmann <erik.edelmann@iki.fi>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+#include "flattree.h"
+#include "functions.h"
+#include "stats.h"
+
+#define INITIAL_SIZE 16
+
+
+flattree_t *flattree_new(void)
+{
+    flattree_t *tree;
+
+    tree = g_malloc(sizeof(flattree_t));
+    tree->n_nodes = 0;
+    tree->size = INITIAL_SIZE;
+    tree->type = g_new(guint8, tree->size);
+    tree->arg = g_new(guint32, tree->size);
+    tree->left = g_new(node_id_t, tree->size);
+    tree->right = g_new(node_id_t, tree->size);
+    tree->root = NO_NODE;
+    tree->has_matrices = FALSE;
+    tree->has_units = FALSE;
+    tree->unit_text = NULL;
+    tree->fma = FALSE;
+
+    tree->n_nums = 0;
+    tree->nums_size = INITIAL_SIZE;
+    tree->nums = g_new(double, tree->nums_size);
+    stats_count(STAT_ALLOCATIONS, 6);
+    tree->lits = NULL;
+    tree->source = NULL;
+
+    tree->n_vars = tree->n_scope = 0;
+    tree->var_names = NULL;
+    tree->scope = NULL;
+    tree->outer = NULL;
+
+    return tree;
+}
+
+
+void free_flattree(flattree_t *tree)
+{
+    if (!tree) return;
+
+    g_free(tree->type);
+    g_free(tree->arg);
+    g_free(tree->left);
+    g_free(tree->right);
+    g_free(tree->nums);
+    g_free(tree->lits);
+    g_free(tree->source);
+    g_free(tree->var_names);
+    g_free(tree->scope);
+    g_free(tree->unit_text);
+    g_free(tree);
+}
+
+
+node_id_t flattree_add_node(flattree_t *tree, node_type_t type, guint32 arg,
+                            node_id_t left, node_id_t right)
+{
+    node_id_t id;
+
+    g_assert(tree);
+
+    if (tree->n_nodes == tree->size) {
+        tree->size *= 2;
+        tree->type = g_renew(guint8, tree->type, tree->size);
+        tree->arg = g_renew(guint32, tree->arg, tree->size);
+        tree->left = g_renew(node_id_t, tree->left, tree->size);
+        tree->right = g_renew(node_id_t, tree->right, tree->size);
+        stats_count(STAT_ALLOCATIONS, 4);
+    }
+
+    id = tree->n_nodes++;
+    tree->type[id] = type;
+    tree->arg[id] = arg;
+    tree->left[id] = left;
+    tree->right[id] = right;
+    if (type == NODE_MATRIX || type == NODE_MATFUN)
+        tree->has_matrices = TRUE;
+    else if (type == NODE_UNIT)
+        tree->has_units = TRUE;
+
+    return id;
+}
+
+
+/* Make room for n more numbers.  'lits' is only there once a literal has
+   been added; until then, none of the numbers count as written. */
+
+static void reserve_nums(flattree_t *tree, guint32 n)
+{
+    guint32 i;
+
+    if (tree->n_nums + n > tree->nums_size) {
+        while (tree->n_nums + n > tree->nums_size)
+            tree->nums_size *= 2;
+        tree->nums = g_renew(double, tree->nums, tree->nums_size);
+        stats_count(STAT_ALLOCATIONS, 1);
+        if (tree->lits) {
+            tree->lits = g_renew(guint32, tree->lits, tree->nums_size);
+            stats_count(STAT_ALLOCATIONS, 1);
+        }
+    }
+    if (tree->lits)
+        for (i = 0; i < n; i++)
+            tree->lits[tree->n_nums + i] = NO_LITERAL;
+}
+
+
+node_id_t flattree_add_number(flattree_t *tree, double num)
+{
+    reserve_nums(tree, 1);
+    tree->nums[tree->n_nums] = num;
+
+    return flattree_add_node(tree, NODE_NUMBER, tree->n_nums++, NO_NODE, NO_NODE);
+}
+
+
+/* A number that is 'num' in double, and was written at 'offset' in the
+   source of the tree (which the parser sets when it's done).  Evaluating
+   with decimals or fractions parses the literal again, so that no digits
+   are lost.  'offset' is NAMED_CONSTANT for constants like pi. */
+
+node_id_t flattree_add_literal(flattree_t *tree, double num, guint32 offset)
+{
+    guint32 i;
+
+    if (!tree->lits) {
+        tree->lits = g_new(guint32, tree->nums_size);
+        stats_count(STAT_ALLOCATIONS, 1);
+        for (i = 0; i < tree->n_nums; i++)
+            tree->lits[i] = NO_LITERAL;
+    }
+    reserve_nums(tree, 1);
+    tree->nums[tree->n_nums] = num;
+    tree->lits[tree->n_nums] = offset;
+
+    return flattree_add_node(tree, NODE_NUMBER, tree->n_nums++, NO_NODE, NO_NODE);
+}
+
+
+/* Append the n numbers in x[] to 'nums', without any nodes.  Return the
+   index of the first one. */
+
+guint32 flattree_add_nums(flattree_t *tree, const double *x, guint32 n)
+{
+    guint32 first;
+
+    reserve_nums(tree, n);
+    first = tree->n_nums;
+    memcpy(tree->nums + first, x, n*sizeof(double));
+    tree->n_nums += n;
+
+    return first;
+}
+
+
+node_id_t flattree_add_operator(flattree_t *tree, operator_type_t op,
+                                node_id_t left, node_id_t right)
+{
+    return flattree_add_node(tree, NODE_OPERATOR, op, left, right);
+}
+
+
+node_id_t flattree_add_function(flattree_t *tree, gint fun, node_id_t arg)
+{
+    g_assert(fun >= 0 && functions[fun].fun);
+    return flattree_add_node(tree, NODE_FUNCTION, fun, NO_NODE, arg);
+}
+
+
+/* A function of two arguments; 'a' is NO_NODE for one of one argument. */
+
+node_id_t flattree_add_function2(flattree_t *tree, gint fun, node_id_t a,
+                                 node_id_t x)
+{
+    g_assert(fun >= 0 && (a == NO_NODE) == (functions[fun].fun2 == NULL));
+    return flattree_add_node(tree, NODE_FUNCTION, fun, a, x);
+}
+
+
+node_id_t flattree_add_variable(flattree_t *tree, gint slot)
+{
+    g_assert(slot >= 0 && slot < tree->n_vars);
+    return flattree_add_node(tree, NODE_VARIABLE, slot, NO_NODE, NO_NODE);
+}
+
+
+/* Return the lowest index in the subtree rooted at 'id'. */
+
+node_id_t flattree_first(const flattree_t *tree, node_id_t id)
+{
+    for (;;) {
+        if (tree->left[id] != NO_NODE)
+            id = tree->left[id];
+        else if (tree->right[id] != NO_NODE)
+            id = tree->right[id];
+        else
+            return id;
+    }
+}
+
+
+/* Return TRUE if every node in the subtree rooted at 'id' always evaluates all
+   its children, i.e. there are no conditionals, sums, integrals etc. */
+
+gboolean flattree_is_straight(const flattree_t *tree, node_id_t id)
+{
+    node_id_t i;
+
+    for (i = flattree_first(tree, id); i <= id; i++) {
+        switch (tree->type[i]) {
+        case NODE_NUMBER:
+        case NODE_FUNCTION:
+        case NODE_VARIABLE:
+        case NODE_POLY:
+            break;
+        case NODE_OPERATOR:
+            if (tree->arg[i] == OP_AND || tree->arg[i] == OP_OR ||
+                tree->arg[i] == OP_COND || tree->arg[i] == OP_BRANCHES ||
+                tree->arg[i] == OP_RANGE || tree->arg[i] == OP_ARGS)
+                return FALSE;
+            break;
+        default:
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+
+/* Create a new variable slot called 'name', and make it visible until the next
+   flattree_unbind_variable().  Return the slot, or -1 if there are too many
+   variables. */
+
+gint flattree_bind_variable(flattree_t *tree, const char *name)
+{
+    if (!tree->var_names) {
+        tree->var_names = g_malloc(MAX_VARS*sizeof(*tree->var_names));
+        tree->scope = g_new(guint32, MAX_VARS);
+        stats_count(STAT_ALLOCATIONS, 2);
+    }
+
+    if (tree->n_vars == MAX_VARS)
+        return -1;
+
+    g_strlcpy(tree->var_names[tree->n_vars], name, MAX_ID_LEN+1);
+    tree->scope[tree->n_scope++] = tree->n_vars;
+
+    return tree->n_vars++;
+}
+
+
+/* Like flattree_bind_variable(), but the slot goes to the outermost scope, and
+   stays visible after the current ones have ended. */
+
+gint flattree_bind_outer_variable(flattree_t *tree, const char *name)
+{
+    gint slot = flattree_bind_variable(tree, name);
+
+    if (slot >= 0) {
+        memmove(tree->scope + 1, tree->scope,
+                (tree->n_scope - 1)*sizeof(*tree->scope));
+        tree->scope[0] = slot;
+    }
+
+    return slot;
+}
+
+
+void flattree_unbind_variable(flattree_t *tree)
+{
+    g_assert(tree->n_scope > 0);
+    tree->n_scope--;
+}
+
+
+/* Return the slot of the innermost visible variable called 'name', or -1 if
+   there is none. */
+
+gint flattree_lookup_variable(const flattree_t *tree, const char *name)
+{
+    gint i;
+
+    for (i = tree->n_scope-1; i >= 0; i--) {
+        if (strcmp(tree->var_names[tree->scope[i]], name) == 0)
+            return tree->scope[i];
+    }
+
+    return -1;
+}
+
+
+static node_t *new_node(node_type_t type, node_t *left, node_t *right)
+{
+    node_t *node;
+
+    node = g_malloc(sizeof(node_t));
+    stats_count(STAT_ALLOCATIONS, 1);
+    node->type = type;
+    node->left = left;
+    node->right = right;
+
+    return node;
+}
+
+
+/* A NODE_POLY in Horner form, as multiplications and additions.  It's
+   always the strict form; node_t trees have no fma(). */
+
+static node_t *poly_to_parsetree(const flattree_t *tree, node_id_t id)
+{
+    const double *c = tree->nums + tree->arg[id];
+    node_t *p, *num;
+    gint i, n = c[0];
+
+    p = new_node(NODE_NUMBER, NULL, NULL);
+    p->val.num = c[1];
+    for (i = 2; i <= n + 1; i++) {
+        p = new_node(NODE_OPERATOR, p,
+                     flattree_to_parsetree(tree, tree->right[id]));
+        p->val.op = OP_TIMES;
+        if (c[i] != 0.0) {
+            num = new_node(NODE_NUMBER, NULL, NULL);
+            num->val.num = c[i];
+            p = new_node(NODE_OPERATOR, p, num);
+            p->val.op = OP_PLUS;
+        }
+    }
+
+    return p;
+}
+
+
+/* Build a node_t tree equivalent to the subtree of 'tree' rooted at 'id'. */
+
+node_t *flattree_to_parsetree(const flattree_t *tree, node_id_t id)
+{
+    node_t *node;
+
+    if (!tree || id == NO_NODE) return NULL;
+    if (tree->type[id] == NODE_POLY)
+        return poly_to_parsetree(tree, id);
+
+    node = g_malloc(sizeof(node_t));
+    stats_count(STAT_ALLOCATIONS, 1);
+    node->type = tree->type[id];
+    switch (node->type) {
+    case NODE_NUMBER:
+        node->val.num = tree->nums[tree->arg[id]];
+        break;
+    case NODE_OPERATOR:
+        node->val.op = tree->arg[id];
+        break;
+    case NODE_FUNCTION:
+        if (functions[tree->arg[id]].fun2)
+            node->val.fun2 = functions[tree->arg[id]].fun2;
+        else
+            node->val.fun = functions[tree->arg[id]].fun;
+        break;
+    case NODE_VARIABLE:
+    case NODE_SUM:
+    case NODE_PROD:
+    case NODE_INTEGRAL:
+    case NODE_INTEGRAL_ERR:
+    case NODE_SOLVE:
+        node->val.var = tree->arg[id];
+        break;
+    case NODE_MATRIX:
+        node->val.cols = tree->arg[id];
+        break;
+    case NODE_MATFUN:
+        node->val.matfun = tree->arg[id];
+        break;
+    case NODE_UNIT:
+        node->val.unit = tree->arg[id];
+        break;
+    case NODE_CONVERT:
+        break;
+    default:
+        g_assert_not_reached();
+    }
+    node->left = flattree_to_parsetree(tree, tree->left[id]);
+    node->right = flattree_to_parsetree(tree, tree->right[id]);
+
+    return node;
+}
+
+
+static node_id_t flatten_node(flattree_t *tree, const node_t *node)
+{
+    node_id_t left, right;
+
+    if (!node) return NO_NODE;
+
+    left = flatten_node(tree, node->left);
+    right = flatten_node(tree, node->right);
+
+    switch (node->type) {
+    case NODE_NUMBER:
+        return flattree_add_number(tree, node->val.num);
+    case NODE_OPERATOR:
+        return flattree_add_operator(tree, node->val.op, left, right);
+    case NODE_FUNCTION:
+        if (node->left)
+            return flattree_add_function2(
+                tree, find_function2_by_pointer(node->val.fun2), left, right);
+        return flattree_add_function(tree, find_function_by_pointer(node->val.fun),
+                                     right);
+    case NODE_VARIABLE:
+    case NODE_SUM:
+    case NODE_PROD:
+    case NODE_INTEGRAL:
+    case NODE_INTEGRAL_ERR:
+    case NODE_SOLVE:
+        tree->n_vars = MAX(tree->n_vars, node->val.var+1);
+        return flattree_add_node(tree, node->type, node->val.var, left, right);
+    case NODE_MATRIX:
+        return flattree_add_node(tree, node->type, node->val.cols, left, right);
+    case NODE_MATFUN:
+        return flattree_add_node(tree, node->type, node->val.matfun, left,
+                                 right);
+    case NODE_UNIT:
+        return flattree_add_node(tree, node->type, node->val.unit, left, right);
+    case NODE_CONVERT:
+        return flattree_add_node(tree, node->type, 0, left, right);
+    default:
+        g_assert_not_reached();
+    }
+
+    return NO_NODE;
+}
+
+
+/* Build a flattree equivalent to 'parsetree'.  All functions in the tree must
+   be in functions[]. */
+
+flattree_t *flatten_parsetree(const node_t *parsetree)
+{
+    flattree_t *tree;
+
+    tree = flattree_new();
+    tree->root = flatten_node(tree, parsetree);
+
+    return tree;
+}
@@ -0,0 +1,108 @@
+/*
+ *  Copyright (C) 2010 Erik Edelmann <erik.edelmann@iki.fi>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+#ifndef __FLATTREE_H__
+#define __FLATTREE_H__
+
+#include <glib.h>
+#include "constants.h"
+#include "parsetree.h"
+
+/* 
+ * A compact representation of a parse tree.  Instead of one heap allocated
+ * node_t per node, the nodes are stored in parallel arrays and refer to their
+ * children by 32 bit indices.  The 'arg' of a node is its operator_type_t
+ * (NODE_OPERATOR), its index in functions[] (NODE_FUNCTION), its index in
+ * 'nums' (NODE_NUMBER), the slot of its variable (NODE_VARIABLE, and the
+ * bound variable of NODE_SUM, NODE_PROD etc.), its number of columns
+ * (NODE_MATRIX), its index in matrix_functions[] (NODE_MATFUN), its index
+ * in units[] (NODE_UNIT), or the index in 'nums' of its degree n, followed by
+ * its n+1 coefficients, highest power first (NODE_POLY).
+ *
+ * Children always have lower indices than their parents, the left subtree of
+ * a node comes before the right one, and every subtree occupies a contiguous
+ * range of indices, ending with its root.  A subtree
+ * without control flow (see flattree_is_straight()) can therefore be evaluated
+ * bottom-up in a single sweep over that range.
+ */
+
+typedef guint32 node_id_t;
+
+#define NO_NODE ((node_id_t)-1)
+
+/* 'lits' of numbers that weren't written in the source, and of named
+   constants like pi, which are irrational */
+#define NO_LITERAL ((guint32)-1)
+#define NAMED_CONSTANT ((guint32)-2)
+
+typedef struct {
+    guint32 n_nodes, size;
+    guint8 *type;
+    guint32 *arg;
+    node_id_t *left, *right;
+    node_id_t root;
+    gboolean has_matrices;      // Are there NODE_MATRIX or NODE_MATFUN nodes?
+    gboolean has_units;         // Are there NODE_UNIT nodes?
+    char *unit_text;            // The unit after 'in', as written, or NULL
+    gboolean fma;               // Evaluate NODE_POLY with fma()?
+
+    guint32 n_nums, nums_size;
+    double *nums;
+    guint32 *lits;              // Where 'nums' were written, see
+    char *source;               // flattree_add_literal()
+
+    /* Variable slot i is called var_names[i].  While parsing, 'scope' lists
+       the slots that are visible, innermost last, and the names in 'outer'
+       get a slot in the outermost scope when they're first used. */
+    guint32 n_vars, n_scope;
+    char (*var_names)[MAX_ID_LEN+1];
+    guint32 *scope;
+    GHashTable *outer;          // See build_definition()
+} flattree_t;
+
+/* Can the tree be evaluated with plain numbers, without matrix_t values? */
+#define flattree_is_scalar(tree) (!(tree)->has_matrices && !(tree)->has_units)
+
+flattree_t *flattree_new(void);
+void free_flattree(flattree_t *tree);
+
+node_id_t flattree_add_number(flattree_t *tree, double num);
+node_id_t flattree_add_literal(flattree_t *tree, double num, guint32 offset);
+node_id_t flattree_add_operator(flattree_t *tree, operator_type_t op,
+                                node_id_t left, node_id_t right);
+node_id_t flattree_add_function(flattree_t *tree, gint fun, node_id_t arg);
+node_id_t flattree_add_function2(flattree_t *tree, gint fun, node_id_t a,
+                                 node_id_t x);
+node_id_t flattree_add_variable(flattree_t *tree, gint slot);
+guint32 flattree_add_nums(flattree_t *tree, const double *x, guint32 n);
+node_id_t flattree_add_node(flattree_t *tree, node_type_t type, guint32 arg,
+                            node_id_t left, node_id_t right);
+
+node_id_t flattree_first(const flattree_t *tree, node_id_t id);
+gboolean flattree_is_straight(const flattree_t *tree, node_id_t id);
+
+/* Variable scopes. */
+gint flattree_bind_variable(flattree_t *tree, const char *name);
+gint flattree_bind_outer_variable(flattree_t *tree, const char *name);
+void flattree_unbind_variable(flattree_t *tree);
+gint flattree_lookup_variable(const flattree_t *tree, const char *name);
+
+/* Conversion to and from node_t trees. */
+node_t *flattree_to_parsetree(const flattree_t *tree, node_id_t id);
+flattree_t *flatten_parsetree(const node_t *parsetree);
+
+#endif
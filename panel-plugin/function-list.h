@@ -0,0 +1,62 @@
+/*
+ *  Copyright (C) 2010 Erik Edelmann <erik.edelmann@iki.fi>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/* The built-in functions, one per line, as
+
+     FUNCTION(name, fun, deriv, vfun, angle, base)
+     DOUBLE_FUNCTION(name, fun, deriv, vfun)
+     FUNCTION2(name, fun2, deriv2)
+
+   The arguments other than 'base' are the fields of function_t, see
+   functions.h.  'base' is the libm function that 'fun' is built on.  The
+   evaluators for float, long double and __float128 (eval-typed.h) use its
+   versions for those types.  DOUBLE_FUNCTIONs, which have no such versions,
+   and the two-argument FUNCTION2s are computed in double by all of them.
+
+   Define all three before including this file.  The order is the order of
+   functions[]. */
+
+FUNCTION("sqrt", sqrt, d_sqrt, NULL, ANGLE_NONE, sqrt)
+FUNCTION("log", log, d_log, vmath_log, ANGLE_NONE, log)
+FUNCTION("ln", log, d_log, vmath_log, ANGLE_NONE, log)
+FUNCTION("exp", exp, exp, vmath_exp, ANGLE_NONE, exp)
+FUNCTION("sin", my_sin, my_dsin, my_vsin, ANGLE_ARGUMENT, sin)
+FUNCTION("cos", my_cos, my_dcos, my_vcos, ANGLE_ARGUMENT, cos)
+FUNCTION("tan", my_tan, my_dtan, my_vtan, ANGLE_ARGUMENT, tan)
+FUNCTION("asin", my_asin, my_dasin, NULL, ANGLE_RESULT, asin)
+FUNCTION("arcsin", my_asin, my_dasin, NULL, ANGLE_RESULT, asin)
+FUNCTION("acos", my_acos, my_dacos, NULL, ANGLE_RESULT, acos)
+FUNCTION("arccos", my_acos, my_dacos, NULL, ANGLE_RESULT, acos)
+FUNCTION("atan", my_atan, my_datan, NULL, ANGLE_RESULT, atan)
+FUNCTION("arctan", my_atan, my_datan, NULL, ANGLE_RESULT, atan)
+FUNCTION("log2", log2, d_log2, vmath_log2, ANGLE_NONE, log2)
+FUNCTION("log10", log10, d_log10, vmath_log10, ANGLE_NONE, log10)
+FUNCTION("lg", log10, d_log10, vmath_log10, ANGLE_NONE, log10)
+FUNCTION("abs", fabs, d_abs, NULL, ANGLE_NONE, fabs)
+FUNCTION("cbrt", cbrt, d_cbrt, NULL, ANGLE_NONE, cbrt)
+FUNCTION("gamma", tgamma, d_gamma, NULL, ANGLE_NONE, tgamma)
+FUNCTION("lgamma", spec_lgamma, spec_digamma, spec_vlgamma, ANGLE_NONE, lgamma)
+DOUBLE_FUNCTION("digamma", spec_digamma, NULL, NULL)
+FUNCTION("erf", erf, d_erf, NULL, ANGLE_NONE, erf)
+FUNCTION("erfc", erfc, d_erfc, NULL, ANGLE_NONE, erfc)
+DOUBLE_FUNCTION("erfinv", spec_erfinv, d_erfinv, NULL)
+FUNCTION2("beta", spec_beta, d_beta)
+FUNCTION2("gammainc", spec_gammainc, d_gammainc)
+FUNCTION2("gammaincc", spec_gammaincc, d_gammaincc)
+FUNCTION2("besselj", spec_besselj, d_besselj)
+FUNCTION2("bessely", spec_bessely, d_bessely)
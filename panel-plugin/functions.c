@@ -0,0 +1,170 @@
+/*
+ *  Copyright (C) 2010 Erik Edelmann <erik.edelmann@iki.fi>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <glib.h>
+#include "functions.h"
+#include "eval.h"
+#include "specfun.h"
+#include "vmath.h"
+
+
+static double d_sqrt(double x)
+{
+    return 0.5/sqrt(x);
+}
+
+static double d_log(double x)
+{
+    return 1.0/x;
+}
+
+static double d_log2(double x)
+{
+    return 1.0/(x*G_LN2);
+}
+
+static double d_log10(double x)
+{
+    return 1.0/(x*G_LN10);
+}
+
+static double d_abs(double x)
+{
+    return (x > 0) - (x < 0);
+}
+
+static double d_cbrt(double x)
+{
+    double y = cbrt(x);
+    return 1.0/(3*y*y);
+}
+
+static double d_gamma(double x)
+{
+    return tgamma(x)*spec_digamma(x);
+}
+
+static double d_erf(double x)
+{
+    return M_2_SQRTPI*exp(-x*x);
+}
+
+static double d_erfc(double x)
+{
+    return -M_2_SQRTPI*exp(-x*x);
+}
+
+static double d_erfinv(double x)
+{
+    double y = spec_erfinv(x);
+    return 1.0/(M_2_SQRTPI*exp(-y*y));
+}
+
+// The two-argument functions are differentiated in their second argument
+
+static double d_beta(double a, double b)
+{
+    return spec_beta(a, b)*(spec_digamma(b) - spec_digamma(a + b));
+}
+
+static double d_gammainc(double a, double x)
+{
+    return exp((a - 1)*log(x) - x - spec_lgamma(a));
+}
+
+static double d_gammaincc(double a, double x)
+{
+    return -d_gammainc(a, x);
+}
+
+static double d_besselj(double n, double x)
+{
+    return 0.5*(spec_besselj(n - 1, x) - spec_besselj(n + 1, x));
+}
+
+static double d_bessely(double n, double x)
+{
+    return 0.5*(spec_bessely(n - 1, x) - spec_bessely(n + 1, x));
+}
+
+
+const function_t functions[] = {
+#define FUNCTION(name, fun, deriv, vfun, angle, base) \
+    { name, fun, deriv, vfun, angle, NULL, NULL },
+#define DOUBLE_FUNCTION(name, fun, deriv, vfun) \
+    { name, fun, deriv, vfun, ANGLE_NONE, NULL, NULL },
+#define FUNCTION2(name, fun2, deriv2) \
+    { name, NULL, NULL, NULL, ANGLE_NONE, fun2, deriv2 },
+#include "function-list.h"
+#undef FUNCTION
+#undef DOUBLE_FUNCTION
+#undef FUNCTION2
+    { NULL, NULL, NULL, NULL, ANGLE_NONE, NULL, NULL }
+};
+
+
+/* Return the index of function 'name' in functions[], or -1 if there is no
+   such function. */
+
+gint find_function(const char *name)
+{
+    gint i = 0;
+
+    while (functions[i].name) {
+        if (strcmp(name, functions[i].name) == 0)
+            return i;
+        i++;
+    }
+
+    return -1;
+}
+
+
+/* Return the index of the first entry in functions[] implemented by 'fun', or
+   -1 if there is none. */
+
+gint find_function_by_pointer(double (*fun)(double x))
+{
+    gint i = 0;
+
+    while (functions[i].name) {
+        if (functions[i].fun == fun)
+            return i;
+        i++;
+    }
+
+    return -1;
+}
+
+
+/* Like find_function_by_pointer(), but for functions of two arguments. */
+
+gint find_function2_by_pointer(double (*fun2)(double a, double x))
+{
+    gint i = 0;
+
+    while (functions[i].name) {
+        if (functions[i].fun2 && functions[i].fun2 == fun2)
+            return i;
+        i++;
+    }
+
+    return -1;
+}
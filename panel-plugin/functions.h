@@ -0,0 +1,47 @@
+/*
+ *  Copyright (C) 2010 Erik Edelmann <erik.edelmann@iki.fi>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+#ifndef __FUNCTIONS_H__
+#define __FUNCTIONS_H__
+
+#include <glib.h>
+
+// Does the function take or give an angle, in degrees or radians?
+typedef enum { ANGLE_NONE, ANGLE_ARGUMENT, ANGLE_RESULT } angle_use_t;
+
+/* A function of one argument has 'fun'.  One of two, like beta(a, b), has
+   'fun2' instead, and its node in a tree has the first argument on the left. */
+typedef struct {
+    const char *name;
+    double (*fun)(double x);
+    double (*deriv)(double x);  // The derivative of fun, or NULL
+    void (*vfun)(const double *x, double *y, gsize n);  // fun for arrays, or NULL
+    angle_use_t angle;
+    double (*fun2)(double a, double x);
+    double (*deriv2)(double a, double x);  // d/dx of fun2, or NULL
+} function_t;
+
+/* The table of built-in functions, terminated by an entry with name NULL.
+   Compiled trees refer to functions by their index in this table.  It is
+   generated from function-list.h. */
+extern const function_t functions[];
+
+gint find_function(const char *name);
+gint find_function_by_pointer(double (*fun)(double x));
+gint find_function2_by_pointer(double (*fun2)(double a, double x));
+
+#endif
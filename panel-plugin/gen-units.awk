@@ -0,0 +1,41 @@
+#!/usr/bin/awk -f
+#
+# Turn units.def into the entries of the units[] table in units.c, one line
+# per unit.  Prefixed forms are listed as units of their own, unless the name
+# is already taken by an unprefixed unit.  The output must be sorted (see
+# Makefile.am), since units are looked up by binary search.
+
+/^#/ || NF == 0 {
+    next
+}
+
+$1 == "prefix" {
+    prefix[$2] = $3
+    next
+}
+
+{
+    n++
+    name[n] = $1
+    factor[n] = $2
+    dims[n] = $3 ", " $4 ", " $5 ", " $6 ", " $7 ", " $8 ", " $9
+    prefixes[n] = ($10 == "yes")
+    taken[$1] = 1
+}
+
+function entry(name, factor, dims) {
+    printf("    { \"%s\", %s, {{ %s }} },\n", name, factor, dims)
+}
+
+END {
+    for (i = 1; i <= n; i++) {
+        entry(name[i], factor[i], dims[i])
+        if (!prefixes[i])
+            continue
+        for (p in prefix) {
+            if ((p name[i]) in taken)
+                continue
+            entry(p name[i], "(" prefix[p] "*" factor[i] ")", dims[i])
+        }
+    }
+}
@@ -17,45 +17,163 @@
  */
 #include <stdlib.h>
 #include <string.h>
-#include <ctype.h>
 #include <glib.h>
+#ifdef __SSE2__
+#   include <emmintrin.h>
+#endif
 #include "lexer.h"
+#include "stats.h"
+#include "numparse.h"
+
+/* Character classes.  Only ASCII counts; the locale doesn't matter. */
+#define CC_SPACE    0x01
+#define CC_DIGIT    0x02
+#define CC_ALPHA    0x04
+#define CC_IDENT    0x08    // Letters, digits and '_'
+#define CC_OPERATOR 0x10
+
+static const guint8 char_class[256] = {
+    [' '] = CC_SPACE, ['\t'] = CC_SPACE, ['\n'] = CC_SPACE,
+    ['\v'] = CC_SPACE, ['\f'] = CC_SPACE, ['\r'] = CC_SPACE,
+    ['0' ... '9'] = CC_DIGIT | CC_IDENT,
+    ['A' ... 'Z'] = CC_ALPHA | CC_IDENT,
+    ['a' ... 'z'] = CC_ALPHA | CC_IDENT,
+    ['_'] = CC_IDENT,
+    ['+'] = CC_OPERATOR, ['-'] = CC_OPERATOR, ['*'] = CC_OPERATOR,
+    ['/'] = CC_OPERATOR, ['^'] = CC_OPERATOR, ['<'] = CC_OPERATOR,
+    ['>'] = CC_OPERATOR, ['!'] = CC_OPERATOR, ['?'] = CC_OPERATOR,
+    [':'] = CC_OPERATOR
+};
+
+#define CHAR_CLASS(c) (char_class[(guchar)(c)])
+
+
+#ifdef __SSE2__
+/* A mask of the bytes of 'x' that are between 'lo' and 'hi' (which must be
+   ASCII, so that the signed compares work). */
+
+static inline __m128i in_range(__m128i x, char lo, char hi)
+{
+    return _mm_and_si128(_mm_cmpgt_epi8(x, _mm_set1_epi8(lo - 1)),
+                         _mm_cmplt_epi8(x, _mm_set1_epi8(hi + 1)));
+}
+
+
+/* A mask of the bytes of 'x' in class 'cls' (CC_SPACE or CC_IDENT). */
+
+static inline __m128i class_mask(__m128i x, guint8 cls)
+{
+    __m128i m;
+
+    if (cls == CC_SPACE)
+        return _mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8(' ')),
+                            in_range(x, '\t', '\r'));
+
+    // Setting bit 5 turns upper case letters to lower case
+    m = in_range(_mm_or_si128(x, _mm_set1_epi8(0x20)), 'a', 'z');
+    m = _mm_or_si128(m, in_range(x, '0', '9'));
+    return _mm_or_si128(m, _mm_cmpeq_epi8(x, _mm_set1_epi8('_')));
+}
+#endif
+
 
-static gboolean isoperator(int c)
+/* Return the number of chars at the start of 's' that are in class 'cls',
+   but at most 'max', which mustn't go past the end of the string.  With
+   SSE2, 16 chars are checked at a time, as long as there are 16 left. */
+
+static inline gsize span(const char *s, guint8 cls, gsize max)
 {
-    if (c == '+' || c == '-' || c == '*' || c == '/' || c == '^')
-        return TRUE;
-    else
-        return FALSE;
+    gsize n = 0;
+#ifdef __SSE2__
+    guint mask;
+#endif
+
+    while (n < max) {
+#ifdef __SSE2__
+        if (n + 16 <= max) {
+            mask = _mm_movemask_epi8(
+                class_mask(_mm_loadu_si128((const __m128i *)(s + n)), cls));
+            if (mask != 0xffff)
+                return n + __builtin_ctz(~mask);
+            n += 16;
+            continue;
+        }
+#endif
+        if (!(CHAR_CLASS(s[n]) & cls))
+            break;
+        n++;
+    }
+
+    return n;
+}
+
+
+/* If input[i] starts a two character operator, return its code, otherwise
+   return 0. */
+
+static char double_operator(const char *input, int i)
+{
+    switch (input[i]) {
+    case '*':
+        // '**' is equivalent to '^'
+        return (input[i+1] == '*') ? '^' : 0;
+    case '<':
+        return (input[i+1] == '=') ? TOK_OP_LE : 0;
+    case '>':
+        return (input[i+1] == '=') ? TOK_OP_GE : 0;
+    case '=':
+        return (input[i+1] == '=') ? TOK_OP_EQ : 0;
+    case '!':
+        return (input[i+1] == '=') ? TOK_OP_NE : 0;
+    case '&':
+        return (input[i+1] == '&') ? TOK_OP_AND : 0;
+    case '|':
+        return (input[i+1] == '|') ? TOK_OP_OR : 0;
+    case '.':
+        // Element-wise operators.  A '.' starting a number is never
+        // followed by these.
+        if (input[i+1] == '*') return TOK_OP_EMUL;
+        if (input[i+1] == '/') return TOK_OP_EDIV;
+        if (input[i+1] == '^') return TOK_OP_EPOW;
+        return 0;
+    default:
+        return 0;
+    }
 }
 
 /* Return pointer to next token, starting at input[*index], or NULL if there
-   were no tokens.  Put pointer to the next char after the token into '*end' Put
-   the position of the start of the token into pos.  Tokens should be
-   g_free():ed when no longer needed. */
+   were no tokens.  'len' is the length of the input.  '*index' is moved past
+   the token, and the position of its start goes into token->position.
+   Tokens should be g_free():ed when no longer needed. */
 
-static token_t *get_next_token(const char *input, int *index)
+static token_t *get_next_token(const char *input, gsize len, int *index)
 {
     const char *t;
     token_t *token;
-    int i;
-
-    g_assert(input);
-    g_assert(index);
-    g_assert(*index <= strlen(input));
-
-    i = *index;
+    char op;
+    int i, n;
 
-    while (isspace(input[i])) i++;
+    i = *index + span(input + *index, CC_SPACE, len - *index);
 
     if (!input[i]) return NULL;
 
     token = g_malloc(sizeof(token_t));
+    stats_count(STAT_ALLOCATIONS, 1);
     token->position = i;
 
-    if (isdigit(input[i]) || input[i] == '.') {
+    if ((op = double_operator(input, i))) {
+        token->type = TOK_OPERATOR;
+        token->val.op = op;
+        i += 2;
+    } else if ((CHAR_CLASS(input[i]) & CC_DIGIT) || input[i] == '.') {
         token->type = TOK_NUMBER;
-        token->val.num = g_strtod(input+i, (char **)&t);
+        token->val.num = parse_number(input+i, &t);
+        if (t == input+i) {
+            // A '.' without digits
+            token->type = TOK_OTHER;
+            token->val.other = input[i];
+            t++;
+        }
         i = (t - input);
     } else if (input[i] == '(') {
         token->type = TOK_LPAREN;
@@ -63,25 +181,30 @@ static token_t *get_next_token(const char *input, int *index)
     } else if (input[i] == ')') {
         token->type = TOK_RPAREN;
         i++;
-    } else if (isoperator(input[i])) {
+    } else if (input[i] == ',') {
+        token->type = TOK_COMMA;
+        i++;
+    } else if (input[i] == '[') {
+        token->type = TOK_LBRACKET;
+        i++;
+    } else if (input[i] == ']') {
+        token->type = TOK_RBRACKET;
+        i++;
+    } else if (input[i] == ';') {
+        token->type = TOK_SEMICOLON;
+        i++;
+    } else if (CHAR_CLASS(input[i]) & CC_OPERATOR) {
         token->type = TOK_OPERATOR;
-        if (input[i] == '*' && input[i+1] == '*') {
-            // '**' is equivalent to '^'
-            token->val.op = '^';
-            i += 2;
-        } else {
-            token->val.op = input[i];
-            i++;
-        }
-    } else if (isalpha(input[i])) {
+        token->val.op = input[i];
+        i++;
+    } else if (CHAR_CLASS(input[i]) & CC_ALPHA) {
         token->type = TOK_IDENTIFIER;
 
-        int n = 0;
-        while (isalnum(input[i]) && n < MAX_ID_LEN) {
-            token->val.id[n] = input[i];
-            n++, i++;
-        }
+        // Longer identifiers are split
+        n = span(input + i, CC_IDENT, MIN((gsize)MAX_ID_LEN, len - i));
+        memcpy(token->val.id, input + i, n);
         token->val.id[n] = '\0';
+        i += n;
     } else {
         token->type = TOK_OTHER;
         token->val.other = input[i];
@@ -104,10 +227,40 @@ const char *token2str(const token_t *token)
 
     switch (token->type) {
     case TOK_NUMBER:
-        g_snprintf(s, MAX_ID_LEN, "%g", token->val.num);
+        g_ascii_formatd(s, MAX_ID_LEN, "%g", token->val.num);
         break;
     case TOK_OPERATOR:
-        g_snprintf(s, MAX_ID_LEN, "%c", token->val.op);
+        switch (token->val.op) {
+        case TOK_OP_LE:
+            g_snprintf(s, MAX_ID_LEN, "<=");
+            break;
+        case TOK_OP_GE:
+            g_snprintf(s, MAX_ID_LEN, ">=");
+            break;
+        case TOK_OP_EQ:
+            g_snprintf(s, MAX_ID_LEN, "==");
+            break;
+        case TOK_OP_NE:
+            g_snprintf(s, MAX_ID_LEN, "!=");
+            break;
+        case TOK_OP_AND:
+            g_snprintf(s, MAX_ID_LEN, "&&");
+            break;
+        case TOK_OP_OR:
+            g_snprintf(s, MAX_ID_LEN, "||");
+            break;
+        case TOK_OP_EMUL:
+            g_snprintf(s, MAX_ID_LEN, ".*");
+            break;
+        case TOK_OP_EDIV:
+            g_snprintf(s, MAX_ID_LEN, "./");
+            break;
+        case TOK_OP_EPOW:
+            g_snprintf(s, MAX_ID_LEN, ".^");
+            break;
+        default:
+            g_snprintf(s, MAX_ID_LEN, "%c", token->val.op);
+        }
         break;
     case TOK_IDENTIFIER:
         g_snprintf(s, MAX_ID_LEN, "%s", token->val.id);
@@ -118,6 +271,18 @@ const char *token2str(const token_t *token)
     case TOK_RPAREN:
         g_strlcat(s, ")", MAX_ID_LEN);
         break;
+    case TOK_COMMA:
+        g_snprintf(s, MAX_ID_LEN, ",");
+        break;
+    case TOK_LBRACKET:
+        g_snprintf(s, MAX_ID_LEN, "[");
+        break;
+    case TOK_RBRACKET:
+        g_snprintf(s, MAX_ID_LEN, "]");
+        break;
+    case TOK_SEMICOLON:
+        g_snprintf(s, MAX_ID_LEN, ";");
+        break;
     case TOK_OTHER:
         g_snprintf(s, MAX_ID_LEN, "%c", token->val.other);
         break;
@@ -140,16 +305,27 @@ token_stack_t *lexer(const char *input)
     token_t *token;
     token_stack_t *stack;
     int index = 0;
+    guint64 n = 0;
+    gsize len;
+    gint64 start;
+
+    start = stats_start();
 
     stack = g_malloc(sizeof(token_stack_t));
-    stack->top = get_next_token(input, &index);
+    stats_count(STAT_ALLOCATIONS, 1);
+    len = strlen(input);
+    stack->top = get_next_token(input, len, &index);
     token = stack->top;
     while (token) {
         //g_print("Token: %s at %i\n", token2str(token), token->position);
-        token->next = get_next_token(input, &index);
+        n++;
+        token->next = get_next_token(input, len, &index);
         token = token->next;
     }
 
+    stats_count(STAT_TOKENS, n);
+    stats_record_time(STAT_LEX, start);
+
     return stack;
 }
 
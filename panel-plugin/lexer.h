@@ -25,9 +25,25 @@ typedef enum { TOK_NUMBER,
                TOK_IDENTIFIER, 
                TOK_LPAREN, 
                TOK_RPAREN, 
+               TOK_COMMA,
+               TOK_LBRACKET,
+               TOK_RBRACKET,
+               TOK_SEMICOLON,
                TOK_OTHER,
                TOK_NULL } token_type_t;
 
+/* Operators spelled with two characters are stored in token_t.val.op as these
+   codes (like '**', which is stored as '^'). */
+#define TOK_OP_LE  'l'
+#define TOK_OP_GE  'g'
+#define TOK_OP_EQ  'e'
+#define TOK_OP_NE  'n'
+#define TOK_OP_AND '&'
+#define TOK_OP_OR  '|'
+#define TOK_OP_EMUL 'x'  // '.*'
+#define TOK_OP_EDIV 'd'  // './'
+#define TOK_OP_EPOW 'p'  // '.^'
+
 typedef struct _token_t {
     token_type_t type;
     gint position;
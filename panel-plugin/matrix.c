@@ -0,0 +1,397 @@
+/*
+ *  Copyright (C) 2010 Erik Edelmann <erik.edelmann@iki.fi>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <glib.h>
+#include "matrix.h"
+#include "stats.h"
+
+/* Matrix products and transposes work on BLOCK x BLOCK tiles, so that the
+   tiles of all operands fit in the L1 cache together.  The innermost loops
+   run over contiguous rows, which lets the compiler vectorize them. */
+#define BLOCK 64
+
+
+const matrix_function_t matrix_functions[] = {
+    {"det",       1},
+    {"inv",       1},
+    {"transpose", 1},
+    {"dot",       2},
+    {"solve",     2},
+    {NULL,        0}
+};
+
+
+gint find_matrix_function(const char *name)
+{
+    gint i;
+
+    for (i = 0; matrix_functions[i].name; i++) {
+        if (strcmp(matrix_functions[i].name, name) == 0)
+            return i;
+    }
+
+    return -1;
+}
+
+
+matrix_t *matrix_new(guint rows, guint cols)
+{
+    matrix_t *m;
+
+    // The elements follow the header in the same block.
+    m = g_malloc(sizeof(matrix_t) + (gsize)rows*cols*sizeof(double));
+    stats_count(STAT_ALLOCATIONS, 1);
+    m->rows = rows;
+    m->cols = cols;
+    m->data = (double *)(m + 1);
+    memset(&m->dims, 0, sizeof(m->dims));
+    m->unit = NULL;
+
+    return m;
+}
+
+
+matrix_t *matrix_scalar(double x)
+{
+    matrix_t *m;
+
+    m = matrix_new(1, 1);
+    m->data[0] = x;
+
+    return m;
+}
+
+
+void free_matrix(matrix_t *m)
+{
+    g_free(m);
+}
+
+
+matrix_t *matrix_mul(const matrix_t *a, const matrix_t *b)
+{
+    matrix_t *c;
+    guint i, j, k, i0, j0, k0, i1, j1, k1;
+    const double *brow;
+    double *crow, aik;
+
+    g_assert(a->cols == b->rows);
+
+    c = matrix_new(a->rows, b->cols);
+    memset(c->data, 0, matrix_size(c)*sizeof(double));
+
+    for (i0 = 0; i0 < a->rows; i0 += BLOCK) {
+        i1 = MIN(i0 + BLOCK, a->rows);
+        for (k0 = 0; k0 < a->cols; k0 += BLOCK) {
+            k1 = MIN(k0 + BLOCK, a->cols);
+            for (j0 = 0; j0 < b->cols; j0 += BLOCK) {
+                j1 = MIN(j0 + BLOCK, b->cols);
+
+                for (i = i0; i < i1; i++) {
+                    crow = &MATRIX_AT(c, i, 0);
+                    for (k = k0; k < k1; k++) {
+                        aik = MATRIX_AT(a, i, k);
+                        brow = &MATRIX_AT(b, k, 0);
+                        for (j = j0; j < j1; j++)
+                            crow[j] += aik*brow[j];
+                    }
+                }
+            }
+        }
+    }
+
+    return c;
+}
+
+
+matrix_t *matrix_transpose(const matrix_t *m)
+{
+    matrix_t *t;
+    guint i, j, i0, j0, i1, j1;
+
+    t = matrix_new(m->cols, m->rows);
+
+    for (i0 = 0; i0 < m->rows; i0 += BLOCK) {
+        i1 = MIN(i0 + BLOCK, m->rows);
+        for (j0 = 0; j0 < m->cols; j0 += BLOCK) {
+            j1 = MIN(j0 + BLOCK, m->cols);
+            for (i = i0; i < i1; i++)
+                for (j = j0; j < j1; j++)
+                    MATRIX_AT(t, j, i) = MATRIX_AT(m, i, j);
+        }
+    }
+
+    return t;
+}
+
+
+/* The dot product of two matrices with the same number of elements, taken as
+   vectors. */
+
+double matrix_dot(const matrix_t *a, const matrix_t *b)
+{
+    double s = 0.0;
+    gsize i;
+
+    g_assert(matrix_size(a) == matrix_size(b));
+
+    for (i = 0; i < matrix_size(a); i++)
+        s += a->data[i]*b->data[i];
+
+    return s;
+}
+
+
+/* Replace the square matrix 'lu' by its LU decomposition with partial
+   pivoting: L below the diagonal (with an implicit unit diagonal) and U on and
+   above it.  Row i of the result is row perm[i] of the original.  Return the
+   sign of the permutation, or 0 if the matrix is singular. */
+
+static int lu_decompose(matrix_t *lu, guint *perm)
+{
+    guint n = lu->rows, i, j, k, p, tmp_perm;
+    double *rowk, *rowi, f, max, tmp;
+    int sign = 1;
+
+    g_assert(lu->rows == lu->cols);
+
+    for (i = 0; i < n; i++)
+        perm[i] = i;
+
+    for (k = 0; k < n; k++) {
+        p = k;
+        max = fabs(MATRIX_AT(lu, k, k));
+        for (i = k+1; i < n; i++) {
+            if (fabs(MATRIX_AT(lu, i, k)) > max) {
+                max = fabs(MATRIX_AT(lu, i, k));
+                p = i;
+            }
+        }
+        if (max == 0.0)
+            return 0;
+
+        if (p != k) {
+            rowk = &MATRIX_AT(lu, k, 0);
+            rowi = &MATRIX_AT(lu, p, 0);
+            for (j = 0; j < n; j++) {
+                tmp = rowk[j];
+                rowk[j] = rowi[j];
+                rowi[j] = tmp;
+            }
+            tmp_perm = perm[k];
+            perm[k] = perm[p];
+            perm[p] = tmp_perm;
+            sign = -sign;
+        }
+
+        // Eliminate below the pivot, one contiguous row at a time.
+        rowk = &MATRIX_AT(lu, k, 0);
+        for (i = k+1; i < n; i++) {
+            rowi = &MATRIX_AT(lu, i, 0);
+            f = rowi[k] /= rowk[k];
+            for (j = k+1; j < n; j++)
+                rowi[j] -= f*rowk[j];
+        }
+    }
+
+    return sign;
+}
+
+
+double matrix_det(const matrix_t *m)
+{
+    matrix_t *lu;
+    guint *perm, i;
+    double det;
+
+    lu = matrix_new(m->rows, m->cols);
+    memcpy(lu->data, m->data, matrix_size(m)*sizeof(double));
+    perm = g_new(guint, m->rows);
+    stats_count(STAT_ALLOCATIONS, 1);
+
+    det = lu_decompose(lu, perm);
+    for (i = 0; i < m->rows && det != 0.0; i++)
+        det *= MATRIX_AT(lu, i, i);
+
+    g_free(perm);
+    free_matrix(lu);
+
+    return det;
+}
+
+
+/* Solve a*x = b for x, where 'a' is square, and 'b' has as many rows as 'a'
+   and any number of columns.  Return NULL if 'a' is singular. */
+
+matrix_t *matrix_solve(const matrix_t *a, const matrix_t *b)
+{
+    matrix_t *lu, *x;
+    guint *perm, n = a->rows, m = b->cols, i, j, k;
+    double *xi, *xk, f;
+
+    g_assert(a->rows == a->cols && b->rows == a->rows);
+
+    lu = matrix_new(n, n);
+    memcpy(lu->data, a->data, matrix_size(a)*sizeof(double));
+    perm = g_new(guint, n);
+    stats_count(STAT_ALLOCATIONS, 1);
+
+    if (!lu_decompose(lu, perm)) {
+        g_free(perm);
+        free_matrix(lu);
+        return NULL;
+    }
+
+    x = matrix_new(n, m);
+    for (i = 0; i < n; i++)
+        memcpy(&MATRIX_AT(x, i, 0), &MATRIX_AT(b, perm[i], 0),
+               m*sizeof(double));
+
+    // Forward substitution with L, then back substitution with U.
+    for (i = 0; i < n; i++) {
+        xi = &MATRIX_AT(x, i, 0);
+        for (k = 0; k < i; k++) {
+            f = MATRIX_AT(lu, i, k);
+            xk = &MATRIX_AT(x, k, 0);
+            for (j = 0; j < m; j++)
+                xi[j] -= f*xk[j];
+        }
+    }
+    for (i = n; i-- > 0; ) {
+        xi = &MATRIX_AT(x, i, 0);
+        for (k = i+1; k < n; k++) {
+            f = MATRIX_AT(lu, i, k);
+            xk = &MATRIX_AT(x, k, 0);
+            for (j = 0; j < m; j++)
+                xi[j] -= f*xk[j];
+        }
+        f = MATRIX_AT(lu, i, i);
+        for (j = 0; j < m; j++)
+            xi[j] /= f;
+    }
+
+    g_free(perm);
+    free_matrix(lu);
+
+    return x;
+}
+
+
+matrix_t *matrix_inv(const matrix_t *m)
+{
+    matrix_t *id, *inv;
+    guint i;
+
+    id = matrix_new(m->rows, m->rows);
+    memset(id->data, 0, matrix_size(id)*sizeof(double));
+    for (i = 0; i < m->rows; i++)
+        MATRIX_AT(id, i, i) = 1.0;
+
+    inv = matrix_solve(m, id);
+    free_matrix(id);
+
+    return inv;
+}
+
+
+/* Raise a square matrix to an integer power by repeated squaring.  Return
+   NULL if n is negative and the matrix is singular. */
+
+matrix_t *matrix_pow(const matrix_t *m, long n)
+{
+    matrix_t *r, *p, *tmp;
+    guint i;
+
+    g_assert(m->rows == m->cols);
+
+    if (n < 0) {
+        p = matrix_inv(m);
+        if (!p)
+            return NULL;
+        n = -n;
+    } else {
+        p = matrix_new(m->rows, m->cols);
+        memcpy(p->data, m->data, matrix_size(m)*sizeof(double));
+    }
+
+    r = matrix_new(m->rows, m->cols);
+    memset(r->data, 0, matrix_size(r)*sizeof(double));
+    for (i = 0; i < m->rows; i++)
+        MATRIX_AT(r, i, i) = 1.0;
+
+    while (n > 0) {
+        if (n & 1) {
+            tmp = matrix_mul(r, p);
+            free_matrix(r);
+            r = tmp;
+        }
+        n >>= 1;
+        if (n > 0) {
+            tmp = matrix_mul(p, p);
+            free_matrix(p);
+            p = tmp;
+        }
+    }
+    free_matrix(p);
+
+    return r;
+}
+
+
+/* Format 'm' like '[1, 2; 3, 4] m/s', each element with the printf format
+   'format' (one of the formats g_ascii_formatd() takes, so that the decimal
+   point is '.' whatever the locale).  A 1 x 1 matrix is formatted as a plain
+   number.  The result should be g_free()d. */
+
+gchar *matrix_to_string(const matrix_t *m, const char *format)
+{
+    GString *s;
+    gchar *dims, buf[G_ASCII_DTOSTR_BUF_SIZE];
+    guint i, j;
+
+    s = g_string_new("");
+    if (matrix_is_scalar(m))
+        g_string_append(s, g_ascii_formatd(buf, sizeof(buf), format,
+                                           m->data[0]));
+    else {
+        g_string_append_c(s, '[');
+        for (i = 0; i < m->rows; i++) {
+            if (i > 0)
+                g_string_append(s, "; ");
+            for (j = 0; j < m->cols; j++) {
+                if (j > 0)
+                    g_string_append(s, ", ");
+                g_string_append(s, g_ascii_formatd(buf, sizeof(buf), format,
+                                                   MATRIX_AT(m, i, j)));
+            }
+        }
+        g_string_append_c(s, ']');
+    }
+
+    if (m->unit)
+        g_string_append_printf(s, " %s", m->unit);
+    else if (!dims_is_zero(m->dims)) {
+        dims = dims_to_string(m->dims);
+        g_string_append_printf(s, " %s", dims);
+        g_free(dims);
+    }
+
+    return g_string_free(s, FALSE);
+}
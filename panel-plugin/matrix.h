@@ -0,0 +1,70 @@
+/*
+ *  Copyright (C) 2010 Erik Edelmann <erik.edelmann@iki.fi>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+#ifndef __MATRIX_H__
+#define __MATRIX_H__
+
+#include <glib.h>
+#include "units.h"
+
+/* A rows x cols matrix, stored row by row.  Numbers are 1 x 1 matrices, and
+   vectors are matrices with one row or one column.  All elements have the
+   unit 'dims'.  'unit' is the name to show the unit by, or NULL to show it in
+   SI base units. */
+typedef struct {
+    guint rows, cols;
+    double *data;
+    dims_t dims;
+    const char *unit;
+} matrix_t;
+
+#define MATRIX_AT(m, i, j) ((m)->data[(gsize)(i)*(m)->cols + (j)])
+#define matrix_is_scalar(m) ((m)->rows == 1 && (m)->cols == 1)
+#define matrix_is_vector(m) ((m)->rows == 1 || (m)->cols == 1)
+#define matrix_size(m) ((gsize)(m)->rows*(m)->cols)
+
+/* Functions taking matrix arguments.  Compiled trees refer to them by their
+   index in matrix_functions[]. */
+typedef enum { MATFUN_DET, MATFUN_INV, MATFUN_TRANSPOSE, MATFUN_DOT,
+               MATFUN_SOLVE
+             } matfun_t;
+
+typedef struct {
+    const char *name;
+    gint n_args;
+} matrix_function_t;
+
+extern const matrix_function_t matrix_functions[];
+
+gint find_matrix_function(const char *name);
+
+matrix_t *matrix_new(guint rows, guint cols);
+matrix_t *matrix_scalar(double x);
+void free_matrix(matrix_t *m);
+
+/* The kernels.  The caller must check that the sizes fit. */
+matrix_t *matrix_mul(const matrix_t *a, const matrix_t *b);
+matrix_t *matrix_transpose(const matrix_t *m);
+double matrix_dot(const matrix_t *a, const matrix_t *b);
+double matrix_det(const matrix_t *m);
+matrix_t *matrix_solve(const matrix_t *a, const matrix_t *b);
+matrix_t *matrix_inv(const matrix_t *m);
+matrix_t *matrix_pow(const matrix_t *m, long n);
+
+gchar *matrix_to_string(const matrix_t *m, const char *format);
+
+#endif
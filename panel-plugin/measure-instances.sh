@@ -0,0 +1,109 @@
+#!/bin/sh
+#
+#  Copyright (C) 2010 Erik Edelmann <erik.edelmann@iki.fi>
+#
+#  This program is free software; you can redistribute it and/or modify
+#  it under the terms of the GNU General Public License as published by
+#  the Free Software Foundation; either version 2 of the License, or
+#  (at your option) any later version.
+#
+#  This program is distributed in the hope that it will be useful,
+#  but WITHOUT ANY WARRANTY; without even the implied warranty of
+#  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#  GNU Library General Public License for more details.
+#
+#  You should have received a copy of the GNU General Public License
+#  along with this program; if not, write to the Free Software
+#  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+#
+# Measure what the calculators on the running panel cost at start up and in
+# memory.  Run it in the desktop session, with the panel up:
+#
+#   measure-instances.sh [--drop-caches]
+#
+# The panel is restarted, and when it and the plugin processes have used no
+# CPU for half a second, the script prints how long the start took, the CPU
+# time it used, and the resident (RSS) and proportional (PSS) memory of the
+# panel and the plugin processes.  PSS divides shared pages between the
+# processes that map them, so it doesn't count GTK once per process like
+# RSS does.  --drop-caches empties the page cache first (needs root), for a
+# start from disk.
+#
+# To compare the builds, run it with no calculators and with N of them, with
+# each build installed.  The cost of an instance is the difference of the
+# totals, divided by N.
+
+PANEL=${PANEL:-xfce4-panel}
+PLUGIN=${PLUGIN:-xfce4-calculator-plugin}
+
+pids()
+{
+    pgrep -x "$PANEL"
+    pgrep -f "^([^ ]*/)?$PLUGIN( |\$)"
+}
+
+now()
+{
+    date +%s.%N
+}
+
+# The CPU time, in clock ticks, used by the processes so far
+cpu()
+{
+    for pid in $(pids); do
+        cat /proc/$pid/stat 2>/dev/null
+    done | awk '{ t += $14 + $15 } END { print t + 0 }'
+}
+
+if [ "$1" = "--drop-caches" ]; then
+    sync && echo 3 > /proc/sys/vm/drop_caches || exit 1
+fi
+
+if ! pgrep -x "$PANEL" > /dev/null; then
+    echo "$PANEL isn't running" >&2
+    exit 1
+fi
+
+hz=$(getconf CLK_TCK)
+start=$(now)
+"$PANEL" --restart || exit 1
+
+# Wait for the old panel to go and the new one to come
+while ! pgrep -x "$PANEL" > /dev/null; do
+    sleep 0.05
+done
+
+last=$(cpu)
+ready=$(now)
+idle=0
+while [ $idle -lt 5 ]; do
+    sleep 0.1
+    t=$(cpu)
+    if [ "$t" = "$last" ]; then
+        idle=$((idle + 1))
+    else
+        last=$t
+        ready=$(now)
+        idle=0
+    fi
+done
+
+echo "$start $ready $last $hz" | awk '{
+    printf "start:  %.2f s, %.2f s of CPU\n", $2 - $1, $3 / $4 }'
+
+printf "%-8s %-24s %10s %10s\n" PID PROCESS "RSS (kB)" "PSS (kB)"
+for pid in $(pids); do
+    name=$(cat /proc/$pid/comm 2>/dev/null) || continue
+    if [ -r /proc/$pid/smaps_rollup ]; then
+        awk -v pid=$pid -v name="$name" '
+            /^Rss:/ { rss = $2 }
+            /^Pss:/ { pss = $2 }
+            END { if (rss) printf "%-8s %-24s %10d %10d\n", pid, name, rss, pss }' \
+            /proc/$pid/smaps_rollup 2>/dev/null
+    else
+        awk -v pid=$pid -v name="$name" '
+            /^VmRSS:/ { printf "%-8s %-24s %10d %10s\n", pid, name, $2, "-" }' \
+            /proc/$pid/status 2>/dev/null
+    fi
+done | awk '{ print; rss += $3; pss += $4; n++ }
+    END { printf "%-8s %-24s %10d %10d\n", "", "total (" n ")", rss, pss }'
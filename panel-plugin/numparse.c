@@ -0,0 +1,469 @@
+/*
+ *  Copyright (C) 2010 Erik Edelmann <erik.edelmann@iki.fi>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <float.h>
+#include <math.h>
+#include <glib.h>
+#include "numparse.h"
+
+/* 
+ * Decimal to double conversion.  A number is read as w * 10^q, where w holds
+ * at most 19 significant digits.  Then, in order:
+ *
+ *  - If w < 2^53 and |q| <= 22, both w and 10^q are exact doubles, and one
+ *    multiplication or division gives the correctly rounded result
+ *    (Clinger's fast path).
+ *
+ *  - Otherwise w is multiplied by a 128 bit approximation of 5^q, and the
+ *    result is rounded by hand (the Eisel-Lemire algorithm, as described in
+ *    D. Lemire, "Number Parsing at a Gigabyte per Second", 2021).  In the
+ *    rare cases where the 128 bits aren't enough to decide the rounding, or
+ *    when there are more than 19 digits, we fall back to g_ascii_strtod().
+ */
+
+#define MAX_DIGITS 19
+#define MIN_POW10 (-342)
+#define MAX_POW10 308
+
+// The 128 bits of 5^q, for MIN_POW10 <= q <= MAX_POW10, normalized so that
+// the highest bit is set.  Built by init_powers().
+static guint64 powers[MAX_POW10 - MIN_POW10 + 1][2];
+
+static const double exact_pow10[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+
+/* The numbers in init_powers() are kept as arrays of 32 bit limbs, least
+   significant first.  5^342 is about 2^795, so 1024 bits is enough to have
+   128 bits left of 2^1024/5^342. */
+
+#define BIG_LIMBS 33
+
+static void big_top128(const guint32 *a, guint64 *hi, guint64 *lo)
+{
+    guint32 t[BIG_LIMBS + 5];
+    gint top, shift, i;
+
+    // Find the highest bit, and shift it to the top of limb 'top'
+    for (top = BIG_LIMBS - 1; a[top] == 0; top--)
+        ;
+    for (shift = 0; !(a[top] << shift & 0x80000000u); shift++)
+        ;
+
+    memset(t, 0, sizeof(t));
+    for (i = 0; i <= top; i++) {
+        t[i + 4] |= a[i] << shift;
+        if (shift > 0)
+            t[i + 5] |= a[i] >> (32 - shift);
+    }
+
+    // The limbs shifted in below index 4 are zero, so short numbers (5^q for
+    // small q) come out padded with zeros
+    top += 4;
+    *hi = (guint64)t[top] << 32 | t[top - 1];
+    *lo = (guint64)t[top - 2] << 32 | t[top - 3];
+}
+
+
+static gpointer init_powers(gpointer data)
+{
+    guint32 a[BIG_LIMBS];
+    guint64 carry, rem;
+    gint q, i;
+
+    // 5^0, 5^1, ... by multiplying
+    memset(a, 0, sizeof(a));
+    a[0] = 1;
+    for (q = 0; q <= MAX_POW10; q++) {
+        big_top128(a, &powers[q - MIN_POW10][0], &powers[q - MIN_POW10][1]);
+        for (i = 0, carry = 0; i < BIG_LIMBS; i++) {
+            carry += (guint64)a[i]*5;
+            a[i] = (guint32)carry;
+            carry >>= 32;
+        }
+    }
+
+    // 2^1024/5^1, 2^1024/5^2, ... by dividing, rounded down.  Down to 5^-27
+    // the table has the quotient rounded up instead, like in Lemire's paper;
+    // 5^27 < 2^64, so the truncated 128 bits are never exact.
+    memset(a, 0, sizeof(a));
+    a[BIG_LIMBS - 1] = 1;
+    for (q = -1; q >= MIN_POW10; q--) {
+        for (i = BIG_LIMBS - 1, rem = 0; i >= 0; i--) {
+            rem = rem << 32 | a[i];
+            a[i] = (guint32)(rem/5);
+            rem %= 5;
+        }
+        big_top128(a, &powers[q - MIN_POW10][0], &powers[q - MIN_POW10][1]);
+        if (q >= -27 && ++powers[q - MIN_POW10][1] == 0)
+            powers[q - MIN_POW10][0]++;
+    }
+
+    return NULL;
+}
+
+
+/* The full 128 bit product of a and b. */
+
+static inline void mul128(guint64 a, guint64 b, guint64 *hi, guint64 *lo)
+{
+#ifdef __SIZEOF_INT128__
+    unsigned __int128 p = (unsigned __int128)a*b;
+
+    *hi = (guint64)(p >> 64);
+    *lo = (guint64)p;
+#else
+    guint64 a_lo = (guint32)a, a_hi = a >> 32;
+    guint64 b_lo = (guint32)b, b_hi = b >> 32;
+    guint64 ll, lh, hl, hh, mid;
+
+    ll = a_lo*b_lo;
+    lh = a_lo*b_hi;
+    hl = a_hi*b_lo;
+    hh = a_hi*b_hi;
+    mid = (ll >> 32) + (guint32)lh + (guint32)hl;
+    *hi = hh + (lh >> 32) + (hl >> 32) + (mid >> 32);
+    *lo = mid << 32 | (guint32)ll;
+#endif
+}
+
+
+/* w * 10^q, correctly rounded, in '*result'.  w is not 0.  Return FALSE if
+   the result can't be decided with 128 bits of 5^q. */
+
+static gboolean eisel_lemire(guint64 w, gint q, double *result)
+{
+    static GOnce once = G_ONCE_INIT;
+    guint64 hi, lo, hi2, lo2, upperbit, mantissa, bits;
+    gint64 exponent;
+    gint lz;
+
+    if (q < MIN_POW10) {
+        *result = 0.0;
+        return TRUE;
+    }
+    if (q > MAX_POW10) {
+        *result = HUGE_VAL;
+        return TRUE;
+    }
+
+    g_once(&once, init_powers, NULL);
+
+    // floor(log2(10^q)) = (217706*q) >> 16, for |q| < 1650
+    exponent = ((217706*(gint64)q) >> 16) + 1024 + 63;
+    lz = __builtin_clzll(w);
+    w <<= lz;
+
+    mul128(w, powers[q - MIN_POW10][0], &hi, &lo);
+    if ((hi & 0x1ff) == 0x1ff) {
+        // The lower bits might carry into the 55 we need
+        mul128(w, powers[q - MIN_POW10][1], &hi2, &lo2);
+        lo += hi2;
+        if (hi2 > lo)
+            hi++;
+        if ((hi & 0x1ff) == 0x1ff && lo + 1 == 0 && (q < -27 || q > 55))
+            return FALSE;
+    }
+
+    upperbit = hi >> 63;
+    mantissa = hi >> (upperbit + 9);
+    lz += 1 ^ upperbit;
+    exponent -= lz;
+
+    if (exponent <= 0) {
+        // Subnormal, or zero
+        if (1 - exponent >= 64) {
+            *result = 0.0;
+            return TRUE;
+        }
+        mantissa >>= 1 - exponent;
+        mantissa += mantissa & 1;
+        mantissa >>= 1;
+        exponent = mantissa < (G_GUINT64_CONSTANT(1) << 52) ? 0 : 1;
+        bits = mantissa | (guint64)exponent << 52;
+        memcpy(result, &bits, sizeof(bits));
+        return TRUE;
+    }
+
+    // Exactly halfway between two doubles: round to even.  This can only
+    // happen for small q, where the product is exact.
+    if (lo <= 1 && q >= -4 && q <= 23 && (mantissa & 3) == 1 &&
+        (mantissa << (upperbit + 9)) == hi)
+        mantissa &= ~G_GUINT64_CONSTANT(1);
+
+    mantissa += mantissa & 1;
+    mantissa >>= 1;
+    if (mantissa >= (G_GUINT64_CONSTANT(2) << 52)) {
+        mantissa = G_GUINT64_CONSTANT(1) << 52;
+        exponent++;
+    }
+    mantissa &= ~(G_GUINT64_CONSTANT(1) << 52);
+    if (exponent > 2046) {
+        *result = HUGE_VAL;
+        return TRUE;
+    }
+
+    bits = mantissa | (guint64)exponent << 52;
+    memcpy(result, &bits, sizeof(bits));
+    return TRUE;
+}
+
+
+/* The slow way: copy s ... end without the '_':s, and let g_ascii_strtod()
+   do it. */
+
+static double fallback(const char *s, const char *end)
+{
+    char buf[128], *copy;
+    const char *p;
+    gsize n;
+    double x;
+
+    n = end - s;
+    copy = (n < sizeof(buf)) ? buf : g_malloc(n + 1);
+    for (p = s, n = 0; p < end; p++)
+        if (*p != '_')
+            copy[n++] = *p;
+    copy[n] = '\0';
+
+    x = g_ascii_strtod(copy, NULL);
+
+    if (copy != buf)
+        g_free(copy);
+    return x;
+}
+
+
+static inline gboolean is_digit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+
+/* If p[0] is a digit separator, skip it.  It must have digits on both
+   sides. */
+
+static inline const char *skip_separator(const char *p, const char *s)
+{
+    if (*p == '_' && p > s && is_digit(p[-1]) && is_digit(p[1]))
+        return p + 1;
+    return p;
+}
+
+
+double parse_number(const char *s, const char **end)
+{
+    const char *p, *e;
+    guint64 w = 0;
+    gint digits = 0, q = 0, n_digits = 0, exp10 = 0, exp_sign = 1;
+    gboolean truncated = FALSE;
+    double x;
+
+    // Hexadecimal numbers, which g_strtod() used to take, are left to it
+    if (s[0] == '0' && (s[1] == 'x' || s[1] == 'X'))
+        return g_ascii_strtod(s, (char **)end);
+
+    p = s;
+    for (;;) {
+        p = skip_separator(p, s);
+        if (!is_digit(*p))
+            break;
+        if (digits < MAX_DIGITS) {
+            if (w > 0 || *p != '0') {
+                w = w*10 + (*p - '0');
+                digits++;
+            }
+        } else {
+            truncated = TRUE;
+            q++;
+        }
+        n_digits++;
+        p++;
+    }
+    if (*p == '.') {
+        p++;
+        for (;;) {
+            p = skip_separator(p, s);
+            if (!is_digit(*p))
+                break;
+            if (digits < MAX_DIGITS) {
+                if (w > 0 || *p != '0') {
+                    w = w*10 + (*p - '0');
+                    digits++;
+                }
+                q--;
+            } else
+                truncated = TRUE;
+            n_digits++;
+            p++;
+        }
+    }
+    if (n_digits == 0) {
+        *end = s;
+        return 0.0;
+    }
+
+    // The exponent is only part of the number if it has digits
+    if (*p == 'e' || *p == 'E') {
+        e = p + 1;
+        if (*e == '+' || *e == '-')
+            exp_sign = (*e++ == '-') ? -1 : 1;
+        if (is_digit(*e)) {
+            for (;;) {
+                e = skip_separator(e, s);
+                if (!is_digit(*e))
+                    break;
+                if (exp10 < 100000)
+                    exp10 = exp10*10 + (*e - '0');
+                e++;
+            }
+            q += exp_sign*exp10;
+            p = e;
+        }
+    }
+    *end = p;
+
+    // 'truncated' only matters if a non-zero digit was dropped, but
+    // g_ascii_strtod() gets it right either way
+    if (truncated)
+        return fallback(s, p);
+    if (w == 0)
+        return 0.0;
+
+#if FLT_EVAL_METHOD == 0
+    if (w <= G_GUINT64_CONSTANT(1) << 53 && q >= -22 && q <= 22)
+        return (q < 0) ? (double)w/exact_pow10[-q] : (double)w*exact_pow10[q];
+#endif
+
+    if (eisel_lemire(w, q, &x))
+        return x;
+    return fallback(s, p);
+}
+
+
+/* x rounded to 'digits' significant digits, half to even, as m*10^e, where
+   10^top is about the size of x (m may get a digit more or less).  With x =
+   mant*2^bexp, x*10^-e is mant*2^bexp*10^-e, which is done exactly with 128
+   bit integers.  Returns FALSE when they aren't enough. */
+
+static gboolean round_digits(double x, gint top, gint digits, guint64 *m,
+                             gint *e)
+{
+    unsigned __int128 n, d, q, r;
+    gint bexp;
+
+    *e = top - (digits - 1);
+    if (*e < -22 || *e > 22)
+        return FALSE;
+
+    n = (guint64)ldexp(frexp(x, &bexp), 53);
+    bexp -= 53;
+    if (bexp > 74 || bexp < -127)
+        return FALSE;
+
+    d = 1;
+    if (*e <= 0)
+        n *= (unsigned __int128)exact_pow10[-*e];
+    else
+        d = (unsigned __int128)exact_pow10[*e];
+    if (bexp >= 0)
+        n <<= bexp;
+    else
+        d <<= -bexp;
+
+    q = n/d;
+    r = n - q*d;
+    if (r > d - r || (r == d - r && (q & 1)))
+        q++;
+
+    *m = q;
+    return TRUE;
+}
+
+
+/* Does m*10^e read back as x?  -1 if we can't tell quickly. */
+
+static gint reads_back(guint64 m, gint e, double x)
+{
+    double y;
+
+    if (m <= G_GUINT64_CONSTANT(1) << 53 && e >= -22 && e <= 22)
+        y = (e < 0) ? (double)m/exact_pow10[-e] : (double)m*exact_pow10[e];
+    else if (!eisel_lemire(m, e, &y))
+        return -1;
+
+    return y == x;
+}
+
+
+/* Doubles that aren't too large or small are rounded to 15, 16 and 17 digits
+   with round_digits(), until they read back as x (17 digits always do).  The
+   others, and the hard cases, are printed with as many digits instead. */
+
+gboolean shortest_decimal(double x, guint64 *m, gint *e)
+{
+    char buf[G_ASCII_DTOSTR_BUF_SIZE], format[8];
+    const char *p;
+    gint digits, top, back;
+
+    if (!isfinite(x) || x < 0)
+        return FALSE;
+
+    *m = 0;
+    *e = 0;
+    if (x == 0)
+        return TRUE;
+
+#if FLT_EVAL_METHOD == 0
+    top = (gint)floor(log10(x));
+    for (digits = 15; digits <= 17; digits++) {
+        if (!round_digits(x, top, digits, m, e) ||
+            *m < exact_pow10[digits - 1] || *m >= exact_pow10[digits])
+            break;
+        back = (digits == 17) ? 1 : reads_back(*m, *e, x);
+        if (back < 0)
+            break;
+        if (back)
+            goto strip;
+    }
+#endif
+
+    for (digits = 15; digits <= 17; digits++) {
+        g_snprintf(format, sizeof(format), "%%.%de", digits - 1);
+        g_ascii_formatd(buf, sizeof(buf), format, x);
+        if (g_ascii_strtod(buf, NULL) == x)
+            break;
+    }
+
+    *m = 0;
+    for (p = buf; *p != 'e'; p++)
+        if (is_digit(*p))
+            *m = 10*(*m) + (*p - '0');
+    *e = atoi(p + 1) - (digits - 1);
+
+strip:
+    while (*m % 10 == 0) {
+        *m /= 10;
+        (*e)++;
+    }
+
+    return TRUE;
+}
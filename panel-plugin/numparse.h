@@ -0,0 +1,34 @@
+/*
+ *  Copyright (C) 2010 Erik Edelmann <erik.edelmann@iki.fi>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+#ifndef __NUMPARSE_H__
+#define __NUMPARSE_H__
+
+#include <glib.h>
+
+/* Parse the decimal number at the start of 's', like '12.5', '.5', '1e-3' or
+   '1_000_000' ('_' is allowed between two digits), and put a pointer to the
+   first char after it in '*end'.  The result is correctly rounded, and the
+   locale doesn't matter: the decimal point is always '.'.  If 's' doesn't
+   start with a number, return 0 and set '*end' to 's'. */
+double parse_number(const char *s, const char **end);
+
+/* The shortest decimal m*10^e that rounds to x, for finite x >= 0.  Returns
+   FALSE for other x.  m has no trailing zeros. */
+gboolean shortest_decimal(double x, guint64 *m, gint *e);
+
+#endif
@@ -0,0 +1,277 @@
+/*
+ *  Copyright (C) 2010 Erik Edelmann <erik.edelmann@iki.fi>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+#include <string.h>
+#include <math.h>
+#include <glib.h>
+#include "flattree.h"
+#include "optimize.h"
+#include "stats.h"
+
+#define MAX_DEGREE 32
+
+static poly_mode_t default_mode = POLY_OFF;
+
+/* What we know about a subtree: whether it's a polynomial, in which
+   variable (-1 for constants), of which degree, and whether it's a single
+   term. */
+typedef struct {
+    gboolean poly;
+    gint slot;
+    gint degree;
+    gboolean monomial;
+} poly_info_t;
+
+
+/* If the subtree 'id' is a whole number 0 ... MAX_DEGREE, return it, or -1
+   if not. */
+
+static gint small_integer(const flattree_t *tree, node_id_t id)
+{
+    double x;
+
+    if (tree->type[id] != NODE_NUMBER)
+        return -1;
+    x = tree->nums[tree->arg[id]];
+    return (x >= 0 && x <= MAX_DEGREE && x == floor(x)) ? (gint)x : -1;
+}
+
+
+/* Fill in info[id] from the infos of the children of 'id'.  Products are
+   only taken apart if one factor is a single term, so that nothing like
+   (x + 1)*(x - 1) is expanded. */
+
+static void classify(const flattree_t *tree, node_id_t id, poly_info_t *info)
+{
+    poly_info_t *r = &info[id], *a, *b;
+    gint n;
+
+    r->poly = FALSE;
+
+    switch (tree->type[id]) {
+    case NODE_NUMBER:
+        r->poly = TRUE;
+        r->slot = -1;
+        r->degree = 0;
+        r->monomial = TRUE;
+        return;
+    case NODE_VARIABLE:
+        r->poly = TRUE;
+        r->slot = tree->arg[id];
+        r->degree = 1;
+        r->monomial = TRUE;
+        return;
+    case NODE_OPERATOR:
+        break;
+    default:
+        return;
+    }
+
+    b = &info[tree->right[id]];
+    a = (tree->left[id] != NO_NODE) ? &info[tree->left[id]] : NULL;
+    if (!b->poly || (a && !a->poly))
+        return;
+    if (a && a->slot >= 0 && b->slot >= 0 && a->slot != b->slot)
+        return;
+
+    switch (tree->arg[id]) {
+    case OP_UMINUS:
+        *r = *b;
+        return;
+    case OP_PLUS:
+    case OP_MINUS:
+        r->degree = MAX(a->degree, b->degree);
+        r->monomial = (a->degree == 0 && b->degree == 0);
+        break;
+    case OP_TIMES:
+        if (!a->monomial && !b->monomial)
+            return;
+        r->degree = a->degree + b->degree;
+        r->monomial = a->monomial && b->monomial;
+        break;
+    case OP_POW:
+        n = small_integer(tree, tree->right[id]);
+        if (!a->monomial || n < 0)
+            return;
+        r->degree = a->degree*n;
+        r->monomial = TRUE;
+        break;
+    default:
+        return;
+    }
+
+    if (r->degree > MAX_DEGREE)
+        return;
+    r->poly = TRUE;
+    r->slot = MAX(a->slot, b->slot);
+}
+
+
+/* Put the coefficients of the polynomial subtree 'id' in c[], lowest power
+   first. */
+
+static void coefficients(const flattree_t *tree, const poly_info_t *info,
+                         node_id_t id, double *c)
+{
+    double a[MAX_DEGREE+1], b[MAX_DEGREE+1];
+    gint i, j, k, n;
+
+    memset(c, 0, (MAX_DEGREE+1)*sizeof(double));
+
+    switch (tree->type[id]) {
+    case NODE_NUMBER:
+        c[0] = tree->nums[tree->arg[id]];
+        return;
+    case NODE_VARIABLE:
+        c[1] = 1.0;
+        return;
+    default:
+        break;
+    }
+
+    if (tree->left[id] != NO_NODE)
+        coefficients(tree, info, tree->left[id], a);
+    if (tree->arg[id] != OP_POW)
+        coefficients(tree, info, tree->right[id], b);
+
+    switch (tree->arg[id]) {
+    case OP_UMINUS:
+        for (i = 0; i <= MAX_DEGREE; i++)
+            c[i] = -b[i];
+        break;
+    case OP_PLUS:
+        for (i = 0; i <= MAX_DEGREE; i++)
+            c[i] = a[i] + b[i];
+        break;
+    case OP_MINUS:
+        for (i = 0; i <= MAX_DEGREE; i++)
+            c[i] = a[i] - b[i];
+        break;
+    case OP_TIMES:
+        for (i = 0; i <= info[tree->left[id]].degree; i++)
+            for (j = 0; j <= info[tree->right[id]].degree; j++)
+                c[i + j] += a[i]*b[j];
+        break;
+    case OP_POW:
+        // (a x^k)^n = a^n x^(k n)
+        k = info[tree->left[id]].degree;
+        n = small_integer(tree, tree->right[id]);
+        c[k*n] = pow(a[k], n);
+        break;
+    default:
+        g_assert_not_reached();
+    }
+}
+
+
+/* Copy the subtree 'id' of 'tree' to 'out', with the polynomials in it
+   rewritten.  Return the new id of 'id', and count the rewritten
+   polynomials in '*n_polys'. */
+
+static node_id_t rewrite(const flattree_t *tree, const poly_info_t *info,
+                         node_id_t id, flattree_t *out, gint *n_polys)
+{
+    const poly_info_t *p = &info[id];
+    double c[MAX_DEGREE+1], horner[MAX_DEGREE+2];
+    node_id_t left, right;
+    gint i;
+
+    if (id == NO_NODE)
+        return NO_NODE;
+
+    // Anything with more than two nodes is worth it
+    if (p->poly && p->slot >= 0 && p->degree >= 1 &&
+        id - flattree_first(tree, id) >= 2) {
+        coefficients(tree, info, id, c);
+        horner[0] = p->degree;
+        for (i = 0; i <= p->degree; i++)
+            horner[i + 1] = c[p->degree - i];
+        right = flattree_add_node(out, NODE_VARIABLE, p->slot, NO_NODE,
+                                  NO_NODE);
+        (*n_polys)++;
+        return flattree_add_node(out, NODE_POLY,
+                                 flattree_add_nums(out, horner, p->degree + 2),
+                                 NO_NODE, right);
+    }
+
+    left = rewrite(tree, info, tree->left[id], out, n_polys);
+    right = rewrite(tree, info, tree->right[id], out, n_polys);
+    if (tree->type[id] == NODE_NUMBER && tree->lits)
+        return flattree_add_literal(out, tree->nums[tree->arg[id]],
+                                    tree->lits[tree->arg[id]]);
+    if (tree->type[id] == NODE_NUMBER)
+        return flattree_add_number(out, tree->nums[tree->arg[id]]);
+    return flattree_add_node(out, tree->type[id], tree->arg[id], left, right);
+}
+
+
+void optimize_flattree(flattree_t *tree, poly_mode_t mode)
+{
+    poly_info_t *info;
+    flattree_t *out, tmp;
+    gint n_polys = 0;
+    node_id_t id;
+
+    if (mode == POLY_OFF || !tree || tree->root == NO_NODE ||
+        !flattree_is_scalar(tree))
+        return;
+
+    info = g_new(poly_info_t, tree->n_nodes);
+    stats_count(STAT_ALLOCATIONS, 1);
+    for (id = 0; id < tree->n_nodes; id++)
+        classify(tree, id, info);
+
+    out = flattree_new();
+    out->root = rewrite(tree, info, tree->root, out, &n_polys);
+
+    // Swap the new nodes and numbers into 'tree', and free the old ones
+    if (n_polys > 0) {
+        tmp = *tree;
+        tree->n_nodes = out->n_nodes;
+        tree->size = out->size;
+        tree->type = out->type;
+        tree->arg = out->arg;
+        tree->left = out->left;
+        tree->right = out->right;
+        tree->root = out->root;
+        tree->n_nums = out->n_nums;
+        tree->nums_size = out->nums_size;
+        tree->nums = out->nums;
+        tree->lits = out->lits;
+        tree->fma = (mode == POLY_CONTRACT);
+        out->type = tmp.type;
+        out->arg = tmp.arg;
+        out->left = tmp.left;
+        out->right = tmp.right;
+        out->nums = tmp.nums;
+        out->lits = tmp.lits;
+    }
+    free_flattree(out);
+    g_free(info);
+}
+
+
+void optimize_set_mode(poly_mode_t mode)
+{
+    default_mode = mode;
+}
+
+
+poly_mode_t optimize_mode(void)
+{
+    return default_mode;
+}
@@ -0,0 +1,58 @@
+/*
+ *  Copyright (C) 2010 Erik Edelmann <erik.edelmann@iki.fi>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+#ifndef __OPTIMIZE_H__
+#define __OPTIMIZE_H__
+
+#include "flattree.h"
+
+/* 
+ * Polynomials in one variable, like 'a*x^3 + b*x^2 + c*x + d', are rewritten
+ * into single NODE_POLY nodes, which are evaluated by Horner's rule
+ * (((a*x + b)*x + c)*x + d) instead of term by term with pow().  A rational
+ * function p(x)/q(x) becomes the quotient of two such nodes.
+ *
+ * The result is not always the same as without the rewriting:
+ *
+ *   - x^n is computed by multiplications rather than pow(), and the terms
+ *     aren't rounded separately, so the result may differ in the last few
+ *     bits.  Horner's rule and the term-by-term sum have error bounds of the
+ *     same size, and both are inaccurate near the roots of the polynomial,
+ *     where the terms cancel.
+ *   - Like terms are added up first: '3*x^2 + 2*x^2' becomes 5*x^2.
+ *   - For infinite x, terms that would be inf - inf can come out as +-inf
+ *     instead of NaN.
+ *
+ * In POLY_CONTRACT mode, each multiplication and addition of Horner's rule
+ * is a single fma(), with one rounding instead of two.  That's usually a
+ * little more accurate, and faster if the compiler targets FMA instructions;
+ * otherwise fma() is a slow library call.
+ * POLY_STRICT rounds after every operation.
+ *
+ * Only trees without matrices or units are rewritten.
+ */
+
+typedef enum { POLY_OFF, POLY_STRICT, POLY_CONTRACT } poly_mode_t;
+
+void optimize_flattree(flattree_t *tree, poly_mode_t mode);
+
+/* The mode parse_flattree(), and everything built on it, uses.  POLY_OFF
+   unless changed. */
+void optimize_set_mode(poly_mode_t mode);
+poly_mode_t optimize_mode(void);
+
+#endif
@@ -0,0 +1,157 @@
+/*
+ *  Copyright (C) 2010 Erik Edelmann <erik.edelmann@iki.fi>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+#include <stdlib.h>
+#include <glib.h>
+#include "parallel.h"
+
+
+typedef struct {
+    parallel_task_t task;
+    gpointer data;
+    guint n_tasks;
+    volatile gint next;
+    /* Helpers from the pool that haven't finished yet */
+    guint n_helpers;
+    GMutex lock;
+    GCond done;
+} job_t;
+
+/* Set in threads that are running tasks, so that nested parallel_for() calls
+   don't start new threads. */
+static GPrivate in_task = G_PRIVATE_INIT(NULL);
+
+static guint max_threads = 0;
+
+/* The threads that help the caller of parallel_for().  They are started
+   with the first call and then kept, since integrate() and the reductions
+   call parallel_for() again and again. */
+static GThreadPool *pool;
+static GMutex pool_lock;
+
+
+static void run_tasks(job_t *job)
+{
+    gint i;
+
+    g_private_set(&in_task, GINT_TO_POINTER(TRUE));
+
+    while ((i = g_atomic_int_add(&job->next, 1)) < job->n_tasks)
+        job->task(i, job->data);
+
+    g_private_set(&in_task, NULL);
+}
+
+
+static void helper(gpointer data, gpointer user_data)
+{
+    job_t *job = data;
+
+    run_tasks(job);
+
+    g_mutex_lock(&job->lock);
+    if (--job->n_helpers == 0)
+        g_cond_signal(&job->done);
+    g_mutex_unlock(&job->lock);
+}
+
+
+/* Pool threads in addition to the calling thread */
+
+static gint pool_size(void)
+{
+    return MAX(max_threads, g_get_num_processors()) - 1;
+}
+
+
+static GThreadPool *get_pool(void)
+{
+    g_mutex_lock(&pool_lock);
+    if (!pool)
+        pool = g_thread_pool_new(helper, NULL, pool_size(), TRUE, NULL);
+    g_mutex_unlock(&pool_lock);
+
+    return pool;
+}
+
+
+guint parallel_n_threads(guint n_tasks)
+{
+    if (g_private_get(&in_task))
+        return 1;
+
+    return MAX(1, MIN(n_tasks, max_threads ? max_threads
+                                           : g_get_num_processors()));
+}
+
+
+void parallel_set_threads(guint n)
+{
+    g_mutex_lock(&pool_lock);
+    max_threads = n;
+    if (pool)
+        g_thread_pool_set_max_threads(pool, pool_size(), NULL);
+    g_mutex_unlock(&pool_lock);
+}
+
+
+guint parallel_get_threads(void)
+{
+    return max_threads;
+}
+
+
+void parallel_for(guint n_tasks, parallel_task_t task, gpointer data)
+{
+    GThreadPool *helpers;
+    job_t job;
+    guint i, n_threads;
+
+    n_threads = parallel_n_threads(n_tasks);
+
+    if (n_threads == 1) {
+        for (i = 0; i < n_tasks; i++)
+            task(i, data);
+        return;
+    }
+
+    job.task = task;
+    job.data = data;
+    job.n_tasks = n_tasks;
+    job.next = 0;
+    job.n_helpers = n_threads - 1;
+    g_mutex_init(&job.lock);
+    g_cond_init(&job.done);
+
+    /* The helpers never wait for anything, so even if they queue up behind
+       the jobs of other threads, they get to run. */
+    helpers = get_pool();
+    for (i = 0; i < n_threads-1; i++)
+        g_thread_pool_push(helpers, &job, NULL);
+
+    run_tasks(&job);
+
+    /* The helpers that start late find no tasks left, but 'job' must stay
+       around until they have looked. */
+    g_mutex_lock(&job.lock);
+    while (job.n_helpers > 0)
+        g_cond_wait(&job.done, &job.lock);
+    g_mutex_unlock(&job.lock);
+
+    g_mutex_clear(&job.lock);
+    g_cond_clear(&job.done);
+}
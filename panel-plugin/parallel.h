@@ -0,0 +1,37 @@
+/*
+ *  Copyright (C) 2010 Erik Edelmann <erik.edelmann@iki.fi>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+#ifndef __PARALLEL_H__
+#define __PARALLEL_H__
+
+#include <glib.h>
+
+typedef void (*parallel_task_t)(guint i, gpointer data);
+
+/* Call task(i, data) for i = 0 ... n_tasks-1, spread over as many threads as
+   there are processors.  The calls may happen in any order, and in parallel.
+   When called from inside a task, the tasks are run in the calling thread. */
+void parallel_for(guint n_tasks, parallel_task_t task, gpointer data);
+
+/* Number of threads parallel_for() would use for 'n_tasks' tasks. */
+guint parallel_n_threads(guint n_tasks);
+
+/* Use at most n threads, or one per processor if n is 0 (the default). */
+void parallel_set_threads(guint n);
+guint parallel_get_threads(void);
+
+#endif
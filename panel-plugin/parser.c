@@ -20,22 +20,29 @@
 #include <math.h>
 #include <glib.h>
 #include "parsetree.h"
+#include "flattree.h"
+#include "functions.h"
 #include "parser.h"
 #include "lexer.h"
-#include "eval.h"
+#include "stats.h"
+#include "quad.h"
+#include "matrix.h"
+#include "units.h"
+#include "optimize.h"
 
 
 /* 
  * A recursive descent parser for the grammar defined in the file grammar.txt.
+ * The nodes are appended to a flattree as they are recognised, so that
+ * children always end up before their parents.
  */
 
 /* 
  * A note on error handling: If a get_<something> function encounters an error,
- * it should:
-
- * 1) Set an apropriate error message in 'err'
- * 2) Either free any nodes it has created using free_parsetree() and return
- *    NULL, or return the node as is (so that it can be freed later).
+ * it should set an apropriate error message in 'err' and return NO_NODE, or
+ * whatever it has built so far.  Nothing is allocated for the error; the
+ * message is put together only if someone asks for it.  Nodes are never
+ * freed one by one; they belong to the tree and go away with it.
  */
 
 
@@ -47,31 +54,6 @@ static struct {
     { NULL, 0.0 }
 };
 
-static struct {
-    char *name;
-    double (*fun)(double x);
-} functions[] = {
-    { "sqrt", sqrt },
-    { "log", log },
-    { "ln", log },
-    { "exp", exp },
-    { "sin", my_sin },
-    { "cos", my_cos },
-    { "tan", my_tan },
-    { "asin", my_asin },
-    { "arcsin", my_asin },
-    { "acos", my_acos },
-    { "arccos", my_acos },
-    { "atan", my_atan },
-    { "arctan", my_atan },
-    { "log2", log2 },
-    { "log10", log10 },
-    { "lg", log10 },
-    { "abs", fabs },
-    { "cbrt", cbrt },
-    { NULL, NULL }
-};
-
 
 /* Look up the constant of name 'name', and put it in 'value' if found.  Return
    TRUE if found, FALSE if not. */
@@ -92,27 +74,20 @@ static gboolean find_constant(const char *name, double *value)
 }
 
 
-/* Lookup the function 'name', and put a pointer to its implementation in 'fun'
-   if found. Return TRUE if found, FALSE if not. */
 
-static gboolean find_function(const char *name, double (**fun)(double x))
-{
-    int i = 0;
+static node_id_t get_expr(token_stack_t *stack, flattree_t *tree,
+                          parse_error_t *err);
 
-    while (functions[i].name) {
-        if (strcmp(name, functions[i].name) == 0) {
-            *fun = functions[i].fun;
-            return TRUE;
-        }
-        i++;
-    }
 
-    return FALSE;
-}
+/* Return TRUE if 'token' can follow a complete expression, without being part
+   of it. */
 
-
-
-static node_t *get_expr(token_stack_t *stack, GError **err);
+static gboolean ends_expr(const token_t *token)
+{
+    return token->type == TOK_RPAREN || token->type == TOK_COMMA ||
+        token->type == TOK_RBRACKET || token->type == TOK_SEMICOLON ||
+        (token->type == TOK_IDENTIFIER && strcmp(token->val.id, "in") == 0);
+}
 
 
 static gboolean is_mult_op(char op)
@@ -120,7 +95,7 @@ static gboolean is_mult_op(char op)
     /*
     return op[0] == '/' || (op[0] == '*' && op[1] == '\0')
     */
-    return op == '/' || op == '*';
+    return op == '/' || op == '*' || op == TOK_OP_EMUL || op == TOK_OP_EDIV;
 }
 
 /*
@@ -131,40 +106,50 @@ static gboolean is_add_op(char op)
 */
 
 
-static void set_error(GError **err, const char *msg, const token_t *token)
+static void set_error(parse_error_t *err, stat_error_t kind, const char *msg,
+                      const token_t *token)
 {
-    char pos_str[32];
-    int pos;
+    // Only the first error is kept
+    if (err->set)
+        return;
+
+    stats_count_error(token ? kind : STAT_ERROR_END_OF_INPUT);
+    err->set = TRUE;
+    err->kind = token ? kind : STAT_ERROR_END_OF_INPUT;
+    err->position = token ? token->position : -1;
+    err->message = msg;
+    err->name[0] = '\0';
+}
 
-    if (token) {
-        pos = token->position;
-        g_snprintf(pos_str, sizeof(pos_str), "position %i", pos+1);
-    } else {
-        pos = -1;
-        g_snprintf(pos_str, sizeof(pos_str), "end of input");
-    }
 
-    g_set_error(err, 0, pos, "At %s: %s", pos_str, msg);
+/* Like set_error(), but 'msg' contains a %s for the identifier 'token'. */
+
+static void set_error_id(parse_error_t *err, stat_error_t kind,
+                         const char *msg, const token_t *token)
+{
+    if (err->set)
+        return;
+
+    set_error(err, kind, msg, token);
+    g_strlcpy(err->name, token->val.id, sizeof(err->name));
 }
 
 
-static node_t *get_number(token_stack_t *stack, GError **err)
+static node_id_t get_number(token_stack_t *stack, flattree_t *tree,
+                            parse_error_t *err)
 {
     token_t *token;
-    node_t *node;
+    node_id_t node;
 
     g_assert(stack);
 
     token = token_pop(stack);
 
     if (token && token->type == TOK_NUMBER) {
-        node = g_malloc(sizeof(node_t));
-        node->type = NODE_NUMBER;
-        node->val.num = token->val.num;
-        node->left = node->right = NULL;
+        node = flattree_add_literal(tree, token->val.num, token->position);
     } else {
-        node = NULL;
-        set_error(err, "Expected number", token);
+        node = NO_NODE;
+        set_error(err, STAT_ERROR_SYNTAX, "Expected number", token);
     }
 
     g_free(token);
@@ -175,42 +160,40 @@ static node_t *get_number(token_stack_t *stack, GError **err)
 
 /* Look for '(' <expr> ')'. */
 
-static node_t *get_parentised_expr(token_stack_t *stack, GError **err)
+static node_id_t get_parentised_expr(token_stack_t *stack, flattree_t *tree,
+                                     parse_error_t *err)
 {
     token_t *token;
-    GError *tmp_err = NULL;
-    node_t *node;
+    node_id_t node;
 
     // '('
     token = token_pop(stack);
     if (!token || token->type != TOK_LPAREN) {
-        set_error(err, "Expected '('", token);
+        set_error(err, STAT_ERROR_SYNTAX, "Expected '('", token);
         g_free(token);
-        return NULL;
+        return NO_NODE;
     }
 
     // expr
-    node = get_expr(stack, &tmp_err); 
-    if (tmp_err) {
-        g_propagate_error(err, tmp_err);
-        free_parsetree(node);
-        return NULL;
+    node = get_expr(stack, tree, err); 
+    if (err->set) {
+        g_free(token);
+        return NO_NODE;
     }
 
-    if (!node) { 
+    if (node == NO_NODE) { 
         // Re-use the RPAREN token for this error message.
         token->position++;
-        set_error(err, "Expected expression", token);
+        set_error(err, STAT_ERROR_SYNTAX, "Expected expression", token);
     }
     g_free(token);
 
     // ')'
     token = token_pop(stack);
     if (!token || token->type != TOK_RPAREN) {
-        free_parsetree(node);
-        set_error(err, "Expected ')'", token);
+        set_error(err, STAT_ERROR_SYNTAX, "Expected ')'", token);
         g_free(token);
-        return NULL;
+        return NO_NODE;
     }
 
     g_free(token);
@@ -218,97 +201,587 @@ static node_t *get_parentised_expr(token_stack_t *stack, GError **err)
 }
 
 
-static node_t *get_pow(token_stack_t *stack, GError **err)
+/* Look for '(' <expr> ',' <expr> ... ')' with exactly 'n' expressions, and put
+   them in 'args'. */
+
+static void get_arguments(token_stack_t *stack, flattree_t *tree,
+                          node_id_t *args, int n, parse_error_t *err)
+{
+    token_t *token;
+    int i;
+
+    // '('
+    token = token_pop(stack);
+    if (!token || token->type != TOK_LPAREN) {
+        set_error(err, STAT_ERROR_SYNTAX, "Expected '('", token);
+        g_free(token);
+        return;
+    }
+
+    for (i = 0; i < n; i++) {
+        // expr
+        args[i] = get_expr(stack, tree, err);
+        if (err->set) {
+            g_free(token);
+            return;
+        }
+        if (args[i] == NO_NODE) {
+            token->position++;
+            set_error(err, STAT_ERROR_SYNTAX, "Expected expression", token);
+            g_free(token);
+            return;
+        }
+        g_free(token);
+
+        // ',' or ')'
+        token = token_pop(stack);
+        if (i < n-1 && (!token || token->type != TOK_COMMA)) {
+            set_error(err, STAT_ERROR_SYNTAX, "Expected ','", token);
+            g_free(token);
+            return;
+        }
+    }
+
+    if (!token || token->type != TOK_RPAREN)
+        set_error(err, STAT_ERROR_SYNTAX, "Expected ')'", token);
+    g_free(token);
+}
+
+
+/* Look for '(' <cond> ',' <expr> ',' <expr> ')' after 'if'. */
+
+static node_id_t get_if(token_stack_t *stack, flattree_t *tree,
+                        parse_error_t *err)
+{
+    node_id_t args[3], branches;
+
+    get_arguments(stack, tree, args, 3, err);
+    if (err->set)
+        return NO_NODE;
+
+    branches = flattree_add_operator(tree, OP_BRANCHES, args[1], args[2]);
+    return flattree_add_operator(tree, OP_COND, args[0], branches);
+}
+
+
+static const char *keywords[] = {
+    "if", "sum", "prod", "integrate", "integrate_err", "solve", "in", NULL
+};
+
+
+/* Return TRUE if 'name' has a meaning of its own, and can't be used as a
+   variable name. */
+
+static gboolean is_reserved(const char *name)
+{
+    double x;
+    int i;
+
+    for (i = 0; keywords[i]; i++) {
+        if (strcmp(name, keywords[i]) == 0)
+            return TRUE;
+    }
+
+    return find_constant(name, &x) || find_function(name) >= 0 ||
+        find_matrix_function(name) >= 0;
+}
+
+
+/* Pop a token of type 'type' from the stack, or set an error. Return TRUE if
+   the token was there. */
+
+static gboolean expect_token(token_stack_t *stack, token_type_t type,
+                             const char *msg, parse_error_t *err)
+{
+    token_t *token;
+    gboolean found;
+
+    token = token_pop(stack);
+    found = token && token->type == type;
+    if (!found)
+        set_error(err, STAT_ERROR_SYNTAX, msg, token);
+    g_free(token);
+
+    return found;
+}
+
+
+/* Return the first token of argument number 'n' (counting from 0) of the
+   argument list that starts at the top of the stack, or NULL if there is no
+   such argument. */
+
+static const token_t *peek_argument(const token_stack_t *stack, int n)
+{
+    const token_t *token;
+    int depth = 0;
+
+    for (token = token_peak(stack); token; token = token->next) {
+        if (token->type == TOK_LPAREN || token->type == TOK_LBRACKET)
+            depth++;
+        else if (token->type == TOK_RBRACKET)
+            depth--;
+        else if (token->type == TOK_RPAREN && --depth == 0)
+            return NULL;
+        else if (token->type == TOK_COMMA && depth == 1 && --n == 0)
+            return token->next;
+    }
+
+    return NULL;
+}
+
+
+/* Return the index in units[] of the unit called 'name', or -1 if there is
+   no such unit, or if 'name' means something else. */
+
+static gint lookup_unit(const flattree_t *tree, const char *name)
+{
+    if (is_reserved(name) || flattree_lookup_variable(tree, name) >= 0)
+        return -1;
+
+    return find_unit(name);
+}
+
+
+/* Check that 'token' is an identifier that can be used as a variable name. */
+
+static gboolean check_variable_name(const token_t *token, parse_error_t *err)
+{
+    if (!token || token->type != TOK_IDENTIFIER) {
+        set_error(err, STAT_ERROR_SYNTAX, "Expected variable name", token);
+        return FALSE;
+    }
+    if (is_reserved(token->val.id)) {
+        set_error_id(err, STAT_ERROR_SYNTAX, "'%s' can't be used as a variable",
+                     token);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+
+/* Look for '(' <variable> ',' <expr> ',' <expr> ',' <expr> ')' after 'sum' or
+   'prod'.  The variable is visible only in the last expression. */
+
+static node_id_t get_reduction(token_stack_t *stack, flattree_t *tree,
+                               node_type_t type, parse_error_t *err)
+{
+    token_t *token;
+    node_id_t bounds[2], range, body;
+    char name[MAX_ID_LEN+1];
+    gint slot;
+    int i;
+
+    // '(' <variable> ','
+    token = token_pop(stack);
+    if (!token || token->type != TOK_LPAREN) {
+        set_error(err, STAT_ERROR_SYNTAX, "Expected '('", token);
+        g_free(token);
+        return NO_NODE;
+    }
+    g_free(token);
+
+    token = token_pop(stack);
+    if (!check_variable_name(token, err)) {
+        g_free(token);
+        return NO_NODE;
+    }
+    g_strlcpy(name, token->val.id, sizeof(name));
+    g_free(token);
+
+    // <lower> ',' <upper> ','
+    for (i = 0; i < 2; i++) {
+        token = token_pop(stack);
+        if (!token || token->type != TOK_COMMA) {
+            set_error(err, STAT_ERROR_SYNTAX, "Expected ','", token);
+            g_free(token);
+            return NO_NODE;
+        }
+        bounds[i] = get_expr(stack, tree, err);
+        if (!err->set && bounds[i] == NO_NODE) {
+            token->position++;
+            set_error(err, STAT_ERROR_SYNTAX, "Expected expression",
+                      token);
+        }
+        g_free(token);
+        if (err->set)
+            return NO_NODE;
+    }
+    range = flattree_add_operator(tree, OP_RANGE, bounds[0], bounds[1]);
+
+    // <body> ')'
+    token = token_pop(stack);
+    if (!token || token->type != TOK_COMMA) {
+        set_error(err, STAT_ERROR_SYNTAX, "Expected ','", token);
+        g_free(token);
+        return NO_NODE;
+    }
+
+    slot = flattree_bind_variable(tree, name);
+    if (slot < 0) {
+        set_error(err, STAT_ERROR_SYNTAX, "Too many variables", token);
+        g_free(token);
+        return NO_NODE;
+    }
+    body = get_expr(stack, tree, err);
+    flattree_unbind_variable(tree);
+    if (!err->set && body == NO_NODE) {
+        token->position++;
+        set_error(err, STAT_ERROR_SYNTAX, "Expected expression", token);
+    }
+    g_free(token);
+    if (err->set)
+        return NO_NODE;
+
+    token = token_pop(stack);
+    if (!token || token->type != TOK_RPAREN) {
+        set_error(err, STAT_ERROR_SYNTAX, "Expected ')'", token);
+        g_free(token);
+        return NO_NODE;
+    }
+    g_free(token);
+
+    return flattree_add_node(tree, type, slot, range, body);
+}
+
+
+/* Look for '(' <expr> ',' <variable> ',' <expr> ',' <expr> [',' <expr>] ')'
+   after 'integrate' or 'integrate_err', or the same without the optional
+   tolerance after 'solve'.  The variable is visible only in the first
+   expression, so it is looked up before that is parsed. */
+
+static node_id_t get_integral(token_stack_t *stack, flattree_t *tree,
+                              node_type_t type, parse_error_t *err)
+{
+    const token_t *var;
+    token_t *token;
+    node_id_t body, lower, upper, range, args, tol = NO_NODE;
+    gint slot;
+
+    var = peek_argument(stack, 1);
+    if (!check_variable_name(var, err))
+        return NO_NODE;
+
+    // '(' <body>
+    if (!expect_token(stack, TOK_LPAREN, "Expected '('", err))
+        return NO_NODE;
+
+    slot = flattree_bind_variable(tree, var->val.id);
+    if (slot < 0) {
+        set_error(err, STAT_ERROR_SYNTAX, "Too many variables", var);
+        return NO_NODE;
+    }
+    body = get_expr(stack, tree, err);
+    flattree_unbind_variable(tree);
+    if (!err->set && body == NO_NODE)
+        set_error(err, STAT_ERROR_SYNTAX, "Expected expression",
+                  token_peak(stack));
+    if (err->set)
+        return NO_NODE;
+
+    // ',' <variable> ','
+    if (!expect_token(stack, TOK_COMMA, "Expected ','", err))
+        return NO_NODE;
+    g_free(token_pop(stack));
+    if (!expect_token(stack, TOK_COMMA, "Expected ','", err))
+        return NO_NODE;
+
+    // <lower> ',' <upper>
+    lower = get_expr(stack, tree, err);
+    if (!err->set && lower == NO_NODE)
+        set_error(err, STAT_ERROR_SYNTAX, "Expected expression",
+                  token_peak(stack));
+    if (!err->set)
+        expect_token(stack, TOK_COMMA, "Expected ','", err);
+    if (!err->set) {
+        upper = get_expr(stack, tree, err);
+        if (!err->set && upper == NO_NODE)
+            set_error(err, STAT_ERROR_SYNTAX, "Expected expression",
+                      token_peak(stack));
+    }
+    if (err->set)
+        return NO_NODE;
+
+    // [',' <tol>] ')'
+    token = token_pop(stack);
+    if (token && token->type == TOK_COMMA && type != NODE_SOLVE) {
+        g_free(token);
+        tol = get_expr(stack, tree, err);
+        if (!err->set && tol == NO_NODE)
+            set_error(err, STAT_ERROR_SYNTAX, "Expected expression",
+                      token_peak(stack));
+        if (err->set)
+            return NO_NODE;
+        token = token_pop(stack);
+    } else if (type != NODE_SOLVE)
+        tol = flattree_add_number(tree, QUAD_DEFAULT_TOL);
+
+    if (!token || token->type != TOK_RPAREN) {
+        set_error(err, STAT_ERROR_SYNTAX, "Expected ')'", token);
+        g_free(token);
+        return NO_NODE;
+    }
+    g_free(token);
+
+    range = flattree_add_operator(tree, OP_RANGE, lower, upper);
+    if (type == NODE_SOLVE)
+        return flattree_add_node(tree, type, slot, body, range);
+
+    args = flattree_add_operator(tree, OP_ARGS, range, tol);
+    return flattree_add_node(tree, type, slot, body, args);
+}
+
+
+/* Look for '[' <expr> ',' <expr> ... ';' <expr> ',' <expr> ... ']', a matrix
+   with its rows separated by ';'.  All rows must have the same length. */
+
+static node_id_t get_matrix(token_stack_t *stack, flattree_t *tree,
+                            parse_error_t *err)
+{
+    token_t *token;
+    node_id_t elem, elems = NO_NODE;
+    guint32 cols = 0, n = 0;    // n: elements in the current row
+
+    // '['
+    if (!expect_token(stack, TOK_LBRACKET, "Expected '['", err))
+        return NO_NODE;
+
+    for (;;) {
+        // <expr>
+        elem = get_expr(stack, tree, err);
+        if (!err->set && elem == NO_NODE)
+            set_error(err, STAT_ERROR_SYNTAX, "Expected expression",
+                      token_peak(stack));
+        if (err->set)
+            return NO_NODE;
+        if (elems == NO_NODE)
+            elems = elem;
+        else
+            elems = flattree_add_operator(tree, OP_ARGS, elems, elem);
+        n++;
+
+        // ',', ';' or ']'
+        token = token_pop(stack);
+        if (token && token->type == TOK_COMMA) {
+            g_free(token);
+            continue;
+        }
+        if (!token || (token->type != TOK_SEMICOLON &&
+                       token->type != TOK_RBRACKET)) {
+            set_error(err, STAT_ERROR_SYNTAX, "Expected ',', ';' or ']'",
+                      token);
+            g_free(token);
+            return NO_NODE;
+        }
+
+        if (cols == 0)
+            cols = n;
+        if (n != cols) {
+            set_error(err, STAT_ERROR_SYNTAX,
+                      "Rows must all have the same length", token);
+            g_free(token);
+            return NO_NODE;
+        }
+        if (token->type == TOK_RBRACKET) {
+            g_free(token);
+            break;
+        }
+        g_free(token);
+        n = 0;
+    }
+
+    return flattree_add_node(tree, NODE_MATRIX, cols, NO_NODE, elems);
+}
+
+
+/* Look for the arguments of matrix_functions[fun]. */
+
+static node_id_t get_matrix_function(token_stack_t *stack, flattree_t *tree,
+                                     gint fun, parse_error_t *err)
+{
+    node_id_t args[2];
+
+    get_arguments(stack, tree, args, matrix_functions[fun].n_args, err);
+    if (err->set)
+        return NO_NODE;
+
+    if (matrix_functions[fun].n_args == 1)
+        return flattree_add_node(tree, NODE_MATFUN, fun, NO_NODE, args[0]);
+    else
+        return flattree_add_node(tree, NODE_MATFUN, fun, args[0], args[1]);
+}
+
+
+/* Look for units written next to each other, as in 'kg m s^-2', and multiply
+   them into 'num' (which may be NO_NODE).  A unit may be raised to a whole
+   number power. */
+
+static node_id_t get_units(token_stack_t *stack, flattree_t *tree,
+                           node_id_t num, parse_error_t *err)
+{
+    const token_t *token;
+    node_id_t unit, power;
+    gboolean negative;
+    gint i;
+
+    for (;;) {
+        token = token_peak(stack);
+        if (!token || token->type != TOK_IDENTIFIER ||
+            (i = lookup_unit(tree, token->val.id)) < 0)
+            return num;
+        g_free(token_pop(stack));
+        unit = flattree_add_node(tree, NODE_UNIT, i, NO_NODE, NO_NODE);
+
+        // ['^' ['-'] NUM]
+        token = token_peak(stack);
+        if (token && token->type == TOK_OPERATOR && token->val.op == '^') {
+            g_free(token_pop(stack));
+            token = token_peak(stack);
+            negative = token && token->type == TOK_OPERATOR &&
+                token->val.op == '-';
+            if (negative)
+                g_free(token_pop(stack));
+            power = get_number(stack, tree, err);
+            if (err->set)
+                return num;
+            if (negative)
+                power = flattree_add_operator(tree, OP_UMINUS, NO_NODE, power);
+            unit = flattree_add_operator(tree, OP_POW, unit, power);
+        }
+
+        if (num == NO_NODE)
+            num = unit;
+        else
+            num = flattree_add_operator(tree, OP_TIMES, num, unit);
+    }
+}
+
+
+static node_id_t get_pow(token_stack_t *stack, flattree_t *tree,
+                         parse_error_t *err)
 {
     const token_t *token;
-    node_t *node;
+    node_id_t node, arg, args[2];
     token_type_t type;
-    GError *tmp_err = NULL;
     double x;
-    double (*fun)(double x);
-    char msg[128];
+    gint fun, slot;
 
     token = token_peak(stack);
 
     type = (token) ? token->type : TOK_NULL;
     switch (type) {
     case TOK_LPAREN:
-        node = get_parentised_expr(stack, &tmp_err);
-        if (tmp_err)
-            g_propagate_error(err, tmp_err);
+        node = get_parentised_expr(stack, tree, err);
         break;
     case TOK_NUMBER:
-        node = get_number(stack, &tmp_err);
-        if (tmp_err)
-            g_propagate_error(err, tmp_err);
+        node = get_number(stack, tree, err);
+        if (!err->set)
+            node = get_units(stack, tree, node, err);
+        break;
+    case TOK_LBRACKET:
+        node = get_matrix(stack, tree, err);
         break;
     case TOK_IDENTIFIER:
-        token = token_pop(stack);
-        if (find_constant(token->val.id, &x)) {
-            node = g_malloc(sizeof(node_t));
-            node->type = NODE_NUMBER;
-            node->val.num = x;
-            node->left = node->right = NULL;
-        } else if (find_function(token->val.id, &fun)) {
-            node = g_malloc(sizeof(node_t));
-            node->type = NODE_FUNCTION;
-            node->val.fun = fun;
-            node->left = NULL;
-            node->right = get_parentised_expr(stack, &tmp_err);
-            if (tmp_err)
-                g_propagate_error(err, tmp_err);
+        if (lookup_unit(tree, token->val.id) >= 0) {
+            node = get_units(stack, tree, NO_NODE, err);
             break;
+        }
+        token = token_pop(stack);
+        if ((slot = flattree_lookup_variable(tree, token->val.id)) >= 0) {
+            node = flattree_add_variable(tree, slot);
+        } else if (tree->outer &&
+                   g_hash_table_lookup_extended(tree->outer, token->val.id,
+                                                NULL, NULL)) {
+            slot = flattree_bind_outer_variable(tree, token->val.id);
+            if (slot >= 0)
+                node = flattree_add_variable(tree, slot);
+            else {
+                set_error(err, STAT_ERROR_SYNTAX, "Too many variables",
+                          token);
+                node = NO_NODE;
+            }
+        } else if (find_constant(token->val.id, &x)) {
+            node = flattree_add_literal(tree, x, NAMED_CONSTANT);
+        } else if (strcmp(token->val.id, "if") == 0) {
+            node = get_if(stack, tree, err);
+        } else if (strcmp(token->val.id, "sum") == 0) {
+            node = get_reduction(stack, tree, NODE_SUM, err);
+        } else if (strcmp(token->val.id, "prod") == 0) {
+            node = get_reduction(stack, tree, NODE_PROD, err);
+        } else if (strcmp(token->val.id, "integrate") == 0) {
+            node = get_integral(stack, tree, NODE_INTEGRAL, err);
+        } else if (strcmp(token->val.id, "integrate_err") == 0) {
+            node = get_integral(stack, tree, NODE_INTEGRAL_ERR, err);
+        } else if (strcmp(token->val.id, "solve") == 0 &&
+                   peek_argument(stack, 2) == NULL) {
+            // solve(A, b) solves a linear system
+            node = get_matrix_function(stack, tree, MATFUN_SOLVE, err);
+        } else if (strcmp(token->val.id, "solve") == 0) {
+            node = get_integral(stack, tree, NODE_SOLVE, err);
+        } else if ((fun = find_matrix_function(token->val.id)) >= 0) {
+            node = get_matrix_function(stack, tree, fun, err);
+        } else if ((fun = find_function(token->val.id)) >= 0 &&
+                   functions[fun].fun2) {
+            get_arguments(stack, tree, args, 2, err);
+            if (err->set)
+                node = NO_NODE;
+            else
+                node = flattree_add_function2(tree, fun, args[0], args[1]);
+        } else if (fun >= 0) {
+            arg = get_parentised_expr(stack, tree, err);
+            if (err->set) {
+                node = NO_NODE;
+            } else
+                node = flattree_add_function(tree, fun, arg);
         } else {
-            g_snprintf(msg,sizeof(msg),"Unknown identifier '%s'",token->val.id);
-            set_error(err, msg, token);
-            node = NULL;
+            set_error_id(err, STAT_ERROR_UNKNOWN_ID, "Unknown identifier '%s'",
+                         token);
+            node = NO_NODE;
         }
+        g_free((token_t *)token);
         break;
     default:
-        set_error(err,"Expected '(', number, constant or function",token);
-        node = NULL;
+        set_error(err, STAT_ERROR_SYNTAX,
+                  "Expected '(', number, constant or function", token);
+        node = NO_NODE;
     }
     return node;
 }
 
 
-static node_t *get_spow(token_stack_t *stack, GError **err)
+static node_id_t get_spow(token_stack_t *stack, flattree_t *tree,
+                          parse_error_t *err)
 {
     const token_t *token;
-    node_t *node;
-    GError *tmp_err = NULL;
+    node_id_t node;
 
     token = token_peak(stack);
 
     if (!token) {
-        set_error(err, "Expected '(', number, constant or function", token);
-        return NULL;
+        set_error(err, STAT_ERROR_SYNTAX,
+                  "Expected '(', number, constant or function", token);
+        return NO_NODE;
     }
 
     if (token->type == TOK_OPERATOR && token->val.op == '-') {
         g_free(token_pop(stack));
-        node = g_malloc(sizeof(node_t));
-        node->type = NODE_OPERATOR;
-        node->val.op = OP_UMINUS;
-        node->left = NULL;
-        node->right = get_spow(stack, &tmp_err);
-        if (tmp_err)
-            g_propagate_error(err, tmp_err);
+        node = get_spow(stack, tree, err);
+        if (!err->set)
+            node = flattree_add_operator(tree, OP_UMINUS, NO_NODE, node);
     } else {
-        node = get_pow(stack, &tmp_err);
-        if (tmp_err)
-            g_propagate_error(err, tmp_err);
+        node = get_pow(stack, tree, err);
     }
 
     return node;
 }
 
 
-static node_t *get_spowtail(token_stack_t *stack, node_t *left_expr, GError **err)
+static node_id_t get_spowtail(token_stack_t *stack, flattree_t *tree,
+                              node_id_t left_expr, parse_error_t *err)
 {
     const token_t *token;
-    node_t *op, *expr;
-    GError *tmp_err = NULL;
+    node_id_t op, right;
+    operator_type_t type;
 
     token = token_peak(stack);
 
@@ -317,55 +790,43 @@ static node_t *get_spowtail(token_stack_t *stack, node_t *left_expr, GError **er
     if (token == NULL) {
         g_free(token_pop(stack));
         return left_expr;
-    } else if (!(token->type == TOK_OPERATOR && token->val.op == '^'))
+    } else if (!(token->type == TOK_OPERATOR &&
+                 (token->val.op == '^' || token->val.op == TOK_OP_EPOW)))
         return left_expr;
 
-    op = g_malloc(sizeof(node_t));
-    op->left = left_expr;
-    op->type = NODE_OPERATOR;
-    op->val.op = OP_POW;
+    type = (token->val.op == '^') ? OP_POW : OP_EPOW;
     g_free(token_pop(stack));
 
      /* Then there should be a spow ... */
-    op->right = get_spow(stack, &tmp_err);
-    if (tmp_err) {
-        g_propagate_error(err, tmp_err);
-        return op;
-    }
+    right = get_spow(stack, tree, err);
+    if (err->set)
+        return left_expr;
+    op = flattree_add_operator(tree, type, left_expr, right);
 
      /* ... and finally another spowtail. */
-    expr = get_spowtail(stack, op, &tmp_err);
-    if (tmp_err)
-        g_propagate_error(err, tmp_err);
-
-    return expr;
+    return get_spowtail(stack, tree, op, err);
 }
 
 
-static node_t *get_factor(token_stack_t *stack, GError **err)
+static node_id_t get_factor(token_stack_t *stack, flattree_t *tree,
+                            parse_error_t *err)
 {
-    node_t *spow, *expr;
-    GError *tmp_err = NULL;
+    node_id_t spow;
 
-    spow = get_spow(stack, &tmp_err);
-    if (tmp_err) {
-        g_propagate_error(err, tmp_err);
+    spow = get_spow(stack, tree, err);
+    if (err->set)
         return spow;
-    }
 
-    expr = get_spowtail(stack, spow, &tmp_err);
-    if (tmp_err)
-        g_propagate_error(err, tmp_err);
-
-    return expr;
+    return get_spowtail(stack, tree, spow, err);
 }
 
 
-static node_t *get_factortail(token_stack_t *stack, node_t *left_expr, GError **err)
+static node_id_t get_factortail(token_stack_t *stack, flattree_t *tree,
+                                node_id_t left_expr, parse_error_t *err)
 {
     const token_t *token;
-    node_t *op, *expr;
-    GError *tmp_err = NULL;
+    node_id_t op, right;
+    operator_type_t type;
 
     token = token_peak(stack);
 
@@ -377,66 +838,57 @@ static node_t *get_factortail(token_stack_t *stack, node_t *left_expr, GError **
     } else if (!(token->type == TOK_OPERATOR && is_mult_op(token->val.op)))
         return left_expr;
 
-    op = g_malloc(sizeof(node_t));
-    op->left = left_expr;
-    op->type = NODE_OPERATOR;
     switch (token->val.op) {
     case '*':
-        op->val.op = OP_TIMES;
+        type = OP_TIMES;
         break;
     case '/':
-        op->val.op = OP_DIV;
+        type = OP_DIV;
+        break;
+    case TOK_OP_EMUL:
+        type = OP_EMUL;
+        break;
+    case TOK_OP_EDIV:
+        type = OP_EDIV;
         break;
     default:
-        set_error(err, "Expected '*' or '/'", token);
-        g_free(op);
+        set_error(err, STAT_ERROR_SYNTAX, "Expected '*' or '/'", token);
         return left_expr;
     }
     g_free(token_pop(stack));
 
     /* Then there should be a factor. */
-    op->right = get_factor(stack, &tmp_err);
-    if (tmp_err) {
-        g_propagate_error(err, tmp_err);
-        return op;
-    }
+    right = get_factor(stack, tree, err);
+    if (err->set)
+        return left_expr;
+    op = flattree_add_operator(tree, type, left_expr, right);
 
     /* and finally another factortail */
-    expr = get_factortail(stack, op, &tmp_err);
-    if (tmp_err)
-        g_propagate_error(err, tmp_err);
-
-    return expr;
+    return get_factortail(stack, tree, op, err);
 }
 
 
-static node_t *get_term(token_stack_t *stack, GError **err)
+static node_id_t get_term(token_stack_t *stack, flattree_t *tree,
+                          parse_error_t *err)
 {
-    node_t *factor, *expr;
-    GError *tmp_err = NULL;
+    node_id_t factor;
 
-    factor = get_factor(stack, &tmp_err);
-    if (tmp_err) {
-        g_propagate_error(err, tmp_err);
+    factor = get_factor(stack, tree, err);
+    if (err->set)
         return factor;
-    }
-
-    expr = get_factortail(stack, factor, &tmp_err);
-    if (tmp_err)
-        g_propagate_error(err, tmp_err);
 
-    return expr;
+    return get_factortail(stack, tree, factor, err);
 }
 
 
 /* Create a tree representing 'left_expr TAIL'. */
 
-static node_t *get_termtail(token_stack_t *stack, node_t *left_expr,
-                            GError **err)
+static node_id_t get_termtail(token_stack_t *stack, flattree_t *tree,
+                              node_id_t left_expr, parse_error_t *err)
 {
     const token_t *token;
-    node_t *op, *expr;
-    GError *tmp_err = NULL;
+    node_id_t op, right;
+    operator_type_t type;
 
     g_assert(stack);
 
@@ -446,79 +898,464 @@ static node_t *get_termtail(token_stack_t *stack, node_t *left_expr,
     if (token == NULL) {
         g_free(token_pop(stack));
         return left_expr;
-    } else if (token->type == TOK_RPAREN)
+    } else if (ends_expr(token))
         return left_expr;
 
     /* First, there should an operator ... */
     if (token->type != TOK_OPERATOR) {
-        set_error(err, "Expected operator", token);
+        set_error(err, STAT_ERROR_SYNTAX, "Expected operator", token);
         return left_expr;
     }
 
-    op = g_malloc(sizeof(node_t));
-    op->left = left_expr;
-    op->type = NODE_OPERATOR;
     switch (token->val.op) {
     case '+':
-        op->val.op = OP_PLUS;
+        type = OP_PLUS;
         break;
     case '-':
-        op->val.op = OP_MINUS;
+        type = OP_MINUS;
         break;
     default:
-        set_error(err, "Expected '+' or '-'", token);
-        g_free(op);
+        /* An operator of lower precedence; leave it to the caller. */
         return left_expr;
     }
     g_free(token_pop(stack));
 
     /* ... then there should be a term ... */
-    op->right = get_term(stack, &tmp_err);
-    if (tmp_err) {
-        g_propagate_error(err, tmp_err);
-        return op;
-    }
+    right = get_term(stack, tree, err);
+    if (err->set)
+        return left_expr;
+    op = flattree_add_operator(tree, type, left_expr, right);
 
     /* ... and finally another termtail. */
-    expr = get_termtail(stack, op, &tmp_err);
-    if (tmp_err)
-        g_propagate_error(err, tmp_err);
+    return get_termtail(stack, tree, op, err);
+}
+
+
+static node_id_t get_sum(token_stack_t *stack, flattree_t *tree,
+                         parse_error_t *err)
+{
+    node_id_t term;
+
+    term = get_term(stack, tree, err);
+    if (err->set)
+        return term;
+
+    return get_termtail(stack, tree, term, err);
+}
+
+
+/* Return the operator type if 'token' is a comparison operator, or -1 if
+   not. */
+
+static gint comparison_op(const token_t *token)
+{
+    if (!token || token->type != TOK_OPERATOR)
+        return -1;
+
+    switch (token->val.op) {
+    case '<':
+        return OP_LT;
+    case TOK_OP_LE:
+        return OP_LE;
+    case '>':
+        return OP_GT;
+    case TOK_OP_GE:
+        return OP_GE;
+    case TOK_OP_EQ:
+        return OP_EQ;
+    case TOK_OP_NE:
+        return OP_NE;
+    default:
+        return -1;
+    }
+}
+
+
+static node_id_t get_comptail(token_stack_t *stack, flattree_t *tree,
+                              node_id_t left_expr, parse_error_t *err)
+{
+    node_id_t op, right;
+    gint type;
+
+    type = comparison_op(token_peak(stack));
+    if (type < 0)
+        return left_expr;
+    g_free(token_pop(stack));
+
+    right = get_sum(stack, tree, err);
+    if (err->set)
+        return left_expr;
+    op = flattree_add_operator(tree, type, left_expr, right);
+
+    return get_comptail(stack, tree, op, err);
+}
+
+
+static node_id_t get_comp(token_stack_t *stack, flattree_t *tree,
+                          parse_error_t *err)
+{
+    node_id_t sum;
+
+    sum = get_sum(stack, tree, err);
+    if (err->set)
+        return sum;
+
+    return get_comptail(stack, tree, sum, err);
+}
+
+
+static gboolean is_operator(const token_t *token, char op)
+{
+    return token && token->type == TOK_OPERATOR && token->val.op == op;
+}
+
+
+static node_id_t get_neg(token_stack_t *stack, flattree_t *tree,
+                         parse_error_t *err)
+{
+    node_id_t node;
+
+    if (!is_operator(token_peak(stack), '!'))
+        return get_comp(stack, tree, err);
+
+    g_free(token_pop(stack));
+    node = get_neg(stack, tree, err);
+    if (err->set)
+        return node;
+
+    return flattree_add_operator(tree, OP_NOT, NO_NODE, node);
+}
+
+
+static node_id_t get_conjtail(token_stack_t *stack, flattree_t *tree,
+                              node_id_t left_expr, parse_error_t *err)
+{
+    node_id_t op, right;
+
+    if (!is_operator(token_peak(stack), TOK_OP_AND))
+        return left_expr;
+    g_free(token_pop(stack));
+
+    right = get_neg(stack, tree, err);
+    if (err->set)
+        return left_expr;
+    op = flattree_add_operator(tree, OP_AND, left_expr, right);
+
+    return get_conjtail(stack, tree, op, err);
+}
+
+
+static node_id_t get_conj(token_stack_t *stack, flattree_t *tree,
+                          parse_error_t *err)
+{
+    node_id_t neg;
+
+    neg = get_neg(stack, tree, err);
+    if (err->set)
+        return neg;
+
+    return get_conjtail(stack, tree, neg, err);
+}
+
+
+static node_id_t get_disjtail(token_stack_t *stack, flattree_t *tree,
+                              node_id_t left_expr, parse_error_t *err)
+{
+    node_id_t op, right;
+
+    if (!is_operator(token_peak(stack), TOK_OP_OR))
+        return left_expr;
+    g_free(token_pop(stack));
+
+    right = get_conj(stack, tree, err);
+    if (err->set)
+        return left_expr;
+    op = flattree_add_operator(tree, OP_OR, left_expr, right);
+
+    return get_disjtail(stack, tree, op, err);
+}
+
+
+static node_id_t get_disj(token_stack_t *stack, flattree_t *tree,
+                          parse_error_t *err)
+{
+    node_id_t conj;
 
-    return expr;
+    conj = get_conj(stack, tree, err);
+    if (err->set)
+        return conj;
+
+    return get_disjtail(stack, tree, conj, err);
 }
 
 
-static node_t *get_expr(token_stack_t *stack, GError **err)
+/* Create a tree for 'cond ? expr : expr', if there is a '?'. */
+
+static node_id_t get_condtail(token_stack_t *stack, flattree_t *tree,
+                              node_id_t cond, parse_error_t *err)
 {
-    node_t *term, *expr;
-    GError *tmp_err = NULL;
+    token_t *token;
+    node_id_t left, right, branches;
+
+    if (!is_operator(token_peak(stack), '?'))
+        return cond;
+    token = token_pop(stack);
+
+    left = get_expr(stack, tree, err);
+    if (err->set) {
+        g_free(token);
+        return cond;
+    }
+    if (left == NO_NODE) {
+        token->position++;
+        set_error(err, STAT_ERROR_SYNTAX, "Expected expression", token);
+        g_free(token);
+        return cond;
+    }
+    g_free(token);
+
+    token = token_pop(stack);
+    if (!is_operator(token, ':')) {
+        set_error(err, STAT_ERROR_SYNTAX, "Expected ':'", token);
+        g_free(token);
+        return cond;
+    }
+    g_free(token);
+
+    right = get_expr(stack, tree, err);
+    if (err->set)
+        return cond;
+    if (right == NO_NODE) {
+        set_error(err, STAT_ERROR_SYNTAX, "Expected expression",
+                  token_peak(stack));
+        return cond;
+    }
+
+    branches = flattree_add_operator(tree, OP_BRANCHES, left, right);
+    return flattree_add_operator(tree, OP_COND, cond, branches);
+}
+
+
+static node_id_t get_expr(token_stack_t *stack, flattree_t *tree,
+                          parse_error_t *err)
+{
+    node_id_t disj;
     const token_t *token;
 
     token = token_peak(stack);
-    if (token == NULL || token->type == TOK_RPAREN) return NULL;
+    if (token == NULL || ends_expr(token))
+        return NO_NODE;
 
-    term = get_term(stack, &tmp_err);
-    if (tmp_err) {
-        g_propagate_error(err, tmp_err);
-        return term;
-    }
+    disj = get_disj(stack, tree, err);
+    if (err->set)
+        return disj;
+
+    return get_condtail(stack, tree, disj, err);
+}
+
+
+/* Look for 'in' <expr> after the whole expression, and make the root a
+   conversion to the unit <expr>. */
+
+static void get_conversion(token_stack_t *stack, flattree_t *tree,
+                           const char *input, parse_error_t *err)
+{
+    const token_t *token;
+    node_id_t unit;
+    gint pos;
 
-    expr = get_termtail(stack, term, &tmp_err);
-    if (tmp_err)
-        g_propagate_error(err, tmp_err);
+    token = token_peak(stack);
+    if (!token || token->type != TOK_IDENTIFIER ||
+        strcmp(token->val.id, "in") != 0)
+        return;
+    g_free(token_pop(stack));
 
-    return expr;
+    // The unit's tokens are freed as they are parsed, so remember where it is
+    token = token_peak(stack);
+    pos = token ? token->position : 0;
+    unit = get_expr(stack, tree, err);
+    if (!err->set && unit == NO_NODE)
+        set_error(err, STAT_ERROR_SYNTAX, "Expected unit",
+                  token_peak(stack));
+    if (err->set)
+        return;
+
+    tree->unit_text = g_strstrip(g_strdup(input + pos));
+    stats_count(STAT_ALLOCATIONS, 1);
+    tree->root = flattree_add_node(tree, NODE_CONVERT, 0, tree->root, unit);
 }
 
 
-node_t *build_parse_tree(const char *input, GError **err)
+/* If the input starts with '<name> =', pop those tokens and copy the name to
+   'name'. */
+
+static void get_definition(token_stack_t *stack, char *name,
+                           parse_error_t *err)
+{
+    const token_t *token = token_peak(stack);
+
+    if (!token || token->type != TOK_IDENTIFIER || !token->next ||
+        token->next->type != TOK_OTHER || token->next->val.other != '=')
+        return;
+    if (!check_variable_name(token, err))
+        return;
+    if (find_unit(token->val.id) >= 0) {
+        set_error_id(err, STAT_ERROR_SYNTAX, "'%s' is a unit", token);
+        return;
+    }
+
+    g_strlcpy(name, token->val.id, MAX_ID_LEN+1);
+    g_free(token_pop(stack));
+    g_free(token_pop(stack));
+}
+
+
+static flattree_t *parse(const char *input, const char * const *names,
+                         gint n_names, GHashTable *outer, char *name,
+                         parse_error_t *err)
 {
     token_stack_t *stack;
-    node_t *tree;
+    flattree_t *tree;
+    gint64 start;
+    gint i;
 
     stack = lexer(input);
-    tree = get_expr(stack, err);
+
+    start = stats_start();
+    if (name) {
+        name[0] = '\0';
+        get_definition(stack, name, err);
+        if (err->set) {
+            free_token_stack(stack);
+            return NULL;
+        }
+    }
+    tree = flattree_new();
+    tree->outer = outer;
+    for (i = 0; i < n_names; i++) {
+        if (flattree_bind_variable(tree, names[i]) < 0) {
+            err->set = TRUE;
+            err->kind = STAT_ERROR_SYNTAX;
+            err->position = -2;
+            err->message = "Too many variables";
+            free_token_stack(stack);
+            free_flattree(tree);
+            return NULL;
+        }
+    }
+    tree->root = get_expr(stack, tree, err);
+    if (!err->set && tree->root != NO_NODE)
+        get_conversion(stack, tree, input, err);
+    if (!err->set && token_peak(stack))
+        set_error(err, STAT_ERROR_SYNTAX, "Expected operator",
+                  token_peak(stack));
+    if (!err->set && tree->root == NO_NODE && name && name[0])
+        set_error(err, STAT_ERROR_END_OF_INPUT, "Expected expression", NULL);
+    tree->outer = NULL;
     free_token_stack(stack);
+    stats_count(STAT_EXPRESSIONS, 1);
+    stats_count(STAT_NODES, tree->n_nodes);
+    stats_record_time(STAT_PARSE, start);
+
+    if (err->set || tree->root == NO_NODE) {
+        free_flattree(tree);
+        return NULL;
+    }
+    if (tree->lits) {
+        tree->source = g_strdup(input);
+        stats_count(STAT_ALLOCATIONS, 1);
+    }
+    optimize_flattree(tree, optimize_mode());
+
+    return tree;
+}
+
+
+/* Parse 'input' into a flattree.  The 'n_names' variables in 'names' get slots
+   0 ... n_names-1, and may appear anywhere in the input.  Return NULL if there
+   was an error, or if the input was empty.  The error goes to 'err', which
+   should be initialized with PARSE_ERROR_INIT. */
+
+flattree_t *parse_flattree(const char *input, const char * const *names,
+                           gint n_names, parse_error_t *err)
+{
+    return parse(input, names, n_names, NULL, NULL, err);
+}
+
+
+static void set_gerror(const parse_error_t *e, GError **err)
+{
+    char msg[128];
+
+    if (!e->set)
+        return;
+
+    parse_error_message(e, msg, sizeof(msg));
+    if (e->position >= 0)
+        g_set_error(err, 0, e->position, "At position %i: %s",
+                    e->position+1, msg);
+    else if (e->position == -1)
+        g_set_error(err, 0, -1, "At end of input: %s", msg);
+    else
+        g_set_error(err, 0, -1, "%s", msg);
+}
+
+
+/* Write the message of 'err', without the position, to 'buf'. */
+
+void parse_error_message(const parse_error_t *err, char *buf, gsize size)
+{
+    if (!err->set)
+        g_strlcpy(buf, "", size);
+    else if (err->name[0])
+        g_snprintf(buf, size, err->message, err->name);
+    else
+        g_strlcpy(buf, err->message, size);
+}
+
+
+flattree_t *build_flattree_vars(const char *input, const char * const *names,
+                                gint n_names, GError **err)
+{
+    parse_error_t e = PARSE_ERROR_INIT;
+    flattree_t *tree;
+
+    tree = parse_flattree(input, names, n_names, &e);
+    set_gerror(&e, err);
+
+    return tree;
+}
+
+
+flattree_t *build_definition(const char *input, GHashTable *outer,
+                             char *name, GError **err)
+{
+    parse_error_t e = PARSE_ERROR_INIT;
+    flattree_t *tree;
+
+    tree = parse(input, NULL, 0, outer, name, &e);
+    set_gerror(&e, err);
 
     return tree;
 }
+
+
+flattree_t *build_flattree(const char *input, GError **err)
+{
+    return build_flattree_vars(input, NULL, 0, err);
+}
+
+
+node_t *build_parse_tree(const char *input, GError **err)
+{
+    flattree_t *tree;
+    node_t *parsetree;
+
+    tree = build_flattree(input, err);
+    if (!tree) return NULL;
+
+    parsetree = flattree_to_parsetree(tree, tree->root);
+    free_flattree(tree);
+
+    return parsetree;
+}
@@ -19,7 +19,36 @@
 #define __PARSER_H__
 
 #include "parsetree.h"
+#include "flattree.h"
+#include "stats.h"
+#include "constants.h"
+
+/* A parse error.  Filling one in allocates nothing; the message is only
+   formatted when parse_error_message() is called. */
+typedef struct {
+    gboolean set;
+    stat_error_t kind;
+    gint position;          // In 'input'; -1 for the end, -2 for none at all
+    const char *message;    // May contain a %s, for 'name'
+    char name[MAX_ID_LEN+1];
+} parse_error_t;
+
+#define PARSE_ERROR_INIT { FALSE, STAT_ERROR_SYNTAX, -1, NULL, "" }
 
 node_t *build_parse_tree(const char *input, GError **err);
+flattree_t *build_flattree(const char *input, GError **err);
+flattree_t *build_flattree_vars(const char *input, const char * const *names,
+                                gint n_names, GError **err);
+flattree_t *parse_flattree(const char *input, const char * const *names,
+                           gint n_names, parse_error_t *err);
+
+/* Like build_flattree(), but 'input' may also be a definition, '<name> =
+   <expr>'; then the name goes to 'name' (MAX_ID_LEN+1 chars), otherwise
+   'name' is set to "".  The names in the set 'outer' are variables, and
+   the ones that were used are left in tree->scope afterwards.  Units can't
+   be defined, so the names never clash with them. */
+flattree_t *build_definition(const char *input, GHashTable *outer,
+                             char *name, GError **err);
+void parse_error_message(const parse_error_t *err, char *buf, gsize size);
 
 #endif
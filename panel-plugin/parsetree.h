@@ -20,12 +20,36 @@
 
 #include "constants.h"
 
-typedef enum { NODE_OPERATOR, NODE_NUMBER, NODE_FUNCTION } node_type_t;
+typedef enum { NODE_OPERATOR, NODE_NUMBER, NODE_FUNCTION,
+               NODE_VARIABLE,
+               NODE_SUM,        // left: OP_RANGE, right: body
+               NODE_PROD,       // left: OP_RANGE, right: body
+               NODE_INTEGRAL,   // left: body, right: OP_ARGS(OP_RANGE, tol)
+               NODE_INTEGRAL_ERR,
+               NODE_SOLVE,      // left: body, right: OP_RANGE
+               NODE_MATRIX,     // right: the elements, row by row, as
+                                //        OP_ARGS(OP_ARGS(e1, e2), e3) etc.
+               NODE_MATFUN,     // left, right: arguments; left is empty
+                                //              for one argument
+               NODE_UNIT,
+               NODE_CONVERT,    // left: quantity, right: unit to convert to
+               NODE_POLY        // right: the variable; only in flattrees,
+                                //        see optimize.h
+             } node_type_t;
 
 typedef enum { OP_PLUS, OP_MINUS,
                OP_UMINUS,
                OP_TIMES, OP_DIV,
-               OP_POW } operator_type_t;
+               OP_POW,
+               OP_EMUL, OP_EDIV, OP_EPOW,   // element-wise .*, ./ and .^
+               OP_LT, OP_LE, OP_GT, OP_GE, OP_EQ, OP_NE,
+               OP_AND, OP_OR,
+               OP_NOT,
+               OP_COND,         // left: condition, right: OP_BRANCHES
+               OP_BRANCHES,     // left: value if true, right: if false
+               OP_RANGE,        // left: lower bound, right: upper bound
+               OP_ARGS          // left, right: more arguments
+             } operator_type_t;
 
 typedef struct _node_t {
     node_type_t type;
@@ -33,6 +57,11 @@ typedef struct _node_t {
         double num;
         operator_type_t op;
         double (*fun)(double x);
+        double (*fun2)(double a, double x); // NODE_FUNCTION with a left child
+        int var;        // variable slot of NODE_VARIABLE, NODE_SUM etc.
+        int cols;       // number of columns of NODE_MATRIX
+        int matfun;     // index in matrix_functions[] of NODE_MATFUN
+        int unit;       // index in units[] of NODE_UNIT
     } val;
    struct _node_t *left, *right; 
 } node_t;
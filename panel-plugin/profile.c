@@ -0,0 +1,302 @@
+/*
+ *  Copyright (C) 2010 Erik Edelmann <erik.edelmann@iki.fi>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <glib.h>
+#include "profile.h"
+#include "functions.h"
+#include "matrix.h"
+#include "units.h"
+#include "stats.h"
+
+#define CALIBRATION_ROUNDS 10000
+
+
+profile_t *profile_new(const flattree_t *tree)
+{
+    profile_t *profile;
+    gint64 start;
+    gint i;
+
+    profile = g_new0(profile_t, 1);
+    profile->tree = tree;
+    profile->count = g_new0(guint64, tree->n_nodes);
+    profile->total_ns = g_new0(guint64, tree->n_nodes);
+
+    start = stats_now();
+    for (i = 0; i < CALIBRATION_ROUNDS; i++)
+        stats_now();
+    profile->overhead_ns = (stats_now() - start)/(double)CALIBRATION_ROUNDS;
+
+    return profile;
+}
+
+
+void profile_free(profile_t *profile)
+{
+    if (!profile)
+        return;
+
+    g_free(profile->count);
+    g_free(profile->total_ns);
+    g_free(profile);
+}
+
+
+/* Operator nodes that just hold arguments together, and are never evaluated
+   by themselves. */
+
+static gboolean is_structural(const flattree_t *tree, node_id_t id)
+{
+    return tree->type[id] == NODE_OPERATOR &&
+           (tree->arg[id] == OP_BRANCHES || tree->arg[id] == OP_RANGE ||
+            tree->arg[id] == OP_ARGS);
+}
+
+
+/* Time spent in the children of 'id' that were timed, and how many times
+   they were timed in '*n'. */
+
+static double children_ns(const profile_t *profile, node_id_t id, guint64 *n)
+{
+    const flattree_t *tree = profile->tree;
+    node_id_t child[2];
+    double t = 0;
+    gint i;
+
+    child[0] = tree->left[id];
+    child[1] = tree->right[id];
+    for (i = 0; i < 2; i++) {
+        if (child[i] == NO_NODE)
+            continue;
+        if (profile->count[child[i]]) {
+            t += profile->total_ns[child[i]];
+            *n += profile->count[child[i]];
+        } else
+            t += children_ns(profile, child[i], n);
+    }
+
+    return t;
+}
+
+
+/* Each timing adds about one stats_now() call to the time of the node, and
+   another to its parent. */
+
+static double self_ns(const profile_t *profile, node_id_t id)
+{
+    guint64 n = profile->count[id];
+    double t;
+
+    t = profile->total_ns[id] - children_ns(profile, id, &n);
+    t -= n*profile->overhead_ns;
+
+    return MAX(t, 0);
+}
+
+
+static void node_label(const flattree_t *tree, node_id_t id, char *buf,
+                       gsize size)
+{
+    static const char *operators[] = {
+        "+", "-", "-", "*", "/", "^", ".*", "./", ".^",
+        "<", "<=", ">", ">=", "==", "!=", "&&", "||", "!",
+        "if", "branches", "range", "args"
+    };
+    guint32 arg = tree->arg[id];
+
+    switch (tree->type[id]) {
+    case NODE_OPERATOR:
+        g_strlcpy(buf, operators[arg], size);
+        break;
+    case NODE_NUMBER:
+        g_snprintf(buf, size, "%g", tree->nums[arg]);
+        break;
+    case NODE_FUNCTION:
+        g_strlcpy(buf, functions[arg].name, size);
+        break;
+    case NODE_VARIABLE:
+        g_strlcpy(buf, tree->var_names[arg], size);
+        break;
+    case NODE_SUM:
+        g_snprintf(buf, size, "sum %s", tree->var_names[arg]);
+        break;
+    case NODE_PROD:
+        g_snprintf(buf, size, "prod %s", tree->var_names[arg]);
+        break;
+    case NODE_INTEGRAL:
+        g_snprintf(buf, size, "integrate %s", tree->var_names[arg]);
+        break;
+    case NODE_INTEGRAL_ERR:
+        g_snprintf(buf, size, "integrate_err %s", tree->var_names[arg]);
+        break;
+    case NODE_SOLVE:
+        g_snprintf(buf, size, "solve %s", tree->var_names[arg]);
+        break;
+    case NODE_MATRIX:
+        g_strlcpy(buf, "matrix", size);
+        break;
+    case NODE_MATFUN:
+        g_strlcpy(buf, matrix_functions[arg].name, size);
+        break;
+    case NODE_UNIT:
+        g_strlcpy(buf, units[arg].name, size);
+        break;
+    case NODE_CONVERT:
+        g_strlcpy(buf, "in", size);
+        break;
+    case NODE_POLY:
+        g_snprintf(buf, size, "polynomial of degree %g", tree->nums[arg]);
+        break;
+    default:
+        g_strlcpy(buf, "?", size);
+    }
+}
+
+
+static void report_node(const profile_t *profile, node_id_t id, gint depth,
+                        GString *s)
+{
+    const flattree_t *tree = profile->tree;
+    char label[64];
+
+    if (is_structural(tree, id)) {
+        // Show the arguments as arguments of the parent
+        if (tree->left[id] != NO_NODE)
+            report_node(profile, tree->left[id], depth, s);
+        if (tree->right[id] != NO_NODE)
+            report_node(profile, tree->right[id], depth, s);
+        return;
+    }
+
+    node_label(tree, id, label, sizeof(label));
+    if (profile->count[id])
+        g_string_append_printf(s, "%10" G_GUINT64_FORMAT " %11.3f %11.3f  ",
+                               profile->count[id], profile->total_ns[id]/1e6,
+                               self_ns(profile, id)/1e6);
+    else
+        g_string_append_printf(s, "%10s %11s %11s  ", "-", "-", "-");
+    g_string_append_printf(s, "%*s%s\n", 2*depth, "", label);
+
+    if (tree->left[id] != NO_NODE)
+        report_node(profile, tree->left[id], depth + 1, s);
+    if (tree->right[id] != NO_NODE)
+        report_node(profile, tree->right[id], depth + 1, s);
+}
+
+
+typedef struct {
+    gint fun;
+    guint64 calls;
+    double ns;
+} function_time_t;
+
+
+static gint compare_function_times(gconstpointer a, gconstpointer b)
+{
+    const function_time_t *fa = a, *fb = b;
+
+    return (fa->ns < fb->ns) - (fa->ns > fb->ns);
+}
+
+
+gchar *profile_report(const profile_t *profile)
+{
+    const flattree_t *tree = profile->tree;
+    function_time_t *funs;
+    GString *s;
+    node_id_t id;
+    gint i, n_funs;
+
+    s = g_string_new(NULL);
+    if (tree->root == NO_NODE)
+        return g_string_free(s, FALSE);
+
+    g_string_append_printf(s, "%" G_GUINT64_FORMAT " evaluations, "
+                           "%.3f ms each\n\n", profile->n_evals,
+                           profile->n_evals ? profile->total_ns[tree->root]/1e6/
+                                              profile->n_evals : 0.0);
+    g_string_append_printf(s, "%10s %11s %11s  %s\n",
+                           "calls", "total ms", "self ms", "node");
+    report_node(profile, tree->root, 0, s);
+
+    // Add up the function nodes
+    for (n_funs = 0; functions[n_funs].name; n_funs++)
+        ;
+    funs = g_new0(function_time_t, n_funs);
+    for (i = 0; i < n_funs; i++)
+        funs[i].fun = i;
+    for (id = 0; id < tree->n_nodes; id++)
+        if (tree->type[id] == NODE_FUNCTION && profile->count[id]) {
+            funs[tree->arg[id]].calls += profile->count[id];
+            funs[tree->arg[id]].ns += self_ns(profile, id);
+        }
+    qsort(funs, n_funs, sizeof(function_time_t), compare_function_times);
+
+    if (n_funs > 0 && funs[0].calls > 0)
+        g_string_append_printf(s, "\n%10s %11s  %s\n",
+                               "calls", "self ms", "function");
+    for (i = 0; i < n_funs && funs[i].calls > 0; i++)
+        g_string_append_printf(s, "%10" G_GUINT64_FORMAT " %11.3f  %s\n",
+                               funs[i].calls, funs[i].ns/1e6,
+                               functions[funs[i].fun].name);
+    g_free(funs);
+
+    return g_string_free(s, FALSE);
+}
+
+
+static void fold_node(const profile_t *profile, node_id_t id, GString *stack,
+                      GString *s)
+{
+    const flattree_t *tree = profile->tree;
+    char label[64];
+    gsize len = stack->len;
+
+    if (!is_structural(tree, id)) {
+        if (!profile->count[id])
+            return;
+        node_label(tree, id, label, sizeof(label));
+        if (len > 0)
+            g_string_append_c(stack, ';');
+        g_string_append(stack, label);
+        g_string_append_printf(s, "%s %.0f\n", stack->str,
+                               self_ns(profile, id));
+    }
+
+    if (tree->left[id] != NO_NODE)
+        fold_node(profile, tree->left[id], stack, s);
+    if (tree->right[id] != NO_NODE)
+        fold_node(profile, tree->right[id], stack, s);
+
+    g_string_truncate(stack, len);
+}
+
+
+gchar *profile_folded(const profile_t *profile)
+{
+    GString *s, *stack;
+
+    s = g_string_new(NULL);
+    stack = g_string_new(NULL);
+    if (profile->tree->root != NO_NODE)
+        fold_node(profile, profile->tree->root, stack, s);
+    g_string_free(stack, TRUE);
+
+    return g_string_free(s, FALSE);
+}
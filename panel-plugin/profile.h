@@ -0,0 +1,57 @@
+/*
+ *  Copyright (C) 2010 Erik Edelmann <erik.edelmann@iki.fi>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+#ifndef __PROFILE_H__
+#define __PROFILE_H__
+
+#include <glib.h>
+#include "flattree.h"
+
+/*
+ * Per-node profile of an expression, filled in by eval_flattree_profile():
+ * how many times each node was evaluated, and the time spent in it, its
+ * children included.  The profile adds up over any number of evaluations.
+ *
+ * Bodies of sums and products are profiled node by node.  Integrands and the
+ * functions given to solve are evaluated in other ways, and their time is
+ * only counted for the integral or solve node.
+ *
+ * Timing a node costs about as much as evaluating a cheap one.  The reports
+ * subtract an estimate of that, measured by profile_new(), from every node,
+ * so times of small nodes are approximate.
+ */
+
+typedef struct {
+    const flattree_t *tree;
+    guint64 *count;             // Indexed by node id
+    guint64 *total_ns;
+    guint64 n_evals;
+    double overhead_ns;         // Cost of one stats_now() call
+} profile_t;
+
+profile_t *profile_new(const flattree_t *tree);
+void profile_free(profile_t *profile);
+
+/* The tree, one node per line, with its number of evaluations, total and own
+   time, followed by the time spent in each function.  Free with g_free(). */
+gchar *profile_report(const profile_t *profile);
+
+/* The own time of each node in nanoseconds, as "root;child;...;node time"
+   lines, for flame graph tools.  Free with g_free(). */
+gchar *profile_folded(const profile_t *profile);
+
+#endif
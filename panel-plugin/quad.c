@@ -0,0 +1,237 @@
+/*
+ *  Copyright (C) 2010 Erik Edelmann <erik.edelmann@iki.fi>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <glib.h>
+#include "constants.h"
+#include "parallel.h"
+#include "quad.h"
+
+/*
+ * Adaptive integration with the 7-point Gauss / 15-point Kronrod pair, using
+ * the error estimate of QUADPACK's qk15.
+ *
+ * Instead of bisecting one interval at a time, every round bisects all the
+ * intervals whose error is above average, and evaluates the new halves in
+ * parallel.  The set of intervals, and the order they are summed in, only
+ * depend on the integrand, so the result doesn't depend on the number of
+ * threads.
+ */
+
+#define N_INITIAL 8
+#define MAX_INTERVALS 4096
+
+#define N_KRONROD 15
+
+/* Kronrod abscissae; the odd ones are the Gauss abscissae. */
+static const double xgk[8] = {
+    0.991455371120812639206854697526329,
+    0.949107912342758524526189684047851,
+    0.864864423359769072789712788640926,
+    0.741531185599394439863864773280788,
+    0.586087235467691130294144845693013,
+    0.405845151377397166906606412076961,
+    0.207784955007898467600689403773245,
+    0.000000000000000000000000000000000
+};
+
+static const double wgk[8] = {
+    0.022935322010529224963732008058970,
+    0.063092092629978553290700663189204,
+    0.104790010322250183839876322541518,
+    0.140653259715525918745189590510238,
+    0.169004726639267902826583426598550,
+    0.190350578064785409913256402421014,
+    0.204432940075298892414161999234649,
+    0.209482141084727828012999174891714
+};
+
+static const double wg[4] = {
+    0.129484966168869693270611432679082,
+    0.279705391489276667901467771423780,
+    0.381830050505118944950369775488975,
+    0.417959183673469387755102040816327
+};
+
+
+typedef struct {
+    double a, b;
+    double result, err;
+} interval_t;
+
+typedef struct {
+    batch_fn_t fn;
+    gconstpointer body;
+    const double *vars;
+    gint slot;
+    interval_t *intervals;
+    guint *todo;        // indices of the intervals to evaluate this round
+} round_t;
+
+
+/* Apply the Gauss-Kronrod rule to one interval. */
+
+static void gauss_kronrod(round_t *r, interval_t *iv)
+{
+    double vars[MAX_VARS];
+    double x[N_KRONROD], f[N_KRONROD];
+    double center, half, kronrod, gauss, resabs, resasc, mean;
+    int j;
+
+    memcpy(vars, r->vars, sizeof(vars));
+
+    center = 0.5*(iv->a + iv->b);
+    half = 0.5*(iv->b - iv->a);
+
+    /* All 15 points are evaluated with one call: x[7] is the center, and
+       x[j], x[14-j] are symmetric around it. */
+    for (j = 0; j < 7; j++) {
+        x[j] = center - half*xgk[j];
+        x[14-j] = center + half*xgk[j];
+    }
+    x[7] = center;
+    r->fn(r->body, vars, r->slot, x, f, N_KRONROD);
+
+    kronrod = wgk[7]*f[7];
+    gauss = wg[3]*f[7];
+    resabs = fabs(kronrod);
+    for (j = 0; j < 7; j++) {
+        kronrod += wgk[j]*(f[j] + f[14-j]);
+        resabs += wgk[j]*(fabs(f[j]) + fabs(f[14-j]));
+        if (j % 2 == 1)
+            gauss += wg[j/2]*(f[j] + f[14-j]);
+    }
+
+    mean = 0.5*kronrod;
+    resasc = wgk[7]*fabs(f[7] - mean);
+    for (j = 0; j < 7; j++)
+        resasc += wgk[j]*(fabs(f[j] - mean) + fabs(f[14-j] - mean));
+
+    iv->result = kronrod*half;
+    iv->err = fabs((kronrod - gauss)*half);
+    resasc *= fabs(half);
+    resabs *= fabs(half);
+    if (resasc != 0.0 && iv->err != 0.0)
+        iv->err = resasc*MIN(1.0, pow(200*iv->err/resasc, 1.5));
+    if (resabs > G_MINDOUBLE/(50*G_DOUBLE_EPSILON))
+        iv->err = MAX(50*G_DOUBLE_EPSILON*resabs, iv->err);
+}
+
+
+static void evaluate_interval(guint i, gpointer data)
+{
+    round_t *r = data;
+
+    gauss_kronrod(r, &r->intervals[r->todo[i]]);
+}
+
+
+/* Neumaier summation of the results (or errors) of the intervals. */
+
+static double sum_intervals(const interval_t *intervals, guint n,
+                            gboolean errors)
+{
+    double s = 0.0, c = 0.0, t, x;
+    guint i;
+
+    for (i = 0; i < n; i++) {
+        x = errors ? intervals[i].err : intervals[i].result;
+        t = s + x;
+        if (fabs(s) >= fabs(x))
+            c += (s - t) + x;
+        else
+            c += (x - t) + s;
+        s = t;
+    }
+
+    return s + c;
+}
+
+
+double quad_integrate(batch_fn_t fn, gconstpointer body, const double *vars,
+                      gint slot, double a, double b, double tol,
+                      double *abserr)
+{
+    interval_t *intervals;
+    guint *todo;
+    round_t r;
+    guint i, n, n_old, n_todo;
+    double result, err, mean_err, mid;
+
+    if (abserr) *abserr = NAN;
+
+    if (!isfinite(a) || !isfinite(b) || isnan(tol))
+        return NAN;
+    if (a == b) {
+        if (abserr) *abserr = 0.0;
+        return 0.0;
+    }
+
+    intervals = g_new(interval_t, MAX_INTERVALS);
+    todo = g_new(guint, MAX_INTERVALS);
+
+    for (i = 0; i < N_INITIAL; i++) {
+        intervals[i].a = a + (b - a)*i/N_INITIAL;
+        intervals[i].b = (i == N_INITIAL-1) ? b : a + (b - a)*(i+1)/N_INITIAL;
+        todo[i] = i;
+    }
+    n = n_todo = N_INITIAL;
+
+    r.fn = fn;
+    r.body = body;
+    r.vars = vars;
+    r.slot = slot;
+    r.intervals = intervals;
+    r.todo = todo;
+
+    for (;;) {
+        parallel_for(n_todo, evaluate_interval, &r);
+
+        result = sum_intervals(intervals, n, FALSE);
+        err = sum_intervals(intervals, n, TRUE);
+        if (err <= tol*MAX(1.0, fabs(result)) || isnan(err))
+            break;
+
+        /* Bisect the intervals with an above average error.  The left halves
+           replace the intervals, the right halves are appended. */
+        mean_err = err/n;
+        n_todo = 0;
+        n_old = n;
+        for (i = 0; i < n_old && n < MAX_INTERVALS; i++) {
+            if (intervals[i].err < mean_err)
+                continue;
+            mid = 0.5*(intervals[i].a + intervals[i].b);
+            if (mid <= intervals[i].a || mid >= intervals[i].b)
+                continue;       // Can't be split any further.
+            intervals[n].a = mid;
+            intervals[n].b = intervals[i].b;
+            intervals[i].b = mid;
+            todo[n_todo++] = i;
+            todo[n_todo++] = n++;
+        }
+        if (n_todo == 0)
+            break;
+    }
+
+    g_free(intervals);
+    g_free(todo);
+
+    if (abserr) *abserr = err;
+    return result;
+}
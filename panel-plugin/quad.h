@@ -0,0 +1,40 @@
+/*
+ *  Copyright (C) 2010 Erik Edelmann <erik.edelmann@iki.fi>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+#ifndef __QUAD_H__
+#define __QUAD_H__
+
+#include <glib.h>
+
+/* Default tolerance of integrate(). */
+#define QUAD_DEFAULT_TOL 1e-10
+
+/* Evaluate an expression 'body' for n values x[] of the variable vars[slot],
+   and put the results in y[].  The other entries of 'vars' (MAX_VARS of them)
+   are passed to the body as they are. */
+typedef void (*batch_fn_t)(gconstpointer body, double *vars, gint slot,
+                           const double *x, double *y, int n);
+
+/* Integrate body over vars[slot] = a ... b with adaptive 15-point
+   Gauss-Kronrod quadrature, aiming at an error below tol*max(1, |result|).
+   The subintervals are evaluated in parallel.  Put the estimated absolute
+   error in '*abserr' if it isn't NULL. */
+double quad_integrate(batch_fn_t fn, gconstpointer body, const double *vars,
+                      gint slot, double a, double b, double tol,
+                      double *abserr);
+
+#endif
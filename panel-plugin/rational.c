@@ -0,0 +1,1094 @@
+/*
+ *  Copyright (C) 2010 Erik Edelmann <erik.edelmann@iki.fi>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <glib.h>
+#include "numparse.h"
+#include "rational.h"
+
+/* Numbers with more bits than this become doubles; 2^-65536 or 10^20000 is
+   as exact as anyone wants. */
+#define MAX_BITS 65536
+
+// Big enough powers are computed in double without trying
+#define MAX_EXPONENT 100000
+
+
+/* Big integers: sign and magnitude, in 32 bit limbs, least significant
+   first, without leading zero limbs.  Zero has no limbs. */
+
+struct _bigint_t {
+    gboolean neg;
+    guint n;
+    guint32 d[];
+};
+
+
+static bigint_t *big_new(guint n)
+{
+    bigint_t *b;
+
+    b = g_malloc(sizeof(bigint_t) + n*sizeof(guint32));
+    b->neg = FALSE;
+    b->n = n;
+    memset(b->d, 0, n*sizeof(guint32));
+
+    return b;
+}
+
+
+static bigint_t *big_trim(bigint_t *b)
+{
+    while (b->n > 0 && b->d[b->n - 1] == 0)
+        b->n--;
+    if (b->n == 0)
+        b->neg = FALSE;
+    return b;
+}
+
+
+static bigint_t *big_copy(const bigint_t *a)
+{
+    bigint_t *b = big_new(a->n);
+
+    b->neg = a->neg;
+    memcpy(b->d, a->d, a->n*sizeof(guint32));
+    return b;
+}
+
+
+static bigint_t *big_from_int(gint64 x)
+{
+    bigint_t *b = big_new(2);
+    guint64 m = (x < 0) ? -(guint64)x : (guint64)x;
+
+    b->neg = (x < 0);
+    b->d[0] = (guint32)m;
+    b->d[1] = (guint32)(m >> 32);
+    return big_trim(b);
+}
+
+
+/* Store b in '*x' and return TRUE if it fits in a gint64 (not counting
+   G_MININT64, which can't be negated). */
+
+static gboolean big_to_int(const bigint_t *b, gint64 *x)
+{
+    guint64 m;
+
+    if (b->n > 2)
+        return FALSE;
+    m = (b->n > 0 ? b->d[0] : 0) | (b->n > 1 ? (guint64)b->d[1] << 32 : 0);
+    if (m > G_MAXINT64)
+        return FALSE;
+    *x = b->neg ? -(gint64)m : (gint64)m;
+    return TRUE;
+}
+
+
+/* a*m + c, for a >= 0. */
+
+static bigint_t *big_mul_add(const bigint_t *a, guint32 m, guint32 c)
+{
+    bigint_t *r = big_new(a->n + 1);
+    guint64 t = c;
+    guint i;
+
+    for (i = 0; i < a->n; i++) {
+        t += (guint64)a->d[i]*m;
+        r->d[i] = (guint32)t;
+        t >>= 32;
+    }
+    r->d[a->n] = (guint32)t;
+    return big_trim(r);
+}
+
+
+/* a*10^n, for a >= 0.  a is consumed. */
+
+static bigint_t *big_mul_pow10(bigint_t *a, guint n)
+{
+    bigint_t *t;
+    guint k;
+
+    for (; n > 0; n -= k) {
+        k = MIN(n, 9);
+        t = big_mul_add(a, (guint32)pow(10, k), 0);
+        g_free(a);
+        a = t;
+    }
+    return a;
+}
+
+
+static guint big_bits(const bigint_t *b)
+{
+    return (b->n == 0) ? 0 : 32*b->n - __builtin_clz(b->d[b->n - 1]);
+}
+
+
+// Compare |a| and |b|
+static gint mag_compare(const bigint_t *a, const bigint_t *b)
+{
+    guint i;
+
+    if (a->n != b->n)
+        return (a->n < b->n) ? -1 : 1;
+    for (i = a->n; i-- > 0;)
+        if (a->d[i] != b->d[i])
+            return (a->d[i] < b->d[i]) ? -1 : 1;
+    return 0;
+}
+
+
+// |a| + |b|
+static bigint_t *mag_add(const bigint_t *a, const bigint_t *b)
+{
+    bigint_t *r = big_new(MAX(a->n, b->n) + 1);
+    guint64 carry = 0;
+    guint i;
+
+    for (i = 0; i < r->n; i++) {
+        carry += (i < a->n ? a->d[i] : 0);
+        carry += (i < b->n ? b->d[i] : 0);
+        r->d[i] = (guint32)carry;
+        carry >>= 32;
+    }
+    return big_trim(r);
+}
+
+
+// |a| - |b|, for |a| >= |b|
+static bigint_t *mag_sub(const bigint_t *a, const bigint_t *b)
+{
+    bigint_t *r = big_new(a->n);
+    gint64 borrow = 0;
+    guint i;
+
+    for (i = 0; i < a->n; i++) {
+        borrow += (gint64)a->d[i] - (i < b->n ? b->d[i] : 0);
+        r->d[i] = (guint32)borrow;
+        borrow = (borrow < 0) ? -1 : 0;
+    }
+    return big_trim(r);
+}
+
+
+// a + b, or a - b if 'negate_b'
+static bigint_t *big_add(const bigint_t *a, const bigint_t *b,
+                         gboolean negate_b)
+{
+    gboolean b_neg = b->neg ^ negate_b;
+    bigint_t *r;
+
+    if (a->neg == b_neg) {
+        r = mag_add(a, b);
+        r->neg = a->neg;
+    } else if (mag_compare(a, b) >= 0) {
+        r = mag_sub(a, b);
+        r->neg = a->neg;
+    } else {
+        r = mag_sub(b, a);
+        r->neg = b_neg;
+    }
+    return big_trim(r);
+}
+
+
+static bigint_t *big_mul(const bigint_t *a, const bigint_t *b)
+{
+    bigint_t *r = big_new(a->n + b->n);
+    guint64 t;
+    guint i, j;
+
+    for (i = 0; i < a->n; i++) {
+        t = 0;
+        for (j = 0; j < b->n; j++) {
+            t += (guint64)a->d[i]*b->d[j] + r->d[i + j];
+            r->d[i + j] = (guint32)t;
+            t >>= 32;
+        }
+        r->d[i + b->n] = (guint32)t;
+    }
+    r->neg = a->neg ^ b->neg;
+    return big_trim(r);
+}
+
+
+/* a = q*b + r, with the quotient rounded towards zero, by Knuth's algorithm
+   D (TAOCP 4.3.1), as in Hacker's Delight.  Either of q and r can be NULL.
+   b must not be 0. */
+
+static void big_divmod(const bigint_t *a, const bigint_t *b, bigint_t **q,
+                       bigint_t **r)
+{
+    guint32 *un, *vn;
+    bigint_t *qq, *rr;
+    guint64 qhat, rhat, p, k1;
+    gint64 t, k;
+    guint m = a->n, n = b->n, s;
+    gint i, j;
+
+    g_assert(n > 0);
+
+    if (mag_compare(a, b) < 0) {
+        if (q) *q = big_new(0);
+        if (r) *r = big_copy(a);
+        return;
+    }
+
+    qq = big_new(m - n + 1);
+    rr = big_new(n);
+
+    if (n == 1) {
+        k1 = 0;
+        for (j = m - 1; j >= 0; j--) {
+            k1 = (k1 << 32) | a->d[j];
+            qq->d[j] = (guint32)(k1/b->d[0]);
+            k1 %= b->d[0];
+        }
+        rr->d[0] = (guint32)k1;
+    } else {
+        // Normalize, so that the top bit of the divisor is set
+        s = __builtin_clz(b->d[n - 1]);
+        vn = g_new(guint32, n);
+        for (i = n - 1; i > 0; i--)
+            vn[i] = (b->d[i] << s) | (guint32)((guint64)b->d[i - 1] >> (32 - s));
+        vn[0] = b->d[0] << s;
+        un = g_new(guint32, m + 1);
+        un[m] = (guint32)((guint64)a->d[m - 1] >> (32 - s));
+        for (i = m - 1; i > 0; i--)
+            un[i] = (a->d[i] << s) | (guint32)((guint64)a->d[i - 1] >> (32 - s));
+        un[0] = a->d[0] << s;
+
+        for (j = m - n; j >= 0; j--) {
+            p = ((guint64)un[j + n] << 32) | un[j + n - 1];
+            qhat = p/vn[n - 1];
+            rhat = p - qhat*vn[n - 1];
+            while (qhat >> 32 ||
+                   qhat*vn[n - 2] > ((rhat << 32) | un[j + n - 2])) {
+                qhat--;
+                rhat += vn[n - 1];
+                if (rhat >> 32)
+                    break;
+            }
+
+            // Multiply and subtract
+            k = 0;
+            for (i = 0; i < (gint)n; i++) {
+                p = qhat*vn[i];
+                t = (gint64)un[i + j] - k - (gint64)(p & 0xffffffff);
+                un[i + j] = (guint32)t;
+                k = (gint64)(p >> 32) - (t >> 32);
+            }
+            t = (gint64)un[j + n] - k;
+            un[j + n] = (guint32)t;
+
+            // Add back if qhat was one too big
+            qq->d[j] = (guint32)qhat;
+            if (t < 0) {
+                qq->d[j]--;
+                k = 0;
+                for (i = 0; i < (gint)n; i++) {
+                    t = (gint64)un[i + j] + vn[i] + k;
+                    un[i + j] = (guint32)t;
+                    k = t >> 32;
+                }
+                un[j + n] += (guint32)k;
+            }
+        }
+
+        for (i = 0; i < (gint)n - 1; i++)
+            rr->d[i] = (un[i] >> s) |
+                       (guint32)((guint64)un[i + 1] << (32 - s));
+        rr->d[n - 1] = un[n - 1] >> s;
+        g_free(un);
+        g_free(vn);
+    }
+
+    qq->neg = a->neg ^ b->neg;
+    rr->neg = a->neg;
+    if (q) *q = big_trim(qq); else g_free(qq);
+    if (r) *r = big_trim(rr); else g_free(rr);
+}
+
+
+static bigint_t *big_gcd(const bigint_t *a, const bigint_t *b)
+{
+    bigint_t *x, *y, *r;
+
+    x = big_copy(a);
+    y = big_copy(b);
+    x->neg = y->neg = FALSE;
+    while (y->n > 0) {
+        big_divmod(x, y, NULL, &r);
+        g_free(x);
+        x = y;
+        y = r;
+        y->neg = FALSE;
+    }
+    g_free(y);
+
+    return x;
+}
+
+
+static bigint_t *big_shift_left(const bigint_t *a, guint bits)
+{
+    bigint_t *r = big_new(a->n + bits/32 + 1);
+    guint i, s = bits % 32;
+
+    for (i = 0; i < a->n; i++) {
+        r->d[i + bits/32] |= a->d[i] << s;
+        if (s > 0)
+            r->d[i + bits/32 + 1] |= a->d[i] >> (32 - s);
+    }
+    r->neg = a->neg;
+    return big_trim(r);
+}
+
+
+static gchar *big_to_string(const bigint_t *a)
+{
+    GString *s;
+    bigint_t *x, *q, *r, *billion;
+    gint64 chunk;
+    GArray *chunks;
+    gint i;
+
+    if (a->n == 0)
+        return g_strdup("0");
+
+    chunks = g_array_new(FALSE, FALSE, sizeof(gint64));
+    billion = big_from_int(1000000000);
+    x = big_copy(a);
+    x->neg = FALSE;
+    while (x->n > 0) {
+        big_divmod(x, billion, &q, &r);
+        big_to_int(r, &chunk);
+        g_array_append_val(chunks, chunk);
+        g_free(x);
+        g_free(r);
+        x = q;
+    }
+    g_free(x);
+    g_free(billion);
+
+    s = g_string_new(a->neg ? "-" : "");
+    for (i = chunks->len - 1; i >= 0; i--)
+        g_string_append_printf(s, (i == (gint)chunks->len - 1) ? "%d" : "%09d",
+                               (gint)g_array_index(chunks, gint64, i));
+    g_array_free(chunks, TRUE);
+
+    return g_string_free(s, FALSE);
+}
+
+
+/* num/den correctly rounded to double.  den must be positive. */
+
+static double big_ratio(const bigint_t *num, const bigint_t *den)
+{
+    bigint_t *a, *b, *q, *r;
+    gint shift;
+    guint64 m;
+    double x;
+
+    if (num->n == 0)
+        return 0.0;
+
+    // Scale so that the quotient has 55 or 56 bits
+    shift = 55 - ((gint)big_bits(num) - (gint)big_bits(den));
+    a = (shift > 0) ? big_shift_left(num, shift) : big_copy(num);
+    b = (shift < 0) ? big_shift_left(den, -shift) : big_copy(den);
+    big_divmod(a, b, &q, &r);
+
+    // The lowest bit is sticky, so that the conversion rounds correctly
+    m = q->d[0] | (q->n > 1 ? (guint64)q->d[1] << 32 : 0);
+    if (r->n > 0)
+        m |= 1;
+    x = ldexp((double)m, -shift);
+
+    g_free(a);
+    g_free(b);
+    g_free(q);
+    g_free(r);
+
+    return num->neg ? -x : x;
+}
+
+
+/* Small fractions. */
+
+static guint64 gcd(guint64 a, guint64 b)
+{
+    gint shift;
+
+    if (a == 0) return b;
+    if (b == 0) return a;
+
+    // Stein's binary algorithm
+    shift = __builtin_ctzll(a | b);
+    a >>= __builtin_ctzll(a);
+    do {
+        b >>= __builtin_ctzll(b);
+        if (a > b) {
+            guint64 t = a;
+            a = b;
+            b = t;
+        }
+        b -= a;
+    } while (b != 0);
+
+    return a << shift;
+}
+
+
+#define ABS64(x) ((x) < 0 ? -(guint64)(x) : (guint64)(x))
+
+
+static rational_t small(gint64 num, gint64 den)
+{
+    rational_t r;
+
+    r.kind = RATIONAL_SMALL;
+    r.num = num;
+    r.den = den;
+    r.big_num = r.big_den = NULL;
+    r.x = 0.0;
+    return r;
+}
+
+
+rational_t rational_inexact(double x)
+{
+    rational_t r = small(0, 1);
+
+    r.kind = RATIONAL_DOUBLE;
+    r.x = x;
+    return r;
+}
+
+
+rational_t rational_from_int(gint64 n)
+{
+    return (n == G_MININT64) ? rational_inexact((double)n) : small(n, 1);
+}
+
+
+/* num/den in lowest terms, from big integers, which are consumed.  Returns a
+   SMALL value if it fits, and a double if it's too big.  den must not be
+   0. */
+
+static rational_t make_big(bigint_t *num, bigint_t *den)
+{
+    bigint_t *g, *t;
+    rational_t r;
+    gint64 n, d;
+
+    if (den->neg) {
+        den->neg = FALSE;
+        num->neg = !num->neg && num->n > 0;
+    }
+    g = big_gcd(num, den);
+    if (!(g->n == 1 && g->d[0] == 1)) {
+        big_divmod(num, g, &t, NULL);
+        g_free(num);
+        num = t;
+        big_divmod(den, g, &t, NULL);
+        g_free(den);
+        den = t;
+    }
+    g_free(g);
+
+    if (big_to_int(num, &n) && big_to_int(den, &d)) {
+        r = small(n, d);
+        g_free(num);
+        g_free(den);
+    } else if (big_bits(num) > MAX_BITS || big_bits(den) > MAX_BITS) {
+        r = rational_inexact(big_ratio(num, den));
+        g_free(num);
+        g_free(den);
+    } else {
+        r = small(0, 1);
+        r.kind = RATIONAL_BIG;
+        r.big_num = num;
+        r.big_den = den;
+    }
+
+    return r;
+}
+
+
+static bigint_t *num_of(const rational_t *a)
+{
+    return (a->kind == RATIONAL_BIG) ? big_copy(a->big_num)
+                                     : big_from_int(a->num);
+}
+
+
+static bigint_t *den_of(const rational_t *a)
+{
+    return (a->kind == RATIONAL_BIG) ? big_copy(a->big_den)
+                                     : big_from_int(a->den);
+}
+
+
+/* x as the shortest decimal that rounds to it, so that 0.1 is 1/10 rather
+   than 3602879701896397/36028797018963968.  That's what numbers in
+   expressions mean. */
+
+rational_t rational_from_double(double x)
+{
+    static const double p10[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12,
+        1e13, 1e14, 1e15, 1e16, 1e17, 1e18
+    };
+    char buf[G_ASCII_DTOSTR_BUF_SIZE], fmt[8], *p;
+    bigint_t *num, *den, *t, *ten;
+    gint64 mantissa = 0, g;
+    double m;
+    gint k, exp, digits;
+
+    if (!isfinite(x))
+        return rational_inexact(x);
+    if (x == floor(x) && fabs(x) < 0x1p63)
+        return small((gint64)x, 1);
+
+    /* Few decimals: x = m/10^k exactly as the parser rounds it, since m and
+       10^k are exact doubles and the division is correctly rounded. */
+    for (k = 1; k < (gint)G_N_ELEMENTS(p10); k++) {
+        m = nearbyint(x*p10[k]);
+        if (fabs(m) < 0x1p53 && m/p10[k] == x) {
+            g = gcd(ABS64((gint64)m), (guint64)p10[k]);
+            return small((gint64)m/g, (gint64)p10[k]/g);
+        }
+    }
+
+    // Others need up to 17 digits and any exponent
+    for (digits = 15; digits <= 17; digits++) {
+        g_snprintf(fmt, sizeof(fmt), "%%.%de", digits - 1);
+        g_ascii_formatd(buf, sizeof(buf), fmt, x);
+        if (g_ascii_strtod(buf, NULL) == x)
+            break;
+    }
+    for (p = buf; *p && *p != 'e'; p++)
+        if (g_ascii_isdigit(*p))
+            mantissa = 10*mantissa + (*p - '0');
+    exp = atoi(p + 1) - (digits - 1);
+
+    num = big_from_int((x < 0) ? -mantissa : mantissa);
+    den = big_from_int(1);
+    ten = big_from_int(10);
+    for (k = 0; k < ABS(exp); k++) {
+        if (exp > 0) {
+            t = big_mul(num, ten);
+            g_free(num);
+            num = t;
+        } else {
+            t = big_mul(den, ten);
+            g_free(den);
+            den = t;
+        }
+    }
+    g_free(ten);
+
+    return make_big(num, den);
+}
+
+
+// As in numparse.c
+static inline gboolean is_digit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+
+static inline const char *skip_separator(const char *p, const char *s)
+{
+    if (*p == '_' && p > s && is_digit(p[-1]) && is_digit(p[1]))
+        return p + 1;
+    return p;
+}
+
+
+/* The number at the start of 's', as parse_number() reads it, but exactly:
+   "0.1" is 1/10 and "9223372036854775807" is 2^63 - 1, whatever they are as
+   doubles.  Numbers too big or too small for MAX_BITS are doubles. */
+
+rational_t rational_from_string(const char *s)
+{
+    bigint_t *num, *t;
+    const char *p, *q;
+    gint64 m, d, g;
+    guint32 chunk = 0;
+    gint n_chunk = 0, e = 0, digits = 0, exp10 = 0, exp_sign = 1;
+    gboolean fraction = FALSE;
+
+    // The digits, 9 at a time
+    num = big_new(0);
+    for (p = s; ; p++) {
+        p = skip_separator(p, s);
+        if (*p == '.' && !fraction) {
+            fraction = TRUE;
+            continue;
+        }
+        if (!is_digit(*p))
+            break;
+        chunk = 10*chunk + (*p - '0');
+        if (++n_chunk == 9) {
+            t = big_mul_add(num, 1000000000, chunk);
+            g_free(num);
+            num = t;
+            chunk = n_chunk = 0;
+        }
+        e -= fraction;
+        digits += (digits > 0 || *p != '0');
+    }
+    t = big_mul_add(num, (guint32)pow(10, n_chunk), chunk);
+    g_free(num);
+    num = t;
+
+    if (*p == 'e' || *p == 'E') {
+        q = p + 1;
+        if (*q == '+' || *q == '-')
+            exp_sign = (*q++ == '-') ? -1 : 1;
+        for (;;) {
+            q = skip_separator(q, s);
+            if (!is_digit(*q))
+                break;
+            if (exp10 < MAX_EXPONENT)
+                exp10 = exp10*10 + (*q - '0');
+            q++;
+        }
+        e += exp_sign*exp10;
+    }
+
+    if (num->n == 0) {
+        g_free(num);
+        return small(0, 1);
+    }
+
+    // Most numbers have a few decimals
+    if (e <= 0 && e >= -18 && big_to_int(num, &m)) {
+        g_free(num);
+        d = (gint64)pow(10, -e);
+        g = gcd(m, d);
+        return small(m/g, d/g);
+    }
+
+    // 10^e has about 3.3*e bits
+    if (digits + e > MAX_BITS/3 || e < -MAX_BITS/3) {
+        g_free(num);
+        return rational_inexact(parse_number(s, &p));
+    }
+
+    if (e >= 0)
+        return make_big(big_mul_pow10(num, e), big_from_int(1));
+    return make_big(num, big_mul_pow10(big_from_int(1), -e));
+}
+
+
+rational_t rational_copy(const rational_t *a)
+{
+    rational_t r = *a;
+
+    if (a->kind == RATIONAL_BIG) {
+        r.big_num = big_copy(a->big_num);
+        r.big_den = big_copy(a->big_den);
+    }
+    return r;
+}
+
+
+void rational_clear(rational_t *a)
+{
+    if (a->kind == RATIONAL_BIG) {
+        g_free(a->big_num);
+        g_free(a->big_den);
+    }
+    *a = small(0, 1);
+}
+
+
+double rational_to_double(const rational_t *a)
+{
+    switch (a->kind) {
+    case RATIONAL_SMALL:
+        if (ABS64(a->num) <= ((guint64)1 << 53) &&
+            a->den <= ((gint64)1 << 53))
+            return (double)a->num/(double)a->den;
+        else {
+            bigint_t *num = num_of(a), *den = den_of(a);
+            double x = big_ratio(num, den);
+
+            g_free(num);
+            g_free(den);
+            return x;
+        }
+    case RATIONAL_BIG:
+        return big_ratio(a->big_num, a->big_den);
+    default:
+        return a->x;
+    }
+}
+
+
+gboolean rational_is_integer(const rational_t *a)
+{
+    switch (a->kind) {
+    case RATIONAL_SMALL:
+        return a->den == 1;
+    case RATIONAL_BIG:
+        return a->big_den->n == 1 && a->big_den->d[0] == 1;
+    default:
+        return a->x == floor(a->x);
+    }
+}
+
+
+/* The sign of a, -1, 0 or 1.  a must be exact. */
+
+gint rational_sign(const rational_t *a)
+{
+    if (a->kind == RATIONAL_BIG)
+        return a->big_num->neg ? -1 : 1;
+    return (a->num > 0) - (a->num < 0);
+}
+
+
+/* Compare two exact values, like strcmp(). */
+
+gint rational_compare(const rational_t *a, const rational_t *b)
+{
+    rational_t d;
+    gint64 x, y;
+    gint c;
+
+    if (a->kind == RATIONAL_SMALL && b->kind == RATIONAL_SMALL &&
+        !__builtin_mul_overflow(a->num, b->den, &x) &&
+        !__builtin_mul_overflow(b->num, a->den, &y))
+        return (x > y) - (x < y);
+
+    d = rational_sub(a, b);
+    c = rational_sign(&d);
+    rational_clear(&d);
+    return c;
+}
+
+
+rational_t rational_neg(const rational_t *a)
+{
+    rational_t r;
+
+    switch (a->kind) {
+    case RATIONAL_SMALL:
+        return small(-a->num, a->den);
+    case RATIONAL_BIG:
+        r = rational_copy(a);
+        r.big_num->neg = !r.big_num->neg;
+        return r;
+    default:
+        return rational_inexact(-a->x);
+    }
+}
+
+
+rational_t rational_abs(const rational_t *a)
+{
+    if (a->kind == RATIONAL_DOUBLE)
+        return rational_inexact(fabs(a->x));
+    return (rational_sign(a) < 0) ? rational_neg(a) : rational_copy(a);
+}
+
+
+/* The fast paths.  They return FALSE if something overflows. */
+
+static gboolean small_add(const rational_t *a, const rational_t *b,
+                          rational_t *r)
+{
+    gint64 g, g2, t1, t2, num, den;
+
+    // Knuth, TAOCP 4.5.1
+    g = gcd(a->den, b->den);
+    if (__builtin_mul_overflow(a->num, b->den/g, &t1) ||
+        __builtin_mul_overflow(b->num, a->den/g, &t2) ||
+        __builtin_add_overflow(t1, t2, &num))
+        return FALSE;
+    if (num == 0) {
+        *r = small(0, 1);
+        return TRUE;
+    }
+    g2 = gcd(ABS64(num), g);
+    if (__builtin_mul_overflow(a->den/g, b->den/g2, &den) ||
+        num == G_MININT64)
+        return FALSE;
+    *r = small(num/g2, den);
+    return TRUE;
+}
+
+
+static gboolean small_mul(const rational_t *a, const rational_t *b,
+                          rational_t *r)
+{
+    gint64 g1, g2, num, den;
+
+    if (a->num == 0 || b->num == 0) {
+        *r = small(0, 1);
+        return TRUE;
+    }
+    g1 = gcd(ABS64(a->num), b->den);
+    g2 = gcd(ABS64(b->num), a->den);
+    if (__builtin_mul_overflow(a->num/g1, b->num/g2, &num) ||
+        __builtin_mul_overflow(a->den/g2, b->den/g1, &den) ||
+        num == G_MININT64)
+        return FALSE;
+    *r = small(num, den);
+    return TRUE;
+}
+
+
+// 1/b, for exact b != 0
+static rational_t inverse(const rational_t *b)
+{
+    rational_t r;
+
+    if (b->kind == RATIONAL_SMALL)
+        return (b->num < 0) ? small(-b->den, -b->num) : small(b->den, b->num);
+
+    r = small(0, 1);
+    r.kind = RATIONAL_BIG;
+    r.big_num = big_copy(b->big_den);
+    r.big_den = big_copy(b->big_num);
+    r.big_num->neg = r.big_den->neg;
+    r.big_den->neg = FALSE;
+    return r;
+}
+
+
+rational_t rational_add(const rational_t *a, const rational_t *b)
+{
+    bigint_t *an, *ad, *bn, *bd, *t1, *t2;
+    rational_t r;
+
+    if (!rational_is_exact(a) || !rational_is_exact(b))
+        return rational_inexact(rational_to_double(a) + rational_to_double(b));
+    if (a->kind == RATIONAL_SMALL && b->kind == RATIONAL_SMALL &&
+        small_add(a, b, &r))
+        return r;
+
+    an = num_of(a);
+    ad = den_of(a);
+    bn = num_of(b);
+    bd = den_of(b);
+    t1 = big_mul(an, bd);
+    t2 = big_mul(bn, ad);
+    g_free(an);
+    g_free(bn);
+    an = big_add(t1, t2, FALSE);
+    g_free(t1);
+    g_free(t2);
+    t1 = big_mul(ad, bd);
+    g_free(ad);
+    g_free(bd);
+
+    return make_big(an, t1);
+}
+
+
+rational_t rational_sub(const rational_t *a, const rational_t *b)
+{
+    rational_t nb, r;
+
+    nb = rational_neg(b);
+    r = rational_add(a, &nb);
+    rational_clear(&nb);
+    return r;
+}
+
+
+rational_t rational_mul(const rational_t *a, const rational_t *b)
+{
+    bigint_t *an, *ad, *bn, *bd, *num, *den;
+    rational_t r;
+
+    if (!rational_is_exact(a) || !rational_is_exact(b))
+        return rational_inexact(rational_to_double(a)*rational_to_double(b));
+    if (a->kind == RATIONAL_SMALL && b->kind == RATIONAL_SMALL &&
+        small_mul(a, b, &r))
+        return r;
+
+    an = num_of(a);
+    ad = den_of(a);
+    bn = num_of(b);
+    bd = den_of(b);
+    num = big_mul(an, bn);
+    den = big_mul(ad, bd);
+    g_free(an);
+    g_free(ad);
+    g_free(bn);
+    g_free(bd);
+
+    return make_big(num, den);
+}
+
+
+rational_t rational_div(const rational_t *a, const rational_t *b)
+{
+    rational_t inv, r;
+
+    if (!rational_is_exact(a) || !rational_is_exact(b) ||
+        rational_sign(b) == 0)
+        return rational_inexact(rational_to_double(a)/rational_to_double(b));
+
+    inv = inverse(b);
+    r = rational_mul(a, &inv);
+    rational_clear(&inv);
+    return r;
+}
+
+
+/* Store the q:th root of x in '*r' and return TRUE if it's an integer. */
+
+static gboolean integer_root(guint64 x, gint64 q, guint64 *r)
+{
+    guint64 c, p;
+    gint64 i;
+    double guess;
+
+    if (x <= 1) {
+        *r = x;
+        return TRUE;
+    }
+    if (q >= 64)
+        return FALSE;
+    guess = nearbyint(pow((double)x, 1.0/q));
+    for (c = (guess > 1) ? (guint64)guess - 1 : 1; c <= (guint64)guess + 1;
+         c++) {
+        p = 1;
+        for (i = 0; i < q && p <= x; i++)
+            if (__builtin_mul_overflow(p, c, &p))
+                break;
+        if (i == q && p == x) {
+            *r = c;
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+
+/* a^b.  It's exact for whole number b, and for b = p/q when a is the q:th
+   power of a small fraction, as in 4^(1/2) or (8/27)^(2/3). */
+
+rational_t rational_pow(const rational_t *a, const rational_t *b)
+{
+    rational_t base, r, t, p;
+    guint64 num, den;
+    gint64 n, m;
+    guint size;
+
+    if (!rational_is_exact(a) || !rational_is_exact(b))
+        return rational_inexact(pow(rational_to_double(a),
+                                    rational_to_double(b)));
+
+    if (!rational_is_integer(b)) {
+        if (a->kind != RATIONAL_SMALL || b->kind != RATIONAL_SMALL ||
+            a->num < 0 || !integer_root(a->num, b->den, &num) ||
+            !integer_root(a->den, b->den, &den))
+            return rational_inexact(pow(rational_to_double(a),
+                                        rational_to_double(b)));
+        base = small(num, den);
+        p = small(b->num, 1);
+        return rational_pow(&base, &p);
+    }
+
+    if (b->kind == RATIONAL_BIG || ABS(b->num) > MAX_EXPONENT)
+        return rational_inexact(pow(rational_to_double(a),
+                                    rational_to_double(b)));
+    n = b->num;
+    size = (a->kind == RATIONAL_BIG) ?
+           MAX(big_bits(a->big_num), big_bits(a->big_den)) :
+           64 - __builtin_clzll(MAX(ABS64(a->num), (guint64)a->den));
+    if ((gint64)(size - 1)*ABS(n) > MAX_BITS ||
+        (n < 0 && rational_sign(a) == 0))
+        return rational_inexact(pow(rational_to_double(a), (double)n));
+
+    // Square and multiply
+    r = small(1, 1);
+    base = rational_copy(a);
+    for (m = ABS(n); m > 0; m >>= 1) {
+        if (m & 1) {
+            t = rational_mul(&r, &base);
+            rational_clear(&r);
+            r = t;
+        }
+        if (m > 1) {
+            t = rational_mul(&base, &base);
+            rational_clear(&base);
+            base = t;
+        }
+    }
+    rational_clear(&base);
+
+    if (n < 0 && rational_is_exact(&r)) {
+        t = inverse(&r);
+        rational_clear(&r);
+        r = t;
+    } else if (n < 0) {
+        r.x = 1/r.x;
+    }
+    return r;
+}
+
+
+rational_t rational_sqrt(const rational_t *a)
+{
+    rational_t half = small(1, 2);
+
+    if (!rational_is_exact(a) || rational_sign(a) < 0)
+        return rational_inexact(sqrt(rational_to_double(a)));
+    return rational_pow(a, &half);
+}
+
+
+gchar *rational_to_string(const rational_t *a, const char *format)
+{
+    char buf[G_ASCII_DTOSTR_BUF_SIZE];
+    gchar *num, *den, *s;
+
+    switch (a->kind) {
+    case RATIONAL_SMALL:
+        if (a->den == 1)
+            return g_strdup_printf("%" G_GINT64_FORMAT, a->num);
+        return g_strdup_printf("%" G_GINT64_FORMAT "/%" G_GINT64_FORMAT,
+                               a->num, a->den);
+    case RATIONAL_BIG:
+        num = big_to_string(a->big_num);
+        if (a->big_den->n == 1 && a->big_den->d[0] == 1)
+            return num;
+        den = big_to_string(a->big_den);
+        s = g_strconcat(num, "/", den, NULL);
+        g_free(num);
+        g_free(den);
+        return s;
+    default:
+        return g_strdup(g_ascii_formatd(buf, sizeof(buf), format, a->x));
+    }
+}
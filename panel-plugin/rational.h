@@ -0,0 +1,74 @@
+/*
+ *  Copyright (C) 2010 Erik Edelmann <erik.edelmann@iki.fi>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __RATIONAL_H__
+#define __RATIONAL_H__
+
+#include <glib.h>
+
+/*
+ * Exact fractions.  A rational_t is num/den in lowest terms with den > 0,
+ * stored inline as two gint64s as long as they fit, and as big integers when
+ * they don't.  Values that can't be exact, like sqrt(2) or anything computed
+ * from one, are plain doubles (RATIONAL_DOUBLE), and stay so: combining a
+ * double with an exact value gives a double.
+ *
+ * BIG values own their integers, so every rational_t must be freed with
+ * rational_clear(), and copied with rational_copy().  The arithmetic functions
+ * return new values and don't touch their arguments.
+ */
+
+typedef struct _bigint_t bigint_t;
+
+typedef enum { RATIONAL_SMALL, RATIONAL_BIG, RATIONAL_DOUBLE } rational_kind_t;
+
+typedef struct {
+    rational_kind_t kind;
+    gint64 num, den;                // RATIONAL_SMALL
+    bigint_t *big_num, *big_den;    // RATIONAL_BIG
+    double x;                       // RATIONAL_DOUBLE
+} rational_t;
+
+#define rational_is_exact(r) ((r)->kind != RATIONAL_DOUBLE)
+
+rational_t rational_from_int(gint64 n);
+rational_t rational_from_double(double x);
+rational_t rational_from_string(const char *s);
+rational_t rational_inexact(double x);
+rational_t rational_copy(const rational_t *a);
+void rational_clear(rational_t *a);
+
+double rational_to_double(const rational_t *a);
+gboolean rational_is_integer(const rational_t *a);
+gint rational_sign(const rational_t *a);
+gint rational_compare(const rational_t *a, const rational_t *b);
+
+rational_t rational_neg(const rational_t *a);
+rational_t rational_abs(const rational_t *a);
+rational_t rational_add(const rational_t *a, const rational_t *b);
+rational_t rational_sub(const rational_t *a, const rational_t *b);
+rational_t rational_mul(const rational_t *a, const rational_t *b);
+rational_t rational_div(const rational_t *a, const rational_t *b);
+rational_t rational_pow(const rational_t *a, const rational_t *b);
+rational_t rational_sqrt(const rational_t *a);
+
+/* "1/2", "-3" etc., or the double formatted with 'format' (see
+   g_ascii_formatd()).  Free with g_free(). */
+gchar *rational_to_string(const rational_t *a, const char *format);
+
+#endif
@@ -0,0 +1,215 @@
+/*
+ *  Copyright (C) 2010 Erik Edelmann <erik.edelmann@iki.fi>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <glib.h>
+#include "constants.h"
+#include "parallel.h"
+#include "reduce.h"
+
+/* Ranges are cut into chunks of at least CHUNK_SIZE terms, and at most
+   MAX_CHUNKS chunks.  The chunking only depends on the length of the range,
+   so the rounding, and thus the result, is the same whatever the number of
+   threads. */
+#define CHUNK_SIZE 65536
+#define MAX_CHUNKS 65536
+
+/* An unevaluated sum or product 'hi + lo', where 'lo' is the accumulated
+   rounding error. */
+typedef struct {
+    double hi, lo;
+} partial_t;
+
+typedef struct {
+    gboolean product;
+    body_fn_t fn;
+    gconstpointer body;
+    const double *vars;
+    gint slot;
+    double lower, n, chunk_size;
+    partial_t *partials;
+    gint range_error;           // Set if a chunk set its range error flag
+} reduction_t;
+
+static GPrivate range_error = G_PRIVATE_INIT(NULL);
+
+
+gboolean reduce_range_error(void)
+{
+    return g_private_get(&range_error) != NULL;
+}
+
+
+void reduce_set_range_error(gboolean set)
+{
+    g_private_set(&range_error, set ? GINT_TO_POINTER(TRUE) : NULL);
+}
+
+
+/* Neumaier's variant of Kahan summation.  Once the sum is inf or nan, the
+   error term would only be inf - inf, so it is left alone. */
+
+static void add_term(partial_t *p, double x)
+{
+    double t;
+
+    t = p->hi + x;
+    if (isfinite(t)) {
+        if (fabs(p->hi) >= fabs(x))
+            p->lo += (p->hi - t) + x;
+        else
+            p->lo += (x - t) + p->hi;
+    }
+    p->hi = t;
+}
+
+
+/* Compensated product (Graillat): the rounding error of each multiplication
+   is recovered exactly with fma(), and carried along in 'lo'.  An inf or
+   nan product has no error term. */
+
+static void mul_term(partial_t *p, double x)
+{
+    double t;
+
+    t = p->hi * x;
+    if (isfinite(t))
+        p->lo = p->lo * x + fma(p->hi, x, -t);
+    else
+        p->lo = 0.0;
+    p->hi = t;
+}
+
+
+static void reduce_chunk(guint i, gpointer data)
+{
+    reduction_t *r = data;
+    partial_t *p = &r->partials[i];
+    double vars[MAX_VARS];
+    double k, first, last;
+
+    memcpy(vars, r->vars, sizeof(vars));
+    reduce_set_range_error(FALSE);
+
+    first = i * r->chunk_size;
+    last = MIN(first + r->chunk_size, r->n);
+
+    if (r->product) {
+        p->hi = 1.0;
+        p->lo = 0.0;
+        for (k = first; k < last; k++) {
+            vars[r->slot] = r->lower + k;
+            mul_term(p, r->fn(r->body, vars));
+        }
+    } else {
+        p->hi = p->lo = 0.0;
+        for (k = first; k < last; k++) {
+            vars[r->slot] = r->lower + k;
+            add_term(p, r->fn(r->body, vars));
+        }
+    }
+
+    if (reduce_range_error())
+        g_atomic_int_set(&r->range_error, TRUE);
+}
+
+
+double reduce_n_terms(double lower, double upper)
+{
+    return (upper >= lower) ? floor(upper - lower) + 1 : 0;
+}
+
+
+static double reduce(gboolean product, body_fn_t fn, gconstpointer body,
+                     const double *vars, gint slot, double lower, double upper)
+{
+    reduction_t r;
+    partial_t total, *p;
+    guint i, n_chunks;
+    gboolean had_error;
+    double n, t;
+
+    g_assert(slot >= 0 && slot < MAX_VARS);
+
+    if (isnan(lower) || isnan(upper))
+        return NAN;
+
+    n = reduce_n_terms(lower, upper);
+    if (n > REDUCE_MAX_TERMS) {
+        reduce_set_range_error(TRUE);
+        return NAN;
+    }
+
+    r.product = product;
+    r.fn = fn;
+    r.body = body;
+    r.vars = vars;
+    r.slot = slot;
+    r.lower = lower;
+    r.n = n;
+    r.chunk_size = MAX(CHUNK_SIZE, ceil(n / MAX_CHUNKS));
+    n_chunks = (guint)ceil(n / r.chunk_size);
+    r.partials = g_new(partial_t, MAX(n_chunks, 1));
+    r.range_error = FALSE;
+
+    // The chunks run in this thread too, and clear its flag
+    had_error = reduce_range_error();
+    parallel_for(n_chunks, reduce_chunk, &r);
+    reduce_set_range_error(had_error || r.range_error);
+
+    /* Combine the chunks in order. */
+    if (product) {
+        total.hi = 1.0;
+        total.lo = 0.0;
+        for (i = 0; i < n_chunks; i++) {
+            p = &r.partials[i];
+            t = total.hi * p->hi;
+            if (isfinite(t))
+                total.lo = total.lo * p->hi + total.hi * p->lo
+                           + fma(total.hi, p->hi, -t);
+            else
+                total.lo = 0.0;
+            total.hi = t;
+        }
+    } else {
+        total.hi = total.lo = 0.0;
+        for (i = 0; i < n_chunks; i++) {
+            add_term(&total, r.partials[i].hi);
+            add_term(&total, r.partials[i].lo);
+        }
+    }
+
+    g_free(r.partials);
+
+    return total.hi + total.lo;
+}
+
+
+double reduce_sum(body_fn_t fn, gconstpointer body, const double *vars,
+                  gint slot, double lower, double upper)
+{
+    return reduce(FALSE, fn, body, vars, slot, lower, upper);
+}
+
+
+double reduce_prod(body_fn_t fn, gconstpointer body, const double *vars,
+                   gint slot, double lower, double upper)
+{
+    return reduce(TRUE, fn, body, vars, slot, lower, upper);
+}
@@ -0,0 +1,50 @@
+/*
+ *  Copyright (C) 2010 Erik Edelmann <erik.edelmann@iki.fi>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+#ifndef __REDUCE_H__
+#define __REDUCE_H__
+
+#include <glib.h>
+
+/* Evaluate an expression 'body' with the variable values in 'vars'. */
+typedef double (*body_fn_t)(gconstpointer body, double *vars);
+
+/* Ranges longer than this can't be counted exactly in a double; the
+   reductions give NaN for them, and set the range error flag of the thread
+   (see below). */
+#define REDUCE_MAX_TERMS 9007199254740992.0    // 2^53
+
+/* The number of terms from lower to upper. */
+double reduce_n_terms(double lower, double upper);
+
+/* The range error flag of the calling thread.  Code that evaluates bodies
+   in other threads must pass their flags on to the thread it returns to,
+   like the reductions themselves do. */
+gboolean reduce_range_error(void);
+void reduce_set_range_error(gboolean set);
+
+/* Sum or multiply body(vars) for vars[slot] = lower, lower+1, ..., upper.  The
+   other entries of 'vars' (MAX_VARS of them) are passed to the body as they
+   are.  Large ranges are split over several threads.  The result is
+   compensated (Neumaier summation, or a compensated product), and doesn't
+   depend on the number of threads. */
+double reduce_sum(body_fn_t fn, gconstpointer body, const double *vars,
+                  gint slot, double lower, double upper);
+double reduce_prod(body_fn_t fn, gconstpointer body, const double *vars,
+                   gint slot, double lower, double upper);
+
+#endif
@@ -0,0 +1,531 @@
+/*
+ *  Copyright (C) 2010 Erik Edelmann <erik.edelmann@iki.fi>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <glib.h>
+#include "flattree.h"
+#include "parser.h"
+#include "eval.h"
+#include "matrix.h"
+#include "stats.h"
+#include "server.h"
+
+#define CHUNK_LINES 256         // Requests evaluated in one go by one thread
+#define MAX_CHUNKS 64           // Chunks in flight per connection
+#define CACHE_SIZE 4096         // Parsed expressions kept
+#define READ_SIZE 65536
+#define CONNECT_TIMEOUT 5000000 // microseconds
+
+typedef struct connection connection_t;
+
+typedef struct {
+    connection_t *conn;
+    GPtrArray *requests;
+    GString *answers;
+    gboolean done;
+} chunk_t;
+
+struct connection {
+    int fd;
+    GMutex lock;
+    GCond cond;
+    chunk_t *chunks[MAX_CHUNKS];    // Ring of the chunks in flight
+    guint64 n_read;                 // Chunks handed out for evaluation
+    guint64 n_written;              // Chunks answered
+    gboolean all_read;              // No more chunks coming
+    gboolean broken;                // The client has gone away
+};
+
+/* Parsed expressions, shared by all connections.  Trees are never removed,
+   so they can be used without holding the lock.  Once the cache is full,
+   new expressions are parsed for every request. */
+static GMutex cache_lock;
+static GHashTable *cache;
+
+static GThreadPool *pool;
+
+
+static gboolean write_all(int fd, const char *buf, gsize len)
+{
+    ssize_t n;
+
+    while (len > 0) {
+        n = write(fd, buf, len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return FALSE;
+        buf += n;
+        len -= n;
+    }
+
+    return TRUE;
+}
+
+
+static void set_errno_error(GError **err, const char *what, const char *path)
+{
+    g_set_error(err, 0, errno, "%s %s: %s", what, path, g_strerror(errno));
+}
+
+
+/* The tree for 'expr', from the cache if it's there.  *shared is set to
+   TRUE if the tree is in the cache, and mustn't be freed. */
+
+static flattree_t *get_tree(const char *expr, gboolean *shared, GError **err)
+{
+    flattree_t *tree;
+
+    g_mutex_lock(&cache_lock);
+    tree = g_hash_table_lookup(cache, expr);
+    g_mutex_unlock(&cache_lock);
+
+    *shared = tree != NULL;
+    if (tree) {
+        stats_count(STAT_CACHE_HITS, 1);
+        return tree;
+    }
+
+    stats_count(STAT_CACHE_MISSES, 1);
+    tree = build_flattree(expr, err);
+    if (!tree)
+        return NULL;
+
+    g_mutex_lock(&cache_lock);
+    if (g_hash_table_size(cache) < CACHE_SIZE &&
+        !g_hash_table_lookup(cache, expr)) {
+        g_hash_table_insert(cache, g_strdup(expr), tree);
+        *shared = TRUE;
+    }
+    g_mutex_unlock(&cache_lock);
+
+    return tree;
+}
+
+
+static void eval_request(const char *expr, GString *answers)
+{
+    flattree_t *tree;
+    matrix_t *r;
+    GError *err = NULL;
+    gboolean shared;
+    gchar *s;
+
+    tree = get_tree(expr, &shared, &err);
+    if (tree)
+        r = eval_flattree_matrix(tree, FALSE, &err);
+
+    if (err) {
+        g_string_append_printf(answers, "error: %s\n", err->message);
+        g_error_free(err);
+    } else if (!tree) {
+        g_string_append(answers, "error: empty expression\n");
+    } else {
+        s = matrix_to_string(r, "%.16g");
+        g_string_append(answers, s);
+        g_string_append_c(answers, '\n');
+        g_free(s);
+        free_matrix(r);
+    }
+
+    if (tree && !shared)
+        free_flattree(tree);
+}
+
+
+static void free_chunk(chunk_t *chunk)
+{
+    g_ptr_array_free(chunk->requests, TRUE);
+    g_string_free(chunk->answers, TRUE);
+    g_free(chunk);
+}
+
+
+/* Run by the thread pool: evaluate a chunk.  The answers are sent by the
+   writer of the connection, so that a client that doesn't read only holds
+   up its own connection, not the pool. */
+
+static void eval_chunk(gpointer data, gpointer user_data)
+{
+    chunk_t *chunk = data;
+    connection_t *conn = chunk->conn;
+    guint i;
+
+    for (i = 0; i < chunk->requests->len; i++)
+        eval_request(g_ptr_array_index(chunk->requests, i), chunk->answers);
+
+    g_mutex_lock(&conn->lock);
+    chunk->done = TRUE;
+    g_cond_broadcast(&conn->cond);
+    g_mutex_unlock(&conn->lock);
+}
+
+
+/* The writer thread of a connection: send the answers of the chunks in
+   order, as they get done.  Stops when all chunks have been answered. */
+
+static gpointer write_answers(gpointer data)
+{
+    connection_t *conn = data;
+    chunk_t *chunk;
+    gboolean ok;
+
+    g_mutex_lock(&conn->lock);
+    for (;;) {
+        while (conn->n_written == conn->n_read ? !conn->all_read :
+               !conn->chunks[conn->n_written % MAX_CHUNKS]->done)
+            g_cond_wait(&conn->cond, &conn->lock);
+        if (conn->n_written == conn->n_read)
+            break;
+
+        // The chunk stays in the ring until it's written, so its place
+        // isn't taken
+        chunk = conn->chunks[conn->n_written % MAX_CHUNKS];
+        g_mutex_unlock(&conn->lock);
+        ok = conn->broken ||
+             write_all(conn->fd, chunk->answers->str, chunk->answers->len);
+        free_chunk(chunk);
+        g_mutex_lock(&conn->lock);
+
+        if (!ok)
+            conn->broken = TRUE;
+        conn->chunks[conn->n_written % MAX_CHUNKS] = NULL;
+        conn->n_written++;
+        g_cond_broadcast(&conn->cond);
+    }
+    g_mutex_unlock(&conn->lock);
+
+    return NULL;
+}
+
+
+/* Queue a chunk for evaluation, when there's room for it.  Returns FALSE if
+   the client has gone away. */
+
+static gboolean submit(connection_t *conn, chunk_t *chunk)
+{
+    g_mutex_lock(&conn->lock);
+    while (conn->n_read - conn->n_written >= MAX_CHUNKS && !conn->broken)
+        g_cond_wait(&conn->cond, &conn->lock);
+    if (conn->broken) {
+        g_mutex_unlock(&conn->lock);
+        free_chunk(chunk);
+        return FALSE;
+    }
+    conn->chunks[conn->n_read % MAX_CHUNKS] = chunk;
+    conn->n_read++;
+    g_mutex_unlock(&conn->lock);
+
+    g_thread_pool_push(pool, chunk, NULL);
+    return TRUE;
+}
+
+
+static chunk_t *new_chunk(connection_t *conn)
+{
+    chunk_t *chunk = g_new0(chunk_t, 1);
+
+    chunk->conn = conn;
+    chunk->requests = g_ptr_array_new_with_free_func(g_free);
+    chunk->answers = g_string_new(NULL);
+
+    return chunk;
+}
+
+
+/* The thread of one client: cut the input into lines, and hand them out for
+   evaluation in chunks. */
+
+static gpointer serve_connection(gpointer data)
+{
+    connection_t *conn = data;
+    GThread *writer;
+    GString *buf;
+    chunk_t *chunk = NULL;
+    gboolean eof = FALSE, ok = TRUE, in_bytes;
+    guint batch_left = 0;
+    gsize batch_bytes = 0, start, end, old_len, limit;
+    char *line, *nl, *rest;
+    gsize len;
+    ssize_t n;
+    gulong count;
+
+    writer = g_thread_new("calc-writer", write_answers, conn);
+    buf = g_string_sized_new(READ_SIZE);
+
+    while (ok && !eof) {
+        old_len = buf->len;
+        g_string_set_size(buf, old_len + READ_SIZE);
+        n = read(conn->fd, buf->str + old_len, READ_SIZE);
+        if (n < 0 && errno == EINTR)
+            n = 0;
+        else if (n <= 0) {
+            eof = TRUE;
+            n = 0;
+        }
+        g_string_set_size(buf, old_len + n);
+
+        // Complete lines, and at the end of the input or of a BYTES batch
+        // an unterminated last line
+        start = 0;
+        while (ok && start < buf->len) {
+            limit = buf->len - start;
+            if (batch_bytes > 0)
+                limit = MIN(limit, batch_bytes);
+            nl = memchr(buf->str + start, '\n', limit);
+            if (!nl && !eof && limit != batch_bytes)
+                break;
+            end = nl ? nl - buf->str : start + limit;
+            line = g_strndup(buf->str + start, end - start);
+            in_bytes = batch_bytes > 0;
+            if (in_bytes)
+                batch_bytes -= end - start + (nl != NULL);
+            start = nl ? end + 1 : end;
+            len = strlen(line);
+            if (len > 0 && line[len - 1] == '\r')
+                line[len - 1] = '\0';
+
+            if (in_bytes) {
+                // Everything in a BYTES batch is an expression
+            } else if (strncmp(line, "BATCH ", 6) == 0) {
+                count = strtoul(line + 6, &rest, 10);
+                if (rest != line + 6 && *rest == '\0') {
+                    batch_left = count;
+                    g_free(line);
+                    continue;
+                }
+            } else if (strncmp(line, "BYTES ", 6) == 0) {
+                count = strtoul(line + 6, &rest, 10);
+                if (rest != line + 6 && *rest == '\0') {
+                    batch_bytes = count;
+                    g_free(line);
+                    continue;
+                }
+            }
+
+            if (!chunk)
+                chunk = new_chunk(conn);
+            g_ptr_array_add(chunk->requests, line);
+            if (batch_left > 0)
+                batch_left--;
+            if (chunk->requests->len == CHUNK_LINES) {
+                ok = submit(conn, chunk);
+                chunk = NULL;
+            }
+        }
+        g_string_erase(buf, 0, start);
+
+        // Don't sit on requests while waiting for more, unless they belong
+        // to a batch that isn't complete yet.
+        if (ok && chunk && ((batch_left == 0 && batch_bytes == 0) || eof)) {
+            ok = submit(conn, chunk);
+            chunk = NULL;
+        }
+    }
+
+    if (chunk)
+        free_chunk(chunk);
+    g_string_free(buf, TRUE);
+
+    g_mutex_lock(&conn->lock);
+    conn->all_read = TRUE;
+    g_cond_broadcast(&conn->cond);
+    g_mutex_unlock(&conn->lock);
+    g_thread_join(writer);
+
+    close(conn->fd);
+    g_mutex_clear(&conn->lock);
+    g_cond_clear(&conn->cond);
+    g_free(conn);
+
+    return NULL;
+}
+
+
+static gboolean make_address(struct sockaddr_un *addr, const char *path,
+                             GError **err)
+{
+    if (strlen(path) >= sizeof(addr->sun_path)) {
+        g_set_error(err, 0, -1, "Socket path too long: %s", path);
+        return FALSE;
+    }
+
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    strcpy(addr->sun_path, path);
+
+    return TRUE;
+}
+
+
+gboolean calc_server_run(const char *path, GError **err)
+{
+    struct sockaddr_un addr;
+    struct stat st;
+    mode_t old_mask;
+    connection_t *conn;
+    int fd, client, res;
+
+    if (!make_address(&addr, path, err))
+        return FALSE;
+
+    signal(SIGPIPE, SIG_IGN);
+
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        set_errno_error(err, "Can't create socket", path);
+        return FALSE;
+    }
+
+    // A socket left behind by a server that is gone is in the way
+    if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+        client = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (connect(client, (struct sockaddr *)&addr, sizeof(addr)) < 0 &&
+            errno == ECONNREFUSED)
+            unlink(path);
+        close(client);
+    }
+
+    // Only the user running the server may connect
+    old_mask = umask(077);
+    res = bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+    umask(old_mask);
+    if (res < 0 || listen(fd, SOMAXCONN) < 0) {
+        set_errno_error(err, "Can't listen on", path);
+        close(fd);
+        return FALSE;
+    }
+
+    cache = g_hash_table_new(g_str_hash, g_str_equal);
+    pool = g_thread_pool_new(eval_chunk, NULL, g_get_num_processors(), FALSE,
+                             err);
+    if (!pool) {
+        close(fd);
+        return FALSE;
+    }
+
+    for (;;) {
+        client = accept(fd, NULL, NULL);
+        if (client < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            set_errno_error(err, "Can't accept connections on", path);
+            close(fd);
+            return FALSE;
+        }
+
+        conn = g_new0(connection_t, 1);
+        conn->fd = client;
+        g_mutex_init(&conn->lock);
+        g_cond_init(&conn->cond);
+        g_thread_unref(g_thread_new("calc-client", serve_connection, conn));
+    }
+}
+
+
+typedef struct {
+    int in, fd;
+} sender_t;
+
+
+static gpointer send_input(gpointer data)
+{
+    sender_t *s = data;
+    char buf[READ_SIZE];
+    ssize_t n;
+
+    while ((n = read(s->in, buf, sizeof(buf))) != 0) {
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 || !write_all(s->fd, buf, n))
+            break;
+    }
+
+    // Tell the server there's no more coming
+    shutdown(s->fd, SHUT_WR);
+
+    return NULL;
+}
+
+
+gboolean calc_client_run(const char *path, int in, int out, GError **err)
+{
+    struct sockaddr_un addr;
+    GThread *sender;
+    sender_t s;
+    char buf[READ_SIZE];
+    gint64 start;
+    ssize_t n;
+    gboolean ok = TRUE;
+    int fd;
+
+    if (!make_address(&addr, path, err))
+        return FALSE;
+
+    signal(SIGPIPE, SIG_IGN);
+
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        set_errno_error(err, "Can't create socket", path);
+        return FALSE;
+    }
+
+    start = g_get_monotonic_time();
+    while (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        if ((errno != ENOENT && errno != ECONNREFUSED) ||
+            g_get_monotonic_time() - start > CONNECT_TIMEOUT) {
+            set_errno_error(err, "Can't connect to", path);
+            close(fd);
+            return FALSE;
+        }
+        g_usleep(10000);
+    }
+
+    s.in = in;
+    s.fd = fd;
+    sender = g_thread_new("calc-sender", send_input, &s);
+
+    while ((n = read(fd, buf, sizeof(buf))) != 0) {
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0) {
+            set_errno_error(err, "Can't read from", path);
+            ok = FALSE;
+            break;
+        }
+        if (!write_all(out, buf, n)) {
+            g_set_error(err, 0, errno, "Can't write: %s", g_strerror(errno));
+            ok = FALSE;
+            break;
+        }
+    }
+
+    // If we stopped early, the sender's next write fails
+    shutdown(fd, SHUT_RDWR);
+    g_thread_join(sender);
+    close(fd);
+
+    return ok;
+}
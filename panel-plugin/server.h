@@ -0,0 +1,56 @@
+/*
+ *  Copyright (C) 2010 Erik Edelmann <erik.edelmann@iki.fi>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+#ifndef __SERVER_H__
+#define __SERVER_H__
+
+#include <glib.h>
+
+/*
+ * A server that evaluates expressions for clients connecting to a Unix domain
+ * socket, so that scripts needn't start a process and parse anew for every
+ * expression.
+ *
+ * The protocol is line based.  Each line a client sends is an expression, and
+ * the server answers each with one line: the value, formatted like in the
+ * panel, or "error: " followed by the error message.  The answers come in the
+ * order of the requests.  Clients need not wait for an answer before sending
+ * the next request; everything sent is evaluated in parallel.  They must
+ * read the answers while they send, though, or both ends end up waiting for
+ * the other.
+ *
+ * A line "BATCH n" announces that the next n lines belong together.  The
+ * server collects all of them before it hands them out for evaluation, which
+ * spreads a batch over the threads better than lines trickling in one at a
+ * time.  BATCH lines themselves get no answer.
+ *
+ * "BYTES n" is the same, but the batch is the next n bytes, which hold one
+ * expression per line.  The newline after the last one may be left out.  A
+ * client that has its expressions in a buffer can send this without counting
+ * the lines.
+ */
+
+/* Serve clients on the socket 'path' until the process is killed.  Returns
+   FALSE, with 'err' set, if the socket can't be set up. */
+gboolean calc_server_run(const char *path, GError **err);
+
+/* Send everything read from file descriptor 'in' to the server at 'path',
+   and copy the answers to 'out'.  Waits a few seconds for the server to
+   appear if it isn't there yet. */
+gboolean calc_client_run(const char *path, int in, int out, GError **err);
+
+#endif
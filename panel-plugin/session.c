@@ -0,0 +1,287 @@
+/*
+ *  Copyright (C) 2010 Erik Edelmann <erik.edelmann@iki.fi>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+#include <string.h>
+#include <glib.h>
+#include "session.h"
+#include "flattree.h"
+#include "parser.h"
+#include "matrix.h"
+#include "eval.h"
+
+
+typedef struct {
+    char name[MAX_ID_LEN+1];
+    flattree_t *tree;
+    gint uses[MAX_VARS];        // The definition in each slot of 'tree', or -1
+    GArray *users;              // The definitions that use this one
+    double value;
+    guint mark;                 // See find_users()
+} definition_t;
+
+struct _session_t {
+    GPtrArray *defs;
+    GHashTable *index;          // Name -> position in 'defs', plus one
+    GArray *order;              // Filled in by find_users()
+    guint mark;
+    gboolean use_degrees;
+    guint64 n_evals;
+};
+
+#define DEF(session, i) ((definition_t *)g_ptr_array_index((session)->defs, i))
+
+
+session_t *session_new(gboolean use_degrees)
+{
+    session_t *session = g_new(session_t, 1);
+
+    session->defs = g_ptr_array_new();
+    session->index = g_hash_table_new(g_str_hash, g_str_equal);
+    session->order = g_array_new(FALSE, FALSE, sizeof(gint));
+    session->mark = 0;
+    session->use_degrees = use_degrees;
+    session->n_evals = 0;
+
+    return session;
+}
+
+
+void session_free(session_t *session)
+{
+    definition_t *d;
+    guint i;
+
+    if (!session) return;
+
+    for (i = 0; i < session->defs->len; i++) {
+        d = DEF(session, i);
+        free_flattree(d->tree);
+        g_array_free(d->users, TRUE);
+        g_free(d);
+    }
+    g_ptr_array_free(session->defs, TRUE);
+    g_hash_table_destroy(session->index);
+    g_array_free(session->order, TRUE);
+    g_free(session);
+}
+
+
+static gint find_definition(const session_t *session, const char *name)
+{
+    return GPOINTER_TO_INT(g_hash_table_lookup(session->index, name)) - 1;
+}
+
+
+/* The definition used in each slot of 'tree'.  The names that were defined
+   when the tree was parsed are in the outermost scope; the other slots are
+   bound inside the tree. */
+
+static void find_uses(const session_t *session, const flattree_t *tree,
+                      gint *uses)
+{
+    guint i, slot;
+
+    for (i = 0; i < tree->n_vars; i++)
+        uses[i] = -1;
+    for (i = 0; i < tree->n_scope; i++) {
+        slot = tree->scope[i];
+        uses[slot] = find_definition(session, tree->var_names[slot]);
+    }
+}
+
+
+static void visit(session_t *session, gint i)
+{
+    definition_t *d = DEF(session, i);
+    guint k;
+
+    d->mark = session->mark;
+    for (k = 0; k < d->users->len; k++)
+        if (DEF(session, g_array_index(d->users, gint, k))->mark !=
+            session->mark)
+            visit(session, g_array_index(d->users, gint, k));
+    g_array_append_val(session->order, i);
+}
+
+
+/* Mark definition i and everything that depends on it, and put them in
+   session->order so that each comes after everything it depends on, when
+   read from the end. */
+
+static void find_users(session_t *session, gint i)
+{
+    session->mark++;
+    g_array_set_size(session->order, 0);
+    visit(session, i);
+}
+
+
+static void evaluate(session_t *session, definition_t *d)
+{
+    double values[MAX_VARS];
+    guint i;
+
+    for (i = 0; i < d->tree->n_vars; i++)
+        values[i] = (d->uses[i] >= 0) ? DEF(session, d->uses[i])->value : 0.0;
+    d->value = eval_flattree_vars(d->tree, values, session->use_degrees);
+    session->n_evals++;
+}
+
+
+static void remove_user(definition_t *d, gint user)
+{
+    guint k;
+
+    for (k = 0; k < d->users->len; k++)
+        if (g_array_index(d->users, gint, k) == user) {
+            g_array_remove_index_fast(d->users, k);
+            return;
+        }
+}
+
+
+/* Make 'tree' the definition of 'name', and recompute what depends on it.
+   Return its position, or -1 if it can't be defined. */
+
+static gint define(session_t *session, const char *name, flattree_t *tree,
+                   GError **err)
+{
+    gint uses[MAX_VARS], i;
+    definition_t *d;
+    guint k;
+
+    if (!flattree_is_scalar(tree)) {
+        g_set_error(err, 0, -1, "Only numbers can be given names");
+        return -1;
+    }
+
+    find_uses(session, tree, uses);
+    i = find_definition(session, name);
+
+    if (i >= 0) {
+        find_users(session, i);
+        for (k = 0; k < tree->n_vars; k++)
+            if (uses[k] >= 0 && DEF(session, uses[k])->mark == session->mark) {
+                g_set_error(err, 0, -1, "'%s' would depend on itself", name);
+                return -1;
+            }
+
+        d = DEF(session, i);
+        for (k = 0; k < d->tree->n_vars; k++)
+            if (d->uses[k] >= 0)
+                remove_user(DEF(session, d->uses[k]), i);
+        free_flattree(d->tree);
+    } else {
+        // New names can't be used yet
+        d = g_new(definition_t, 1);
+        g_strlcpy(d->name, name, sizeof(d->name));
+        d->users = g_array_new(FALSE, FALSE, sizeof(gint));
+        d->mark = 0;
+        i = session->defs->len;
+        g_ptr_array_add(session->defs, d);
+        g_hash_table_insert(session->index, d->name, GINT_TO_POINTER(i + 1));
+
+        g_array_set_size(session->order, 0);
+        g_array_append_val(session->order, i);
+    }
+
+    d->tree = tree;
+    memcpy(d->uses, uses, tree->n_vars*sizeof(gint));
+    for (k = 0; k < tree->n_vars; k++)
+        if (uses[k] >= 0)
+            g_array_append_val(DEF(session, uses[k])->users, i);
+
+    for (k = session->order->len; k-- > 0; )
+        evaluate(session, DEF(session, g_array_index(session->order, gint, k)));
+
+    return i;
+}
+
+
+gchar *session_enter(session_t *session, const char *input,
+                     const char *format, GError **err)
+{
+    char name[MAX_ID_LEN+1];
+    double values[MAX_VARS];
+    gint uses[MAX_VARS], i;
+    flattree_t *tree;
+    matrix_t *r;
+    gchar *s;
+    guint k;
+
+    tree = build_definition(input, session->index, name, err);
+    if (!tree)
+        return NULL;
+
+    if (name[0]) {
+        if ((i = define(session, name, tree, err)) < 0) {
+            free_flattree(tree);
+            return NULL;
+        }
+        r = matrix_scalar(DEF(session, i)->value);
+        s = matrix_to_string(r, format);
+        free_matrix(r);
+        return s;
+    }
+
+    find_uses(session, tree, uses);
+    for (k = 0; k < tree->n_vars; k++)
+        values[k] = (uses[k] >= 0) ? DEF(session, uses[k])->value : 0.0;
+    r = eval_flattree_matrix_vars(tree, values, session->use_degrees, err);
+    s = r ? matrix_to_string(r, format) : NULL;
+    free_matrix(r);
+    free_flattree(tree);
+
+    return s;
+}
+
+
+gboolean session_lookup(const session_t *session, const char *name,
+                        double *value)
+{
+    gint i = find_definition(session, name);
+
+    if (i < 0)
+        return FALSE;
+    *value = DEF(session, i)->value;
+    return TRUE;
+}
+
+
+guint64 session_get_evaluations(const session_t *session)
+{
+    return session->n_evals;
+}
+
+
+void session_set_degrees(session_t *session, gboolean use_degrees)
+{
+    guint i;
+
+    if (use_degrees == session->use_degrees)
+        return;
+
+    session->use_degrees = use_degrees;
+    session->mark++;
+    g_array_set_size(session->order, 0);
+    for (i = 0; i < session->defs->len; i++)
+        if (DEF(session, i)->mark != session->mark)
+            visit(session, i);
+
+    for (i = session->order->len; i-- > 0; )
+        evaluate(session, DEF(session, g_array_index(session->order, gint, i)));
+}
@@ -0,0 +1,58 @@
+/*
+ *  Copyright (C) 2010 Erik Edelmann <erik.edelmann@iki.fi>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+#ifndef __SESSION_H__
+#define __SESSION_H__
+
+#include <glib.h>
+
+/*
+ * Named definitions, like 'rate = 0.07' and 'total = price*(1 + rate)', for
+ * later input to use.  Each definition is parsed once, and keeps its tree and
+ * its value.  Redefining a name recomputes the definitions that depend on it,
+ * directly or through others, and nothing else: each of them once, after the
+ * ones it uses.
+ *
+ * A definition can only use names that are already defined, and it can't
+ * end up depending on itself.  The values are plain numbers; matrices and
+ * quantities with units can't be given names.
+ */
+
+typedef struct _session_t session_t;
+
+session_t *session_new(gboolean use_degrees);
+void session_free(session_t *session);
+
+/* Evaluate 'input', which is either a definition or an expression that may
+   use the defined names, and format the result with matrix_to_string().  The
+   result of a definition is its new value.  Returns NULL if there's an error,
+   with 'err' set, or if 'input' is empty; then nothing changes. */
+gchar *session_enter(session_t *session, const char *input,
+                     const char *format, GError **err);
+
+/* Put the value of 'name' in 'value'.  FALSE if 'name' isn't defined. */
+gboolean session_lookup(const session_t *session, const char *name,
+                        double *value);
+
+/* The number of definitions computed so far, for seeing how much a change
+   cost. */
+guint64 session_get_evaluations(const session_t *session);
+
+/* Changing the angle unit recomputes every definition. */
+void session_set_degrees(session_t *session, gboolean use_degrees);
+
+#endif
@@ -0,0 +1,120 @@
+/*
+ *  Copyright (C) 2010 Erik Edelmann <erik.edelmann@iki.fi>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <glib.h>
+#include "constants.h"
+#include "solve.h"
+
+#define MAX_ITER 200
+
+
+/* This is Brent's zeroin, as in Numerical Recipes' zbrent(), with one change:
+   when the derivative at the current best point 'b' is known, a Newton step
+   is tried before the inverse quadratic/secant interpolation, under the same
+   acceptance test. */
+
+double solve_root(dual_fn_t fn, gconstpointer body, const double *vars,
+                  gint slot, double a, double b)
+{
+    double vars_copy[MAX_VARS];
+    double c, d, e, fa, fb, fc, dfb, p, q, r, s, tol1, xm, min1, min2;
+    int iter;
+
+    memcpy(vars_copy, vars, sizeof(vars_copy));
+
+    fa = fn(body, vars_copy, slot, a, &dfb);
+    fb = fn(body, vars_copy, slot, b, &dfb);
+    if (isnan(fa) || isnan(fb) || (fa > 0 && fb > 0) || (fa < 0 && fb < 0))
+        return NAN;
+    if (fa == 0.0) return a;
+    if (fb == 0.0) return b;
+
+    c = b;
+    fc = fb;
+    d = e = b - a;
+
+    for (iter = 0; iter < MAX_ITER; iter++) {
+        if ((fb > 0 && fc > 0) || (fb < 0 && fc < 0)) {
+            /* Keep the root between b and c. */
+            c = a;
+            fc = fa;
+            d = e = b - a;
+        }
+        if (fabs(fc) < fabs(fb)) {
+            /* Keep b the best guess; dfb is not valid after this swap. */
+            a = b; b = c; c = a;
+            fa = fb; fb = fc; fc = fa;
+            dfb = NAN;
+        }
+
+        tol1 = 2*G_DOUBLE_EPSILON*fabs(b) + G_MINDOUBLE;
+        xm = 0.5*(c - b);
+        if (fabs(xm) <= tol1 || fb == 0.0)
+            return b;
+
+        if (fabs(e) >= tol1 && fabs(fa) > fabs(fb)) {
+            /* As in zbrent(), p/q is minus the step. */
+            if (isfinite(dfb) && dfb != 0.0) {
+                /* Newton */
+                p = fb;
+                q = dfb;
+            } else if (a == c) {
+                /* Secant */
+                s = fb/fa;
+                p = 2*xm*s;
+                q = 1 - s;
+            } else {
+                /* Inverse quadratic interpolation */
+                q = fa/fc;
+                r = fb/fc;
+                s = fb/fa;
+                p = s*(2*xm*q*(q - r) - (b - a)*(r - 1));
+                q = (q - 1)*(r - 1)*(s - 1);
+            }
+            if (p > 0) q = -q;
+            p = fabs(p);
+            min1 = 3*xm*q - fabs(tol1*q);
+            min2 = fabs(e*q);
+            if (2*p < MIN(min1, min2)) {
+                e = d;
+                d = p/q;
+            } else {
+                d = xm;
+                e = d;
+            }
+        } else {
+            /* Bisection */
+            d = xm;
+            e = d;
+        }
+
+        a = b;
+        fa = fb;
+        if (fabs(d) > tol1)
+            b += d;
+        else
+            b += (xm > 0) ? tol1 : -tol1;
+        fb = fn(body, vars_copy, slot, b, &dfb);
+        if (isnan(fb))
+            return NAN;
+    }
+
+    return b;
+}
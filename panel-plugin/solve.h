@@ -0,0 +1,35 @@
+/*
+ *  Copyright (C) 2010 Erik Edelmann <erik.edelmann@iki.fi>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+#ifndef __SOLVE_H__
+#define __SOLVE_H__
+
+#include <glib.h>
+
+/* Evaluate an expression 'body' at vars[slot] = x.  Put its derivative with
+   respect to vars[slot] in '*dy', or NaN if the derivative isn't known. */
+typedef double (*dual_fn_t)(gconstpointer body, double *vars, gint slot,
+                            double x, double *dy);
+
+/* Find a root of body(vars[slot]) between a and b with Brent's method, taking
+   Newton steps instead whenever the derivative is known and the step stays
+   well inside the bracket.  body(a) and body(b) must have different signs,
+   otherwise the result is NaN. */
+double solve_root(dual_fn_t fn, gconstpointer body, const double *vars,
+                  gint slot, double a, double b);
+
+#endif
@@ -0,0 +1,456 @@
+/*
+ *  Copyright (C) 2010 Erik Edelmann <erik.edelmann@iki.fi>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/* Throughput and accuracy of the special functions, see specfun.h.
+
+   specbench            time every function, one value at a time and, where
+                        there is an array version, on arrays
+   specbench --check    only measure the errors, and fail if some function is
+                        worse than documented in specfun.h
+
+   The references are computed in long double. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <glib.h>
+#include "specfun.h"
+
+#define N 4096
+#define ROUNDS 16               // of N arguments, for the errors
+#define BENCH_TIME 200000       // microseconds per measurement
+
+#define PI_L 3.14159265358979323846264338327950288L
+
+typedef struct {
+    const char *name;
+    double (*fun)(double x);    // one argument, or
+    double (*fun2)(double a, double x);  // two
+    void (*vfun)(const double *x, double *y, gsize n);  // or NULL
+    long double (*ref)(long double a, long double x);
+    void (*fill)(double *a, double *x, gsize n);
+    double tiny;                // smaller results count in ulps of this
+    double max_ulps;            // documented bound; 0 for libm's functions
+    double (*growth)(double a, double x);  // of the bound, or NULL
+} bench_t;
+
+
+static guint64 rng_state = 0x9e3779b97f4a7c15ULL;
+
+static double uniform(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return (rng_state >> 11)*0x1p-53;
+}
+
+
+/* Evenly over [lo, hi] for even i, otherwise logarithmically over
+   [tiny, hi], so that small arguments get tested too. */
+
+static double spread(gsize i, double lo, double hi, double tiny)
+{
+    double u = uniform();
+
+    if (i % 2 == 0)
+        return lo + (hi - lo)*u;
+    return exp(log(tiny) + (log(hi) - log(tiny))*u);
+}
+
+
+static void fill_gamma(double *a, double *x, gsize n)
+{
+    gsize i;
+
+    for (i = 0; i < n; i++) x[i] = spread(i, -30, 171, 1e-10);
+}
+
+static void fill_lgamma(double *a, double *x, gsize n)
+{
+    gsize i;
+
+    // A quarter up to 1e6
+    for (i = 0; i < n; i++)
+        x[i] = spread(i, -30, 100, 1e-10)*(i % 4 == 1 ? 1e4 : 1);
+}
+
+static void fill_digamma(double *a, double *x, gsize n)
+{
+    gsize i;
+
+    for (i = 0; i < n; i++)
+        x[i] = spread(i, -30, 30, 1e-10)*(i % 4 == 1 ? 1e4 : 1);
+}
+
+static void fill_erf(double *a, double *x, gsize n)
+{
+    gsize i;
+
+    for (i = 0; i < n; i++) x[i] = spread(i, -6, 27, 1e-10);
+}
+
+static void fill_erfinv(double *a, double *x, gsize n)
+{
+    gsize i;
+
+    for (i = 0; i < n; i++) {
+        x[i] = spread(i, -1, 1, 1e-10);
+        if (i % 4 == 3)
+            x[i] = 1 - x[i]/2;  // close to 1
+    }
+}
+
+static void fill_beta(double *a, double *x, gsize n)
+{
+    gsize i;
+
+    for (i = 0; i < n; i++) {
+        a[i] = spread(i + 1, 0, 800, 1e-3);
+        x[i] = spread(i/2, 0, 800, 1e-3);
+    }
+}
+
+static void fill_gammainc(double *a, double *x, gsize n)
+{
+    gsize i;
+
+    for (i = 0; i < n; i++) {
+        a[i] = spread(i + 1, 0, 1e4, 1e-2);
+        x[i] = a[i]*3*uniform();
+    }
+}
+
+static void fill_bessel(double *a, double *x, gsize n)
+{
+    gsize i;
+
+    for (i = 0; i < n; i++) {
+        a[i] = floor(21*uniform());
+        x[i] = spread(i, 0, 100, 1e-10);
+    }
+}
+
+
+// The condition number of beta
+static double growth_beta(double a, double b)
+{
+    double psi_c = spec_digamma(a + b);
+
+    return MAX(1, a*fabs(spec_digamma(a) - psi_c) +
+                  b*fabs(spec_digamma(b) - psi_c));
+}
+
+static double growth_gammainc(double a, double x)
+{
+    return MAX(1, sqrt(a));
+}
+
+
+static long double ref_gamma(long double a, long double x)
+{
+    return tgammal(x);
+}
+
+static long double ref_lgamma(long double a, long double x)
+{
+    int sign;
+
+    return lgammal_r(x, &sign);
+}
+
+static long double ref_digamma(long double a, long double x)
+{
+    long double r = 0, z;
+
+    if (isnan(x) || x == -INFINITY)
+        return NAN;
+    if (x <= 0) {
+        if (x == floorl(x))
+            return NAN;
+        r = -PI_L/tanl(PI_L*(x - nearbyintl(x)));
+        x = 1 - x;
+    }
+    while (x < 20) {
+        r -= 1/x;
+        x += 1;
+    }
+    z = 1/(x*x);
+    return r + logl(x) - 0.5L/x -
+        z*(1.0L/12 - z*(1.0L/120 - z*(1.0L/252 - z*(1.0L/240 - z*(1.0L/132 -
+        z*(691.0L/32760 - z/12))))));
+}
+
+static long double ref_erf(long double a, long double x)
+{
+    return erfl(x);
+}
+
+static long double ref_erfc(long double a, long double x)
+{
+    return erfcl(x);
+}
+
+// Newton's method from the result, in long double
+static long double ref_erfinv(long double a, long double x)
+{
+    long double y, f, ax = fabsl(x);
+    gint i;
+
+    if (isnan(x) || ax > 1)
+        return NAN;
+    if (ax == 1)
+        return copysignl(INFINITY, x);
+
+    y = spec_erfinv(x);
+    for (i = 0; i < 3; i++) {
+        if (ax <= 0.5)
+            f = erfl(y) - x;
+        else
+            f = ((1 - ax) - erfcl(fabsl(y)))*(x < 0 ? -1 : 1);
+        y -= f/(2/sqrtl(PI_L)*expl(-y*y));
+    }
+    return y;
+}
+
+/* With c + lo = a + b exactly; the rounding of a + b to long double would
+   cost about an ulp of double for large a + b.  c < 1755, or tgammal()
+   overflows. */
+static long double ref_beta(long double a, long double b)
+{
+    long double c = a + b, bb = c - a, lo = (a - (c - bb)) + (b - bb);
+
+    return tgammal(a)*tgammal(b)/tgammal(c)*(1 - spec_digamma(c)*lo);
+}
+
+// The same series and continued fraction as specfun.c, in long double
+static long double ref_gammainc(long double a, long double x)
+{
+    long double term, sum, b, c, d, h, an, del;
+    int sign;
+    gint i;
+
+    if (x == 0)
+        return 0;
+    if (x < a + 1) {
+        term = sum = 1/a;
+        for (i = 1; i < 10000000 && fabsl(term) > fabsl(sum)*1e-21L; i++) {
+            term *= x/(a + i);
+            sum += term;
+        }
+        return sum*expl(a*logl(x) - x - lgammal_r(a, &sign));
+    }
+
+    b = x + 1 - a;
+    c = 1/G_MINDOUBLE;
+    d = h = 1/b;
+    for (i = 1; i < 10000000; i++) {
+        an = -i*(i - a);
+        b += 2;
+        d = an*d + b;
+        c = b + an/c;
+        d = 1/d;
+        del = d*c;
+        h *= del;
+        if (fabsl(del - 1) < 1e-21L)
+            break;
+    }
+    return 1 - h*expl(a*logl(x) - x - lgammal_r(a, &sign));
+}
+
+static long double ref_gammaincc(long double a, long double x)
+{
+    return 1 - ref_gammainc(a, x);
+}
+
+static long double ref_besselj(long double n, long double x)
+{
+    return jnl((int)n, x);
+}
+
+static long double ref_bessely(long double n, long double x)
+{
+    return ynl((int)n, x);
+}
+
+
+static const bench_t benches[] = {
+    { "gamma", tgamma, NULL, NULL, ref_gamma, fill_gamma, 0, 0, NULL },
+    { "lgamma", spec_lgamma, NULL, spec_vlgamma, ref_lgamma, fill_lgamma,
+      1, 4, NULL },
+    { "digamma", spec_digamma, NULL, NULL, ref_digamma, fill_digamma,
+      1, 8, NULL },
+    { "erf", erf, NULL, NULL, ref_erf, fill_erf, 0, 0, NULL },
+    { "erfc", erfc, NULL, NULL, ref_erfc, fill_erf, 0, 0, NULL },
+    { "erfinv", spec_erfinv, NULL, NULL, ref_erfinv, fill_erfinv, 0, 2, NULL },
+    { "beta", NULL, spec_beta, NULL, ref_beta, fill_beta,
+      0, 16, growth_beta },
+    { "gammainc", NULL, spec_gammainc, NULL, ref_gammainc, fill_gammainc,
+      1, 6, growth_gammainc },
+    { "gammaincc", NULL, spec_gammaincc, NULL, ref_gammaincc, fill_gammainc,
+      1, 6, growth_gammainc },
+    { "besselj", NULL, spec_besselj, NULL, ref_besselj, fill_bessel,
+      1, 0, NULL },
+    { "bessely", NULL, spec_bessely, NULL, ref_bessely, fill_bessel,
+      1, 0, NULL },
+    { NULL, NULL, NULL, NULL, NULL, NULL, 0, 0, NULL }
+};
+
+// Arguments that take unusual paths
+static const double special[] = {
+    0.0, -0.0, 1.0, -1.0, 0.5, 2.0, 1.4616321449683623, 8.0, 1e-300, 1e300,
+    -0.5, -2.0, 1 - 0x1p-53, -1 + 0x1p-53, 0.85, 171.5, INFINITY, -INFINITY,
+    NAN
+};
+
+
+/* The distance between y and 'ref', in units of the last place of
+   max(tiny, |ref|). */
+
+static double ulps(double y, long double ref, double tiny)
+{
+    double r = ref, ulp;
+
+    if (isnan(r) || isnan(y))
+        return isnan(r) && isnan(y) ? 0 : INFINITY;
+    if (isinf(r) || isinf(y))
+        return y == r ? 0 : INFINITY;
+
+    r = MAX(fabs(r), tiny);
+    if (r < G_MINDOUBLE)
+        return y == 0 ? 0 : fabsl(y - ref)/(G_MINDOUBLE*G_DOUBLE_EPSILON);
+    ulp = nextafter(r, INFINITY) - r;
+    return fabsl(y - ref)/ulp;
+}
+
+
+static double call(const bench_t *b, double a, double x)
+{
+    return b->fun ? b->fun(x) : b->fun2(a, x);
+}
+
+
+/* The largest error, over the bound's growth if it has one, of the scalar
+   function, or of the array one if 'array'. */
+
+static double max_error(const bench_t *b, gboolean array)
+{
+    double a[N], x[N], y[N], err, worst = 0;
+    gsize i, n_special = G_N_ELEMENTS(special);
+    gint round;
+
+    for (round = 0; round < ROUNDS; round++) {
+        b->fill(a, x, N);
+        if (round == 0 && b->fun)
+            memcpy(x, special, sizeof(special));
+        if (array)
+            b->vfun(x, y, N);
+        else
+            for (i = 0; i < N; i++) y[i] = call(b, a[i], x[i]);
+        for (i = 0; i < N; i++) {
+            err = ulps(y[i], b->ref(a[i], x[i]), b->tiny);
+            if (b->growth)
+                err /= b->growth(a[i], x[i]);
+            worst = MAX(worst, err);
+        }
+    }
+
+    // Odd lengths and arguments inside arrays, the same as on their own
+    if (array)
+        for (i = 0; i < n_special; i++) {
+            b->vfun(special + i, y, 1);
+            worst = MAX(worst, ulps(y[0], b->ref(0, special[i]), b->tiny));
+        }
+
+    return worst;
+}
+
+
+/* Millions of function values per second. */
+
+static double throughput(const bench_t *b, gboolean array)
+{
+    double a[N], x[N], y[N];
+    gint64 start, elapsed;
+    guint64 count = 0;
+    gsize i;
+
+    b->fill(a, x, N);
+
+    start = g_get_monotonic_time();
+    do {
+        if (array)
+            b->vfun(x, y, N);
+        else if (b->fun)
+            for (i = 0; i < N; i++) y[i] = b->fun(x[i]);
+        else
+            for (i = 0; i < N; i++) y[i] = b->fun2(a[i], x[i]);
+        count += N;
+        elapsed = g_get_monotonic_time() - start;
+    } while (elapsed < BENCH_TIME);
+
+    // Keep the compiler from dropping the loop
+    if (y[N/2] == 12345.678) putchar(' ');
+
+    return (double)count/elapsed;
+}
+
+
+int main(int argc, char **argv)
+{
+    gboolean check = argc > 1 && strcmp(argv[1], "--check") == 0;
+    gboolean ok = TRUE;
+    const bench_t *b;
+    double err;
+
+    if (!check) {
+        printf("%-10s %10s %10s    Mvalues/s\n", "", "scalar", "array");
+        for (b = benches; b->name; b++) {
+            printf("%-10s %10.1f", b->name, throughput(b, FALSE));
+            if (b->vfun)
+                printf(" %10.1f\n", throughput(b, TRUE));
+            else
+                printf(" %10s\n", "-");
+        }
+        printf("\n");
+    }
+
+    printf("%-10s %10s %10s %10s    max error, ulp\n", "", "scalar", "array",
+           "bound");
+    for (b = benches; b->name; b++) {
+        err = max_error(b, FALSE);
+        printf("%-10s %10.2f", b->name, err);
+        if (b->max_ulps && err > b->max_ulps)
+            ok = FALSE;
+        if (b->vfun) {
+            err = max_error(b, TRUE);
+            printf(" %10.2f", err);
+            if (b->max_ulps && err > b->max_ulps)
+                ok = FALSE;
+        } else
+            printf(" %10s", "-");
+        if (b->max_ulps)
+            printf(" %10g%s\n", b->max_ulps, b->growth ? "*" : "");
+        else
+            printf(" %10s\n", "libm");
+    }
+    printf("\n* times the growth in specfun.h\n");
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,62 @@
+/*
+ *  Copyright (C) 2010 Erik Edelmann <erik.edelmann@iki.fi>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+#ifndef __SPECFUN_H__
+#define __SPECFUN_H__
+
+#include <glib.h>
+
+/* Special functions that libm lacks, or has only in a form that isn't safe
+   to call from several threads.
+
+   The largest errors, as measured against long double references by
+   'specbench --check', in units in the last place of max(1, |result|) for
+   lgamma, digamma and the incomplete gammas, and of |result| for the others:
+
+     spec_lgamma     as libm's lgamma_r(), which it is
+     spec_vlgamma    4 ulp
+     spec_digamma    8 ulp
+     spec_erfinv     2 ulp
+     spec_beta       16 ulp times the condition number of beta, a |psi(a) -
+                     psi(a + b)| + b |psi(b) - psi(a + b)|, or 1 if that is
+                     smaller; that is about what rounding a and b is worth
+     spec_gammainc   6 ulp times max(1, sqrt(a)), for a up to 1e4
+     spec_besselj    as jn() for integer n; NaN for other orders
+     spec_bessely    as yn() for integer n; NaN for other orders
+*/
+
+double spec_lgamma(double x);
+double spec_digamma(double x);
+double spec_erfinv(double x);
+
+/* The beta function, gamma(a)*gamma(b)/gamma(a + b). */
+double spec_beta(double a, double b);
+
+/* The regularized incomplete gamma functions P(a, x) and Q(a, x) = 1 - P(a, x),
+   for a > 0 and x >= 0. */
+double spec_gammainc(double a, double x);
+double spec_gammaincc(double a, double x);
+
+/* Bessel functions of the first and second kind, of integer order n. */
+double spec_besselj(double n, double x);
+double spec_bessely(double n, double x);
+
+/* lgamma for arrays, with the logarithms done by vmath_log(); see vmath.h. */
+void spec_vlgamma(const double *x, double *y, gsize n);
+
+#endif
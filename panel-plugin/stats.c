@@ -0,0 +1,313 @@
+/*
+ *  Copyright (C) 2010 Erik Edelmann <erik.edelmann@iki.fi>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <glib.h>
+#include "stats.h"
+
+/* Latency histograms have one bucket per power of two nanoseconds; bucket i
+   counts the samples t with 2^(i-1) <= t < 2^i.  The last bucket also holds
+   everything slower than that (about 2 seconds). */
+#define N_BUCKETS 32
+
+typedef struct {
+    guint64 n;
+    guint64 total_ns;
+    guint64 max_ns;
+    guint64 buckets[N_BUCKETS];
+} histogram_t;
+
+typedef struct {
+    histogram_t histograms[N_STAT_PHASES];
+    guint64 counters[N_STAT_COUNTERS];
+    guint64 errors[N_STAT_ERRORS];
+    gint generation;
+} block_t;
+
+static void retire_block(gpointer data);
+
+/* Every thread records into a block of its own, so that the backend can run
+   in several threads without a lock around every update.  The blocks are
+   added up when the statistics are read.  When a thread finishes, its block
+   is added to 'retired'.  stats_reset() doesn't touch the blocks of other
+   threads; it starts a new generation, and a block from an older one counts
+   as zero until its thread clears it. */
+static GMutex blocks_lock;
+static gint generation;
+static GSList *blocks;
+static block_t retired;
+static GPrivate thread_block = G_PRIVATE_INIT(retire_block);
+
+/* The number of stats_set_timing(TRUE) calls not yet undone */
+static gint timing;
+
+static const char *phase_names[N_STAT_PHASES] = {
+    "lex", "parse", "eval"
+};
+
+static const char *counter_names[N_STAT_COUNTERS] = {
+    "expressions", "tokens", "nodes", "allocations",
+    "cache hits", "cache misses", "adaptive evaluations", "escalations"
+};
+
+static const char *error_names[N_STAT_ERRORS] = {
+    "syntax", "unexpected end of input", "unknown identifier",
+    "NaN result", "infinite result", "matrix size", "units",
+    "range too long"
+};
+
+
+static void add_block(block_t *sum, const block_t *b)
+{
+    histogram_t *h;
+    int i, j;
+
+    for (i = 0; i < N_STAT_PHASES; i++) {
+        h = &sum->histograms[i];
+        h->n += b->histograms[i].n;
+        h->total_ns += b->histograms[i].total_ns;
+        h->max_ns = MAX(h->max_ns, b->histograms[i].max_ns);
+        for (j = 0; j < N_BUCKETS; j++)
+            h->buckets[j] += b->histograms[i].buckets[j];
+    }
+    for (i = 0; i < N_STAT_COUNTERS; i++)
+        sum->counters[i] += b->counters[i];
+    for (i = 0; i < N_STAT_ERRORS; i++)
+        sum->errors[i] += b->errors[i];
+}
+
+
+static void retire_block(gpointer data)
+{
+    block_t *b = data;
+
+    g_mutex_lock(&blocks_lock);
+    if (g_atomic_int_get(&b->generation) == generation)
+        add_block(&retired, b);
+    blocks = g_slist_remove(blocks, data);
+    g_mutex_unlock(&blocks_lock);
+
+    g_free(data);
+}
+
+
+/* The block of the calling thread. */
+
+static block_t *my_block(void)
+{
+    block_t *b = g_private_get(&thread_block);
+
+    if (!b) {
+        b = g_new0(block_t, 1);
+        g_private_set(&thread_block, b);
+
+        g_mutex_lock(&blocks_lock);
+        b->generation = generation;
+        blocks = g_slist_prepend(blocks, b);
+        g_mutex_unlock(&blocks_lock);
+    } else if (b->generation != g_atomic_int_get(&generation)) {
+        memset(b, 0, G_STRUCT_OFFSET(block_t, generation));
+        g_atomic_int_set(&b->generation, g_atomic_int_get(&generation));
+    }
+
+    return b;
+}
+
+
+/* Add up the blocks of all threads.  The threads that are still running may
+   be in the middle of an update, so the sum is only a snapshot. */
+
+static void sum_blocks(block_t *sum)
+{
+    GSList *l;
+    block_t *b;
+
+    g_mutex_lock(&blocks_lock);
+    *sum = retired;
+    for (l = blocks; l; l = l->next) {
+        b = l->data;
+        if (g_atomic_int_get(&b->generation) == generation)
+            add_block(sum, b);
+    }
+    g_mutex_unlock(&blocks_lock);
+}
+
+
+void stats_reset(void)
+{
+    g_mutex_lock(&blocks_lock);
+    memset(&retired, 0, sizeof(retired));
+    g_atomic_int_inc(&generation);
+    g_mutex_unlock(&blocks_lock);
+}
+
+
+gint64 stats_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (gint64)ts.tv_sec*1000000000 + ts.tv_nsec;
+}
+
+
+void stats_set_timing(gboolean on)
+{
+    if (on)
+        g_atomic_int_inc(&timing);
+    else
+        g_atomic_int_add(&timing, -1);
+}
+
+
+gint64 stats_start(void)
+{
+    return g_atomic_int_get(&timing) > 0 ? stats_now() : 0;
+}
+
+
+void stats_record_time(stat_phase_t phase, gint64 start)
+{
+    histogram_t *h;
+    guint64 t;
+    int i;
+
+    g_assert(phase < N_STAT_PHASES);
+
+    if (start == 0) return;
+    t = stats_now() - start;
+    h = &my_block()->histograms[phase];
+
+    h->n++;
+    h->total_ns += t;
+    if (t > h->max_ns) h->max_ns = t;
+
+    for (i = 0; i < N_BUCKETS-1 && t; i++)
+        t >>= 1;
+    h->buckets[i]++;
+}
+
+
+void stats_count(stat_counter_t counter, guint64 n)
+{
+    g_assert(counter < N_STAT_COUNTERS);
+    my_block()->counters[counter] += n;
+}
+
+
+void stats_count_error(stat_error_t error)
+{
+    g_assert(error < N_STAT_ERRORS);
+    my_block()->errors[error]++;
+}
+
+
+/* Count evaluation results that signal a domain error or an overflow. */
+
+void stats_count_result(double r)
+{
+    if (isnan(r))
+        my_block()->errors[STAT_ERROR_NAN]++;
+    else if (isinf(r))
+        my_block()->errors[STAT_ERROR_INF]++;
+}
+
+
+guint64 stats_get_counter(stat_counter_t counter)
+{
+    block_t sum;
+
+    g_assert(counter < N_STAT_COUNTERS);
+    sum_blocks(&sum);
+    return sum.counters[counter];
+}
+
+
+guint64 stats_get_errors(stat_error_t error)
+{
+    block_t sum;
+
+    g_assert(error < N_STAT_ERRORS);
+    sum_blocks(&sum);
+    return sum.errors[error];
+}
+
+
+/* Return an upper bound for the q:th quantile of the histogram, in ns. */
+
+static guint64 quantile(const histogram_t *h, double q)
+{
+    guint64 seen = 0;
+    int i;
+
+    for (i = 0; i < N_BUCKETS; i++) {
+        seen += h->buckets[i];
+        if (seen >= q*h->n)
+            return MIN((guint64)1 << i, h->max_ns);
+    }
+    return h->max_ns;
+}
+
+
+gchar *stats_report(void)
+{
+    GString *s;
+    block_t sum;
+    const histogram_t *h;
+    int i, j;
+
+    sum_blocks(&sum);
+
+    s = g_string_new("Counters:\n");
+    for (i = 0; i < N_STAT_COUNTERS; i++)
+        g_string_append_printf(s, "  %-28s %" G_GUINT64_FORMAT "\n",
+                               counter_names[i], sum.counters[i]);
+
+    g_string_append(s, "Errors:\n");
+    for (i = 0; i < N_STAT_ERRORS; i++)
+        g_string_append_printf(s, "  %-28s %" G_GUINT64_FORMAT "\n",
+                               error_names[i], sum.errors[i]);
+
+    g_string_append(s, g_atomic_int_get(&timing) > 0 ? "Latencies (ns):\n" :
+                    "Latencies (ns), with timing off:\n");
+    for (i = 0; i < N_STAT_PHASES; i++) {
+        h = &sum.histograms[i];
+        g_string_append_printf(s, "  %-6s n=%" G_GUINT64_FORMAT, phase_names[i],
+                               h->n);
+        if (h->n == 0) {
+            g_string_append(s, "\n");
+            continue;
+        }
+        g_string_append_printf(s, " mean=%" G_GUINT64_FORMAT
+                               " p50<=%" G_GUINT64_FORMAT
+                               " p99<=%" G_GUINT64_FORMAT
+                               " max=%" G_GUINT64_FORMAT "\n",
+                               h->total_ns/h->n, quantile(h, 0.5),
+                               quantile(h, 0.99), h->max_ns);
+        for (j = 0; j < N_BUCKETS; j++) {
+            if (h->buckets[j])
+                g_string_append_printf(s, "         <%-12" G_GUINT64_FORMAT
+                                       " %" G_GUINT64_FORMAT "\n",
+                                       (guint64)1 << j, h->buckets[j]);
+        }
+    }
+
+    return g_string_free(s, FALSE);
+}
@@ -0,0 +1,82 @@
+/*
+ *  Copyright (C) 2010 Erik Edelmann <erik.edelmann@iki.fi>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+#ifndef __STATS_H__
+#define __STATS_H__
+
+#include <glib.h>
+
+/*
+ * Runtime statistics for the backend: event counters, error counters and
+ * latency histograms for lexing, parsing and evaluation.  The statistics are
+ * process wide.  The counters are always collected; they are cheap enough
+ * for that.  The latencies take two clock reads per phase, which is a good
+ * part of the time of a small expression, so they are only collected while
+ * timing is on.  Each thread counts on its own, and the reading functions
+ * add the threads up.
+ */
+
+typedef enum { STAT_LEX,
+               STAT_PARSE,
+               STAT_EVAL,
+               N_STAT_PHASES } stat_phase_t;
+
+typedef enum { STAT_EXPRESSIONS,
+               STAT_TOKENS,
+               STAT_NODES,
+               STAT_ALLOCATIONS,
+               STAT_CACHE_HITS,
+               STAT_CACHE_MISSES,
+               STAT_ADAPTIVE,
+               STAT_ESCALATIONS,
+               N_STAT_COUNTERS } stat_counter_t;
+
+typedef enum { STAT_ERROR_SYNTAX,
+               STAT_ERROR_END_OF_INPUT,
+               STAT_ERROR_UNKNOWN_ID,
+               STAT_ERROR_NAN,
+               STAT_ERROR_INF,
+               STAT_ERROR_MATRIX,
+               STAT_ERROR_UNITS,
+               STAT_ERROR_RANGE,
+               N_STAT_ERRORS } stat_error_t;
+
+void stats_reset(void);
+
+/* Turn the latency timing on or off.  The calls nest: timing stays on until
+   every stats_set_timing(TRUE) has been matched by a stats_set_timing(FALSE). */
+void stats_set_timing(gboolean on);
+
+/* Monotonic time in nanoseconds. */
+gint64 stats_now(void);
+
+/* The start of a phase, for stats_record_time(): stats_now(), or 0 if
+   timing is off, and then stats_record_time() does nothing. */
+gint64 stats_start(void);
+
+void stats_record_time(stat_phase_t phase, gint64 start);
+void stats_count(stat_counter_t counter, guint64 n);
+void stats_count_error(stat_error_t error);
+void stats_count_result(double r);
+
+guint64 stats_get_counter(stat_counter_t counter);
+guint64 stats_get_errors(stat_error_t error);
+
+/* Return a human readable report of all statistics. Free with g_free(). */
+gchar *stats_report(void);
+
+#endif
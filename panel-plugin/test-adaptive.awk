@@ -0,0 +1,33 @@
+#!/usr/bin/awk -f
+
+function calc(args,    res) {
+    ("./calctest " args) | getline res
+    return res
+}
+
+BEGIN{
+    if (calc("'(1e16 + 1) - 1e16'") != "0" ||
+        calc("--adaptive 1e-12 '(1e16 + 1) - 1e16'") != "1" ||
+        calc("--adaptive 1e-12 '1/((1e16 + 1) - 1e16)'") != "1" ||
+        calc("--adaptive 1e-12 'sqrt(2)^2 - 2'") != "0" ||
+        calc("--adaptive 1e-12 '1/0'") != "inf") {
+        print "wrong result"
+        exit 1
+    }
+
+    # Only the ill-conditioned expression is evaluated twice
+    cmd = "printf '1 + 2\\n(1e16 + 1) - 1e16\\nsin(1)\\n' | " \
+          "./calctest --stats --adaptive 1e-12 2>&1"
+    adaptive = escalations = -1
+    while ((cmd | getline) > 0) {
+        if ($1 == "adaptive" && $2 == "evaluations")
+            adaptive = $3
+        if ($1 == "escalations")
+            escalations = $2
+    }
+    if (adaptive != 3 || escalations != 1) {
+        print adaptive " adaptive evaluations, " escalations " escalations"
+        exit 1
+    }
+    exit 0
+}
@@ -0,0 +1,25 @@
+#!/usr/bin/awk -f
+
+# Evaluate over a CSV file with binary output, and read that back as a
+# memory mapped column.
+
+BEGIN{
+    system("printf 'x, y\\n1,2\\n3,4\\n5,6\\n' > test-columns.csv")
+    system("./calctest --csv test-columns.csv --binary-output " \
+           "--output test-columns.bin 'x*y'")
+
+    cmd = "./calctest --column z=test-columns.bin 'z + 1'"
+    n = 0
+    while ((cmd | getline line) > 0)
+        res[++n] = line
+    close(cmd)
+
+    system("rm -f test-columns.csv test-columns.bin")
+
+    if (n != 3 || res[1] != 3 || res[2] != 13 || res[3] != 31) {
+        for (i = 1; i <= n; i++)
+            print res[i]
+        exit 1
+    }
+    exit 0
+}
@@ -0,0 +1,33 @@
+#!/usr/bin/awk -f
+
+function abs(x) {
+    return (x < 0) ? -x : x
+}
+
+# 'big' would run for days if it were evaluated, so the branches that
+# aren't taken and the right operands of && and || that aren't needed must
+# be skipped for this to finish within the timeout.
+function check(cmd, expected,    res) {
+    res = ""
+    (cmd) | getline res
+    close(cmd)
+    if (res == "" || abs(res - expected) > 1.0e-15) {
+        print cmd ": " res
+        failed = 1
+    }
+}
+
+BEGIN{
+    big = "sum(k,1,1e15,1)"
+    expr = "if(x < 2, 3, " big ") + (0 ? " big " : 2)" \
+           "*(1 <= x && 2 != 2 || !0) + (0 && " big ") + (x || " big ")"
+
+    plain = expr
+    gsub(/x/, "1", plain)
+    check("timeout 10 ./calctest '" plain "'", 6)
+    check("echo 1 | timeout 10 ./calctest --batch x '" expr "'", 6)
+    check("echo 1 | timeout 10 ./calctest --type decimal128 --batch x '" \
+          expr "'", 6)
+
+    exit failed
+}
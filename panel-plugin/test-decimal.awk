@@ -0,0 +1,50 @@
+#!/usr/bin/awk -f
+
+function calc(args,    res) {
+    res = ""
+    ("./calctest " args " 2> /dev/null") | getline res
+    return res
+}
+
+BEGIN{
+    if (calc("--type decimal64 '0.1 + 0.2'") != "0.3" ||
+        calc("--type decimal64 '0.1 + 0.2 == 0.3'") != "1" ||
+        calc("--type decimal64 '1/3'") != "0.3333333333333333" ||
+        calc("--type decimal64 '1e400'") != "inf") {
+        print "wrong decimal64 result"
+        exit 1
+    }
+
+    # Trailing zeros are kept, like in the IEEE formats
+    if (calc("--type decimal64 '1.10 + 2.20'") != "3.30") {
+        print "wrong exponent"
+        exit 1
+    }
+
+    # Literals with more digits than a double are still exact
+    if (calc("--type decimal128 '12345678901234567890123 + 1'") != \
+            "12345678901234567890124" ||
+        calc("--type decimal128 '2^100'") != \
+            "1267650600228229401496703205376" ||
+        calc("--type decimal128 '1/3'") != \
+            "0.3333333333333333333333333333333333") {
+        print "wrong decimal128 result"
+        exit 1
+    }
+
+    # Also where --optimize would rewrite a polynomial
+    if (calc("--optimize strict --type decimal128 " \
+             "'sum(k, 1, 1, 0.123456789012345678901*k^2 + 0.7*k)'") != \
+            "0.823456789012345678901") {
+        print "wrong polynomial"
+        exit 1
+    }
+
+    cmd = "echo 0.7 | ./calctest --type decimal64 --batch x 'x*3 - 2.1'"
+    cmd | getline res
+    if (res != "0") {
+        print "wrong batch result"
+        exit 1
+    }
+    exit 0
+}
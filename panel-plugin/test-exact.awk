@@ -0,0 +1,39 @@
+#!/usr/bin/awk -f
+
+function calc(args,    res) {
+    ("./calctest --exact " args) | getline res
+    return res
+}
+
+BEGIN{
+    if (calc("'1/3 + 1/6'") != "1/2" ||
+        calc("'0.1 + 0.2'") != "3/10" ||
+        calc("'-7/14'") != "-1/2" ||
+        calc("'2^-3'") != "1/8" ||
+        calc("'sqrt(9/4)'") != "3/2" ||
+        calc("'(8/27)^(2/3)'") != "4/9" ||
+        calc("'sum(k, 1, 10, 1/k)'") != "7381/2520" ||
+        calc("'prod(k, 1, 25, k)'") != "15511210043330985984000000" ||
+        calc("'0.1*3 == 0.3'") != "1") {
+        print "wrong exact result"
+        exit 1
+    }
+
+    # Literals are exact even where their doubles aren't
+    if (calc("'9223372036854775807 + 1'") != "9223372036854775808" ||
+        calc("'0.1000000000000000000001 - 0.1'") != \
+            "1/10000000000000000000000" ||
+        calc("'3.141592653589793'") != "3141592653589793/1000000000000000") {
+        print "wrong literal"
+        exit 1
+    }
+
+    # Irrational values fall back to doubles
+    if (calc("'pi'") != "3.14159" ||
+        calc("'sqrt(2)'") != "1.41421" ||
+        calc("'1/3 + sin(1)'") != "1.1748") {
+        print "wrong inexact result"
+        exit 1
+    }
+    exit 0
+}
@@ -0,0 +1,66 @@
+#!/usr/bin/awk -f
+
+BEGIN{
+    file = "test-flatfile.tmp"
+    cmd = "printf '1 + 2\\nsum(k, 1, 10, k^2)\\n[1, 2] * 3\\n100 km/h in m/s\\n\\n2^0.5\\n' | ./calctest --compile " file
+    if (system(cmd) != 0) {
+        print "compile failed"
+        exit 1
+    }
+
+    n = 0
+    cmd = "./calctest --load " file
+    while ((cmd | getline res) > 0)
+        out[++n] = res
+    close(cmd)
+    if (n != 5 || out[1] != "3" || out[2] != "385" || out[3] != "[3, 6]" ||
+        out[4] != "27.7778 m/s" || out[5] != "1.41421") {
+        for (i = 1; i <= n; i++)
+            print out[i]
+        exit 1
+    }
+
+    # Errors are reported by line, and nothing is written
+    cmd = "printf '1 +\\n2\\n' | ./calctest --compile " file ".bad 2>&1"
+    found = 0
+    while ((cmd | getline res) > 0)
+        if (res == "1: At end of input: Expected '(', number, constant or function")
+            found = 1
+    close(cmd)
+    if (!found || system("test -e " file ".bad") == 0) {
+        print "bad input compiled"
+        exit 1
+    }
+
+    # A damaged tree is refused when the file is opened: here the 'arg' of
+    # the first node, the lower bound, points far outside 'nums'.  Byte 40
+    # holds the offset of the 'arg' array of the first tree.
+    system("printf 'sum(k, 1, 10, k^2)\\n' | ./calctest --compile " file)
+    ("od -A n -t u8 -j 40 -N 8 " file) | getline arg
+    system("printf '\\377\\377\\377\\177' | dd of=" file " bs=1 seek=" \
+           (arg + 0) " conv=notrunc 2> /dev/null")
+    cmd = "./calctest --load " file " 2>&1"
+    found = 0
+    while ((cmd | getline res) > 0)
+        if (res == file ": File is corrupt")
+            found = 1
+    close(cmd)
+    if (!found) {
+        print "corrupt file loaded"
+        exit 1
+    }
+
+    system("printf 'junk' > " file)
+    cmd = "./calctest --load " file " 2>&1"
+    found = 0
+    while ((cmd | getline res) > 0)
+        if (res == file ": Not a file of compiled expressions")
+            found = 1
+    close(cmd)
+    system("rm -f " file)
+    if (!found) {
+        print "junk loaded"
+        exit 1
+    }
+    exit 0
+}
@@ -0,0 +1,14 @@
+#!/usr/bin/awk -f
+
+function abs(x) {
+    return (x < 0) ? -x : x
+}
+
+BEGIN{
+    "./calctest 'integrate(sin(x), x, 0, pi) + integrate(integrate(x*y, y, 0, 1), x, 0, 2)'" | getline res
+    if (abs(res - 3.0) > 1.0e-12) {
+        print res
+        exit 1
+    } else
+        exit 0
+}
@@ -0,0 +1,33 @@
+#!/usr/bin/awk -f
+
+BEGIN{
+    "./calctest 'inv([4, 7; 2, 6]) * [1, 2; 3, 4]^2 - [1, 0; 0, 1]'" | getline res
+    if (res != "[-7.3, -9.4; 4.6, 5.8]") {
+        print res
+        exit 1
+    }
+
+    "./calctest 'det([2, 1; 1, 3]) + dot([1, 2] .* [3, 4], solve([2, 1; 1, 3], [3; 5]))'" | getline res
+    if (res != "18.6") {
+        print res
+        exit 1
+    }
+
+    # Sums, integrals etc. can have matrices inside, but must give numbers
+    "./calctest 'sum(k, 1, 3, det([k, 0; 0, k]))'" | getline res
+    if (res != "14") {
+        print res
+        exit 1
+    }
+    "./calctest 'sum(k, 1, 3, [k, k])' 2>/dev/null" | getline res
+    if (res != "Expected a number, not a matrix") {
+        print res
+        exit 1
+    }
+    "./calctest 'integrate([x, x], x, 0, 1)' 2>/dev/null" | getline res
+    if (res != "Expected a number, not a matrix") {
+        print res
+        exit 1
+    }
+    exit 0
+}
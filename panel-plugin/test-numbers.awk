@@ -0,0 +1,26 @@
+#!/usr/bin/awk -f
+
+function check(expr, expected,    cmd, res) {
+    cmd = "./calctest '" expr "' 2>/dev/null"
+    cmd | getline res
+    close(cmd)
+    if (res != expected) {
+        print expr ": " res
+        exit 1
+    }
+}
+
+BEGIN{
+    check("1_000 * 1_000 + 2.5e-3", "1e+06")
+    check("1_000_000 == 1e6", "1")
+    check("0.1 + 0.2 == 0.3", "0")
+    # Halfway between two doubles: rounds to even
+    check("9007199254740993 == 9007199254740992", "1")
+    check("9007199254740995 == 9007199254740996", "1")
+    check("2.4703282292062328e-324 > 0", "1")
+    check("1e400", "inf")
+    check("0x10 + .5", "16.5")
+    check("1_", "At position 2: Expected operator")
+    check("3 . 4", "At position 3: Expected operator")
+    exit 0
+}
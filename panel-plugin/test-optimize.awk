@@ -0,0 +1,41 @@
+#!/usr/bin/awk -f
+
+BEGIN{
+    # 1 + 2^-27, where x^2 - 2*x + 1 = 2^-54 cancels to 0 unless the
+    # steps of Horner's rule are fused
+    x = "1.000000007450580596923828125"
+    expr = "x^2 - 2*x + 1"
+
+    cmd = "echo " x " | ./calctest --optimize strict --batch x '" expr "'"
+    cmd | getline res
+    if (res != "0") {
+        print "strict: " res
+        exit 1
+    }
+
+    cmd = "echo " x " | ./calctest --optimize contract --batch x '" expr "'"
+    cmd | getline res
+    if (res != "5.55112e-17") {
+        print "contract: " res
+        exit 1
+    }
+
+    # Rewritten polynomials inside sums, conditions and solve
+    cmd = "printf '2\\n-1.5\\n' | ./calctest --optimize contract --batch x " \
+          "'sum(k, 1, 4, 3*k^2 - x*k) + (x > 0 ? 2*x^3 - x : -x^2*x)'"
+    n = 0
+    while ((cmd | getline res) > 0)
+        out[++n] = res
+    if (n != 2 || out[1] != "84" || out[2] != "101.625") {
+        for (i = 1; i <= n; i++)
+            print out[i]
+        exit 1
+    }
+
+    "./calctest --optimize strict 'solve(x^3 - 2, x, 0, 2)'" | getline res
+    if (res != "1.25992") {
+        print "solve: " res
+        exit 1
+    }
+    exit 0
+}
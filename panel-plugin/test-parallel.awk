@@ -0,0 +1,8 @@
+#!/usr/bin/awk -f
+
+# Huge expressions are split over several threads, which mustn't change the
+# result.
+
+BEGIN{
+    exit system("./evalbench --check > /dev/null")
+}
@@ -0,0 +1,30 @@
+#!/usr/bin/awk -f
+
+# Every node is counted once per evaluation, sum bodies once per term, and
+# nodes that aren't evaluated not at all.
+
+BEGIN{
+    folded = "test-profile.folded"
+    cmd = "./calctest --profile --folded " folded \
+          " 'sum(k, 1, 10, sqrt(k)) + (2 > 3 && 1/0)'"
+    cmd | getline result
+    while ((cmd | getline) > 0) {
+        if ($NF == "sqrt" && NF == 4)
+            sqrt_calls = $1
+        if ($NF == "sqrt" && NF == 3)
+            function_calls = $1
+        if ($NF == "/")
+            div_calls = $1
+    }
+    while ((getline line < folded) > 0)
+        if (line ~ /^\+;sum k;sqrt;k [0-9]+$/)
+            stacks++
+    system("rm -f " folded)
+
+    if (result != "22.4683" || sqrt_calls != 10000 ||
+        function_calls != 10000 || div_calls != "-" || stacks != 1) {
+        print result, sqrt_calls, function_calls, div_calls, stacks
+        exit 1
+    }
+    exit 0
+}
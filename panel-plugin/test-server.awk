@@ -0,0 +1,42 @@
+#!/usr/bin/awk -f
+
+# Start a server, send it a few pipelined requests and a batch, and check
+# that the answers come back in order.
+
+BEGIN{
+    sock = "./test-server.sock"
+    cmd = "./calctest --serve " sock " > /dev/null 2>&1 & echo $!"
+    cmd | getline pid
+    close(cmd)
+
+    cmd = "printf '1+2\\nsqrt(16)\\nBATCH 3\\n2*3\\n1+\\n[1, 2] * 2\\n' | ./calctest --connect " sock
+    n = 0
+    while ((cmd | getline line) > 0)
+        res[++n] = line
+    close(cmd)
+
+    if (n != 5 || res[1] != "3" || res[2] != "4" || res[3] != "6" ||
+        res[4] !~ /^error: / || res[5] != "[2, 4]") {
+        for (i = 1; i <= n; i++)
+            print res[i]
+        system("kill " pid "; rm -f " sock)
+        exit 1
+    }
+
+    # A batch of 13 bytes, without a newline at the end, and a line after it
+    cmd = "printf 'BYTES 13\\n2+2\\nBATCH 1\\n57*2\\n' | ./calctest --connect " sock
+    n = 0
+    while ((cmd | getline line) > 0)
+        res[++n] = line
+    close(cmd)
+
+    system("kill " pid "; rm -f " sock)
+
+    if (n != 4 || res[1] != "4" || res[2] !~ /^error: / || res[3] != "5" ||
+        res[4] != "14") {
+        for (i = 1; i <= n; i++)
+            print res[i]
+        exit 1
+    }
+    exit 0
+}
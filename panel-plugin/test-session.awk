@@ -0,0 +1,53 @@
+#!/usr/bin/awk -f
+
+# Feed 'lines' to calctest, one per line, and put the non-empty lines of the
+# output in out[].  Return their number.
+function session(lines,    cmd, res, n) {
+    cmd = "printf '" lines "' | ./calctest 2> /dev/null"
+    n = 0
+    while ((cmd | getline res) > 0)
+        if (res != "")
+            out[++n] = res
+    close(cmd)
+    return n
+}
+
+BEGIN{
+    n = session("price = 100\\nrate = 0.07\\ntotal = price*(1 + rate)\\n" \
+                "rate = 0.1\\ntotal\\n[total, 1]*2\\n")
+    if (n != 6 || out[3] != "107" || out[5] != "110" ||
+        out[6] != "[220, 2]") {
+        print "wrong values"
+        exit 1
+    }
+
+    # Redefinitions change what depends on what
+    n = session("a = 1\\nb = a + 1\\nc = b*2\\nc = 10\\na = c\\nb\\n" \
+                "x = b + a\\nc = 0\\nx\\n")
+    if (n != 9 || out[6] != "11" || out[9] != "1") {
+        print "wrong recomputation"
+        exit 1
+    }
+
+    # Names bound inside sums hide the definitions
+    n = session("k = 10\\nsum(k, 1, 3, k) + k\\n")
+    if (n != 2 || out[2] != "16") {
+        print "wrong scope"
+        exit 1
+    }
+
+    n = session("a = 1\\nb = a\\na = b + 1\\nx = x\\nkm = 3\\nsin = 1\\n" \
+                "y = [1, 2]\\nz = q\\na\\n")
+    if (n != 9 || out[3] != "'a' would depend on itself" ||
+        out[4] != "At position 5: Unknown identifier 'x'" ||
+        out[5] != "At position 1: 'km' is a unit" ||
+        out[6] != "At position 1: 'sin' can't be used as a variable" ||
+        out[7] != "Only numbers can be given names" ||
+        out[8] != "At position 5: Unknown identifier 'q'" ||
+        out[9] != "1") {
+        for (i = 1; i <= n; i++)
+            print out[i]
+        exit 1
+    }
+    exit 0
+}
@@ -0,0 +1,14 @@
+#!/usr/bin/awk -f
+
+function abs(x) {
+    return (x < 0) ? -x : x
+}
+
+BEGIN{
+    "./calctest 'solve(x^2 - 2, x, 0, 2) + solve(cos(x) - x, x, 0, 1)'" | getline res
+    if (abs(res - 2.1533) > 1.0e-4) {
+        print res
+        exit 1
+    } else
+        exit 0
+}
@@ -0,0 +1,39 @@
+#!/usr/bin/awk -f
+
+function calc(args,    res) {
+    res = ""
+    ("./calctest " args " 2> /dev/null") | getline res
+    return res
+}
+
+BEGIN{
+    if (calc("'gamma(5)'") != "24" ||
+        calc("'erfinv(erf(0.3))'") != "0.3" ||
+        calc("'beta(2, 3)*12'") != "1" ||
+        calc("'gammainc(2.5, 1) + gammaincc(2.5, 1)'") != "1" ||
+        calc("'besselj(0.5, 1)'") != "nan" ||
+        calc("'solve(besselj(0, x), x, 2, 3)'") != "2.40483") {
+        print "wrong result"
+        exit 1
+    }
+
+    # Two-argument functions want both
+    if (calc("--validate 'beta(2)'") != "1:7: Expected ','") {
+        print "wrong error"
+        exit 1
+    }
+
+    # The array lgamma agrees with the scalar one
+    cmd = "printf '0.5\\n3\\n20\\n150\\n' | " \
+          "./calctest --batch x 'abs(lgamma(x) - log(gamma(x))) < 1e-12'"
+    n = 0
+    while ((cmd | getline res) > 0)
+        if (res == "1") n++
+    if (n != 4) {
+        print "wrong batch result"
+        exit 1
+    }
+
+    # And everything stays within the bounds in specfun.h
+    exit system("./specbench --check > /dev/null")
+}
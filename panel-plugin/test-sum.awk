@@ -0,0 +1,43 @@
+#!/usr/bin/awk -f
+
+function abs(x) {
+    return (x < 0) ? -x : x
+}
+
+function calc(args,    res) {
+    ("./calctest " args) | getline res
+    return res
+}
+
+BEGIN{
+    "./calctest 'sum(k, 1, 100, k) + prod(k, 1, 5, k) + sum(i, 1, 3, sum(j, 1, i, i*j))'" | getline res
+    if (abs(res - 5195) > 1.0e-15) {
+        print res
+        exit 1
+    }
+
+    # Overflow gives inf, not nan from the error terms
+    if (calc("'prod(k, 1, 200, k)'") != "inf" ||
+        calc("'sum(k, 1, 3, 1e308)'") != "inf" ||
+        calc("'sum(k, 1, 3, -1e308)'") != "-inf" ||
+        calc("'sum(k, 1, 3, 1/0)'") != "inf" ||
+        calc("'sum(k, 1, 100000, 1e304*k)'") != "inf") {
+        print "wrong overflow"
+        exit 1
+    }
+
+    "./calctest '2*sum(k, 1, 1e20, 1)' 2> /dev/null" | getline res
+    if (res != "Too many terms") {
+        print res
+        exit 1
+    }
+
+    # Also inside other sums, but not from a branch that isn't taken
+    if (calc("'sum(i, 1, 2, sum(k, 1, 1e20, 1))' 2> /dev/null") != \
+            "Too many terms" ||
+        calc("'if(0, sum(k, 1, 1e20, 1), sqrt(-1))' 2> /dev/null") ~ /Too/) {
+        print "wrong range error"
+        exit 1
+    }
+    exit 0
+}
@@ -0,0 +1,39 @@
+#!/usr/bin/awk -f
+
+function calc(args,    res) {
+    res = ""
+    ("./calctest " args " 2> /dev/null") | getline res
+    return res
+}
+
+BEGIN{
+    if (calc("--type float '0.1 + 0.2'") != "0.300000012" ||
+        calc("--type double '0.1 + 0.2'") != "0.30000000000000004" ||
+        calc("--type float 'sum(k, 1, 3, k/2)'") != "3") {
+        print "wrong result"
+        exit 1
+    }
+
+    # Literals are rounded to the wider type from their decimal value
+    # (long double is wider than double on x86)
+    if (calc("--type long-double '0.1 + 0.2'") + 0 != 0.3) {
+        print "wrong long double result"
+        exit 1
+    }
+
+    # float128 is there only with libquadmath
+    res = calc("--type float128 pi")
+    if (res != "" && res != "3.1415926535897932384626433832795028") {
+        print "wrong float128 result"
+        exit 1
+    }
+
+    # 1 + 1e-8 is 1 in float
+    cmd = "echo 1 | ./calctest --type float --batch x 'x*1e-8 + 1 - 1'"
+    cmd | getline res
+    if (res != "0") {
+        print "wrong batch result"
+        exit 1
+    }
+    exit 0
+}
@@ -0,0 +1,40 @@
+#!/usr/bin/awk -f
+
+BEGIN{
+    "./calctest '100 km/h in m/s'" | getline res
+    if (res != "27.7778 m/s") {
+        print res
+        exit 1
+    }
+
+    "./calctest '5 kWh / 230 V in A h'" | getline res
+    if (res != "21.7391 A h") {
+        print res
+        exit 1
+    }
+
+    "./calctest '9.81 m s^-2 * 70 kg'" | getline res
+    if (res != "686.7 m kg s^-2") {
+        print res
+        exit 1
+    }
+
+    "./calctest '2 m + 3 s' 2>/dev/null" | getline res
+    if (res != "Units don't match") {
+        print res
+        exit 1
+    }
+
+    # The bodies of sums, integrals etc. can't have units
+    "./calctest 'solve(x - 1 m, x, 0, 2)' 2>/dev/null" | getline res
+    if (res != "Expected a number without a unit") {
+        print res
+        exit 1
+    }
+    "./calctest 'integrate(x, x, 0, 1 m)' 2>/dev/null" | getline res
+    if (res != "Expected a number without a unit") {
+        print res
+        exit 1
+    }
+    exit 0
+}
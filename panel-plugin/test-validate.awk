@@ -0,0 +1,28 @@
+#!/usr/bin/awk -f
+
+BEGIN{
+    "./calctest --validate '1 + sin(2)'" | getline res
+    if (res != "") {
+        print res
+        exit 1
+    }
+
+    "./calctest --validate '1 + foo(2)'" | getline res
+    if (res != "1:5: Unknown identifier 'foo'") {
+        print res
+        exit 1
+    }
+
+    cmd = "printf '1+2\\n3 *\\n(4\\n2 2\\n' | ./calctest --validate"
+    n = 0
+    while ((cmd | getline res) > 0)
+        out[++n] = res
+    if (n != 3 || out[1] != "2:end: Expected '(', number, constant or function" ||
+        out[2] != "3:end: Expected ')'" ||
+        out[3] != "4:3: Expected operator") {
+        for (i = 1; i <= n; i++)
+            print out[i]
+        exit 1
+    }
+    exit 0
+}
@@ -0,0 +1,8 @@
+#!/usr/bin/awk -f
+
+# The vector kernels must stay within the error bounds documented in vmath.h,
+# on every instruction set this processor has.
+
+BEGIN{
+    exit system("./vmathbench --check > /dev/null")
+}
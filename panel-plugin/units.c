@@ -0,0 +1,151 @@
+/*
+ *  Copyright (C) 2010 Erik Edelmann <erik.edelmann@iki.fi>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <glib.h>
+#include "units.h"
+
+
+const unit_t units[] = {
+#include "units-table.h"
+};
+
+#define N_UNITS (sizeof(units)/sizeof(units[0]))
+
+const gsize n_units = N_UNITS;
+
+static const char *base_names[N_BASE_UNITS] = {
+    "m", "kg", "s", "A", "K", "mol", "cd"
+};
+
+
+static int compare_unit(const void *name, const void *unit)
+{
+    return strcmp(name, ((const unit_t *)unit)->name);
+}
+
+
+/* Return the index of unit 'name' in units[], or -1 if there is no such
+   unit. */
+
+gint find_unit(const char *name)
+{
+    const unit_t *unit;
+
+    unit = bsearch(name, units, N_UNITS, sizeof(unit_t), compare_unit);
+
+    return unit ? unit - units : -1;
+}
+
+
+gboolean dims_is_zero(dims_t a)
+{
+    int i;
+
+    for (i = 0; i < N_BASE_UNITS; i++)
+        if (a.e[i] != 0) return FALSE;
+
+    return TRUE;
+}
+
+
+gboolean dims_equal(dims_t a, dims_t b)
+{
+    return memcmp(a.e, b.e, sizeof(a.e)) == 0;
+}
+
+
+dims_t dims_add(dims_t a, dims_t b)
+{
+    int i;
+
+    for (i = 0; i < N_BASE_UNITS; i++)
+        a.e[i] += b.e[i];
+
+    return a;
+}
+
+
+dims_t dims_sub(dims_t a, dims_t b)
+{
+    int i;
+
+    for (i = 0; i < N_BASE_UNITS; i++)
+        a.e[i] -= b.e[i];
+
+    return a;
+}
+
+
+/* Put the dimension of a quantity of dimension 'a' raised to the power 'n' in
+   '*r'.  Return FALSE if that isn't a whole power of the base units. */
+
+gboolean dims_scale(dims_t a, double n, dims_t *r)
+{
+    double e;
+    int i;
+
+    for (i = 0; i < N_BASE_UNITS; i++) {
+        e = a.e[i]*n;
+        if (e != floor(e) || fabs(e) > G_MAXINT8)
+            return FALSE;
+        r->e[i] = (gint8)e;
+    }
+
+    return TRUE;
+}
+
+
+/* Like dims_scale(a, 1.0/n, r), without the rounding. */
+
+gboolean dims_root(dims_t a, int n, dims_t *r)
+{
+    int i;
+
+    for (i = 0; i < N_BASE_UNITS; i++) {
+        if (a.e[i] % n != 0)
+            return FALSE;
+        r->e[i] = a.e[i]/n;
+    }
+
+    return TRUE;
+}
+
+
+/* Format 'a' in SI base units, like 'm^2 kg s^-2'.  The result should be
+   g_free()d. */
+
+gchar *dims_to_string(dims_t a)
+{
+    GString *s;
+    int i;
+
+    s = g_string_new("");
+    for (i = 0; i < N_BASE_UNITS; i++) {
+        if (a.e[i] == 0)
+            continue;
+        if (s->len > 0)
+            g_string_append_c(s, ' ');
+        g_string_append(s, base_names[i]);
+        if (a.e[i] != 1)
+            g_string_append_printf(s, "^%d", a.e[i]);
+    }
+
+    return g_string_free(s, FALSE);
+}
@@ -0,0 +1,52 @@
+/*
+ *  Copyright (C) 2010 Erik Edelmann <erik.edelmann@iki.fi>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+#ifndef __UNITS_H__
+#define __UNITS_H__
+
+#include <glib.h>
+
+/* The SI base units, in the order their exponents are stored in dims_t. */
+#define N_BASE_UNITS 7
+
+/* The dimension of a quantity, as exponents of m, kg, s, A, K, mol and cd. */
+typedef struct {
+    gint8 e[N_BASE_UNITS];
+} dims_t;
+
+typedef struct {
+    const char *name;
+    double factor;      // The size of the unit in SI base units
+    dims_t dims;
+} unit_t;
+
+/* The table of units, generated from units.def and sorted by name.  Compiled
+   trees refer to units by their index in this table. */
+extern const unit_t units[];
+extern const gsize n_units;
+
+gint find_unit(const char *name);
+
+gboolean dims_is_zero(dims_t a);
+gboolean dims_equal(dims_t a, dims_t b);
+dims_t dims_add(dims_t a, dims_t b);
+dims_t dims_sub(dims_t a, dims_t b);
+gboolean dims_scale(dims_t a, double n, dims_t *r);
+gboolean dims_root(dims_t a, int n, dims_t *r);
+gchar *dims_to_string(dims_t a);
+
+#endif
@@ -0,0 +1,366 @@
+/*
+ *  Copyright (C) 2010 Erik Edelmann <erik.edelmann@iki.fi>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/* The vector kernels of vmath.c.  This file is included once for every
+   instruction set, with
+
+     W              the number of doubles in a vector,
+     KERNEL(name)   the name 'name' gets for this instruction set, and
+     TARGET         the attributes that enable the instruction set,
+
+   and LIBM_LOG defined if the log kernels are slower than libm with this
+   instruction set, so that they are left out.
+
+   The kernels only handle whole vectors; the caller does the rest with libm.
+   Elements outside the range where the argument reduction is accurate are
+   also handed over to libm, one at a time.
+
+   Everything is branch free: both sides of a choice are computed, and the
+   right one is picked with select(). */
+
+#define vd KERNEL(vd)
+#define vi KERNEL(vi)
+#define vu KERNEL(vu)
+
+typedef double vd __attribute__((vector_size(W*sizeof(double))));
+typedef gint64 vi __attribute__((vector_size(W*sizeof(double))));
+
+// For loads and stores: the arrays need not be aligned
+typedef double vu __attribute__((vector_size(W*sizeof(double)), aligned(8)));
+
+
+static inline TARGET vd KERNEL(select)(vi mask, vd a, vd b)
+{
+    return (vd)(((vi)a & mask) | ((vi)b & ~mask));
+}
+
+
+static inline TARGET vd KERNEL(splat)(double x)
+{
+    vd v = {0};
+
+    return v + x;
+}
+
+
+static inline TARGET int KERNEL(any)(vi mask)
+{
+    int i;
+
+    for (i = 0; i < W; i++)
+        if (mask[i])
+            return 1;
+    return 0;
+}
+
+
+static inline TARGET vd KERNEL(load)(const double *p)
+{
+    return *(const vu *)p;
+}
+
+
+static inline TARGET void KERNEL(store)(double *p, vd v)
+{
+    *(vu *)p = v;
+}
+
+
+/* x rounded to the nearest integer, as a double and as an integer.  Only
+   valid for |x| < 2^51. */
+
+static inline TARGET vd KERNEL(round)(vd x, vi *k)
+{
+    vd shift = KERNEL(splat)(ROUND_SHIFT);
+    vd t = x + shift;
+
+    *k = (vi)t - (vi)shift;
+    return t - shift;
+}
+
+
+static void TARGET KERNEL(exp)(const double *x, double *y, gsize n)
+{
+    gsize i;
+
+    for (i = 0; i + W <= n; i += W) {
+        vd v, kd, r, p;
+        vi k, k1, k2;
+
+        v = KERNEL(load)(x + i);
+        v = KERNEL(select)(v > EXP_MAX, KERNEL(splat)(EXP_MAX), v);
+        v = KERNEL(select)(v < EXP_MIN, KERNEL(splat)(EXP_MIN), v);
+
+        kd = KERNEL(round)(v*(1/G_LN2), &k);
+        r = (v - kd*LN2_HI) - kd*LN2_LO;
+
+        p = KERNEL(splat)(1.0/6227020800);
+        p = p*r + 1.0/479001600;
+        p = p*r + 1.0/39916800;
+        p = p*r + 1.0/3628800;
+        p = p*r + 1.0/362880;
+        p = p*r + 1.0/40320;
+        p = p*r + 1.0/5040;
+        p = p*r + 1.0/720;
+        p = p*r + 1.0/120;
+        p = p*r + 1.0/24;
+        p = p*r + 1.0/6;
+        p = p*r + 0.5;
+        p = p*r + 1.0;
+        p = p*r + 1.0;
+
+        /* 2^k in two halves, so that neither overflows for results close
+           to the subnormal or overflow limit. */
+        k1 = k >> 1;
+        k2 = k - k1;
+        p = p*(vd)((k1 + 1023) << 52);
+        p = p*(vd)((k2 + 1023) << 52);
+
+        KERNEL(store)(y + i, p);
+    }
+}
+
+
+/* The logarithm in base b, given ln(2)/ln(b) = hi + lo and 1/ln(b) =
+   scale_hi + scale_lo, where the _hi parts have at most 33 significant bits.
+   That makes e*hi exact for any exponent e, and the product of scale_hi and
+   a number with 20 significant bits exact too. */
+
+#ifndef LIBM_LOG
+static inline TARGET void KERNEL(logb)(const double *x, double *y, gsize n,
+                                       double hi, double lo,
+                                       double scale_hi, double scale_lo)
+{
+    gsize i;
+
+    for (i = 0; i + W <= n; i += W) {
+        vd v, m, f, fh, fl, s, z, t, e, r;
+        vi tiny, big, bits, ei;
+
+        v = KERNEL(load)(x + i);
+
+        // Subnormals are scaled up to get a normalized mantissa
+        tiny = v < G_MINDOUBLE;
+        m = KERNEL(select)(tiny, v*0x1p54, v);
+        bits = (vi)m;
+        ei = ((bits >> 52) & 0x7ff) - 1023 - (tiny & 54);
+
+        // v = 2^ei * m, with sqrt(2)/2 <= m < sqrt(2)
+        m = (vd)((bits & 0x000fffffffffffffLL) | 0x3ff0000000000000LL);
+        big = m > G_SQRT2;
+        m = KERNEL(select)(big, m*0.5, m);
+        ei = ei - big;
+
+        // log(1 + f) = 2 atanh(s) = f - s*(f - t)
+        f = m - 1.0;
+        s = f/(2.0 + f);
+        z = s*s;
+        t = KERNEL(splat)(2.0/21);
+        t = t*z + 2.0/19;
+        t = t*z + 2.0/17;
+        t = t*z + 2.0/15;
+        t = t*z + 2.0/13;
+        t = t*z + 2.0/11;
+        t = t*z + 2.0/9;
+        t = t*z + 2.0/7;
+        t = t*z + 2.0/5;
+        t = t*z + 2.0/3;
+        t = t*z;
+
+        /* Split f = fh + fl, where fh has 20 significant bits, so that
+           e*hi + fh*scale_hi is the exact leading part of the result. */
+        fh = (vd)((vi)f & (gint64)0xfffffffe00000000LL);
+        fl = f - fh;
+        e = (vd)(ei + (vi)KERNEL(splat)(ROUND_SHIFT)) - ROUND_SHIFT;
+        r = (e*lo + fh*scale_lo + (fl - s*(f - t))*(scale_hi + scale_lo)) +
+            (e*hi + fh*scale_hi);
+
+        r = KERNEL(select)(v < 0, KERNEL(splat)(NAN), r);
+        r = KERNEL(select)(v == 0, KERNEL(splat)(-INFINITY), r);
+        r = KERNEL(select)(v == INFINITY, v, r);
+        r = KERNEL(select)(v != v, v, r);
+
+        KERNEL(store)(y + i, r);
+    }
+}
+
+
+static void TARGET KERNEL(log)(const double *x, double *y, gsize n)
+{
+    KERNEL(logb)(x, y, n, LN2_HI, LN2_LO, 1.0, 0.0);
+}
+
+
+static void TARGET KERNEL(log2)(const double *x, double *y, gsize n)
+{
+    KERNEL(logb)(x, y, n, 1.0, 0.0, INV_LN2_HI, INV_LN2_LO);
+}
+
+
+static void TARGET KERNEL(log10)(const double *x, double *y, gsize n)
+{
+    KERNEL(logb)(x, y, n, LOG10_2_HI, LOG10_2_LO, INV_LN10_HI, INV_LN10_LO);
+}
+#endif
+
+
+/* a - b = *s + the returned error, exactly (Knuth's TwoSum). */
+
+static inline TARGET vd KERNEL(two_diff)(vd a, vd b, vd *s)
+{
+    vd bb;
+
+    *s = a - b;
+    bb = a - *s;
+    return (a - (*s + bb)) + (bb - b);
+}
+
+
+/* Reduce v to r + rl = v - q*pi/2, |r| <= pi/4, and compute sin(r + rl) and
+   cos(r + rl).  Returns a mask of the elements where the reduction isn't
+   accurate: huge or non-finite arguments, and arguments so close to a
+   multiple of pi/2 that the leftover bits of pi/2 matter. */
+
+static inline TARGET vi KERNEL(sincos)(vd v, vd *s, vd *c, vi *q)
+{
+    vd kd, t, r, rl, z, p, h, w;
+    vi bad;
+
+    kd = KERNEL(round)(v*(2/G_PI), q);
+    rl = KERNEL(two_diff)(v - kd*PIO2_1, kd*PIO2_2, &t);
+    rl += KERNEL(two_diff)(t, kd*PIO2_3, &r);
+    rl -= kd*PIO2_3T;
+
+    bad = ~((vd)((vi)v & 0x7fffffffffffffffLL) <= TRIG_MAX);
+    bad |= (vd)((vi)r & 0x7fffffffffffffffLL) <
+           (vd)((vi)kd & 0x7fffffffffffffffLL)*TRIG_CANCEL;
+
+    z = r*r;
+
+    // sin(r + rl) = sin(r) + rl*cos(r), to first order in rl
+    p = KERNEL(splat)(1.0/1307674368000);
+    p = p*z - 1.0/6227020800;
+    p = p*z + 1.0/39916800;
+    p = p*z - 1.0/362880;
+    p = p*z + 1.0/5040;
+    p = p*z - 1.0/120;
+    p = p*z + 1.0/6;
+    *s = r + (rl*(1.0 - 0.5*z) - r*z*p);
+
+    // cos(r + rl) = cos(r) - rl*sin(r); the rounding error of 1 - z/2 is
+    // added back too
+    p = KERNEL(splat)(1.0/20922789888000);
+    p = p*z - 1.0/87178291200;
+    p = p*z + 1.0/479001600;
+    p = p*z - 1.0/3628800;
+    p = p*z + 1.0/40320;
+    p = p*z - 1.0/720;
+    p = p*z + 1.0/24;
+    h = 0.5*z;
+    w = 1.0 - h;
+    *c = w + (((1.0 - w) - h) + (z*z*p - r*rl));
+
+    return bad;
+}
+
+
+static void TARGET KERNEL(sin)(const double *x, double *y, gsize n)
+{
+    gsize i;
+
+    for (i = 0; i + W <= n; i += W) {
+        vd v, s, c, r;
+        vi q, bad;
+        int j;
+
+        v = KERNEL(load)(x + i);
+        bad = KERNEL(sincos)(v, &s, &c, &q);
+
+        // sin, cos, -sin, -cos in quadrants 0, 1, 2, 3
+        r = KERNEL(select)((q & 1) != 0, c, s);
+        r = (vd)((vi)r ^ (((q & 2) != 0) & G_MININT64));
+        r = KERNEL(select)(v == 0, v, r);   // sin(-0) is -0
+        if (KERNEL(any)(bad))
+            for (j = 0; j < W; j++)
+                if (bad[j])
+                    r[j] = sin(x[i + j]);
+        KERNEL(store)(y + i, r);
+    }
+}
+
+
+static void TARGET KERNEL(cos)(const double *x, double *y, gsize n)
+{
+    gsize i;
+
+    for (i = 0; i + W <= n; i += W) {
+        vd s, c, r;
+        vi q, bad;
+        int j;
+
+        bad = KERNEL(sincos)(KERNEL(load)(x + i), &s, &c, &q);
+
+        // cos, -sin, -cos, sin in quadrants 0, 1, 2, 3
+        r = KERNEL(select)((q & 1) != 0, s, c);
+        r = (vd)((vi)r ^ ((((q + 1) & 2) != 0) & G_MININT64));
+        if (KERNEL(any)(bad))
+            for (j = 0; j < W; j++)
+                if (bad[j])
+                    r[j] = cos(x[i + j]);
+        KERNEL(store)(y + i, r);
+    }
+}
+
+
+static void TARGET KERNEL(tan)(const double *x, double *y, gsize n)
+{
+    gsize i;
+
+    for (i = 0; i + W <= n; i += W) {
+        vd v, s, c, r;
+        vi q, bad;
+        int j;
+
+        v = KERNEL(load)(x + i);
+        bad = KERNEL(sincos)(v, &s, &c, &q);
+
+        // sin/cos in even quadrants, -cos/sin in odd ones
+        r = KERNEL(select)((q & 1) != 0, -c/s, s/c);
+        r = KERNEL(select)(v == 0, v, r);   // tan(-0) is -0
+        if (KERNEL(any)(bad))
+            for (j = 0; j < W; j++)
+                if (bad[j])
+                    r[j] = tan(x[i + j]);
+        KERNEL(store)(y + i, r);
+    }
+}
+
+
+static const kernels_t KERNEL(kernels) = {
+    KERNEL_NAME, W,
+#ifdef LIBM_LOG
+    { KERNEL(exp), NULL, NULL, NULL,
+#else
+    { KERNEL(exp), KERNEL(log), KERNEL(log2), KERNEL(log10),
+#endif
+      KERNEL(sin), KERNEL(cos), KERNEL(tan) }
+};
+
+#undef vd
+#undef vi
+#undef vu
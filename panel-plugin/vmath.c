@@ -0,0 +1,261 @@
+/*
+ *  Copyright (C) 2010 Erik Edelmann <erik.edelmann@iki.fi>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <glib.h>
+#include "constants.h"
+#include "vmath.h"
+
+/* The kernels are written with the vector extensions of GCC (and clang).
+   Other compilers get the plain libm loops. */
+#if defined(__GNUC__) && (__GNUC__ >= 5 || defined(__clang__))
+#   define HAVE_VECTORS 1
+#   if defined(__x86_64__) || defined(__i386__)
+#       define HAVE_X86 1
+#   endif
+#endif
+
+enum {
+    VM_EXP, VM_LOG, VM_LOG2, VM_LOG10, VM_SIN, VM_COS, VM_TAN,
+    N_KERNELS
+};
+
+typedef struct {
+    const char *name;
+    gsize width;
+    void (*fun[N_KERNELS])(const double *x, double *y, gsize n);
+} kernels_t;
+
+static const kernels_t scalar_kernels = { "scalar", 1, { NULL } };
+
+#ifdef HAVE_VECTORS
+
+/* x + ROUND_SHIFT - ROUND_SHIFT rounds x to an integer, and leaves the
+   integer in the low bits of x + ROUND_SHIFT. */
+#define ROUND_SHIFT 0x1.8p52
+
+/* ln(2), log10(2), 1/ln(2), 1/ln(10) and pi/2 split in parts with enough
+   trailing zeros that k*LN2_HI etc. are exact for the k we use (Cody &
+   Waite; the values are from fdlibm). */
+#define LN2_HI 6.93147180369123816490e-01
+#define LN2_LO 1.90821492927058770002e-10
+#define LOG10_2_HI 3.01029995663611771306e-01
+#define LOG10_2_LO 3.69423907715893078616e-13
+#define INV_LN2_HI 1.44269504072144627571e+00
+#define INV_LN2_LO 1.67517131648865118353e-10
+#define INV_LN10_HI 4.34294481878168880939e-01
+#define INV_LN10_LO 2.50829467116452752298e-11
+#define PIO2_1 1.57079632673412561417e+00
+#define PIO2_2 6.07710050630396597660e-11
+#define PIO2_3 2.02226624871116645580e-21
+#define PIO2_3T 8.47842766036889956997e-32
+
+/* exp() overflows above EXP_MAX and underflows to zero below EXP_MIN. */
+#define EXP_MAX 709.8
+#define EXP_MIN -745.2
+
+/* The parts of pi/2 are good for |k| < 2^20.  The reduced argument is off
+   by about |k|*1e-47, which is much less than an ulp as long as |r| >
+   |k|*TRIG_CANCEL. */
+#define TRIG_MAX 1.0e6
+#define TRIG_CANCEL 0x1p-90
+
+#ifdef HAVE_X86
+
+// Without FMA, the log kernels lose to libm on two-element vectors
+#define W 2
+#define KERNEL(name) name##_sse2
+#define KERNEL_NAME "sse2"
+#define TARGET __attribute__((target("sse2")))
+#define LIBM_LOG
+#include "vmath-kernels.h"
+#undef W
+#undef KERNEL
+#undef KERNEL_NAME
+#undef TARGET
+#undef LIBM_LOG
+
+#define W 4
+#define KERNEL(name) name##_avx2
+#define KERNEL_NAME "avx2"
+#define TARGET __attribute__((target("avx2,fma")))
+#include "vmath-kernels.h"
+#undef W
+#undef KERNEL
+#undef KERNEL_NAME
+#undef TARGET
+
+#define W 8
+#define KERNEL(name) name##_avx512
+#define KERNEL_NAME "avx512"
+#define TARGET __attribute__((target("avx512f")))
+#include "vmath-kernels.h"
+#undef W
+#undef KERNEL
+#undef KERNEL_NAME
+#undef TARGET
+
+#else
+
+// Whatever the compiler makes of two-element vectors on this processor
+#define W 2
+#define KERNEL(name) name##_vector
+#define KERNEL_NAME "vector"
+#define TARGET
+#include "vmath-kernels.h"
+#undef W
+#undef KERNEL
+#undef KERNEL_NAME
+#undef TARGET
+
+#endif
+#endif
+
+
+static const kernels_t *all_kernels[] = {
+#ifdef HAVE_X86
+    &kernels_avx512,
+    &kernels_avx2,
+    &kernels_sse2,
+#elif defined(HAVE_VECTORS)
+    &kernels_vector,
+#endif
+    &scalar_kernels,
+    NULL
+};
+
+static const kernels_t *volatile current;
+
+
+static gboolean supported(const kernels_t *k)
+{
+#ifdef HAVE_X86
+    __builtin_cpu_init();
+
+    if (k == &kernels_avx512)
+        return __builtin_cpu_supports("avx512f");
+    if (k == &kernels_avx2)
+        return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    if (k == &kernels_sse2)
+        return __builtin_cpu_supports("sse2");
+#endif
+    return TRUE;
+}
+
+
+/* The best kernels this processor can run, picked on first use. */
+
+static const kernels_t *kernels(void)
+{
+    const kernels_t *k = current;
+    gint i;
+
+    if (k)
+        return k;
+
+    for (i = 0; !supported(all_kernels[i]); i++)
+        ;
+    current = all_kernels[i];
+
+    return current;
+}
+
+
+const char *vmath_isa(void)
+{
+    return kernels()->name;
+}
+
+
+gboolean vmath_set_isa(const char *name)
+{
+    gint i;
+
+    for (i = 0; all_kernels[i]; i++) {
+        if (strcmp(all_kernels[i]->name, name) == 0) {
+            if (!supported(all_kernels[i]))
+                return FALSE;
+            current = all_kernels[i];
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+
+/* Run kernel 'which' on as much of x as fills whole vectors, and libm's
+   'fun' on the rest. */
+
+static void run(gint which, double (*fun)(double x),
+                const double *x, double *y, gsize n)
+{
+    const kernels_t *k = kernels();
+    gsize i, done = 0;
+
+    if (k->fun[which]) {
+        done = n - n % k->width;
+        k->fun[which](x, y, done);
+    }
+
+    for (i = done; i < n; i++)
+        y[i] = fun(x[i]);
+}
+
+
+void vmath_exp(const double *x, double *y, gsize n)
+{
+    run(VM_EXP, exp, x, y, n);
+}
+
+
+void vmath_log(const double *x, double *y, gsize n)
+{
+    run(VM_LOG, log, x, y, n);
+}
+
+
+void vmath_log2(const double *x, double *y, gsize n)
+{
+    run(VM_LOG2, log2, x, y, n);
+}
+
+
+void vmath_log10(const double *x, double *y, gsize n)
+{
+    run(VM_LOG10, log10, x, y, n);
+}
+
+
+void vmath_sin(const double *x, double *y, gsize n)
+{
+    run(VM_SIN, sin, x, y, n);
+}
+
+
+void vmath_cos(const double *x, double *y, gsize n)
+{
+    run(VM_COS, cos, x, y, n);
+}
+
+
+void vmath_tan(const double *x, double *y, gsize n)
+{
+    run(VM_TAN, tan, x, y, n);
+}
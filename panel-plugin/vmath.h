@@ -0,0 +1,55 @@
+/*
+ *  Copyright (C) 2010 Erik Edelmann <erik.edelmann@iki.fi>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+#ifndef __VMATH_H__
+#define __VMATH_H__
+
+#include <glib.h>
+
+/* y[i] = f(x[i]) for i = 0 ... n-1, on as many elements at a time as the
+   processor can.  The instruction set is picked at run time.  x and y may
+   be the same array.
+
+   The largest differences from libm, in units in the last place, as
+   measured by 'vmathbench --check' (sin, cos and tan of |x| > 1e6 are left
+   to libm, and so are the logarithms with SSE2).  Zeros keep their sign.
+
+     vmath_exp    1 ulp
+     vmath_log    1 ulp
+     vmath_log2   1 ulp
+     vmath_log10  1 ulp
+     vmath_sin    1 ulp
+     vmath_cos    1 ulp
+     vmath_tan    3 ulp
+*/
+void vmath_exp(const double *x, double *y, gsize n);
+void vmath_log(const double *x, double *y, gsize n);
+void vmath_log2(const double *x, double *y, gsize n);
+void vmath_log10(const double *x, double *y, gsize n);
+void vmath_sin(const double *x, double *y, gsize n);
+void vmath_cos(const double *x, double *y, gsize n);
+void vmath_tan(const double *x, double *y, gsize n);
+
+/* The name of the instruction set in use: "avx512", "avx2", "sse2",
+   "vector" or "scalar". */
+const char *vmath_isa(void);
+
+/* Use instruction set 'name' (as returned by vmath_isa()) from now on.
+   Returns FALSE, and changes nothing, if the processor doesn't have it. */
+gboolean vmath_set_isa(const char *name);
+
+#endif
@@ -0,0 +1,217 @@
+/*
+ *  Copyright (C) 2010 Erik Edelmann <erik.edelmann@iki.fi>
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Library General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111-1307, USA.
+ */
+
+/* Throughput and accuracy of the vmath kernels, compared with libm.
+
+   vmathbench            time every kernel on every instruction set this
+                         processor has, and the libm loop
+   vmathbench --check    only measure the errors, and fail if some kernel is
+                         worse than documented in vmath.h */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <glib.h>
+#include "vmath.h"
+
+#define N 4096
+#define BENCH_TIME 200000       // microseconds per measurement
+
+typedef struct {
+    const char *name;
+    void (*vfun)(const double *x, double *y, gsize n);
+    double (*fun)(double x);
+    double lo, hi;              // range of the random arguments
+    double max_ulps;            // documented bound
+} bench_t;
+
+static const bench_t benches[] = {
+    { "exp", vmath_exp, exp, -745, 709, 1 },
+    { "log", vmath_log, log, 0, 1e300, 1 },
+    { "log2", vmath_log2, log2, 0, 1e300, 1 },
+    { "log10", vmath_log10, log10, 0, 1e300, 1 },
+    { "sin", vmath_sin, sin, -1e6, 1e6, 1 },
+    { "cos", vmath_cos, cos, -1e6, 1e6, 1 },
+    { "tan", vmath_tan, tan, -1e6, 1e6, 3 },
+    { NULL, NULL, NULL, 0, 0, 0 }
+};
+
+static const char *isas[] = { "avx512", "avx2", "sse2", "vector", "scalar" };
+
+// Arguments that take unusual paths through the kernels
+static const double special[] = {
+    0.0, -0.0, 1.0, -1.0, 0.5, 2.0, G_PI, G_PI/2, G_PI/4, 3*G_PI/2,
+    1e-300, 4.9e-324, 2.2250738585072014e-308, 709.78, 709.79, -745.1, -745.2,
+    -708.5, 1e6, 1e7, 1e300, 6381956970095103.0*0x1p797, INFINITY, -INFINITY, NAN
+};
+
+
+static guint64 rng_state = 0x9e3779b97f4a7c15ULL;
+
+static double uniform(void)
+{
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return (rng_state >> 11)*0x1p-53;
+}
+
+
+/* Half of the arguments are spread evenly over [lo, hi], the other half
+   logarithmically, so that small arguments get tested too. */
+
+static void fill(double *x, gsize n, double lo, double hi)
+{
+    gsize i;
+    double u;
+
+    for (i = 0; i < n; i++) {
+        u = uniform();
+        if (i % 2 == 0)
+            x[i] = lo + (hi - lo)*u;
+        else if (lo < 0 && u < 0.5)
+            x[i] = -exp(-40 + (log(-lo) + 40)*2*u);
+        else
+            x[i] = exp(-40 + (log(hi) + 40)*fabs(2*u - (lo < 0)));
+    }
+}
+
+
+/* The distance between y and the libm result 'ref', in units of the last
+   place of 'ref'. */
+
+static double ulps(double y, double ref)
+{
+    double ulp;
+
+    if (isnan(ref) || isnan(y))
+        return isnan(ref) && isnan(y) ? 0 : INFINITY;
+    if (isinf(ref) || isinf(y))
+        return y == ref ? 0 : INFINITY;
+    if (y == 0 && ref == 0)
+        return signbit(y) == signbit(ref) ? 0 : INFINITY;
+
+    ulp = nextafter(fabs(ref), INFINITY) - fabs(ref);
+    return fabs(y - ref)/ulp;
+}
+
+
+static double max_error(const bench_t *b)
+{
+    double x[N], y[N], err = 0;
+    gsize i, n_special = G_N_ELEMENTS(special);
+    gint round;
+
+    for (round = 0; round < 64; round++) {
+        fill(x, N, b->lo, b->hi);
+        if (round == 0)
+            memcpy(x, special, sizeof(special));
+        b->vfun(x, y, N);
+        for (i = 0; i < N; i++)
+            err = MAX(err, ulps(y[i], b->fun(x[i])));
+        // Odd lengths and arguments inside vectors, the same as on their own
+        for (i = 0; i < n_special; i++) {
+            b->vfun(special + i, y, 1);
+            err = MAX(err, ulps(y[0], b->fun(special[i])));
+        }
+    }
+
+    return err;
+}
+
+
+/* Millions of function values per second. */
+
+static double throughput(const bench_t *b, gboolean use_libm)
+{
+    double x[N], y[N];
+    gint64 start, elapsed;
+    guint64 count = 0;
+    gsize i;
+
+    fill(x, N, b->lo, b->hi);
+
+    start = g_get_monotonic_time();
+    do {
+        if (use_libm)
+            for (i = 0; i < N; i++) y[i] = b->fun(x[i]);
+        else
+            b->vfun(x, y, N);
+        count += N;
+        elapsed = g_get_monotonic_time() - start;
+    } while (elapsed < BENCH_TIME);
+
+    // Keep the compiler from dropping the loop
+    if (y[N/2] == 12345.678) putchar(' ');
+
+    return (double)count/elapsed;
+}
+
+
+int main(int argc, char **argv)
+{
+    const char *best;
+    gboolean check = argc > 1 && strcmp(argv[1], "--check") == 0;
+    gboolean ok = TRUE;
+    double err;
+    gint i, j;
+
+    best = vmath_isa();
+
+    if (!check) {
+        printf("%-8s %10s", "", "libm");
+        for (j = 0; j < G_N_ELEMENTS(isas); j++)
+            if (vmath_set_isa(isas[j]))
+                printf(" %10s", isas[j]);
+        printf("    Mvalues/s\n");
+
+        for (i = 0; benches[i].name; i++) {
+            printf("%-8s %10.1f", benches[i].name,
+                   throughput(&benches[i], TRUE));
+            for (j = 0; j < G_N_ELEMENTS(isas); j++)
+                if (vmath_set_isa(isas[j]))
+                    printf(" %10.1f", throughput(&benches[i], FALSE));
+            printf("\n");
+        }
+        printf("\n");
+    }
+
+    printf("%-8s", "");
+    for (j = 0; j < G_N_ELEMENTS(isas); j++)
+        if (vmath_set_isa(isas[j]))
+            printf(" %10s", isas[j]);
+    printf("    max error vs. libm, ulp\n");
+
+    for (i = 0; benches[i].name; i++) {
+        printf("%-8s", benches[i].name);
+        for (j = 0; j < G_N_ELEMENTS(isas); j++) {
+            if (!vmath_set_isa(isas[j]))
+                continue;
+            err = max_error(&benches[i]);
+            printf(" %10.2f", err);
+            if (err > benches[i].max_ulps)
+                ok = FALSE;
+        }
+        printf("\n");
+    }
+
+    vmath_set_isa(best);
+
+    return ok ? 0 : 1;
+}